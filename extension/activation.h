@@ -15,8 +15,12 @@ enum activationFunction {
     SOFTMAX,
     SOFTMAX_PRIME
 };
+//Slope of lRelu below 0
+#define ALPHA 0.2
+
 #include "matrix.h"
 enum activationFunction getDeriv(enum activationFunction func);
+double activationPrime(enum activationFunction func, double y);
 double relu(double x);
 double reluPrime(double x);
 double lRelu(double x);
@@ -0,0 +1,35 @@
+#ifndef _allreduce_h_
+#define _allreduce_h_
+
+#include <semaphore.h>
+#include <stdbool.h>
+
+#include "matrix.h"
+
+#define ALLREDUCE_SLOTS 2
+#define ALLREDUCE_CHUNK 4096
+
+//Chunks written by the previous rank in the ring, read only by the owning rank
+typedef struct mailbox {
+    sem_t full;
+    sem_t empty;
+    real_t slots[ALLREDUCE_SLOTS][ALLREDUCE_CHUNK];
+} mailbox_t;
+
+typedef struct communicator {
+    int rank, nRanks;
+    mailbox_t *mailboxes;
+    //nShared doubles every rank can read and write, i.e. to return results
+    real_t *shared;
+    int nShared;
+    int sendSlot, recvSlot;
+    size_t size;
+} communicator_t;
+
+communicator_t *communicatorInit(int nRanks, int nShared);
+void communicatorJoin(communicator_t *comm, int rank);
+bool communicatorRun(communicator_t *comm, void (*rankMain)(void *arg), void *arg);
+void allReduce(communicator_t *comm, real_t *data, int length);
+void communicatorFree(communicator_t *comm);
+
+#endif
@@ -0,0 +1,26 @@
+#ifndef _autograd_h_
+#define _autograd_h_
+
+#include "matrix.h"
+#include "nodes.h"
+#include "scheduler.h"
+
+//Reverse-mode differentiation of a forward schedule. BACKWARD walks the schedule backwards
+//and each operation adds its vector-Jacobian product to its inputs' gradient buffers,
+//so no backward graph is built
+typedef struct tape {
+    node_t **nodes; //The forward schedule, not owned
+    int length;
+    //Weights and biases, in the order BACKWARD completes their gradients
+    node_t **params;
+    int nParams;
+} tape_t;
+
+tape_t *tapeRecord(node_t **nodes, int length);
+void tapeZero(tape_t *tape);
+void tapeSeed(node_t *node, matrix2d_t *gradient);
+void tapeBackward(tape_t *tape, checkpoints_t *plan);
+void vjp(node_t *node);
+void tapeFree(tape_t *tape);
+
+#endif
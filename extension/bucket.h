@@ -0,0 +1,32 @@
+#ifndef _bucket_h_
+#define _bucket_h_
+
+#include "lstm.h"
+#include "nodes.h"
+
+//A packed LSTM graph for batches whose longest sequence has at most maxLength steps
+//It's built the first time a batch needs it, then reused for every batch after
+typedef struct lstmBucket {
+    int maxLength;
+    graph_t *graph;
+    node_t **nodes; //The graph's schedule
+    int length;
+    node_t **inputs, **configs; //One per step
+} lstmBucket_t;
+
+typedef struct bucketedLSTM {
+    lstmParams_t *params; //Shared by every bucket's graph, not owned
+    int nFeatures;
+    lstmBucket_t *buckets; //In ascending maxLength
+    int nBuckets;
+    //Cell rows computed by the last forward, and how many padding every sequence
+    //to the longest would have taken
+    long nRowsComputed, nRowsPadded;
+} bucketedLSTM_t;
+
+bucketedLSTM_t *bucketedLSTMCreate(lstmParams_t *params, int nFeatures, int *bucketLengths, int nBuckets);
+void bucketedLSTMForward(bucketedLSTM_t *model, matrix2d_t **sequences, int nSequences,
+                         int batchSize, matrix2d_t **outputs);
+void bucketedLSTMFree(bucketedLSTM_t *model);
+
+#endif
@@ -5,6 +5,7 @@
 #include <assert.h>
 #include <math.h>
 #include <stdio.h>
+#include <stdlib.h>
 
 #include "../matrix.h"
 enum activationFunction getDeriv(enum activationFunction func) {
@@ -18,7 +19,21 @@ enum activationFunction getDeriv(enum activationFunction func) {
         default:      return -1;
     }
 }
-#define ALPHA 0.2
+
+//PRE: y is func's output, i.e. already activated
+//POST: func's derivative at the input which gave y
+double activationPrime(enum activationFunction func, double y) {
+    switch (func) {
+        case SIGMOID: return sigmoidPrime(y);
+        case TANH:    return tanhPrime(y);
+        case RELU:    return y > 0;
+        case LRELU:   return y > 0 ? 1 : ALPHA;
+        case LINEAR:  return linearPrime();
+        default:
+            printf("No derivative for that activation function\n");
+            exit(EXIT_FAILURE);
+    }
+}
 
 double relu(double x) {
     return (x > 0) ? x : 0;
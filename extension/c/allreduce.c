@@ -0,0 +1,187 @@
+#include "../allreduce.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define MAX_SHM_NAME_LENGTH 64
+
+//PRE: Called before forking the ranks so they all inherit the mapping
+//POST: A communicator backed by POSIX shared memory, with no rank assigned yet
+communicator_t *communicatorInit(int nRanks, int nShared) {
+    communicator_t *comm = malloc(sizeof(communicator_t));
+    comm->nRanks = nRanks;
+    comm->nShared = nShared;
+    comm->rank = 0;
+    comm->sendSlot = comm->recvSlot = 0;
+    comm->size = sizeof(mailbox_t) * nRanks + sizeof(real_t) * nShared;
+
+    char name[MAX_SHM_NAME_LENGTH];
+    snprintf(name, MAX_SHM_NAME_LENGTH, "/cflow-allreduce-%d", (int) getpid());
+    int fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0600);
+    if (fd < 0) {
+        perror("Couldn't create shared memory");
+        exit(EXIT_FAILURE);
+    }
+    if (ftruncate(fd, comm->size)) {
+        perror("Couldn't size shared memory");
+        exit(EXIT_FAILURE);
+    }
+    void *memory = mmap(NULL, comm->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (MAP_FAILED == memory) {
+        perror("Couldn't map shared memory");
+        exit(EXIT_FAILURE);
+    }
+    //The mapping outlives the name, so nothing is left behind if a rank dies
+    shm_unlink(name);
+    close(fd);
+
+    comm->mailboxes = memory;
+    comm->shared = (real_t *) (comm->mailboxes + nRanks);
+    for (int i = 0; i < nRanks; i++) {
+        sem_init(&comm->mailboxes[i].full, 1, 0);
+        sem_init(&comm->mailboxes[i].empty, 1, ALLREDUCE_SLOTS);
+    }
+    return comm;
+}
+
+//PRE: Called by the rank's own process after forking
+void communicatorJoin(communicator_t *comm, int rank) {
+    comm->rank = rank;
+    comm->sendSlot = comm->recvSlot = 0;
+}
+
+//PRE: No other threads are running in the calling process
+//POST: Returns whether rankMain(arg) returned normally in each of the nRanks forked processes
+//      A rank dying would leave the others blocked in the ring, so then the rest are stopped
+bool communicatorRun(communicator_t *comm, void (*rankMain)(void *arg), void *arg) {
+    fflush(stdout);
+    pid_t *pids = malloc(sizeof(pid_t) * comm->nRanks);
+    for (int rank = 0; rank < comm->nRanks; rank++) {
+        pids[rank] = fork();
+        if (pids[rank] < 0) {
+            perror("Couldn't fork rank");
+            exit(EXIT_FAILURE);
+        }
+        if (0 == pids[rank]) {
+            communicatorJoin(comm, rank);
+            rankMain(arg);
+            fflush(stdout);
+            _exit(EXIT_SUCCESS);
+        }
+    }
+
+    bool succeeded = true;
+    int status;
+    pid_t pid;
+    for (int i = 0; i < comm->nRanks; i++) {
+        pid = wait(&status);
+        for (int rank = 0; rank < comm->nRanks; rank++) {
+            if (pids[rank] == pid) pids[rank] = 0;
+        }
+        if (WIFEXITED(status) && EXIT_SUCCESS == WEXITSTATUS(status)) continue;
+        if (succeeded) printf("Rank process %d failed, stopping the others\n", (int) pid);
+        succeeded = false;
+        for (int rank = 0; rank < comm->nRanks; rank++) {
+            if (pids[rank]) kill(pids[rank], SIGTERM);
+        }
+    }
+    free(pids);
+    return succeeded;
+}
+
+static void semWait(sem_t *sem) {
+    while (sem_wait(sem)) {
+        if (EINTR != errno) {
+            perror("Semaphore wait failed");
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+static void sendChunk(communicator_t *comm, real_t *chunk, int length) {
+    mailbox_t *next = &comm->mailboxes[(comm->rank + 1) % comm->nRanks];
+    semWait(&next->empty);
+    memcpy(next->slots[comm->sendSlot], chunk, sizeof(real_t) * length);
+    comm->sendSlot = (comm->sendSlot + 1) % ALLREDUCE_SLOTS;
+    sem_post(&next->full);
+}
+
+static void receiveChunk(communicator_t *comm, real_t *chunk, int length, bool accumulate) {
+    mailbox_t *own = &comm->mailboxes[comm->rank];
+    semWait(&own->full);
+    real_t *slot = own->slots[comm->recvSlot];
+    if (accumulate) {
+        for (int i = 0; i < length; i++) chunk[i] += slot[i];
+    } else {
+        memcpy(chunk, slot, sizeof(real_t) * length);
+    }
+    comm->recvSlot = (comm->recvSlot + 1) % ALLREDUCE_SLOTS;
+    sem_post(&own->empty);
+}
+
+static int segmentStart(int length, int nRanks, int segment) {
+    return (int) ((long) length * segment / nRanks);
+}
+
+//POST: send is passed to the next rank while recv is read from the previous one,
+//      chunk by chunk so the next rank can start on a chunk while this one is sending the next
+static void exchange(communicator_t *comm, real_t *send, int nSend,
+                     real_t *recv, int nRecv, bool accumulate) {
+    int nChunks = ((nSend > nRecv ? nSend : nRecv) + ALLREDUCE_CHUNK - 1) / ALLREDUCE_CHUNK;
+    int offset, length;
+    for (int c = 0; c < nChunks; c++) {
+        offset = c * ALLREDUCE_CHUNK;
+        if (offset < nSend) {
+            length = nSend - offset < ALLREDUCE_CHUNK ? nSend - offset : ALLREDUCE_CHUNK;
+            sendChunk(comm, send + offset, length);
+        }
+        if (offset < nRecv) {
+            length = nRecv - offset < ALLREDUCE_CHUNK ? nRecv - offset : ALLREDUCE_CHUNK;
+            receiveChunk(comm, recv + offset, length, accumulate);
+        }
+    }
+}
+
+//PRE: Every rank calls allReduce with the same length, in the same order
+//POST: data holds the elementwise sum of data over all ranks
+//      Ring algorithm: a reduce-scatter then an all-gather, each of nRanks - 1 steps
+void allReduce(communicator_t *comm, real_t *data, int length) {
+    int n = comm->nRanks;
+    int r = comm->rank;
+    if (1 == n) return;
+
+    int send, recv;
+    for (int step = 0; step < n - 1; step++) {
+        send = (r - step + n) % n;
+        recv = (r - step - 1 + n) % n;
+        exchange(comm, data + segmentStart(length, n, send),
+                 segmentStart(length, n, send + 1) - segmentStart(length, n, send),
+                 data + segmentStart(length, n, recv),
+                 segmentStart(length, n, recv + 1) - segmentStart(length, n, recv), true);
+    }
+    for (int step = 0; step < n - 1; step++) {
+        send = (r - step + 1 + n) % n;
+        recv = (r - step + n) % n;
+        exchange(comm, data + segmentStart(length, n, send),
+                 segmentStart(length, n, send + 1) - segmentStart(length, n, send),
+                 data + segmentStart(length, n, recv),
+                 segmentStart(length, n, recv + 1) - segmentStart(length, n, recv), false);
+    }
+}
+
+void communicatorFree(communicator_t *comm) {
+    for (int i = 0; i < comm->nRanks; i++) {
+        sem_destroy(&comm->mailboxes[i].full);
+        sem_destroy(&comm->mailboxes[i].empty);
+    }
+    munmap(comm->mailboxes, comm->size);
+    free(comm);
+}
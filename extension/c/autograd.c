@@ -0,0 +1,421 @@
+#include "../autograd.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../activation.h"
+#include "../fusion.h"
+#include "../lstm.h"
+#include "../matrix.h"
+#include "../nodes.h"
+#include "../pooling.h"
+#include "../predict.h"
+#include "../util.h"
+
+//POST: Whether node's input idx is differentiated, rather than being i.e. a config of integers
+static bool isDifferentiable(node_t *node, int idx) {
+    switch (node->content.operation.funcName) {
+        case CONVOLUTION:
+        case DECONVOLUTION:   return idx < 2;
+        case MAX_POOLING:
+        case AVERAGE_POOLING:
+        case FLATTEN:         return 0 == idx;
+        case LSTM_STEP:       return idx < 3;
+        default:              return true;
+    }
+}
+
+//PRE: nodes is a forward schedule as made by schedule
+//POST: Every node on a path from a weight or bias has a gradient buffer, sized on first use
+//      Weights and biases are the data nodes which are part of the model, i.e. internal, and not constant
+tape_t *tapeRecord(node_t **nodes, int length) {
+    tape_t *tape = malloc(sizeof(tape_t));
+    tape->nodes = nodes;
+    tape->length = length;
+    tape->params = NULL;
+    tape->nParams = 0;
+
+    node_t *node, *input;
+    //Inputs run before the nodes reading them, so their buffers are already decided
+    for (int i = length - 1; i >= 0; i--) {
+        node = nodes[i];
+        if (node->isData) continue;
+        for (int j = 0; j < node->n; j++) {
+            input = node->inputs[j];
+            if (!input || !isDifferentiable(node, j)) continue;
+            if (input->isData && input->content.data->internalNode && !input->content.data->constant
+                && !input->gradient) {
+                input->gradient = calloc(1, sizeof(matrix_t));
+            }
+            if (input->gradient && !node->gradient) node->gradient = calloc(1, sizeof(matrix_t));
+        }
+    }
+
+    //BACKWARD reaches a weight once every node reading it is done
+    for (int i = 0; i < length; i++) {
+        if (nodes[i]->isData && nodes[i]->gradient) push(&tape->params, &tape->nParams, nodes[i]);
+    }
+    return tape;
+}
+
+//PRE: node->gradient isn't NULL
+//POST: node's gradient buffer, allocated zeroed the first time and kept for later passes
+static matrix2d_t *gradientOf(node_t *node, int nRows, int nCols) {
+    matrix2d_t *gradient = node->gradient->matrix2d;
+    if (gradient && gradient->nRows == nRows && gradient->nCols == nCols) return gradient;
+    if (gradient) matrixFree(gradient);
+    return node->gradient->matrix2d = matrixCreate(nRows, nCols);
+}
+
+//POST: Whether node holds a 3D matrix, which only FLATTEN reads, so its gradient is 3D too
+static bool isVolume(node_t *node) {
+    for (int i = 0; i < node->m; i++) {
+        if (node->outputs[i] && !node->outputs[i]->isData && FLATTEN == node->outputs[i]->content.operation.funcName) {
+            return true;
+        }
+    }
+    return false;
+}
+
+//POST: Every gradient buffer is zeroed, ready for the next seeds
+//      Each weight and bias has one even if no path from it reaches a seed, so optimisers can always read it
+void tapeZero(tape_t *tape) {
+    matrix2d_t *gradient;
+    matrix3d_t *volume;
+    for (int i = 0; i < tape->nParams; i++) {
+        //3D gradients are made by the first FLATTEN to pass one on
+        if (isVolume(tape->params[i])) continue;
+        gradient = tape->params[i]->content.data->data->matrix2d;
+        gradientOf(tape->params[i], gradient->nRows, gradient->nCols);
+    }
+    for (int i = 0; i < tape->length; i++) {
+        if (!tape->nodes[i]->gradient || !tape->nodes[i]->gradient->matrix2d) continue;
+        if (isVolume(tape->nodes[i])) {
+            volume = tape->nodes[i]->gradient->matrix3d;
+            for (int j = 0; j < volume->nRows; j++) {
+                for (int k = 0; k < volume->nCols; k++) memset(volume->data[j][k], 0, sizeof(real_t) * volume->nDepth);
+            }
+            continue;
+        }
+        gradient = tape->nodes[i]->gradient->matrix2d;
+        for (int j = 0; j < gradient->nRows; j++) memset(gradient->data[j], 0, sizeof(real_t) * gradient->nCols);
+    }
+}
+
+//POST: into += scale * from
+static void accumulate(matrix2d_t *into, matrix2d_t *from, double scale) {
+    for (int i = 0; i < into->nRows; i++) {
+        for (int j = 0; j < into->nCols; j++) into->data[i][j] += scale * from->data[i][j];
+    }
+}
+
+//PRE: tapeZero was called since the last BACKWARD
+//POST: gradient, i.e. dL/d(node's matrix) for an output of the graph, is added to node's gradient
+void tapeSeed(node_t *node, matrix2d_t *gradient) {
+    if (!node->gradient) return;
+    accumulate(gradientOf(node, gradient->nRows, gradient->nCols), gradient, 1);
+}
+
+//PRE: FORWARD has run on tape->nodes, with plan unless it's NULL, and the loss has been seeded
+//POST: Every node on a path from a weight to a seed holds dL/d(node) in its gradient buffer
+void tapeBackward(tape_t *tape, checkpoints_t *plan) {
+    if (plan) {
+        executeCheckpointed(plan, tape->nodes, tape->length, BACKWARD);
+    } else {
+        execute(tape->nodes, tape->length, BACKWARD);
+    }
+}
+
+//POST: The buffer to add dL/d(input idx) to, or NULL if the input doesn't need a gradient
+static matrix2d_t *inputGradient(node_t *node, int idx) {
+    node_t *input = node->inputs[idx];
+    if (!input->gradient) return NULL;
+    return gradientOf(input, input->matrix->matrix2d->nRows, input->matrix->matrix2d->nCols);
+}
+
+//POST: As inputGradient, but the LSTM kernels always write a gradient for each parameter
+//      so inputs which don't need one get zeroed scratch, which scratch is set to
+static matrix2d_t *lstmGradient(node_t *node, int idx, matrix2d_t **scratch) {
+    matrix2d_t *gradient = inputGradient(node, idx);
+    *scratch = NULL;
+    if (gradient) return gradient;
+    matrix2d_t *input = node->inputs[idx]->matrix->matrix2d;
+    return *scratch = matrixCreate(input->nRows, input->nCols);
+}
+
+static void freeScratch(matrix2d_t **scratch, int n) {
+    for (int i = 0; i < n; i++) {
+        if (scratch[i]) matrixFree(scratch[i]);
+    }
+}
+
+//C = A . B, so dA += dC . B^T and dB += A^T . dC
+static void dotVJP(node_t *node, matrix2d_t *g) {
+    int first = 0, second = 1;
+    matrix2d_t *a = node->inputs[0]->matrix->matrix2d, *b = node->inputs[1]->matrix->matrix2d;
+    //matrixDotProduct swaps operands which only fit the other way round
+    if (a->nCols != b->nRows) {
+        first = 1;
+        second = 0;
+        a = node->inputs[1]->matrix->matrix2d;
+        b = node->inputs[0]->matrix->matrix2d;
+    }
+    matrix2d_t *dA = inputGradient(node, first), *dB = inputGradient(node, second);
+
+    real_t sum, value;
+    for (int i = 0; i < a->nRows; i++) {
+        for (int k = 0; k < a->nCols; k++) {
+            if (dA) {
+                sum = 0;
+                for (int j = 0; j < b->nCols; j++) sum += g->data[i][j] * b->data[k][j];
+                dA->data[i][k] += sum;
+            }
+            if (dB && (value = a->data[i][k])) {
+                for (int j = 0; j < b->nCols; j++) dB->data[k][j] += value * g->data[i][j];
+            }
+        }
+    }
+}
+
+static void lstmCellVJP(node_t *node, matrix2d_t *g) {
+    matrix2d_t *x = node->inputs[0]->matrix->matrix2d, *state = node->inputs[1]->matrix->matrix2d;
+    lstmParams_t params = {.weightW = node->inputs[2]->matrix->matrix2d,
+                           .weightU = node->inputs[3]->matrix->matrix2d,
+                           .bias = node->inputs[4]->matrix->matrix2d,
+                           .nNeurons = node->inputs[3]->matrix->matrix2d->nRows,
+                           .func = node->content.operation.activationName};
+    matrix2d_t *scratch[3];
+    lstmParams_t gradients = {.weightW = lstmGradient(node, 2, &scratch[0]),
+                              .weightU = lstmGradient(node, 3, &scratch[1]),
+                              .bias = lstmGradient(node, 4, &scratch[2])};
+
+    //FORWARD only keeps the next state, so the gates are recomputed for the cache
+    lstmCache_t cache;
+    matrixFree(lstmCellForward(&params, x, state, &cache));
+    matrix2d_t *dXs = inputGradient(node, 0), *dx = NULL;
+    matrix2d_t *dPrev = lstmCellBackward(&params, x, state, &cache, g, &gradients, dXs ? &dx : NULL);
+
+    matrix2d_t *dState = inputGradient(node, 1);
+    if (dState) accumulate(dState, dPrev, 1);
+    if (dx) {
+        accumulate(dXs, dx, 1);
+        matrixFree(dx);
+    }
+    matrixFree(dPrev);
+    lstmCacheFree(&cache);
+    freeScratch(scratch, 3);
+}
+
+static void lstmStepVJP(node_t *node, matrix2d_t *g) {
+    matrix2d_t *projection = node->inputs[0]->matrix->matrix2d, *state = node->inputs[1]->matrix->matrix2d;
+    int firstRow = matrixGet(node->inputs[3]->matrix->matrix2d, 0, 0);
+    int nActive = matrixGet(node->inputs[3]->matrix->matrix2d, 0, 1);
+    lstmParams_t params = {.weightU = node->inputs[2]->matrix->matrix2d,
+                           .nNeurons = node->inputs[2]->matrix->matrix2d->nRows,
+                           .func = node->content.operation.activationName};
+
+    //Rows which had finished carried their state straight through
+    matrix2d_t *dState = inputGradient(node, 1);
+    if (dState) {
+        for (int i = nActive; i < state->nRows; i++) {
+            for (int j = 0; j < state->nCols; j++) dState->data[i][j] += g->data[i][j];
+        }
+    }
+    if (!nActive) return;
+
+    matrix2d_t active = {.data = state->data, .nRows = nActive, .nCols = state->nCols};
+    matrix2d_t dActive = {.data = g->data, .nRows = nActive, .nCols = g->nCols};
+    lstmCache_t cache;
+    matrixFree(lstmStepForward(&params, projection, firstRow, &active, &cache));
+
+    //The bias is the projection's input, which gets its gradient from dProjection
+    matrix2d_t *scratch[3];
+    scratch[2] = matrixCreate(1, projection->nCols);
+    lstmParams_t gradients = {.weightU = lstmGradient(node, 2, &scratch[0]), .bias = scratch[2]};
+    matrix2d_t *dProjection = lstmGradient(node, 0, &scratch[1]);
+    matrix2d_t *dPrev = lstmStepBackward(&params, firstRow, &active, &cache, &dActive, &gradients, dProjection);
+
+    if (dState) {
+        for (int i = 0; i < nActive; i++) {
+            for (int j = 0; j < state->nCols; j++) dState->data[i][j] += dPrev->data[i][j];
+        }
+    }
+    matrixFree(dPrev);
+    lstmCacheFree(&cache);
+    freeScratch(scratch, 3);
+}
+
+static void lstmProjectionVJP(node_t *node, matrix2d_t *g) {
+    int timeSteps = node->n - 2;
+    matrix2d_t **inputs = malloc(sizeof(matrix2d_t*) * timeSteps);
+    bool needsDx = false;
+    for (int t = 0; t < timeSteps; t++) {
+        inputs[t] = node->inputs[t]->matrix->matrix2d;
+        needsDx |= NULL != node->inputs[t]->gradient;
+    }
+    lstmParams_t params = {.weightW = node->inputs[timeSteps]->matrix->matrix2d,
+                           .bias = node->inputs[timeSteps + 1]->matrix->matrix2d,
+                           .nNeurons = node->inputs[timeSteps]->matrix->matrix2d->nCols / N_GATES};
+    matrix2d_t *scratch;
+    lstmParams_t gradients = {.weightW = lstmGradient(node, timeSteps, &scratch)};
+    matrix2d_t **dxs = needsDx ? malloc(sizeof(matrix2d_t*) * timeSteps) : NULL;
+    lstmProjectInputsBackward(&params, inputs, timeSteps, g, &gradients, dxs);
+
+    matrix2d_t *dBias = inputGradient(node, timeSteps + 1);
+    if (dBias) {
+        for (int i = 0; i < g->nRows; i++) {
+            for (int j = 0; j < g->nCols; j++) dBias->data[0][j] += g->data[i][j];
+        }
+    }
+
+    matrix2d_t *dx;
+    for (int t = 0; dxs && t < timeSteps; t++) {
+        if ((dx = inputGradient(node, t))) accumulate(dx, dxs[t], 1);
+        matrixFree(dxs[t]);
+    }
+    free(dxs);
+    free(inputs);
+    freeScratch(&scratch, 1);
+}
+
+//The kernels index the taps in place, so no rotated kernel or dilated gradient is built
+static void convolutionVJP(node_t *node, matrix2d_t *g) {
+    matrix2d_t *x = node->inputs[0]->matrix->matrix2d, *kernel = node->inputs[1]->matrix->matrix2d;
+    matrix2d_t *config = node->inputs[2]->matrix->matrix2d;
+    int stride = matrixGet(config, 0, 0), padding = matrixGet(config, 0, 1);
+    matrix2d_t *dx = inputGradient(node, 0), *dKernel = inputGradient(node, 1);
+
+    if (CONVOLUTION == node->content.operation.funcName) {
+        matrixConvolutionBackward(x, kernel, g, stride, padding, convolutionDilation(config), false, dx, dKernel);
+    } else {
+        //DECONVOLUTION is the data gradient of a convolution by the flipped kernel, so the roles swap
+        if (dx) matrixConvolutionInto(g, kernel, stride, padding, 1, true, dx);
+        if (dKernel) matrixConvolutionBackward(g, NULL, x, stride, padding, 1, true, NULL, dKernel);
+    }
+}
+
+static void fusedVJP(node_t *node, matrix2d_t *g) {
+    matrix2d_t **inputs = malloc(sizeof(matrix2d_t*) * node->n);
+    matrix2d_t **gradients = malloc(sizeof(matrix2d_t*) * node->n);
+    for (int i = 0; i < node->n; i++) {
+        inputs[i] = node->inputs[i]->matrix->matrix2d;
+        gradients[i] = inputGradient(node, i);
+    }
+    fusedBackward(node->content.operation.kernel, inputs, g, gradients);
+    free(inputs);
+    free(gradients);
+}
+
+//POST: g, as a 1 x n row, is unflattened back to the shape of node's 3D input and added to its gradient
+static void flattenVJP(node_t *node, matrix2d_t *g) {
+    matrix_t *gradient = node->inputs[0]->gradient;
+    if (!gradient) return;
+    matrix3d_t *input = node->inputs[0]->matrix->matrix3d;
+    matrix2d_t *column = matrixTranspose(g);
+    matrix3d_t *dX = matrixUnflatten(column, input->nRows, input->nCols, input->nDepth);
+    matrixFree(column);
+    if (!gradient->matrix3d) {
+        gradient->matrix3d = dX;
+        return;
+    }
+    for (int i = 0; i < dX->nRows; i++) {
+        for (int j = 0; j < dX->nCols; j++) {
+            for (int k = 0; k < dX->nDepth; k++) gradient->matrix3d->data[i][j][k] += dX->data[i][j][k];
+        }
+    }
+    matrix3DFree(dX);
+}
+
+//PRE: FORWARD has run, so node and its inputs hold their activations
+//POST: dL/d(node) is multiplied by node's Jacobian and added to the gradient of each input
+//      which needs one; nothing happens if no path from node reached a seed
+void vjp(node_t *node) {
+    if (!node->gradient || !node->gradient->matrix2d) return;
+    matrix2d_t *g = node->gradient->matrix2d;
+    matrix2d_t *dA, *dB, *a, *b;
+
+    switch (node->content.operation.funcName) {
+        case ADD:
+        case SUBTRACT:
+            if ((dA = inputGradient(node, 0))) accumulate(dA, g, 1);
+            if ((dB = inputGradient(node, 1))) accumulate(dB, g, SUBTRACT == node->content.operation.funcName ? -1 : 1);
+            break;
+        case MULTIPLY:
+            a = node->inputs[0]->matrix->matrix2d;
+            b = node->inputs[1]->matrix->matrix2d;
+            dA = inputGradient(node, 0);
+            dB = inputGradient(node, 1);
+            for (int i = 0; i < g->nRows; i++) {
+                for (int j = 0; j < g->nCols; j++) {
+                    if (dA) dA->data[i][j] += g->data[i][j] * b->data[i][j];
+                    if (dB) dB->data[i][j] += g->data[i][j] * a->data[i][j];
+                }
+            }
+            break;
+        case DOT:
+            dotVJP(node, g);
+            break;
+        case CONVOLUTION:
+        case DECONVOLUTION:
+            convolutionVJP(node, g);
+            break;
+        case MAX_POOLING:
+            if ((dA = inputGradient(node, 0))) matrixMaxPoolingBackward(g, node->poolingArgmax, dA);
+            break;
+        case AVERAGE_POOLING:
+            if ((dA = inputGradient(node, 0))) {
+                matrixAveragePoolingBackward(g, matrixGet(node->inputs[1]->matrix->matrix2d, 0, 0),
+                                             matrixGet(node->inputs[1]->matrix->matrix2d, 0, 1), dA);
+            }
+            break;
+        case ACTIVATION:
+            if (!(dA = inputGradient(node, 0))) break;
+            //The derivatives are written in terms of the output
+            a = node->matrix->matrix2d;
+            for (int i = 0; i < g->nRows; i++) {
+                for (int j = 0; j < g->nCols; j++) {
+                    dA->data[i][j] += g->data[i][j] * activationPrime(node->content.operation.activationName, a->data[i][j]);
+                }
+            }
+            break;
+        case FUSED:
+            fusedVJP(node, g);
+            break;
+        case TRANSPOSE:
+            if (!(dA = inputGradient(node, 0))) break;
+            for (int i = 0; i < g->nRows; i++) {
+                for (int j = 0; j < g->nCols; j++) dA->data[j][i] += g->data[i][j];
+            }
+            break;
+        case LSTM_CELL:
+            lstmCellVJP(node, g);
+            break;
+        case LSTM_PROJECTION:
+            lstmProjectionVJP(node, g);
+            break;
+        case LSTM_STEP:
+            lstmStepVJP(node, g);
+            break;
+        case FLATTEN:
+            flattenVJP(node, g);
+            break;
+        case LSTM_HIDDEN:
+            //Only the h half of the state reaches the output
+            if (!(dA = inputGradient(node, 0))) break;
+            for (int i = 0; i < g->nRows; i++) {
+                for (int j = 0; j < g->nCols; j++) dA->data[i][j] += g->data[i][j];
+            }
+            break;
+        default:
+            printf("No gradient for %s yet\n", node->name);
+            exit(EXIT_FAILURE);
+    }
+}
+
+//POST: The tape is freed; the gradient buffers stay with their nodes for the next tape
+void tapeFree(tape_t *tape) {
+    free(tape->params);
+    free(tape);
+}
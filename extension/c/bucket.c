@@ -0,0 +1,139 @@
+#include "../bucket.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../layers.h"
+#include "../lstm.h"
+#include "../matrix.h"
+#include "../nodes.h"
+#include "../predict.h"
+#include "../scheduler.h"
+
+//PRE: bucketLengths is ascending, params outlives the model
+//POST: A model with no graphs built yet
+bucketedLSTM_t *bucketedLSTMCreate(lstmParams_t *params, int nFeatures, int *bucketLengths, int nBuckets) {
+    bucketedLSTM_t *model = calloc(1, sizeof(bucketedLSTM_t));
+    model->params = params;
+    model->nFeatures = nFeatures;
+    model->nBuckets = nBuckets;
+    model->buckets = calloc(nBuckets, sizeof(lstmBucket_t));
+    for (int b = 0; b < nBuckets; b++) model->buckets[b].maxLength = bucketLengths[b];
+    return model;
+}
+
+static void bucketBuild(bucketedLSTM_t *model, lstmBucket_t *bucket) {
+    bucket->inputs = malloc(sizeof(node_t*) * bucket->maxLength);
+    bucket->configs = malloc(sizeof(node_t*) * bucket->maxLength);
+    for (int t = 0; t < bucket->maxLength; t++) {
+        bucket->inputs[t] = nodeInit("x", 0, 1, true);
+        bucket->inputs[t]->content.data->internalNode = false;
+        bucket->inputs[t]->content.data->data->matrix2d = matrixCreate(1, model->nFeatures);
+        bucket->inputs[t]->matrix->matrix2d = bucket->inputs[t]->content.data->data->matrix2d;
+    }
+    bucket->graph = packedLSTM(bucket->inputs, bucket->maxLength, model->params, bucket->configs);
+    bucket->nodes = schedule(bucket->graph, &bucket->length);
+    bucket->graph->exitPoints[0]->content.data->data->matrix2d = NULL;
+}
+
+static void setContent(node_t *node, matrix2d_t *matrix) {
+    if (node->content.data->data->matrix2d) matrixFree(node->content.data->data->matrix2d);
+    node->content.data->data->matrix2d = matrix;
+}
+
+//PRE: batch holds nBatch sequences longest first, none longer than the bucket
+//POST: outputs[k] is the last hidden output of batch[k], taken at its own last step
+//      Step t only takes the rows of the sequences longer than t, which come first in the batch,
+//      so padded steps aren't part of any GEMM
+static void bucketForward(bucketedLSTM_t *model, lstmBucket_t *bucket, matrix2d_t **batch, int nBatch,
+                          matrix2d_t **outputs) {
+    if (!bucket->graph) bucketBuild(model, bucket);
+    int nNeurons = model->params->nNeurons;
+
+    //The initial state is the first entry point
+    setContent(bucket->graph->entryPoints[0], matrixCreate(nBatch, 2 * nNeurons));
+    setContent(bucket->graph->exitPoints[0], matrixCreate(nBatch, nNeurons));
+
+    int nActive = nBatch, firstRow = 0;
+    matrix2d_t *x, *config;
+    for (int t = 0; t < bucket->maxLength; t++) {
+        while (nActive && batch[nActive - 1]->nRows <= t) nActive--;
+        x = matrixCreate(nActive, model->nFeatures);
+        for (int k = 0; k < nActive; k++) {
+            memcpy(x->data[k], batch[k]->data[t], sizeof(real_t) * model->nFeatures);
+        }
+        setContent(bucket->inputs[t], x);
+
+        config = matrixCreate(1, 2);
+        matrixSet(config, 0, 0, firstRow);
+        matrixSet(config, 0, 1, nActive);
+        setContent(bucket->configs[t], config);
+        firstRow += nActive;
+    }
+    model->nRowsComputed += firstRow;
+
+    execute(bucket->nodes, bucket->length, FORWARD);
+
+    matrix2d_t *hidden = bucket->graph->exitPoints[0]->inputs[0]->matrix->matrix2d;
+    for (int k = 0; k < nBatch; k++) {
+        outputs[k] = matrixCreate(1, nNeurons);
+        memcpy(outputs[k]->data[0], hidden->data[k], sizeof(real_t) * nNeurons);
+    }
+}
+
+typedef struct sequenceIndex {
+    matrix2d_t *sequence;
+    int idx;
+} sequenceIndex_t;
+
+static int compareLengths(const void *a, const void *b) {
+    int first = ((sequenceIndex_t*) a)->sequence->nRows, second = ((sequenceIndex_t*) b)->sequence->nRows;
+    return (first < second) - (first > second);
+}
+
+//PRE: sequences[i] has one row of nFeatures per step, no more than the longest bucket
+//POST: outputs[i] is the 1 x nNeurons last hidden output of sequences[i]
+//      Sequences are batched longest first, so each batch holds similar lengths and
+//      runs in the smallest bucket its longest sequence fits
+void bucketedLSTMForward(bucketedLSTM_t *model, matrix2d_t **sequences, int nSequences,
+                         int batchSize, matrix2d_t **outputs) {
+    sequenceIndex_t *sorted = malloc(sizeof(sequenceIndex_t) * nSequences);
+    for (int i = 0; i < nSequences; i++) sorted[i] = (sequenceIndex_t) {.sequence = sequences[i], .idx = i};
+    qsort(sorted, nSequences, sizeof(sequenceIndex_t), compareLengths);
+
+    int longest = sorted[0].sequence->nRows;
+    if (longest > model->buckets[model->nBuckets - 1].maxLength) {
+        printf("A sequence of %d steps is longer than every bucket\n", longest);
+        exit(EXIT_FAILURE);
+    }
+    model->nRowsComputed = 0;
+    model->nRowsPadded = (long) longest * nSequences;
+
+    matrix2d_t **batch = malloc(sizeof(matrix2d_t*) * batchSize);
+    matrix2d_t **batchOutputs = malloc(sizeof(matrix2d_t*) * batchSize);
+    int nBatch, b;
+    for (int i = 0; i < nSequences; i += nBatch) {
+        nBatch = nSequences - i < batchSize ? nSequences - i : batchSize;
+        for (int k = 0; k < nBatch; k++) batch[k] = sorted[i + k].sequence;
+        for (b = 0; model->buckets[b].maxLength < batch[0]->nRows; b++);
+        bucketForward(model, &model->buckets[b], batch, nBatch, batchOutputs);
+        for (int k = 0; k < nBatch; k++) outputs[sorted[i + k].idx] = batchOutputs[k];
+    }
+
+    free(batchOutputs);
+    free(batch);
+    free(sorted);
+}
+
+//POST: Frees the model and its schedules; the graphs' weights belong to params
+void bucketedLSTMFree(bucketedLSTM_t *model) {
+    for (int b = 0; b < model->nBuckets; b++) {
+        if (!model->buckets[b].graph) continue;
+        free(model->buckets[b].nodes);
+        free(model->buckets[b].inputs);
+        free(model->buckets[b].configs);
+    }
+    free(model->buckets);
+    free(model);
+}
@@ -0,0 +1,460 @@
+#include "../convolution.h"
+
+#include <complex.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../gemm.h"
+#include "../matrix.h"
+#include "../nodes.h"
+#include "../passes.h"
+#include "../predict.h"
+#include "../util.h"
+
+//Every algorithm computes output (i, j) = sum of input (i * stride + k * dilation - padding,
+//j * stride + l * dilation - padding) * kernel (k, l), with the padding read as zeros
+//A deconvolution is the convolution, with stride 1, of its input spread out by stride and padded
+//by kernelSize - 1 - padding, so every algorithm runs both
+
+//Each timing runs at least this many multiply-adds, the best of TIMING_TRIALS is kept
+#define TIMED_MACS (1 << 20)
+#define TIMING_TRIALS 3
+#define CPU_MODEL_LENGTH 128
+
+static const char *algorithmNames[] = {"direct", "im2col", "winograd", "fft"};
+
+typedef struct choice {
+    int key[8]; //funcName, nRows, nCols, kRows, kCols, stride, padding, dilation
+    enum convolutionAlgorithm algorithm;
+    char cpuModel[CPU_MODEL_LENGTH];
+} choice_t;
+
+static choice_t *choices = NULL;
+static int nChoices = 0;
+static bool unsaved = false;
+static char cpuModel[CPU_MODEL_LENGTH] = "unknown";
+static pthread_once_t loaded = PTHREAD_ONCE_INIT;
+
+//POST: A copy of matrix with padRows and padCols zeros around it, and extraRows and extraCols more
+//      below and to the right of that
+static matrix2d_t *padMatrix(matrix2d_t *matrix, int padRows, int padCols, int extraRows, int extraCols) {
+    matrix2d_t *padded = matrixCreate(matrix->nRows + 2 * padRows + extraRows, matrix->nCols + 2 * padCols + extraCols);
+    for (int i = 0; i < matrix->nRows; i++) {
+        memcpy(padded->data[i + padRows] + padCols, matrix->data[i], sizeof(real_t) * matrix->nCols);
+    }
+    return padded;
+}
+
+//POST: Size of one axis of the output of a convolution over an axis of length size
+static int outputSize(int size, int kernelSize, int stride, int padding, int dilation) {
+    return (size + 2 * padding - dilation * (kernelSize - 1) - 1) / stride + 1;
+}
+
+//POST: Each output is a row of the kernel times a column of patches, so the whole convolution is one GEMM
+static matrix2d_t *im2col(matrix2d_t *matrix, matrix2d_t *kernel, int stride, int padding, int dilation) {
+    int outRows = outputSize(matrix->nRows, kernel->nRows, stride, padding, dilation);
+    int outCols = outputSize(matrix->nCols, kernel->nCols, stride, padding, dilation);
+    int nTaps = kernel->nRows * kernel->nCols, nOutputs = outRows * outCols, row, col;
+    matrix2d_t *patches = matrixCreate(nTaps, nOutputs), *flat = matrixCreate(1, nTaps), *out = matrixCreate(1, nOutputs);
+    real_t *taps;
+    for (int k = 0; k < kernel->nRows; k++) {
+        for (int l = 0; l < kernel->nCols; l++) {
+            flat->data[0][k * kernel->nCols + l] = kernel->data[k][l];
+            taps = patches->data[k * kernel->nCols + l];
+            for (int i = 0; i < outRows; i++) {
+                row = i * stride + k * dilation - padding;
+                if (row < 0 || row >= matrix->nRows) continue;
+                for (int j = 0; j < outCols; j++) {
+                    col = j * stride + l * dilation - padding;
+                    if (col >= 0 && col < matrix->nCols) taps[i * outCols + j] = matrix->data[row][col];
+                }
+            }
+        }
+    }
+    gemm(flat->data, patches->data, out->data, 1, nTaps, nOutputs);
+    matrix2d_t *result = matrixCreate(outRows, outCols);
+    for (int i = 0; i < outRows; i++) memcpy(result->data[i], out->data[0] + i * outCols, sizeof(real_t) * outCols);
+    matrixFree(patches);
+    matrixFree(flat);
+    matrixFree(out);
+    return result;
+}
+
+//POST: out = left . in . right^T for 4 x 4 in, where left and right are nOut x 4
+static void transformTile(const double *left, const double *right, int nOut, double in[4][4], double out[4][4]) {
+    double half[4][4];
+    for (int i = 0; i < nOut; i++) {
+        for (int j = 0; j < 4; j++) {
+            half[i][j] = 0;
+            for (int k = 0; k < 4; k++) half[i][j] += left[i * 4 + k] * in[k][j];
+        }
+    }
+    for (int i = 0; i < nOut; i++) {
+        for (int j = 0; j < nOut; j++) {
+            out[i][j] = 0;
+            for (int k = 0; k < 4; k++) out[i][j] += half[i][k] * right[j * 4 + k];
+        }
+    }
+}
+
+//PRE: kernel is 3 x 3, stride and dilation are 1
+//POST: Winograd's F(2 x 2, 3 x 3): each 2 x 2 block of outputs costs 16 multiplications instead of 36
+static matrix2d_t *winograd(matrix2d_t *matrix, matrix2d_t *kernel, int padding) {
+    static const double bT[16] = {1, 0, -1, 0,  0, 1, 1, 0,  0, -1, 1, 0,  0, 1, 0, -1};
+    static const double aT[16] = {1, 1, 1, 0,  0, 1, -1, -1};
+    //G's rows, padded to 4 columns so transformTile can take them
+    static const double g[16] = {1, 0, 0, 0,  0.5, 0.5, 0.5, 0,  0.5, -0.5, 0.5, 0,  0, 0, 1, 0};
+    int outRows = matrix->nRows + 2 * padding - 2, outCols = matrix->nCols + 2 * padding - 2;
+    if (outRows < 1 || outCols < 1) return NULL;
+    //Padded out to whole tiles
+    matrix2d_t *padded = padMatrix(matrix, padding, padding, outRows % 2, outCols % 2);
+    matrix2d_t *result = matrixCreate(outRows, outCols);
+
+    double tile[4][4] = {{0}}, u[4][4], v[4][4], y[4][4];
+    for (int k = 0; k < 3; k++) {
+        for (int l = 0; l < 3; l++) tile[k][l] = kernel->data[k][l];
+    }
+    transformTile(g, g, 4, tile, u);
+    for (int i = 0; i < outRows; i += 2) {
+        for (int j = 0; j < outCols; j += 2) {
+            for (int k = 0; k < 4; k++) {
+                for (int l = 0; l < 4; l++) tile[k][l] = padded->data[i + k][j + l];
+            }
+            transformTile(bT, bT, 4, tile, v);
+            for (int k = 0; k < 4; k++) {
+                for (int l = 0; l < 4; l++) v[k][l] *= u[k][l];
+            }
+            transformTile(aT, aT, 2, v, y);
+            for (int k = 0; k < 2 && i + k < outRows; k++) {
+                for (int l = 0; l < 2 && j + l < outCols; l++) result->data[i + k][j + l] = y[k][l];
+            }
+        }
+    }
+    matrixFree(padded);
+    return result;
+}
+
+//PRE: n is a power of 2
+//POST: x is replaced by its discrete Fourier transform, or its inverse times n
+static void fft(double complex *x, int n, bool inverse) {
+    double complex swap, w, step, even, odd;
+    for (int i = 1, j = 0, bit; i < n; i++) {
+        for (bit = n >> 1; j & bit; bit >>= 1) j ^= bit;
+        j ^= bit;
+        if (i < j) {
+            swap = x[i];
+            x[i] = x[j];
+            x[j] = swap;
+        }
+    }
+    for (int length = 2; length <= n; length <<= 1) {
+        step = cexp((inverse ? 2 : -2) * M_PI * I / length);
+        for (int i = 0; i < n; i += length) {
+            w = 1;
+            for (int k = 0; k < length / 2; k++) {
+                even = x[i + k];
+                odd = x[i + k + length / 2] * w;
+                x[i + k] = even + odd;
+                x[i + k + length / 2] = even - odd;
+                w *= step;
+            }
+        }
+    }
+}
+
+//POST: Every row then every column of the nRows x nCols grid is transformed
+static void fft2D(double complex *grid, int nRows, int nCols, bool inverse) {
+    double complex *column = malloc(sizeof(double complex) * nRows);
+    for (int i = 0; i < nRows; i++) fft(grid + i * nCols, nCols, inverse);
+    for (int j = 0; j < nCols; j++) {
+        for (int i = 0; i < nRows; i++) column[i] = grid[i * nCols + j];
+        fft(column, nRows, inverse);
+        for (int i = 0; i < nRows; i++) grid[i * nCols + j] = column[i];
+    }
+    free(column);
+}
+
+static int powerOf2AtLeast(int n) {
+    int power = 1;
+    while (power < n) power <<= 1;
+    return power;
+}
+
+//POST: The correlation taken as a product of Fourier transforms, costing O(n log n) whatever the kernel's size
+//      The transforms are as big as the padded input, so the kernel never wraps round onto outputs that are kept
+static matrix2d_t *fftConvolution(matrix2d_t *matrix, matrix2d_t *kernel, int stride, int padding, int dilation) {
+    int outRows = outputSize(matrix->nRows, kernel->nRows, stride, padding, dilation);
+    int outCols = outputSize(matrix->nCols, kernel->nCols, stride, padding, dilation);
+    int nRows = powerOf2AtLeast(matrix->nRows + 2 * padding), nCols = powerOf2AtLeast(matrix->nCols + 2 * padding);
+    double complex *signal = calloc((size_t) nRows * nCols, sizeof(double complex));
+    double complex *filter = calloc((size_t) nRows * nCols, sizeof(double complex));
+    for (int i = 0; i < matrix->nRows; i++) {
+        for (int j = 0; j < matrix->nCols; j++) signal[(i + padding) * nCols + j + padding] = matrix->data[i][j];
+    }
+    for (int k = 0; k < kernel->nRows; k++) {
+        for (int l = 0; l < kernel->nCols; l++) filter[k * dilation * nCols + l * dilation] = kernel->data[k][l];
+    }
+    fft2D(signal, nRows, nCols, false);
+    fft2D(filter, nRows, nCols, false);
+    //Correlating is multiplying by the conjugate
+    for (int i = 0; i < nRows * nCols; i++) signal[i] *= conj(filter[i]);
+    fft2D(signal, nRows, nCols, true);
+
+    matrix2d_t *result = matrixCreate(outRows, outCols);
+    double scale = 1.0 / ((double) nRows * nCols);
+    for (int i = 0; i < outRows; i++) {
+        for (int j = 0; j < outCols; j++) result->data[i][j] = creal(signal[i * stride * nCols + j * stride]) * scale;
+    }
+    free(signal);
+    free(filter);
+    return result;
+}
+
+//POST: matrix convolved by kernel with the algorithm, NULL if the algorithm can't do that convolution
+matrix2d_t *convolveWith(enum convolutionAlgorithm algorithm, matrix2d_t *matrix, matrix2d_t *kernel,
+                         int stride, int padding, int dilation) {
+    if (outputSize(matrix->nRows, kernel->nRows, stride, padding, dilation) < 1
+        || outputSize(matrix->nCols, kernel->nCols, stride, padding, dilation) < 1) return NULL;
+    switch (algorithm) {
+        case DIRECT_CONVOLUTION:
+            return matrixDilatedConvolution(matrix, kernel, stride, padding, dilation);
+        case IM2COL_CONVOLUTION:
+            return im2col(matrix, kernel, stride, padding, dilation);
+        case WINOGRAD_CONVOLUTION:
+            if (3 != kernel->nRows || 3 != kernel->nCols || 1 != stride || 1 != dilation) return NULL;
+            return winograd(matrix, kernel, padding);
+        case FFT_CONVOLUTION:
+            return fftConvolution(matrix, kernel, stride, padding, dilation);
+        default:
+            return NULL;
+    }
+}
+
+//POST: matrix deconvolved by kernel with the algorithm, NULL if the algorithm can't do that deconvolution
+matrix2d_t *deconvolveWith(enum convolutionAlgorithm algorithm, matrix2d_t *matrix, matrix2d_t *kernel,
+                           int stride, int padding) {
+    if (DIRECT_CONVOLUTION == algorithm) return matrixDeconvolution(matrix, kernel, stride, padding);
+    int padRows = kernel->nRows - 1 - padding, padCols = kernel->nCols - 1 - padding;
+    //Padding past the kernel crops the output, which the spread out input can't give
+    if (padRows < 0 || padCols < 0) return NULL;
+    matrix2d_t *spread = matrixCreate((matrix->nRows - 1) * stride + 1 + 2 * padRows,
+                                      (matrix->nCols - 1) * stride + 1 + 2 * padCols);
+    for (int i = 0; i < matrix->nRows; i++) {
+        for (int j = 0; j < matrix->nCols; j++) spread->data[i * stride + padRows][j * stride + padCols] = matrix->data[i][j];
+    }
+    matrix2d_t *result = convolveWith(algorithm, spread, kernel, 1, 0, 1);
+    matrixFree(spread);
+    return result;
+}
+
+//POST: The convolution or deconvolution in the algorithm it was prepared with
+static matrix2d_t *convolveNode(node_t *node) {
+    matrix2d_t *matrix = node->inputs[0]->matrix->matrix2d, *kernel = node->inputs[1]->matrix->matrix2d;
+    matrix2d_t *config = node->inputs[2]->matrix->matrix2d;
+    int stride = matrixGet(config, 0, 0), padding = matrixGet(config, 0, 1);
+    if (CONVOLUTION == node->content.operation.funcName) {
+        return convolveWith(node->content.operation.algorithm, matrix, kernel, stride, padding, convolutionDilation(config));
+    }
+    return deconvolveWith(node->content.operation.algorithm, matrix, kernel, stride, padding);
+}
+
+static matrix2d_t *runAlgorithm(enum convolutionAlgorithm algorithm, enum matrixFunction funcName, matrix2d_t *matrix,
+                                matrix2d_t *kernel, int stride, int padding, int dilation) {
+    return CONVOLUTION == funcName ? convolveWith(algorithm, matrix, kernel, stride, padding, dilation)
+                                   : deconvolveWith(algorithm, matrix, kernel, stride, padding);
+}
+
+//POST: Whether result is within CONVOLUTION_TOLERANCE of expected, relative to expected's largest element
+static bool closeTo(matrix2d_t *expected, matrix2d_t *result) {
+    double largest = 0;
+    for (int i = 0; i < expected->nRows; i++) {
+        for (int j = 0; j < expected->nCols; j++) largest = fmax(largest, fabs(expected->data[i][j]));
+    }
+    return areMatrixesEqual(expected, result, CONVOLUTION_TOLERANCE * (1 + largest));
+}
+
+//POST: The CPU's model name, i.e. as /proc/cpuinfo gives it, so caches copied between machines aren't trusted
+static void readCpuModel(void) {
+    FILE *file = fopen("/proc/cpuinfo", "r");
+    if (!file) return;
+    char line[256], *value;
+    while (fgets(line, sizeof(line), file)) {
+        if (strncmp(line, "model name", 10) || !(value = strchr(line, ':'))) continue;
+        for (value++; ' ' == *value; value++);
+        value[strcspn(value, "\n")] = '\0';
+        snprintf(cpuModel, sizeof(cpuModel), "%s", value);
+        break;
+    }
+    fclose(file);
+}
+
+static void addChoice(int *key, enum convolutionAlgorithm algorithm, char *model) {
+    choices = realloc(choices, sizeof(choice_t) * (nChoices + 1));
+    memcpy(choices[nChoices].key, key, sizeof(choices[nChoices].key));
+    choices[nChoices].algorithm = algorithm;
+    snprintf(choices[nChoices].cpuModel, CPU_MODEL_LENGTH, "%s", model);
+    nChoices++;
+}
+
+//POST: The choices in path replace those held, which are left empty if it can't be read
+static void readCache(char *path) {
+    free(choices);
+    choices = NULL;
+    nChoices = 0;
+    FILE *file = fopen(path, "r");
+    if (!file) return;
+    char line[512], model[CPU_MODEL_LENGTH];
+    int key[8], algorithm;
+    while (fgets(line, sizeof(line), file)) {
+        if ('#' == line[0]) continue;
+        if (10 == sscanf(line, "%d %d %d %d %d %d %d %d %d %127[^\n]", &key[0], &key[1], &key[2], &key[3], &key[4],
+                         &key[5], &key[6], &key[7], &algorithm, model)
+            && algorithm >= 0 && algorithm < N_CONVOLUTION_ALGORITHMS) {
+            addChoice(key, algorithm, model);
+        }
+    }
+    fclose(file);
+}
+
+static void readDefaultCache(void) {
+    char path[512];
+    if (cacheFile(path, sizeof(path), CONVOLUTION_CACHE_FILE)) readCache(path);
+}
+
+static void loadDefaultCache(void) {
+    readCpuModel();
+    readDefaultCache();
+}
+
+//POST: The choices in path, or CONVOLUTION_CACHE_FILE if NULL, replace those held,
+//      i.e. to share them between machines with the same CPU
+void loadConvolutionCache(char *path) {
+    pthread_once(&loaded, loadDefaultCache);
+    if (path) {
+        readCache(path);
+    } else {
+        readDefaultCache();
+    }
+}
+
+//POST: The choices held, for every CPU model, are written to path, or CONVOLUTION_CACHE_FILE if NULL
+void saveConvolutionCache(char *path) {
+    char defaultPath[512], writing[512];
+    if (!path) {
+        if (!cacheFile(defaultPath, sizeof(defaultPath), CONVOLUTION_CACHE_FILE)) return;
+        path = defaultPath;
+    }
+    FILE *file = startReplacing(path, writing, sizeof(writing));
+    if (!file) {
+        perror("Couldn't write convolution cache");
+        return;
+    }
+    fprintf(file, "# function nRows nCols kRows kCols stride padding dilation algorithm cpu\n");
+    for (int c = 0; c < nChoices; c++) {
+        for (int k = 0; k < 8; k++) fprintf(file, "%d ", choices[c].key[k]);
+        fprintf(file, "%d %s\n", choices[c].algorithm, choices[c].cpuModel);
+    }
+    if (!finishReplacing(file, writing, path)) perror("Couldn't write convolution cache");
+}
+
+//POST: Seconds per run of the algorithm, the best of TIMING_TRIALS
+static double timeAlgorithm(enum convolutionAlgorithm algorithm, enum matrixFunction funcName, matrix2d_t *matrix,
+                            matrix2d_t *kernel, int stride, int padding, int dilation, int reps) {
+    struct timespec start, end;
+    double seconds, best = -1;
+    for (int trial = 0; trial < TIMING_TRIALS; trial++) {
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (int r = 0; r < reps; r++) matrixFree(runAlgorithm(algorithm, funcName, matrix, kernel, stride, padding, dilation));
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+        if (best < 0 || seconds < best) best = seconds;
+    }
+    return best / reps;
+}
+
+//PRE: funcName is CONVOLUTION or DECONVOLUTION, whose input is nRows x nCols and kernel kRows x kCols
+//POST: The fastest algorithm for the shape on this CPU which agrees with direct convolution
+//      Shapes are only timed the first time; after that the cache file gives the choice
+enum convolutionAlgorithm selectConvolution(enum matrixFunction funcName, int nRows, int nCols, int kRows, int kCols,
+                                            int stride, int padding, int dilation) {
+    pthread_once(&loaded, loadDefaultCache);
+    int key[8] = {funcName, nRows, nCols, kRows, kCols, stride, padding, dilation};
+    for (int c = 0; c < nChoices; c++) {
+        if (!memcmp(choices[c].key, key, sizeof(key)) && !strcmp(choices[c].cpuModel, cpuModel)) return choices[c].algorithm;
+    }
+
+    matrix2d_t *matrix = matrixCreate(nRows, nCols), *kernel = matrixCreate(kRows, kCols), *expected, *result;
+    matrixRandomise(matrix);
+    matrixRandomise(kernel);
+    //Shapes with no outputs are left to fail as they would have
+    if (!(expected = runAlgorithm(DIRECT_CONVOLUTION, funcName, matrix, kernel, stride, padding, dilation))) {
+        matrixFree(matrix);
+        matrixFree(kernel);
+        return DIRECT_CONVOLUTION;
+    }
+    long macs = (long) expected->nRows * expected->nCols * kRows * kCols;
+    int reps = 1 + TIMED_MACS / (macs ? macs : 1);
+    enum convolutionAlgorithm best = DIRECT_CONVOLUTION;
+    double seconds, bestSeconds = timeAlgorithm(DIRECT_CONVOLUTION, funcName, matrix, kernel, stride, padding, dilation, reps);
+    for (enum convolutionAlgorithm algorithm = IM2COL_CONVOLUTION; algorithm < N_CONVOLUTION_ALGORITHMS; algorithm++) {
+        if (!(result = runAlgorithm(algorithm, funcName, matrix, kernel, stride, padding, dilation))) continue;
+        if (!closeTo(expected, result)) {
+            printf("%s convolution disagrees with direct convolution, so it isn't used\n", algorithmNames[algorithm]);
+        } else if ((seconds = timeAlgorithm(algorithm, funcName, matrix, kernel, stride, padding, dilation, reps))
+                   < bestSeconds) {
+            best = algorithm;
+            bestSeconds = seconds;
+        }
+        matrixFree(result);
+    }
+    matrixFree(matrix);
+    matrixFree(kernel);
+    matrixFree(expected);
+
+    addChoice(key, best, cpuModel);
+    unsaved = true;
+    return best;
+}
+
+//PRE: nodes is a forward schedule as made by schedule
+//POST: Every convolution and deconvolution runs the algorithm selectConvolution chooses for its shape,
+//      new choices are written to the cache file, and the number not run directly is returned
+int selectConvolutions(node_t **nodes, int length) {
+    shape_t *shapes = scheduleShapes(nodes, length);
+    nodeIndex_t *sorted = indexNodes(nodes, length);
+    int nSelected = 0, input, kernel, stride, padding, dilation;
+    enum matrixFunction funcName;
+    matrix2d_t *config;
+    for (int i = 0; i < length; i++) {
+        if (nodes[i]->isData) continue;
+        funcName = nodes[i]->content.operation.funcName;
+        if (CONVOLUTION != funcName && DECONVOLUTION != funcName) continue;
+        input = indexOf(sorted, length, nodes[i]->inputs[0]);
+        kernel = indexOf(sorted, length, nodes[i]->inputs[1]);
+        config = nodes[i]->inputs[2]->isData ? nodes[i]->inputs[2]->content.data->data->matrix2d : NULL;
+        if (input < 0 || kernel < 0 || !config || !shapes[input].nRows || !shapes[kernel].nRows) continue;
+        stride = matrixGet(config, 0, 0);
+        padding = matrixGet(config, 0, 1);
+        dilation = CONVOLUTION == funcName ? convolutionDilation(config) : 1;
+        nodes[i]->content.operation.algorithm = selectConvolution(funcName, shapes[input].nRows, shapes[input].nCols,
+                                                                  shapes[kernel].nRows, shapes[kernel].nCols,
+                                                                  stride, padding, dilation);
+        //Direct convolution keeps whatever kernel prepareKernels chose
+        if (DIRECT_CONVOLUTION != nodes[i]->content.operation.algorithm) {
+            nodes[i]->specialised = convolveNode;
+            nSelected++;
+        }
+    }
+    if (unsaved && cacheWrites()) {
+        saveConvolutionCache(NULL);
+        unsaved = false;
+    }
+    free(shapes);
+    free(sorted);
+    return nSelected;
+}
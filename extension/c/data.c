@@ -1,24 +1,38 @@
 #include "../data.h"
 
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
 
+#include "../quantize.h"
+#include "../sparse.h"
+
 #define INITIAL_N_DATA_BLOCKS 10
 
 //PRE: file is the file to be appended to (MUST be opened in append mode), node is a node_t which isn't an operation 
 void writeBlock(FILE *file, node_t node) {
     data_t data = *(node.content.data);
+    //Pruned weights are written dense, and made sparse again when they're first run
+    matrix_t dense = {.matrix2d = data.sparse ? sparseToMatrix(data.sparse) : NULL};
+    if (data.sparse) data.data = &dense;
     //Write name to file
     fwrite(node.name, sizeof(char), strlen(node.name), file);
 
-	//Write length, width to the file
-	fprintf(file, "\t%d\t%d\t", data.data->matrix2d->nRows, data.data->matrix2d->nCols);
-
-    //Write matrix values to the file
+    //Write length, width, the size of each value and whether it's constant to the file
+    if (data.quantized) {
+        fprintf(file, "\t%d\t%d:%zu:%d\t", data.quantized->nRows, data.quantized->nCols, sizeof(int8_t),
+                data.constant);
+        //Quantized weights are written as their bytes
+        fwrite(data.quantized->values, sizeof(int8_t), data.quantized->nRows * data.quantized->nCols, file);
+        return;
+    }
+    fprintf(file, "\t%d\t%d:%zu:%d\t", data.data->matrix2d->nRows, data.data->matrix2d->nCols, sizeof(real_t),
+            data.constant);
 	for (int i = 0; i < data.data->matrix2d->nRows; i++)
-        fwrite(data.data->matrix2d->data[i], sizeof(double), data.data->matrix2d->nCols, file);
+        fwrite(data.data->matrix2d->data[i], sizeof(real_t), data.data->matrix2d->nCols, file);
+    if (data.sparse) matrixFree(dense.matrix2d);
 }
 
 //PRE: file must be in rb mode, string must be large enough to accomodate the data
@@ -56,14 +70,46 @@ static data_t *readBlock(FILE *file) {
     char *cCols = seek(file);
     int rows = atoi(cRows);
     int cols = atoi(cCols);
-    matrix2d_t *matrix = matrixCreate(rows, cols);
-    for (int i = 0; i < rows; i++) {
-        fread(matrix->data[i], sizeof(double), cols, file);
+    //Files written before float32 builds existed give no size, and hold doubles
+    char *size = strchr(cCols, ':');
+    bool isFloat = size && sizeof(float) == atoi(size + 1);
+    //Nor did they say which data is constant
+    char *constant = size ? strchr(size + 1, ':') : NULL;
+    bool isConstant = constant && atoi(constant + 1);
+    quantized_t *quantized = NULL;
+    matrix2d_t *matrix = NULL;
+    if (size && sizeof(int8_t) == atoi(size + 1)) {
+        //Quantized weights, which only keep their bytes for QUANTIZED_DOT
+        quantized = malloc(sizeof(quantized_t));
+        quantized->nRows = rows;
+        quantized->nCols = cols;
+        quantized->values = malloc(sizeof(int8_t) * rows * cols + 1);
+        fread(quantized->values, sizeof(int8_t), rows * cols, file);
+    } else if (isFloat == (sizeof(float) == sizeof(real_t))) {
+        matrix = matrixCreate(rows, cols);
+        for (int i = 0; i < rows; i++) fread(matrix->data[i], sizeof(real_t), cols, file);
+    } else {
+        //Written by a build of the other precision, so converted as it's read
+        matrix = matrixCreate(rows, cols);
+        float asFloat;
+        double asDouble;
+        for (int i = 0; i < rows; i++) {
+            for (int j = 0; j < cols; j++) {
+                if (isFloat) fread(&asFloat, sizeof(float), 1, file);
+                else fread(&asDouble, sizeof(double), 1, file);
+                matrix->data[i][j] = isFloat ? asFloat : asDouble;
+            }
+        }
     }
+    free(cRows);
+    free(cCols);
 
     data_t *data = malloc(sizeof(data_t));
     data->data = malloc(sizeof(matrix_t));
     data->internalNode = true;
+    data->constant = quantized || isConstant;
+    data->quantized = quantized;
+    data->sparse = NULL;
     data->data->matrix2d = matrix;
     return data;
 }
@@ -1,15 +1,27 @@
 #include <stdlib.h>
 #include <stdbool.h>
+#include <stdio.h>
 #include <assert.h>
+#include <time.h>
+#include <math.h>
+#include <sys/sysinfo.h>
 
-#include "../compiler.h"
+#include "../predict.h"
+#include "../scheduler.h"
 #include "../nodes.h"
 #include "../layers.h"
+#include "../lowrank.h"
+#include "../lstm.h"
+#include "../bucket.h"
 #include "../graphix.h"
+#include "../jit.h"
 #include "../file.h"
 #include "../error.h"
 #include "../optimisers.h"
+#include "../passes.h"
+#include "../pooling.h"
 #include "../readCSV.h"
+#include "../sparse.h"
 #include "../testUtils.h"
 #include "../train.h"
 #include "../util.h"
@@ -168,12 +180,9 @@ matrix2d_t **xor(matrix2d_t ***inputs) {
     return targets;
 }
 
-void trainXOR(void) {
-    //Create xor net
+graph_t *xorNetwork(int batchSize) {
     node_t *x = nodeInit("x", 0, 1, true);
     x->content.data->internalNode = false;
-
-    int batchSize = 4;
     
     x->matrix->matrix2d = matrixCreate(batchSize, 2);
 
@@ -193,7 +202,89 @@ void trainXOR(void) {
     node_t **exitPoints = malloc(sizeof(node_t*));
     exitPoints[0] = y;
 
-    graph_t *network = graphInit("xor", n, entryPoints, 1, exitPoints);
+    return graphInit("xor", n, entryPoints, 1, exitPoints);
+}
+
+//POST: An XOR network with nLayers hidden layers, deep enough for checkpointing to matter
+graph_t *deepXorNetwork(int batchSize, int nLayers) {
+    node_t *x = nodeInit("x", 0, 1, true);
+    x->content.data->internalNode = false;
+    
+    x->matrix->matrix2d = matrixCreate(batchSize, 2);
+
+    node_t **entryPoints = NULL;
+    int n = 0;
+
+    push(&entryPoints, &n, x);
+
+    node_t *layer = x;
+    for (int i = 0; i < nLayers; i++) {
+        layer = denseLayer(layer, 4, SIGMOID, &entryPoints, &n);
+    }
+    layer = denseLayer(layer, 1, SIGMOID, &entryPoints, &n);
+    node_t *y = nodeInit("y", 1, 0, true);
+
+    layer->outputs[0] = y;
+    y->inputs[0] = layer;
+    y->content.data->internalNode = false;
+
+    node_t **exitPoints = malloc(sizeof(node_t*));
+    exitPoints[0] = y;
+
+    return graphInit("xor", n, entryPoints, 1, exitPoints);
+}
+
+//POST: Trains the same deep XOR network with and without checkpointing, they should reach the same loss
+void compareCheckpointingXOR(void) {
+    const int seed = 42;
+    const int batchSize = 4;
+    const int nLayers = 16;
+    const int epochs = 1000;
+    matrix2d_t **inputs;
+    matrix2d_t **targets = xor(&inputs);
+    graph_t *graph;
+
+    srand(seed);
+    graph = deepXorNetwork(batchSize, nLayers);
+    train(graph, inputs, targets, 1, epochs, MSE, batchSize, SGD);
+    printf("Loss without checkpointing: %.10e\n", evaluate(graph, inputs, targets, MSE, batchSize));
+
+    srand(seed);
+    graph = deepXorNetwork(batchSize, nLayers);
+    trainCheckpointed(graph, inputs, targets, 1, epochs, MSE, batchSize, SGD, 0);
+    printf("Loss with checkpointing:    %.10e\n", evaluate(graph, inputs, targets, MSE, batchSize));
+}
+
+//POST: Trains the same deep XOR network at full precision and holding activations in bf16 and fp16
+void compareMixedPrecisionXOR(void) {
+    const int seed = 42;
+    const int batchSize = 4;
+    const int nLayers = 16;
+    const int epochs = 1000;
+    matrix2d_t **inputs;
+    matrix2d_t **targets = xor(&inputs);
+    graph_t *graph;
+
+    srand(seed);
+    graph = deepXorNetwork(batchSize, nLayers);
+    train(graph, inputs, targets, 1, epochs, MSE, batchSize, SGD);
+    printf("Loss at full precision: %.10e\n", evaluate(graph, inputs, targets, MSE, batchSize));
+
+    srand(seed);
+    graph = deepXorNetwork(batchSize, nLayers);
+    trainMixedPrecision(graph, inputs, targets, 1, epochs, MSE, batchSize, SGD, BF16);
+    printf("Loss in bf16:           %.10e\n", evaluate(graph, inputs, targets, MSE, batchSize));
+
+    srand(seed);
+    graph = deepXorNetwork(batchSize, nLayers);
+    trainMixedPrecision(graph, inputs, targets, 1, epochs, MSE, batchSize, SGD, FP16);
+    printf("Loss in fp16:           %.10e\n", evaluate(graph, inputs, targets, MSE, batchSize));
+}
+
+void trainXOR(void) {
+    //Create xor net
+    int batchSize = 4;
+    graph_t *network = xorNetwork(batchSize);
     writeGraph(network);
 
     matrix2d_t **inputs;
@@ -209,6 +300,340 @@ void trainXOR(void) {
 
 }
 
+static double secondsSince(struct timespec *start) {
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return (end.tv_sec - start->tv_sec) + (end.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+//POST: Prints the loss reached and updates per second by train and by trainAsync with
+//      increasing numbers of threads, all starting from the same weights
+void compareAsync(graph_t *(*network)(int batchSize), matrix2d_t **inputs, matrix2d_t **targets,
+                  double lRate, int updates, enum errorFunction func, int batchSize) {
+    const int seed = 42;
+    const int nThreadCounts = 4;
+    const int threadCounts[] = {1, 2, 4, 8};
+    struct timespec start;
+    double seconds;
+    graph_t *graph;
+
+    srand(seed);
+    graph = network(batchSize);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    train(graph, inputs, targets, lRate, updates, func, batchSize, SGD);
+    seconds = secondsSince(&start);
+    printf("%-12s %8s %10s %12s %10s\n", "mode", "threads", "seconds", "updates/s", "loss");
+    printf("%-12s %8d %10.3lf %12.1lf %10.2e\n", "synchronous", 1, seconds,
+           updates / seconds, evaluate(graph, inputs, targets, func, batchSize));
+
+    for (int i = 0; i < nThreadCounts; i++) {
+        srand(seed);
+        graph = network(batchSize);
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        trainAsync(graph, inputs, targets, lRate, updates, func, batchSize, SGD, threadCounts[i]);
+        seconds = secondsSince(&start);
+        printf("%-12s %8d %10.3lf %12.1lf %10.2e\n", "hogwild", threadCounts[i], seconds,
+               updates / seconds, evaluate(graph, inputs, targets, func, batchSize));
+    }
+}
+
+void compareAsyncXOR(void) {
+    matrix2d_t **inputs;
+    matrix2d_t **targets = xor(&inputs);
+    compareAsync(xorNetwork, inputs, targets, 1, 10000, MSE, 4);
+}
+
+//POST: Copies of the XOR dataset stacked nCopies times, so each of nCopies workers gets a full batch
+matrix2d_t **xorReplicated(matrix2d_t ***inputs, int nCopies) {
+    matrix2d_t **xorInputs;
+    matrix2d_t **xorTargets = xor(&xorInputs);
+    *inputs = malloc(sizeof(matrix2d_t*));
+    matrix2d_t **targets = malloc(sizeof(matrix2d_t*));
+    (*inputs)[0] = matrixCreate(4 * nCopies, 2);
+    targets[0] = matrixCreate(4 * nCopies, 1);
+
+    for (int i = 0; i < 4 * nCopies; i++) {
+        for (int j = 0; j < 2; j++) {
+            matrixSet((*inputs)[0], i, j, matrixGet(xorInputs[0], i % 4, j));
+        }
+        matrixSet(targets[0], i, 0, matrixGet(xorTargets[0], i % 4, 0));
+    }
+
+    matrixFree(xorInputs[0]);
+    matrixFree(xorTargets[0]);
+    free(xorInputs);
+    free(xorTargets);
+    return targets;
+}
+
+//POST: Prints the loss reached and updates per second by trainDistributed with 1, 2, 4 and 8 worker processes
+//      Each worker trains on its own copy of XOR, so every step all-reduces gradients over the ring
+void compareDistributedXOR(void) {
+    const int seed = 42;
+    const int nWorkerCounts = 4;
+    const int workerCounts[] = {1, 2, 4, 8};
+    const int batchSize = 4;
+    const int updates = 10000;
+    struct timespec start;
+    double seconds;
+    graph_t *graph;
+    matrix2d_t **inputs, **targets;
+    bool succeeded;
+
+    printf("%-12s %8s %10s %12s %10s\n", "mode", "workers", "seconds", "updates/s", "loss");
+    for (int i = 0; i < nWorkerCounts; i++) {
+        srand(seed);
+        targets = xorReplicated(&inputs, workerCounts[i]);
+        graph = xorNetwork(batchSize);
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        succeeded = trainDistributed(graph, inputs, targets, 1, updates, MSE, batchSize, SGD, workerCounts[i]);
+        seconds = secondsSince(&start);
+        if (!succeeded) continue;
+        //Every copy is the same so evaluating on the first is enough
+        inputs[0]->nRows = targets[0]->nRows = batchSize;
+        printf("%-12s %8d %10.3lf %12.1lf %10.2e\n", "distributed", workerCounts[i], seconds,
+               updates / seconds, evaluate(graph, inputs, targets, MSE, batchSize));
+    }
+}
+
+static node_t **sequenceInputs(int timeSteps, int batchSize, int nFeatures, int nOutputs) {
+    node_t **inputs = malloc(sizeof(node_t*) * timeSteps);
+    for (int t = 0; t < timeSteps; t++) {
+        inputs[t] = nodeInit("x", 0, nOutputs, true);
+        inputs[t]->content.data->internalNode = false;
+        inputs[t]->matrix->matrix2d = matrixCreate(batchSize, nFeatures);
+        matrixRandomise(inputs[t]->matrix->matrix2d);
+        inputs[t]->content.data->data->matrix2d = inputs[t]->matrix->matrix2d;
+    }
+    return inputs;
+}
+
+//POST: Seconds per forward pass of graph, whose exit point takes batchSize x nNeurons targets
+static double timeForward(graph_t *graph, int batchSize, int nNeurons, int repeats) {
+    node_t *y = graph->exitPoints[0]->isData ? graph->exitPoints[0] : graph->exitPoints[0]->outputs[0];
+    y->content.data->data->matrix2d = matrixCreate(batchSize, nNeurons);
+    int length;
+    node_t **nodes = schedule(graph, &length);
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < repeats; i++) execute(nodes, length, FORWARD);
+    return secondsSince(&start) / repeats;
+}
+
+//POST: Prints the forward time of an unrolled LSTM built from separate gate nodes and from fused cells,
+//      then of the fused cells with and without the input projections hoisted out of the recurrence
+void compareFusedLSTM(void) {
+    const int timeSteps = 64, batchSize = 32, nFeatures = 32, nNeurons = 64, repeats = 5;
+    double unfused = timeForward(LSTM(sequenceInputs(timeSteps, batchSize, nFeatures, N_GATES), timeSteps, SIGMOID, nNeurons),
+                                 batchSize, nNeurons, repeats);
+    double fused = timeForward(fusedLSTM(sequenceInputs(timeSteps, batchSize, nFeatures, 1), timeSteps, SIGMOID, nNeurons),
+                               batchSize, nNeurons, repeats);
+
+    //The same fused cells, with x . W done per step or hoisted into one GEMM over the sequence
+    //Per step GEMMs are worst at small batches, as when serving one sequence at a time
+    const int smallBatch = 1;
+    lstmParams_t *params = lstmParamsCreate(nFeatures, nNeurons, SIGMOID);
+    matrix2d_t *xs[timeSteps], *state, *next, *projection;
+    for (int t = 0; t < timeSteps; t++) {
+        xs[t] = matrixCreate(smallBatch, nFeatures);
+        matrixRandomise(xs[t]);
+    }
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < repeats; i++) {
+        state = matrixCreate(smallBatch, 2 * nNeurons);
+        for (int t = 0; t < timeSteps; t++) {
+            next = lstmCellForward(params, xs[t], state, NULL);
+            matrixFree(state);
+            state = next;
+        }
+        matrixFree(state);
+    }
+    double perStep = secondsSince(&start) / repeats;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < repeats; i++) {
+        state = matrixCreate(smallBatch, 2 * nNeurons);
+        projection = lstmProjectInputs(params, xs, timeSteps);
+        for (int t = 0; t < timeSteps; t++) {
+            next = lstmStepForward(params, projection, t * smallBatch, state, NULL);
+            matrixFree(state);
+            state = next;
+        }
+        matrixFree(projection);
+        matrixFree(state);
+    }
+    double hoisted = secondsSince(&start) / repeats;
+    for (int t = 0; t < timeSteps; t++) matrixFree(xs[t]);
+    lstmParamsFree(params);
+
+    printf("%-10s %12s\n", "LSTM", "seconds");
+    printf("%-10s %12.4lf\n", "unfused", unfused);
+    printf("%-10s %12.4lf\n", "fused", fused);
+    printf("Speedup: %.2lfx\n", unfused / fused);
+    printf("With a batch of %d:\n", smallBatch);
+    printf("%-10s %12.4lf\n", "per step", perStep);
+    printf("%-10s %12.4lf\n", "hoisted", hoisted);
+    printf("Speedup from hoisting x . W: %.2lfx\n", perStep / hoisted);
+}
+
+//POST: Prints the forward time of a 4 layer, 256 step stacked LSTM run serially and by wavefront
+void compareWavefrontLSTM(void) {
+    const int timeSteps = 256, nLayers = 4, batchSize = 8, nFeatures = 32, nNeurons = 32, repeats = 3;
+    int nThreads = get_nprocs();
+    graph_t *graph = stackedLSTM(sequenceInputs(timeSteps, batchSize, nFeatures, 1), timeSteps, nLayers, SIGMOID, nNeurons);
+    graph->exitPoints[0]->content.data->data->matrix2d = matrixCreate(batchSize, nNeurons);
+    int length;
+    node_t **nodes = schedule(graph, &length);
+    wavefront_t *plan = scheduleWavefront(nodes, length);
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < repeats; i++) execute(nodes, length, FORWARD);
+    double serial = secondsSince(&start) / repeats;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < repeats; i++) executeWavefront(plan, nThreads);
+    double wavefront = secondsSince(&start) / repeats;
+
+    //With unlimited cores each level of cells costs one cell
+    int nCells = 0, nCellLevels = 0, levelCells;
+    for (int l = 0; l < plan->nLevels; l++) {
+        levelCells = 0;
+        for (int i = 0; i < plan->levelLengths[l]; i++) {
+            node_t *node = plan->levels[l][i];
+            levelCells += !node->isData && LSTM_CELL == node->content.operation.funcName;
+        }
+        nCells += levelCells;
+        nCellLevels += levelCells > 0;
+    }
+
+    printf("%d layers, %d steps, %d threads\n", nLayers, timeSteps, nThreads);
+    printf("%-10s %12s\n", "LSTM", "seconds");
+    printf("%-10s %12.4lf\n", "serial", serial);
+    printf("%-10s %12.4lf\n", "wavefront", wavefront);
+    printf("Speedup: %.2lfx, at most %.2lfx with %d cells in %d levels\n",
+           serial / wavefront, (double) nCells / nCellLevels, nCells, nCellLevels);
+    wavefrontFree(plan);
+}
+
+//POST: Prints the events per second of streams stepped one at a time and batched by a session
+void compareStreamingLSTM(void) {
+    const int nStreams = 2000, nTicks = 10, nFeatures = 32, nNeurons = 64;
+    lstmParams_t *params = lstmParamsCreate(nFeatures, nNeurons, SIGMOID);
+    matrix2d_t *x = matrixCreate(1, nFeatures);
+    matrixRandomise(x);
+
+    //One cell per event, each stream keeping its own state
+    matrix2d_t **states = malloc(sizeof(matrix2d_t*) * nStreams), *next;
+    for (int s = 0; s < nStreams; s++) states[s] = matrixCreate(1, 2 * nNeurons);
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int t = 0; t < nTicks; t++) {
+        for (int s = 0; s < nStreams; s++) {
+            next = lstmCellForward(params, x, states[s], NULL);
+            matrixFree(states[s]);
+            states[s] = next;
+        }
+    }
+    double single = secondsSince(&start);
+    for (int s = 0; s < nStreams; s++) matrixFree(states[s]);
+    free(states);
+
+    lstmSession_t *session = lstmSessionCreate(params, nFeatures, nStreams);
+    for (int s = 0; s < nStreams; s++) lstmSessionOpen(session);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int t = 0; t < nTicks; t++) {
+        for (int s = 0; s < nStreams; s++) lstmSessionPush(session, s, x->data[0]);
+        lstmSessionTick(session);
+    }
+    double batched = secondsSince(&start);
+
+    printf("%d streams, one event each per tick\n", nStreams);
+    printf("%-10s %14s %14s\n", "LSTM", "events/s", "ms per tick");
+    printf("%-10s %14.0lf %14.3lf\n", "single", nStreams * nTicks / single, 1000 * single / nTicks);
+    printf("%-10s %14.0lf %14.3lf\n", "batched", nStreams * nTicks / batched, 1000 * batched / nTicks);
+    printf("Speedup: %.2lfx\n", single / batched);
+
+    lstmSessionFree(session);
+    lstmParamsFree(params);
+    matrixFree(x);
+}
+
+//POST: Trains an LSTM to continue a 20000 step sine wave with truncated BPTT, printing the loss per epoch
+void trainLongSineLSTM(void) {
+    const int length = 20000, batchSize = 4, nNeurons = 16, k1 = 10, k2 = 20, epochs = 5;
+    matrix2d_t **inputs = malloc(sizeof(matrix2d_t*) * length);
+    matrix2d_t **targets = malloc(sizeof(matrix2d_t*) * length);
+    for (int t = 0; t < length; t++) {
+        inputs[t] = matrixCreate(batchSize, 1);
+        targets[t] = matrixCreate(batchSize, 1);
+        for (int r = 0; r < batchSize; r++) {
+            inputs[t]->data[r][0] = sin(0.05 * t + r);
+            targets[t]->data[r][0] = sin(0.05 * (t + 1) + r);
+        }
+    }
+    lstmParams_t *params = lstmParamsCreate(1, nNeurons, SIGMOID);
+    matrix2d_t *readout = matrixCreate(nNeurons, 1);
+    matrixRandomise(readout);
+
+    printf("%d steps, k1 = %d, k2 = %d\n", length, k1, k2);
+    for (int e = 0; e < epochs; e++) {
+        printf("Epoch %d loss: %lf\n", e, trainTruncatedBPTT(params, readout, inputs, targets, length, k1, k2, 0.05,
+                                                                  BPTT_MAX_GRADIENT_NORM, 1));
+    }
+
+    for (int t = 0; t < length; t++) {
+        matrixFree(inputs[t]);
+        matrixFree(targets[t]);
+    }
+    free(inputs);
+    free(targets);
+    matrixFree(readout);
+    lstmParamsFree(params);
+}
+
+//POST: Prints the forward time of variable length sequences padded to the longest and bucketed
+void compareBucketedLSTM(void) {
+    const int nSequences = 256, maxLength = 256, batchSize = 32, nFeatures = 16, nNeurons = 32;
+    int bucketLengths[] = {32, 64, 128, 256};
+    matrix2d_t **sequences = malloc(sizeof(matrix2d_t*) * nSequences);
+    matrix2d_t **outputs = malloc(sizeof(matrix2d_t*) * nSequences);
+    for (int i = 0; i < nSequences; i++) {
+        sequences[i] = matrixCreate(8 + rand() % (maxLength - 7), nFeatures);
+        matrixRandomise(sequences[i]);
+    }
+    //Every sequence is the longest one's length once padded
+    matrixFree(sequences[0]);
+    sequences[0] = matrixCreate(maxLength, nFeatures);
+
+    //Padded, every batch is a full maxLength graph
+    double padded = nSequences / batchSize *
+                    timeForward(fusedLSTM(sequenceInputs(maxLength, batchSize, nFeatures, 1), maxLength, SIGMOID, nNeurons),
+                                batchSize, nNeurons, 1);
+
+    lstmParams_t *params = lstmParamsCreate(nFeatures, nNeurons, SIGMOID);
+    bucketedLSTM_t *model = bucketedLSTMCreate(params, nFeatures, bucketLengths, 4);
+    //The first pass also builds the graphs
+    bucketedLSTMForward(model, sequences, nSequences, batchSize, outputs);
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    bucketedLSTMForward(model, sequences, nSequences, batchSize, outputs);
+    double bucketed = secondsSince(&start);
+
+    printf("%-10s %12s %12s\n", "LSTM", "seconds", "cell rows");
+    printf("%-10s %12.4lf %12ld\n", "padded", padded, model->nRowsPadded);
+    printf("%-10s %12.4lf %12ld\n", "bucketed", bucketed, model->nRowsComputed);
+    printf("Speedup: %.2lfx\n", padded / bucketed);
+
+    for (int i = 0; i < nSequences; i++) {
+        matrixFree(sequences[i]);
+        matrixFree(outputs[i]);
+    }
+    free(sequences);
+    free(outputs);
+    bucketedLSTMFree(model);
+    lstmParamsFree(params);
+}
+
 void trainMNIST() {
     node_t *x = nodeInit("x", 0, 1, true);
     x->content.data->internalNode = false;
@@ -235,13 +660,11 @@ void trainMNIST() {
 
     // Max Pooling Layer
     matrix3d_t *toMaxPool = layer1->matrix->matrix3d;
-    matrix2d_t **maxPoolGradients = calloc(toMaxPool->nRows, sizeof(matrix2d_t*));
-
     for (int i = 0; i < toMaxPool->nRows; i++) {
         matrix2d_t *tmp = matrixCreate(toMaxPool->nCols, toMaxPool->nDepth);
         tmp->data = toMaxPool->data[i];
 
-        matrix2d_t* maxPooledTmp = matrixMaxPooling(tmp, maxPoolGradients[i], 1, 2);
+        matrix2d_t* maxPooledTmp = matrixMaxPooling(tmp, NULL, 1, 2);
         toMaxPool->data[i] = maxPooledTmp->data;
     }
 
@@ -278,25 +701,11 @@ void trainMNIST() {
     train(network, inputs, targets, 0.1, 100, CSL, 100, SGD);
 }
 
-void trainMNISTSimple() {
+graph_t *mnistSimpleNetwork(int batchSize) {
     node_t *x = nodeInit("x", 0, 1, true);
     x->content.data->internalNode = false;
-
-    int nInstances = 60000;
-
-    int batchSize = 1;
     x->matrix->matrix2d = matrixCreate(batchSize, 784);
 
-    // Loading training data
-    csvDataPack_t trainingData = readCSV("data/mnist_train.csv", nInstances);
-    matrix2d_t** inputs = calloc(1, sizeof(matrix2d_t*));
-    inputs[0] = matrixCreate(nInstances, 784);
-    matrix2d_t** matrixData = trainingData.matrixInputs;
-    for (int i = 0; i < nInstances; i++) {
-        inputs[0]->data[i] = flatten2d(matrixData[i]);
-    }
-
-
     node_t **entryPoints = NULL;
     int n = 0;
 
@@ -314,7 +723,19 @@ void trainMNISTSimple() {
 
     node_t **exitPoints = malloc(sizeof(node_t*));
     exitPoints[0] = y;
-    graph_t *network = graphInit("mnist", n, entryPoints, 1, exitPoints);
+    return graphInit("mnist", n, entryPoints, 1, exitPoints);
+}
+
+//POST: Returns the targets and sets inputs to the flattened MNIST training images
+matrix2d_t **mnistSimpleData(matrix2d_t ***inputs, int nInstances) {
+    // Loading training data
+    csvDataPack_t trainingData = readCSV("data/mnist_train.csv", nInstances);
+    *inputs = calloc(1, sizeof(matrix2d_t*));
+    (*inputs)[0] = matrixCreate(nInstances, 784);
+    matrix2d_t** matrixData = trainingData.matrixInputs;
+    for (int i = 0; i < nInstances; i++) {
+        (*inputs)[0]->data[i] = flatten2d(matrixData[i]);
+    }
 
     // Convert labels into CFlow format
     matrix2d_t *labelMTTransposed = matrixCreate(1, nInstances);
@@ -322,12 +743,173 @@ void trainMNISTSimple() {
 
     matrix2d_t **targets = calloc(1, sizeof(matrix2d_t*));
     targets[0] = matrixTranspose(labelMTTransposed);
+    return targets;
+}
+
+//POST: Seconds per FORWARD over nodes, run by kernel or interpreted if it's NULL
+static double timeSchedule(node_t **nodes, int length, jitKernel_t *kernel, int repeats) {
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < repeats; i++) {
+        if (kernel) {
+            jitExecute(kernel);
+        } else {
+            execute(nodes, length, FORWARD);
+        }
+    }
+    return secondsSince(&start) / repeats;
+}
+
+//POST: Prints the forward time of the XOR and MNIST MLPs, interpreted and JIT compiled
+void compareJIT(void) {
+    graph_t *(*networks[])(int batchSize) = {xorNetwork, mnistSimpleNetwork};
+    const char *names[] = {"XOR", "MNIST"};
+    const int batchSizes[] = {4, 64}, nOutputs[] = {1, 10}, repeats = 200;
+
+    printf("%-10s %12s %12s %9s\n", "MLP", "interpreted", "JIT", "speedup");
+    graph_t *graph;
+    node_t *x, **nodes;
+    int length;
+    jitKernel_t *kernel;
+    double interpreted, compiled;
+    for (int n = 0; n < 2; n++) {
+        graph = networks[n](batchSizes[n]);
+        x = graph->entryPoints[0];
+        x->content.data->data->matrix2d = matrixCreate(batchSizes[n], x->matrix->matrix2d->nCols);
+        matrixRandomise(x->content.data->data->matrix2d);
+        graph->exitPoints[0]->content.data->data->matrix2d = matrixCreate(batchSizes[n], nOutputs[n]);
+        nodes = schedule(graph, &length);
+        optimiseSchedule(graph, nodes, &length, false);
+        //The kernel is compiled for the shapes of the last FORWARD
+        execute(nodes, length, FORWARD);
+        kernel = jitCompile(nodes, length);
+        if (!kernel) {
+            printf("Couldn't compile %s\n", names[n]);
+            continue;
+        }
+        interpreted = timeSchedule(nodes, length, NULL, repeats);
+        compiled = timeSchedule(nodes, length, kernel, repeats);
+        printf("%-10s %12.3e %12.3e %8.2lfx\n", names[n], interpreted, compiled, interpreted / compiled);
+        jitFree(kernel);
+        free(nodes);
+    }
+}
+
+//POST: Prints the time and weight memory of a layer's product with dense weights, and with them pruned
+//      element by element and in 4 x 4 blocks to a few sparsities
+void compareSparse(void) {
+    const double sparsities[] = {0.5, 0.9, 0.95};
+    const int blockSizes[] = {1, 4}, nRows = 64, nShared = 1024, nCols = 1024, repeats = 5;
+    struct timespec start;
+    matrix2d_t *x = matrixCreate(nRows, nShared), *weights = matrixCreate(nShared, nCols), *pruned, *output;
+    matrixRandomise(x);
+    matrixRandomise(weights);
+    sparse_t *sparse;
+    double dense, seconds;
+    long bytes;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int r = 0; r < repeats; r++) matrixFree(matrixDotProduct(x, weights));
+    dense = secondsSince(&start) / repeats;
+    printf("%-8s %6s %12s %9s %12s\n", "sparsity", "block", "seconds", "speedup", "weight bytes");
+    printf("%-8s %6s %12.3e %8.2lfx %12ld\n", "dense", "-", dense, 1.0, (long) sizeof(real_t) * nShared * nCols);
+    for (int s = 0; s < sizeof(sparsities) / sizeof(double); s++) {
+        for (int b = 0; b < sizeof(blockSizes) / sizeof(int); b++) {
+            pruned = matrixClone(weights);
+            pruneMatrix(pruned, sparsities[s], blockSizes[b]);
+            sparse = sparseFromMatrix(pruned, blockSizes[b]);
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            for (int r = 0; r < repeats; r++) {
+                output = denseSparseProduct(x, sparse);
+                matrixFree(output);
+            }
+            seconds = secondsSince(&start) / repeats;
+            bytes = (long) sparse->nBlocks * (sizeof(int) + sizeof(real_t) * blockSizes[b] * blockSizes[b])
+                    + sizeof(int) * (nShared / blockSizes[b] + 1);
+            printf("%-8.2lf %6d %12.3e %8.2lfx %12ld\n", sparsities[s], blockSizes[b], seconds, dense / seconds, bytes);
+            sparseFree(sparse);
+            matrixFree(pruned);
+        }
+    }
+    matrixFree(x);
+    matrixFree(weights);
+}
+
+//POST: A 512 neuron dense layer on a batch of 64, whose weights are close to rank 32
+static graph_t *nearlyLowRankLayer(void) {
+    node_t **entryPoints = NULL;
+    int n = 0;
+    node_t *x = nodeInit("x", 0, 1, true);
+    x->content.data->internalNode = false;
+    x->content.data->data->matrix2d = matrixCreate(64, 512);
+    for (int i = 0; i < 64; i++) {
+        for (int j = 0; j < 512; j++) x->content.data->data->matrix2d->data[i][j] = randFloat() - randFloat();
+    }
+    x->matrix->matrix2d = x->content.data->data->matrix2d;
+    push(&entryPoints, &n, x);
+    node_t *layer = denseLayer(x, 512, TANH, &entryPoints, &n);
+    node_t *y = nodeInit("y", 1, 0, true);
+    y->content.data->internalNode = false;
+    y->content.data->data->matrix2d = matrixCreate(64, 512);
+    linkNodes(layer, y);
+
+    //Differences of randFloats, as its mean alone would be most of any product of them
+    matrix2d_t *left = matrixCreate(512, 32), *right = matrixCreate(32, 512);
+    for (int i = 0; i < 512; i++) {
+        for (int k = 0; k < 32; k++) {
+            left->data[i][k] = randFloat() - randFloat();
+            right->data[k][i] = randFloat() - randFloat();
+        }
+    }
+    matrix2d_t *weights = entryPoints[1]->content.data->data->matrix2d, *lowRank = matrixDotProduct(left, right);
+    for (int i = 0; i < 512; i++) {
+        for (int j = 0; j < 512; j++) weights->data[i][j] = lowRank->data[i][j] / 8 + (randFloat() - randFloat()) / 100;
+    }
+    matrixFree(left);
+    matrixFree(right);
+    matrixFree(lowRank);
+    node_t **exitPoints = malloc(sizeof(node_t*));
+    exitPoints[0] = y;
+    return graphInit("lowRank", n, entryPoints, 1, exitPoints);
+}
+
+//POST: Prints the rank, speedup and error factoriseDense gets for a nearly low rank layer,
+//      keeping 99% of its energy and within a quarter of its FLOPs
+void compareLowRank(void) {
+    const enum rankSelection selections[] = {ENERGY, FLOP_BUDGET};
+    const double targets[] = {0.99, 0.25};
+    graph_t *graph;
+    node_t **nodes;
+    int length;
+    for (int t = 0; t < 2; t++) {
+        graph = nearlyLowRankLayer();
+        nodes = schedule(graph, &length);
+        //So the layer's input is held to time the factors on
+        execute(nodes, length, FORWARD);
+        factoriseDense(graph, nodes, length, selections[t], targets[t], true);
+        free(nodes);
+    }
+}
+
+void trainMNISTSimple() {
+    int nInstances = 60000;
+    int batchSize = 1;
+
+    matrix2d_t **inputs;
+    matrix2d_t **targets = mnistSimpleData(&inputs, nInstances);
+    graph_t *network = mnistSimpleNetwork(batchSize);
 
     // Don't know if batch size of 100 is right
     train(network, inputs, targets, 0.1, 5, CSL, batchSize, SGD);
     
 }
 
+void compareAsyncMNISTSimple(void) {
+    matrix2d_t **inputs;
+    matrix2d_t **targets = mnistSimpleData(&inputs, 60000);
+    compareAsync(mnistSimpleNetwork, inputs, targets, 0.01, 1000, MSE, 1);
+}
+
 int main(void) {
 
     /*graph_t *graphOne = genGraphOne();
@@ -356,13 +938,23 @@ int main(void) {
     inputs[3]->matrix = matrixCreate(4, 6);
     graph_t *lstm = LSTM(inputs, 4, SIGMOID, 5);
     writeGraph(lstm);
-
-    lstm = LSTM(inputs, 2, SIGMOID, 5);
-    writeGraph(compile(lstm, "lstmDiff"));
     free(inputs);*/
 
     trainXOR();
+    //compareAsyncXOR();
+    //compareDistributedXOR();
+    //compareCheckpointingXOR();
+    //compareMixedPrecisionXOR();
+    //compareFusedLSTM();
+    //compareWavefrontLSTM();
+    //compareStreamingLSTM();
+    //trainLongSineLSTM();
+    //compareBucketedLSTM();
+    //compareJIT();
+    //compareSparse();
+    //compareLowRank();
     //trainMNISTSimple();
+    //compareAsyncMNISTSimple();
     //trainMNIST();
     return EXIT_SUCCESS;
 }
\ No newline at end of file
@@ -6,6 +6,7 @@
 #include <string.h>
 
 #include "../data.h"
+#include "../fusion.h"
 #include "../matrix.h"
 #include "../testUtils.h"
 #include "../util.h"
@@ -76,10 +77,51 @@ int get(hashtable_t* table, char* key) {
     return currTable->val;
 }
 
+//POST: Where node's i-th output reads it, counting repeats so x * x links both inputs
+static int inputIndex(node_t *node, int i) {
+    node_t *output = node->outputs[i];
+    int repeats = 0;
+    for (int j = 0; j < i; j++) repeats += node->outputs[j] == output;
+    for (int j = 0; j < output->n; j++) {
+        if (output->inputs[j] == node && !repeats--) return j;
+    }
+    return 0;
+}
+
+//POST: kernel is appended to encoded as nInputs savedPerElement nOps, then each op's
+//      function, activation and registers
+static void encodeKernel(char *encoded, fusedKernel_t *kernel) {
+    int length = strlen(encoded);
+    length += snprintf(encoded + length, MAX_LINE_LENGTH - length, " %d %d %d",
+                       kernel->nInputs, kernel->savedPerElement, kernel->nOps);
+    for (int i = 0; i < kernel->nOps && length < MAX_LINE_LENGTH; i++) {
+        length += snprintf(encoded + length, MAX_LINE_LENGTH - length, " %d %d %d %d", kernel->ops[i].funcName,
+                           kernel->ops[i].activationName, kernel->ops[i].a, kernel->ops[i].b);
+    }
+    if (length >= MAX_LINE_LENGTH) {
+        printf("Fused kernel too long to write\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+//PRE: tokens are what encodeKernel appended
+static fusedKernel_t *decodeKernel(char **tokens) {
+    fusedKernel_t *kernel = malloc(sizeof(fusedKernel_t));
+    kernel->nInputs = atoi(tokens[0]);
+    kernel->savedPerElement = atoi(tokens[1]);
+    kernel->nOps = atoi(tokens[2]);
+    kernel->ops = malloc(sizeof(fusedOp_t) * kernel->nOps);
+    for (int i = 0; i < kernel->nOps; i++) {
+        kernel->ops[i] = (fusedOp_t) {.funcName = atoi(tokens[3 + 4 * i]), .activationName = atoi(tokens[4 + 4 * i]),
+                                      .a = atoi(tokens[5 + 4 * i]), .b = atoi(tokens[6 + 4 * i])};
+    }
+    return kernel;
+}
+
 //PRE: Takes in node and a string representing the filename that data_t is stored in
 //POST: Returns a string-encoded node
 char* encodeNode(node_t* node, FILE* fp, char*** linkLines, int* linksCreated) {
-    //FORMAT: NODE NODE_NAME isData(1/0) DATA_FILENAME/OP_NAME N M
+    //FORMAT: NODE NODE_NAME isData(1/0) DATA_FILENAME/OP_NAME N M [ACTIVATION_FUNCTION | FUSED_KERNEL]
     char* contentName;
 
     if (node->isData) {
@@ -91,13 +133,19 @@ char* encodeNode(node_t* node, FILE* fp, char*** linkLines, int* linksCreated) {
 
     for (int i = 0; i < node->m; i++) {
         char* linkLine = calloc(MAX_LINE_LENGTH, sizeof(char));
-        sprintf(linkLine, "LINK %s %s\n", node->name, node->outputs[i]->name);
+        //Operands like a QUANTIZED_DOT's aren't interchangeable, so each link keeps its place
+        sprintf(linkLine, "LINK %s %s %d\n", node->name, node->outputs[i]->name, inputIndex(node, i));
         // printf("%s", linkLine);
         append(linkLines, linksCreated, linkLine);
     }
 
     char* encoded = calloc(MAX_LINE_LENGTH, sizeof(char));
     sprintf(encoded, "%s %s %d %s %d %d", "NODE", node->name, node->isData, contentName, node->n, node->m);
+    if (!node->isData && ACTIVATION == node->content.operation.funcName) {
+        sprintf(encoded + strlen(encoded), " %d", node->content.operation.activationName);
+    } else if (!node->isData && FUSED == node->content.operation.funcName) {
+        encodeKernel(encoded, node->content.operation.kernel);
+    }
     encoded = realloc(encoded, strlen(encoded) + 1);
     return encoded;
 }
@@ -108,7 +156,7 @@ char** encodeGraph(graph_t* graph, char*** linkSection, int* nNodeLines, int* nL
 
     //dataFilename: GRAPHNAME_DATA\0
     //Each graph stores the data field of all nodes in 1 file
-    char* dataFilename = calloc(strlen(graph->name + 1) + 6, sizeof(char));
+    char* dataFilename = calloc(strlen(graph->name) + 6, sizeof(char));
     sprintf(dataFilename, "%s_data", graph->name);
     FILE* dataFile = fopen(dataFilename, "a");
     append(&lines, &nLines, dataFilename);
@@ -194,7 +242,7 @@ graph_t* graphFileRead(char* filename) {
     data_t** dataArr = readData(dataFilename);
 
     node_t** nodeArr = calloc(1, sizeof(node_t*));
-    int nAdded = 0;
+    int nAdded = 0, nData = 0;
 
     hashtable_t* nodeNameToId = calloc(1, sizeof(hashtable_t));
 
@@ -202,10 +250,16 @@ graph_t* graphFileRead(char* filename) {
         char** tokens = tokenize(fgets(buffer, MAX_LINE_LENGTH, fp));
         node_t* tmp = nodeInit(tokens[1], atoi(tokens[4]), atoi(tokens[5]), atoi(tokens[2]));
 
+        //Blocks are written in the same order as the nodes, but only for data nodes
         if (tmp->isData) {
-            tmp->content.data = dataArr[i];
+            tmp->content.data = dataArr[nData++];
         } else {
             tmp->content.operation.funcName = decodeOperation(tokens[3]);
+            if (FUSED == tmp->content.operation.funcName) {
+                tmp->content.operation.kernel = decodeKernel(tokens + 6);
+            } else if (tokens[6]) {
+                tmp->content.operation.activationName = atoi(tokens[6]);
+            }
         }
 
         add(nodeNameToId, tokens[1], nAdded);
@@ -216,7 +270,13 @@ graph_t* graphFileRead(char* filename) {
         char** tokens = tokenize(fgets(buffer, MAX_LINE_LENGTH, fp));
         node_t* input = nodeArr[get(nodeNameToId, tokens[1])];
         node_t* output = nodeArr[get(nodeNameToId, tokens[2])];
-        linkNodes(input, output);
+        if (!tokens[3]) {
+            linkNodes(input, output);
+            continue;
+        }
+        input->outputs[input->outputIdx++] = output;
+        output->inputs[atoi(tokens[3])] = input;
+        output->inputIdx++;
     }
 
     node_t** graphEntryPoints = calloc(nEntryPoints, sizeof(node_t*));
@@ -0,0 +1,328 @@
+#include "../fusion.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../activation.h"
+#include "../matrix.h"
+#include "../nodes.h"
+
+//Elements of a row run through every op before moving on, so the intermediates stay in cache
+#define FUSED_TILE 256
+
+typedef struct nodeIndex {
+    node_t *node;
+    int idx;
+} nodeIndex_t;
+
+static int compareNodeIndex(const void *a, const void *b) {
+    node_t *first = ((nodeIndex_t*) a)->node, *second = ((nodeIndex_t*) b)->node;
+    return (first > second) - (first < second);
+}
+
+//POST: node's index in the schedule sorted is made from, -1 if it isn't in it
+static int indexOf(nodeIndex_t *sorted, int length, node_t *node) {
+    nodeIndex_t key = {.node = node}, *found;
+    if (!node) return -1;
+    found = bsearch(&key, sorted, length, sizeof(nodeIndex_t), compareNodeIndex);
+    return found ? found->idx : -1;
+}
+
+//POST: The elementwise function a fused ACTIVATION applies, NULL if it can't be fused
+static double (*activationOf(enum activationFunction func))(double) {
+    switch (func) {
+        case SIGMOID: return sigmoid;
+        case TANH:    return tanhActive;
+        case RELU:    return relu;
+        case LRELU:   return lRelu;
+        case LINEAR:  return linear;
+        default:      return NULL;
+    }
+}
+
+//POST: Whether node is an operation a fused kernel can run, one element at a time
+static bool isElementwise(node_t *node) {
+    if (node->isData) return false;
+    switch (node->content.operation.funcName) {
+        case ADD:
+        case SUBTRACT:
+        case MULTIPLY:
+            return 2 == node->n && node->inputs[0] && node->inputs[1];
+        case ACTIVATION:
+            return 1 == node->n && node->inputs[0] && activationOf(node->content.operation.activationName);
+        default:
+            return false;
+    }
+}
+
+//POST: Whether every output of node is in the group rooted at root, so nothing else reads it
+static bool feedsOnly(node_t *node, int *group, int root, nodeIndex_t *sorted, int length) {
+    int idx;
+    if (!node->m) return false;
+    for (int i = 0; i < node->m; i++) {
+        idx = indexOf(sorted, length, node->outputs[i]);
+        if (idx < 0 || group[idx] != root) return false;
+    }
+    return true;
+}
+
+//POST: The first of node's outputs which is from is replaced by to
+static void relinkOutput(node_t *node, node_t *from, node_t *to) {
+    for (int i = 0; i < node->m; i++) {
+        if (node->outputs[i] == from) {
+            node->outputs[i] = to;
+            return;
+        }
+    }
+}
+
+//PRE: group[k] == root for the size nodes in the group, which root is the only one read from outside
+//POST: root becomes a FUSED node reading the group's inputs, one input per edge into the group
+static void fuseGroup(node_t **nodes, int length, int *group, int root, nodeIndex_t *sorted) {
+    int *opOf = malloc(sizeof(int) * length);
+    int nOps = 0, nInputs = 0, idx;
+    //Inputs run before the nodes reading them, i.e. from the end of the schedule
+    for (int k = length - 1; k >= root; k--) {
+        if (group[k] != root) continue;
+        opOf[k] = nOps++;
+        for (int s = 0; s < nodes[k]->n; s++) {
+            idx = indexOf(sorted, length, nodes[k]->inputs[s]);
+            nInputs += idx < 0 || group[idx] != root;
+        }
+    }
+
+    fusedKernel_t *kernel = malloc(sizeof(fusedKernel_t));
+    kernel->nInputs = nInputs;
+    kernel->nOps = nOps;
+    kernel->ops = malloc(sizeof(fusedOp_t) * nOps);
+    kernel->savedPerElement = 0;
+    node_t **inputs = malloc(sizeof(node_t*) * nInputs);
+
+    node_t *member, *input;
+    int operands[2], nextInput = 0;
+    for (int k = length - 1; k >= root; k--) {
+        if (group[k] != root) continue;
+        member = nodes[k];
+        for (int s = 0; s < member->n; s++) {
+            input = member->inputs[s];
+            idx = indexOf(sorted, length, input);
+            if (idx >= 0 && group[idx] == root) {
+                operands[s] = nInputs + opOf[idx];
+            } else {
+                operands[s] = nextInput;
+                inputs[nextInput++] = input;
+                relinkOutput(input, member, nodes[root]);
+            }
+        }
+        kernel->ops[opOf[k]] = (fusedOp_t) {.funcName = member->content.operation.funcName,
+                                            .activationName = member->content.operation.activationName,
+                                            .a = operands[0], .b = member->n > 1 ? operands[1] : operands[0]};
+        //It was written once and read by each of its outputs
+        if (k != root) kernel->savedPerElement += 1 + member->m;
+    }
+
+    member = nodes[root];
+    free(member->inputs);
+    member->inputs = inputs;
+    member->n = member->inputIdx = nInputs;
+    member->content.operation = (operation_t) {.funcName = FUSED, .kernel = kernel};
+    free(opOf);
+}
+
+//PRE: nodes is a forward schedule as made by schedule, before any tape or plan is made from it
+//POST: Each maximal group of elementwise operations whose only output leaving the group is one node's
+//      is replaced by that node running a fused kernel; the rest of the group is freed and taken
+//      out of the schedule, whose new length is set
+fusionStats_t fuseElementwise(node_t **nodes, int *length) {
+    fusionStats_t stats = {0, 0};
+    int n = *length;
+    nodeIndex_t *sorted = malloc(sizeof(nodeIndex_t) * n);
+    int *group = malloc(sizeof(int) * n);
+    for (int i = 0; i < n; i++) {
+        sorted[i] = (nodeIndex_t) {.node = nodes[i], .idx = i};
+        group[i] = -1;
+    }
+    qsort(sorted, n, sizeof(nodeIndex_t), compareNodeIndex);
+
+    int size, idx;
+    bool grown;
+    //Readers come before the nodes they read, so each group is found from its root
+    for (int i = 0; i < n; i++) {
+        if (-1 != group[i] || !isElementwise(nodes[i])) continue;
+        group[i] = i;
+        size = 1;
+        do {
+            grown = false;
+            for (int k = i; k < n; k++) {
+                if (group[k] != i) continue;
+                for (int s = 0; s < nodes[k]->n; s++) {
+                    idx = indexOf(sorted, n, nodes[k]->inputs[s]);
+                    if (idx < 0 || -1 != group[idx] || !isElementwise(nodes[idx])
+                        || !feedsOnly(nodes[idx], group, i, sorted, n)) continue;
+                    group[idx] = i;
+                    size++;
+                    grown = true;
+                }
+            }
+        } while (grown);
+        if (size < 2) continue;
+        fuseGroup(nodes, n, group, i, sorted);
+        stats.nKernels++;
+        stats.nRemoved += size - 1;
+    }
+
+    int kept = 0;
+    for (int i = 0; i < n; i++) {
+        if (-1 == group[i] || i == group[i]) {
+            nodes[kept++] = nodes[i];
+            continue;
+        }
+        //Its activation may be shared with a clone, so only the node itself goes
+        free(nodes[i]->inputs);
+        free(nodes[i]->outputs);
+        free(nodes[i]->matrix);
+        free(nodes[i]);
+    }
+    *length = kept;
+    free(sorted);
+    free(group);
+    return stats;
+}
+
+//POST: out = op applied to a and b, over width elements
+static void runOp(fusedOp_t *op, real_t *a, real_t *b, real_t *out, int width) {
+    double (*func)(double);
+    switch (op->funcName) {
+        case ADD:
+            for (int x = 0; x < width; x++) out[x] = a[x] + b[x];
+            break;
+        case SUBTRACT:
+            for (int x = 0; x < width; x++) out[x] = a[x] - b[x];
+            break;
+        case MULTIPLY:
+            for (int x = 0; x < width; x++) out[x] = a[x] * b[x];
+            break;
+        default:
+            func = activationOf(op->activationName);
+            for (int x = 0; x < width; x++) out[x] = func(a[x]);
+            break;
+    }
+}
+
+static void checkShapes(fusedKernel_t *kernel, matrix2d_t **inputs) {
+    for (int r = 1; r < kernel->nInputs; r++) {
+        if (inputs[r]->nRows != inputs[0]->nRows || inputs[r]->nCols != inputs[0]->nCols) {
+            printf("Fused elementwise inputs have different shapes\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+//PRE: inputs are the FUSED node's kernel->nInputs inputs, all the same shape
+//POST: The kernel's output, made with one pass over the inputs
+matrix2d_t *fusedForward(fusedKernel_t *kernel, matrix2d_t **inputs) {
+    checkShapes(kernel, inputs);
+    int nRows = inputs[0]->nRows, nCols = inputs[0]->nCols, width, last = kernel->nOps - 1;
+    matrix2d_t *result = matrixCreate(nRows, nCols);
+    real_t *scratch = malloc(sizeof(real_t) * FUSED_TILE * kernel->nOps);
+    real_t **registers = malloc(sizeof(real_t*) * (kernel->nInputs + kernel->nOps));
+    fusedOp_t *op;
+    for (int i = 0; i < nRows; i++) {
+        for (int j = 0; j < nCols; j += FUSED_TILE) {
+            width = nCols - j < FUSED_TILE ? nCols - j : FUSED_TILE;
+            for (int r = 0; r < kernel->nInputs; r++) registers[r] = inputs[r]->data[i] + j;
+            for (int t = 0; t < kernel->nOps; t++) {
+                op = &kernel->ops[t];
+                registers[kernel->nInputs + t] = t == last ? result->data[i] + j : scratch + t * FUSED_TILE;
+                runOp(op, registers[op->a], registers[op->b], registers[kernel->nInputs + t], width);
+            }
+        }
+    }
+    free(scratch);
+    free(registers);
+    return result;
+}
+
+//PRE: gradient is dL/d(the kernel's output), inputGradients[r] is input r's gradient or NULL if it has none
+//POST: dL/d(each input) is added to its gradient. The intermediates are recomputed a tile at a time,
+//      then the tile's ops are differentiated in reverse
+void fusedBackward(fusedKernel_t *kernel, matrix2d_t **inputs, matrix2d_t *gradient, matrix2d_t **inputGradients) {
+    checkShapes(kernel, inputs);
+    int nRegisters = kernel->nInputs + kernel->nOps, width, out;
+    real_t *scratch = malloc(sizeof(real_t) * FUSED_TILE * kernel->nOps);
+    real_t *adjoints = malloc(sizeof(real_t) * FUSED_TILE * nRegisters);
+    real_t **values = malloc(sizeof(real_t*) * nRegisters);
+    real_t *dOut, *dA, *dB, *a, *b, *y, *into;
+    fusedOp_t *op;
+    for (int i = 0; i < gradient->nRows; i++) {
+        for (int j = 0; j < gradient->nCols; j += FUSED_TILE) {
+            width = gradient->nCols - j < FUSED_TILE ? gradient->nCols - j : FUSED_TILE;
+            for (int r = 0; r < kernel->nInputs; r++) values[r] = inputs[r]->data[i] + j;
+            for (int t = 0; t < kernel->nOps; t++) {
+                op = &kernel->ops[t];
+                values[kernel->nInputs + t] = scratch + t * FUSED_TILE;
+                runOp(op, values[op->a], values[op->b], values[kernel->nInputs + t], width);
+            }
+
+            memset(adjoints, 0, sizeof(real_t) * FUSED_TILE * nRegisters);
+            memcpy(adjoints + (nRegisters - 1) * FUSED_TILE, gradient->data[i] + j, sizeof(real_t) * width);
+            for (int t = kernel->nOps - 1; t >= 0; t--) {
+                op = &kernel->ops[t];
+                out = kernel->nInputs + t;
+                dOut = adjoints + out * FUSED_TILE;
+                dA = adjoints + op->a * FUSED_TILE;
+                dB = adjoints + op->b * FUSED_TILE;
+                a = values[op->a];
+                b = values[op->b];
+                y = values[out];
+                switch (op->funcName) {
+                    case ADD:
+                        for (int x = 0; x < width; x++) dA[x] += dOut[x];
+                        for (int x = 0; x < width; x++) dB[x] += dOut[x];
+                        break;
+                    case SUBTRACT:
+                        for (int x = 0; x < width; x++) dA[x] += dOut[x];
+                        for (int x = 0; x < width; x++) dB[x] -= dOut[x];
+                        break;
+                    case MULTIPLY:
+                        for (int x = 0; x < width; x++) dA[x] += dOut[x] * b[x];
+                        for (int x = 0; x < width; x++) dB[x] += dOut[x] * a[x];
+                        break;
+                    default:
+                        for (int x = 0; x < width; x++) dA[x] += dOut[x] * activationPrime(op->activationName, y[x]);
+                        break;
+                }
+            }
+
+            for (int r = 0; r < kernel->nInputs; r++) {
+                if (!inputGradients[r]) continue;
+                into = inputGradients[r]->data[i] + j;
+                for (int x = 0; x < width; x++) into[x] += adjoints[r * FUSED_TILE + x];
+            }
+        }
+    }
+    free(scratch);
+    free(adjoints);
+    free(values);
+}
+
+//PRE: FORWARD has run on nodes
+//POST: Bytes of memory traffic a forward step avoids thanks to its fused kernels
+long fusedTrafficSaved(node_t **nodes, int length) {
+    long saved = 0;
+    matrix2d_t *output;
+    for (int i = 0; i < length; i++) {
+        if (nodes[i]->isData || FUSED != nodes[i]->content.operation.funcName) continue;
+        if (!(output = nodes[i]->matrix->matrix2d)) continue;
+        saved += (long) nodes[i]->content.operation.kernel->savedPerElement
+               * output->nRows * output->nCols * sizeof(real_t);
+    }
+    return saved;
+}
+
+void fusedKernelFree(fusedKernel_t *kernel) {
+    free(kernel->ops);
+    free(kernel);
+}
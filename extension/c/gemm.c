@@ -0,0 +1,320 @@
+#include "../gemm.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../matrix.h"
+#include "../nodes.h"
+#include "../passes.h"
+#include "../util.h"
+
+//Every config adds each out[i][j]'s products in order of k, so they all give the same bits
+//and only the time taken decides between them
+
+#define DEFAULT_COL_BLOCK 64
+//Each timing runs at least this many multiply-adds, the best of TUNING_TRIALS is kept
+#define TIMED_MACS (1 << 20)
+#define TUNING_TRIALS 3
+//Smaller products aren't worth starting threads for
+#define PARALLEL_MACS (1 << 16)
+#define MAX_THREADS 8
+
+typedef struct tuning {
+    int nRows, nShared, nCols;
+    gemmConfig_t config;
+} tuning_t;
+
+static tuning_t *table = NULL;
+static int nTuned = 0;
+static pthread_once_t loaded = PTHREAD_ONCE_INIT;
+
+typedef struct gemmTask {
+    gemmConfig_t config;
+    real_t **a, **b, **out;
+    int rowFrom, rowTo, nShared, nCols;
+} gemmTask_t;
+
+//POST: out += a . b over rows [rowFrom, rowTo)
+//      Blocks of GEMM_ROWS rows share each load of b, and each colBlock x sharedBlock
+//      tile of b stays in cache while every row block passes over it
+static void gemmRows(gemmTask_t *task) {
+    real_t **a = task->a, **b = task->b, **out = task->out;
+    int colBlock = task->config.colBlock, sharedBlock = task->config.sharedBlock ? task->config.sharedBlock : task->nShared;
+    real_t a0, a1, a2, a3, bkj, *bk, *o0, *o1, *o2, *o3;
+    int i, j, jEnd, kEnd;
+    for (int jStart = 0; jStart < task->nCols; jStart += colBlock) {
+        jEnd = jStart + colBlock < task->nCols ? jStart + colBlock : task->nCols;
+        for (int kStart = 0; kStart < task->nShared; kStart += sharedBlock) {
+            kEnd = kStart + sharedBlock < task->nShared ? kStart + sharedBlock : task->nShared;
+            for (i = task->rowFrom; i + GEMM_ROWS <= task->rowTo; i += GEMM_ROWS) {
+                o0 = out[i], o1 = out[i + 1], o2 = out[i + 2], o3 = out[i + 3];
+                for (int k = kStart; k < kEnd; k++) {
+                    a0 = a[i][k], a1 = a[i + 1][k], a2 = a[i + 2][k], a3 = a[i + 3][k];
+                    //Sparse inputs, i.e. images, are mostly zeros
+                    if (!(a0 || a1 || a2 || a3)) continue;
+                    bk = b[k];
+                    for (j = jStart; j < jEnd; j++) {
+                        bkj = bk[j];
+                        o0[j] += a0 * bkj;
+                        o1[j] += a1 * bkj;
+                        o2[j] += a2 * bkj;
+                        o3[j] += a3 * bkj;
+                    }
+                }
+            }
+            for (; i < task->rowTo; i++) {
+                o0 = out[i];
+                for (int k = kStart; k < kEnd; k++) {
+                    if (!(a0 = a[i][k])) continue;
+                    bk = b[k];
+                    for (j = jStart; j < jEnd; j++) o0[j] += a0 * bk[j];
+                }
+            }
+        }
+    }
+}
+
+static void *gemmWorker(void *arg) {
+    gemmRows(arg);
+    return NULL;
+}
+
+//POST: out += a . b, where a is nRows x nShared and b is nShared x nCols, blocked and split as config says
+void gemmWith(gemmConfig_t config, real_t **a, real_t **b, real_t **out, int nRows, int nShared, int nCols) {
+    int nBlocks = (nRows + GEMM_ROWS - 1) / GEMM_ROWS;
+    int nThreads = config.nThreads < nBlocks ? config.nThreads : nBlocks;
+    if (nThreads <= 1) {
+        gemmRows(&(gemmTask_t) {config, a, b, out, 0, nRows, nShared, nCols});
+        return;
+    }
+    gemmTask_t *tasks = malloc(sizeof(gemmTask_t) * nThreads);
+    pthread_t *threads = malloc(sizeof(pthread_t) * nThreads);
+    int rowTo;
+    for (int t = 0; t < nThreads; t++) {
+        rowTo = nBlocks * (t + 1) / nThreads * GEMM_ROWS;
+        tasks[t] = (gemmTask_t) {config, a, b, out, nBlocks * t / nThreads * GEMM_ROWS,
+                                 rowTo < nRows ? rowTo : nRows, nShared, nCols};
+    }
+    //The calling thread takes the first share itself
+    for (int t = 1; t < nThreads; t++) {
+        if (pthread_create(&threads[t], NULL, gemmWorker, &tasks[t])) {
+            perror("Couldn't start GEMM thread");
+            exit(EXIT_FAILURE);
+        }
+    }
+    gemmRows(&tasks[0]);
+    for (int t = 1; t < nThreads; t++) pthread_join(threads[t], NULL);
+    free(tasks);
+    free(threads);
+}
+
+static void addTuning(int nRows, int nShared, int nCols, gemmConfig_t config) {
+    table = realloc(table, sizeof(tuning_t) * (nTuned + 1));
+    table[nTuned++] = (tuning_t) {nRows, nShared, nCols, config};
+}
+
+//POST: The tunings in path replace those held, which are left empty if it can't be read
+static void readTuning(char *path) {
+    free(table);
+    table = NULL;
+    nTuned = 0;
+    FILE *file = fopen(path, "r");
+    if (!file) return;
+    char line[256];
+    int nRows, nShared, nCols, colBlock, sharedBlock, nThreads;
+    while (fgets(line, sizeof(line), file)) {
+        if ('#' == line[0]) continue;
+        if (6 == sscanf(line, "%d %d %d %d %d %d", &nRows, &nShared, &nCols, &colBlock, &sharedBlock, &nThreads)
+            && colBlock > 0 && sharedBlock >= 0 && nThreads > 0) {
+            addTuning(nRows, nShared, nCols, (gemmConfig_t) {colBlock, sharedBlock, nThreads});
+        }
+    }
+    fclose(file);
+}
+
+static void loadDefaultTuning(void) {
+    char path[512];
+    if (cacheFile(path, sizeof(path), GEMM_TUNING_FILE)) readTuning(path);
+}
+
+static tuning_t *findTuning(int nRows, int nShared, int nCols) {
+    pthread_once(&loaded, loadDefaultTuning);
+    for (int i = 0; i < nTuned; i++) {
+        if (table[i].nRows == nRows && table[i].nShared == nShared && table[i].nCols == nCols) return &table[i];
+    }
+    return NULL;
+}
+
+//POST: The config tuneGemm found fastest for the shape, the untuned default if it hasn't timed it
+gemmConfig_t gemmTuning(int nRows, int nShared, int nCols) {
+    tuning_t *tuning = findTuning(nRows, nShared, nCols);
+    return tuning ? tuning->config : (gemmConfig_t) {DEFAULT_COL_BLOCK, 0, 1};
+}
+
+//POST: out += a . b, where a is nRows x nShared and b is nShared x nCols, as tuned for the shape
+void gemm(real_t **a, real_t **b, real_t **out, int nRows, int nShared, int nCols) {
+    gemmWith(gemmTuning(nRows, nShared, nCols), a, b, out, nRows, nShared, nCols);
+}
+
+//POST: Seconds per product with config, the best of TUNING_TRIALS
+static double timeConfig(gemmConfig_t config, matrix2d_t *a, matrix2d_t *b, matrix2d_t *out, int reps) {
+    struct timespec start, end;
+    double seconds, best = -1;
+    for (int trial = 0; trial < TUNING_TRIALS; trial++) {
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (int r = 0; r < reps; r++) gemmWith(config, a->data, b->data, out->data, a->nRows, a->nCols, b->nCols);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+        if (best < 0 || seconds < best) best = seconds;
+    }
+    return best / reps;
+}
+
+//POST: Every column and shared block size and thread count that makes sense for the shape has been timed,
+//      and the fastest is returned and kept for gemm
+gemmConfig_t tuneGemmShape(int nRows, int nShared, int nCols) {
+    static const int colBlocks[] = {16, 32, 64, 128, 256, 512}, sharedBlocks[] = {0, 64, 256}, threads[] = {1, 2, 4, 8};
+    long macs = (long) nRows * nShared * nCols;
+    int reps = 1 + TIMED_MACS / (macs ? macs : 1);
+    int maxThreads = macs < PARALLEL_MACS ? 1 : sysconf(_SC_NPROCESSORS_ONLN);
+    if (maxThreads > MAX_THREADS) maxThreads = MAX_THREADS;
+
+    matrix2d_t *a = matrixCreate(nRows, nShared), *b = matrixCreate(nShared, nCols), *out = matrixCreate(nRows, nCols);
+    matrixRandomise(a);
+    matrixRandomise(b);
+    gemmConfig_t config, best = {DEFAULT_COL_BLOCK, 0, 1};
+    double seconds, bestSeconds = timeConfig(best, a, b, out, reps);
+    for (int c = 0; c < sizeof(colBlocks) / sizeof(int); c++) {
+        //Blocks past the width are all the same
+        if (c > 0 && colBlocks[c - 1] >= nCols) break;
+        for (int s = 0; s < sizeof(sharedBlocks) / sizeof(int); s++) {
+            if (sharedBlocks[s] >= nShared) break;
+            for (int t = 0; t < sizeof(threads) / sizeof(int) && threads[t] <= maxThreads; t++) {
+                config = (gemmConfig_t) {colBlocks[c], sharedBlocks[s], threads[t]};
+                if ((seconds = timeConfig(config, a, b, out, reps)) < bestSeconds) {
+                    best = config;
+                    bestSeconds = seconds;
+                }
+            }
+        }
+    }
+    matrixFree(a);
+    matrixFree(b);
+    matrixFree(out);
+
+    tuning_t *tuning = findTuning(nRows, nShared, nCols);
+    if (tuning) tuning->config = best;
+    else addTuning(nRows, nShared, nCols, best);
+    return best;
+}
+
+//Most GEMMs one operation runs, i.e. an LSTM cell's x . W and h . U
+#define MAX_NODE_PRODUCTS 2
+
+typedef struct product {
+    int nRows, nShared, nCols;
+} product_t;
+
+//PRE: in holds the shapes of node's inputs and out its own, as scheduleShapes infers them
+//POST: The shapes of the GEMMs node runs, which are put in products, and how many there are
+static int nodeProducts(node_t *node, shape_t *in, shape_t out, product_t products[MAX_NODE_PRODUCTS]) {
+    shape_t swap;
+    matrix2d_t *config;
+    switch (node->content.operation.funcName) {
+        case DOT:
+            //matrixDotProduct swaps operands which only fit the other way round
+            if (in[0].nCols != in[1].nRows) {
+                swap = in[0];
+                in[0] = in[1];
+                in[1] = swap;
+            }
+            products[0] = (product_t) {in[0].nRows, in[0].nCols, in[1].nCols};
+            return 1;
+        case CONVOLUTION:
+        case DECONVOLUTION:
+            //im2col multiplies the kernel's taps by a column of patches for every output
+            if (IM2COL_CONVOLUTION != node->content.operation.algorithm) return 0;
+            products[0] = (product_t) {1, in[1].nRows * in[1].nCols, out.nRows * out.nCols};
+            return 1;
+        case LSTM_CELL:
+            products[0] = (product_t) {in[0].nRows, in[2].nRows, in[2].nCols};
+            products[1] = (product_t) {in[0].nRows, in[3].nRows, in[3].nCols};
+            return 2;
+        case LSTM_PROJECTION:
+            products[0] = (product_t) {out.nRows, in[node->n - 2].nRows, in[node->n - 2].nCols};
+            return 1;
+        case LSTM_STEP:
+            //Only the running rows are multiplied by U
+            config = node->inputs[3]->isData ? node->inputs[3]->content.data->data->matrix2d : NULL;
+            products[0] = (product_t) {config ? matrixGet(config, 0, 1) : in[1].nRows, in[2].nRows, in[2].nCols};
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+//PRE: nodes is a forward schedule as made by schedule, whose convolutions have their algorithms chosen
+//POST: Every GEMM in nodes whose shape hasn't been tuned yet is tuned, i.e. products, im2col convolutions
+//      and LSTM projections, and if there were any the tuning file is rewritten; the number of shapes
+//      tuned is returned
+int tuneGemm(node_t **nodes, int length) {
+    shape_t *shapes = scheduleShapes(nodes, length), *in;
+    nodeIndex_t *sorted = indexNodes(nodes, length);
+    product_t products[MAX_NODE_PRODUCTS], product;
+    int idx, nProducts, nNew = 0;
+    for (int i = 0; i < length; i++) {
+        if (nodes[i]->isData) continue;
+        in = malloc(sizeof(shape_t) * (nodes[i]->n + 1));
+        for (int j = 0; j < nodes[i]->n; j++) {
+            idx = indexOf(sorted, length, nodes[i]->inputs[j]);
+            in[j] = idx < 0 ? (shape_t) {0, 0} : shapes[idx];
+        }
+        nProducts = nodeProducts(nodes[i], in, shapes[i], products);
+        free(in);
+        for (int p = 0; p < nProducts; p++) {
+            product = products[p];
+            //Shapes not known before running are 0
+            if (!product.nRows || !product.nShared || !product.nCols
+                || findTuning(product.nRows, product.nShared, product.nCols)) continue;
+            tuneGemmShape(product.nRows, product.nShared, product.nCols);
+            nNew++;
+        }
+    }
+    if (nNew && cacheWrites()) saveGemmTuning(NULL);
+    free(shapes);
+    free(sorted);
+    return nNew;
+}
+
+//POST: The tunings in path, or GEMM_TUNING_FILE if NULL, replace those held, i.e. those tuned on another machine
+void loadGemmTuning(char *path) {
+    pthread_once(&loaded, loadDefaultTuning);
+    if (path) {
+        readTuning(path);
+    } else {
+        loadDefaultTuning();
+    }
+}
+
+//POST: The tunings held are written to path, or GEMM_TUNING_FILE if NULL
+void saveGemmTuning(char *path) {
+    char defaultPath[512], writing[512];
+    if (!path) {
+        if (!cacheFile(defaultPath, sizeof(defaultPath), GEMM_TUNING_FILE)) return;
+        path = defaultPath;
+    }
+    FILE *file = startReplacing(path, writing, sizeof(writing));
+    if (!file) {
+        perror("Couldn't write GEMM tuning");
+        return;
+    }
+    fprintf(file, "# M K N colBlock sharedBlock nThreads\n");
+    for (int i = 0; i < nTuned; i++) {
+        fprintf(file, "%d %d %d %d %d %d\n", table[i].nRows, table[i].nShared, table[i].nCols,
+                table[i].config.colBlock, table[i].config.sharedBlock, table[i].config.nThreads);
+    }
+    if (!finishReplacing(file, writing, path)) perror("Couldn't write GEMM tuning");
+}
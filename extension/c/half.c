@@ -0,0 +1,147 @@
+#include "../half.h"
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../matrix.h"
+#include "../nodes.h"
+#include "../passes.h"
+
+//The conversions go through float, and compute every case before picking one rather than branching,
+//so the loops over whole rows can be vectorised
+
+static inline uint32_t bitsOf(float value) {
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+static inline float floatOf(uint32_t bits) {
+    float value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+//POST: value rounded to the nearest bf16, ties to even; NaNs stay NaNs
+static inline half_t bf16FromFloat(float value) {
+    uint32_t bits = bitsOf(value);
+    uint32_t rounded = (bits + 0x7fff + ((bits >> 16) & 1)) >> 16;
+    return (bits & 0x7fffffff) > 0x7f800000 ? (bits >> 16) | 0x40 : rounded;
+}
+
+static inline float bf16ToFloat(half_t half) {
+    return floatOf((uint32_t) half << 16);
+}
+
+//POST: value rounded to the nearest fp16, ties to even; anything from 65520 up is infinite
+static inline half_t fp16FromFloat(float value) {
+    uint32_t bits = bitsOf(value), sign = bits & 0x80000000u, magnitude = bits ^ sign;
+    uint32_t special = magnitude > 0x7f800000u ? 0x7e00 : 0x7c00;
+    //Adding 0.5 shifts a subnormal's mantissa down to where the FPU rounds it
+    uint32_t subnormal = bitsOf(floatOf(magnitude) + 0.5f) - bitsOf(0.5f);
+    uint32_t normal = (magnitude + ((15u - 127u) << 23) + 0xfff + ((magnitude >> 13) & 1)) >> 13;
+    uint32_t half = magnitude >= 0x47800000u ? special : magnitude < 0x38800000u ? subnormal : normal;
+    return half | sign >> 16;
+}
+
+static inline float fp16ToFloat(half_t half) {
+    uint32_t bits = (uint32_t) (half & 0x7fff) << 13, exponent = bits & (0x7c00u << 13);
+    bits += (127u - 15u) << 23;
+    //Infinities and NaNs take the exponent the rest of the way up
+    uint32_t special = bits + ((128u - 16u) << 23);
+    //The FPU renormalises subnormals
+    uint32_t subnormal = bitsOf(floatOf(bits + (1u << 23)) - floatOf(113u << 23));
+    bits = exponent == (0x7c00u << 13) ? special : exponent ? bits : subnormal;
+    return floatOf(bits | (uint32_t) (half & 0x8000) << 16);
+}
+
+//POST: out holds in's n values in format, and the number which became infinite or NaN is returned
+int halfFromReals(enum halfFormat format, const real_t *in, half_t *out, int n) {
+    int nOverflows = 0;
+    if (BF16 == format) {
+        for (int i = 0; i < n; i++) {
+            out[i] = bf16FromFloat(in[i]);
+            nOverflows += (out[i] & 0x7fff) >= 0x7f80;
+        }
+    } else {
+        for (int i = 0; i < n; i++) {
+            out[i] = fp16FromFloat(in[i]);
+            nOverflows += (out[i] & 0x7fff) >= 0x7c00;
+        }
+    }
+    return nOverflows;
+}
+
+void halfToReals(enum halfFormat format, const half_t *in, real_t *out, int n) {
+    if (BF16 == format) {
+        for (int i = 0; i < n; i++) out[i] = bf16ToFloat(in[i]);
+    } else {
+        for (int i = 0; i < n; i++) out[i] = fp16ToFloat(in[i]);
+    }
+}
+
+//POST: Every element of matrix is rounded to the nearest value format holds,
+//      and the number which became infinite or NaN is returned
+int matrixRoundToHalf(enum halfFormat format, matrix2d_t *matrix) {
+    half_t *row = malloc(sizeof(half_t) * (matrix->nCols + 1));
+    int nOverflows = 0;
+    for (int i = 0; i < matrix->nRows; i++) {
+        nOverflows += halfFromReals(format, matrix->data[i], row, matrix->nCols);
+        halfToReals(format, row, matrix->data[i], matrix->nCols);
+    }
+    free(row);
+    return nOverflows;
+}
+
+//POST: Whether node's activation can be packed between passes; exit points are read by train after FORWARD
+static bool isStashable(node_t *node) {
+    if (node->isData || !node->m) return false;
+    for (int i = 0; i < node->m; i++) {
+        if (node->outputs[i] && node->outputs[i]->isData) return false;
+    }
+    return true;
+}
+
+//PRE: nodes is a schedule of length nodes as returned by schedule
+//POST: Every stashable activation is packed once the last node reading it in FORWARD has run
+mixedPrecision_t *scheduleMixedPrecision(node_t **nodes, int length, enum halfFormat format) {
+    mixedPrecision_t *plan = calloc(1, sizeof(mixedPrecision_t));
+    plan->format = format;
+    plan->nodes = nodes;
+    plan->length = length;
+    plan->sorted = indexNodes(nodes, length);
+    plan->stashed = calloc(length, sizeof(half_t*));
+    plan->shapes = calloc(length, sizeof(shape_t));
+    plan->drops = calloc(length, sizeof(int*));
+    plan->nDrops = calloc(length, sizeof(int));
+
+    //Nodes run from the end of the schedule so an activation's last reader has the smallest index
+    int *lastUse = malloc(sizeof(int) * length), input;
+    for (int i = 0; i < length; i++) lastUse[i] = -1;
+    for (int i = length - 1; i >= 0; i--) {
+        for (int j = 0; j < nodes[i]->n; j++) {
+            if ((input = indexOf(plan->sorted, length, nodes[i]->inputs[j])) >= 0) lastUse[input] = i;
+        }
+    }
+    for (int i = 0; i < length; i++) {
+        if (!isStashable(nodes[i]) || lastUse[i] < 0) continue;
+        plan->drops[lastUse[i]] = realloc(plan->drops[lastUse[i]], sizeof(int) * (plan->nDrops[lastUse[i]] + 1));
+        plan->drops[lastUse[i]][plan->nDrops[lastUse[i]]++] = i;
+    }
+    free(lastUse);
+    return plan;
+}
+
+void mixedPrecisionFree(mixedPrecision_t *plan) {
+    for (int i = 0; i < plan->length; i++) {
+        free(plan->drops[i]);
+        free(plan->stashed[i]);
+    }
+    free(plan->drops);
+    free(plan->nDrops);
+    free(plan->stashed);
+    free(plan->shapes);
+    free(plan->sorted);
+    free(plan);
+}
@@ -0,0 +1,370 @@
+#include "../jit.h"
+
+#include <dlfcn.h>
+#include <errno.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "../activation.h"
+#include "../fusion.h"
+#include "../matrix.h"
+#include "../nodes.h"
+#include "../util.h"
+
+//The activations as the generated code defines them, matching activation.c
+static const char *prelude =
+    "static inline double relu(double x) { return x > 0 ? x : 0; }\n"
+    "static inline double lRelu(double x) { return ALPHA * x > x ? ALPHA * x : x; }\n"
+    "static inline double linear(double x) { return x; }\n"
+    "static inline double sigmoid(double x) { return 1 / (1 + exp(-x)); }\n"
+    "static inline double tanhActive(double x) { return tanh(x); }\n\n";
+
+//What the generated code is emitting, and the buffers it reads and writes
+typedef struct emitter {
+    FILE *out;
+    node_t *node;
+    int self;
+    int *in; //The buffer of each of node's inputs
+    int depth; //How far in lines are indented
+} emitter_t;
+
+//POST: A line of generated code at e's depth
+static void line(emitter_t *e, const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    fprintf(e->out, "%*s", 4 * e->depth, "");
+    vfprintf(e->out, format, args);
+    fputc('\n', e->out);
+    va_end(args);
+}
+
+//POST: node's buffer, -1 if it isn't in the schedule
+static int bufferOf(node_t **nodes, int length, node_t *node) {
+    for (int k = 0; k < length; k++) {
+        if (nodes[k] == node) return k;
+    }
+    return -1;
+}
+
+//POST: The matrix whose shape node's buffer has, NULL if it doesn't have one yet
+static matrix2d_t *shapeOf(node_t *node) {
+    return node->isData ? node->content.data->data->matrix2d : node->matrix->matrix2d;
+}
+
+static bool sameShape(matrix2d_t *a, matrix2d_t *b) {
+    return a->nRows == b->nRows && a->nCols == b->nCols;
+}
+
+//POST: The generated function for func, NULL if it can't be compiled
+static const char *activationOf(enum activationFunction func) {
+    switch (func) {
+        case SIGMOID: return "sigmoid";
+        case TANH:    return "tanhActive";
+        case RELU:    return "relu";
+        case LRELU:   return "lRelu";
+        case LINEAR:  return "linear";
+        default:      return NULL;
+    }
+}
+
+static char symbolOf(enum matrixFunction func) {
+    switch (func) {
+        case ADD:      return '+';
+        case SUBTRACT: return '-';
+        default:       return '*';
+    }
+}
+
+//POST: The statements computing element (row, col) of the node's activation
+static void emitElement(emitter_t *e, const char *row, const char *col) {
+    operation_t *op = &e->node->content.operation;
+    if (FUSED == op->funcName) {
+        //Each register is a local, so the whole chain stays in the CPU's registers
+        fusedKernel_t *kernel = op->kernel;
+        fusedOp_t *fused;
+        line(e, "{");
+        e->depth++;
+        for (int r = 0; r < kernel->nInputs; r++) line(e, "real_t r%d = b[%d][%s][%s];", r, e->in[r], row, col);
+        for (int t = 0; t < kernel->nOps; t++) {
+            fused = &kernel->ops[t];
+            if (ACTIVATION == fused->funcName) {
+                line(e, "real_t r%d = %s(r%d);", kernel->nInputs + t, activationOf(fused->activationName), fused->a);
+            } else {
+                line(e, "real_t r%d = r%d %c r%d;", kernel->nInputs + t, fused->a, symbolOf(fused->funcName), fused->b);
+            }
+        }
+        line(e, "b[%d][%s][%s] = r%d;", e->self, row, col, kernel->nInputs + kernel->nOps - 1);
+        e->depth--;
+        line(e, "}");
+        return;
+    }
+
+    fprintf(e->out, "%*sb[%d][%s][%s] = ", 4 * e->depth, "", e->self, row, col);
+    switch (op->funcName) {
+        case ADD:
+        case SUBTRACT:
+        case MULTIPLY:
+            fprintf(e->out, "b[%d][%s][%s] %c b[%d][%s][%s];\n", e->in[0], row, col, symbolOf(op->funcName),
+                    e->in[1], row, col);
+            break;
+        case ACTIVATION:
+            fprintf(e->out, "%s(b[%d][%s][%s]);\n", activationOf(op->activationName), e->in[0], row, col);
+            break;
+        case TRANSPOSE:
+            fprintf(e->out, "b[%d][%s][%s];\n", e->in[0], col, row);
+            break;
+        default:
+            //DOT, when the inner dimension is short enough to unroll
+            for (int k = 0; k < shapeOf(e->node->inputs[0])->nCols; k++) {
+                fprintf(e->out, "%sb[%d][%s][%d] * b[%d][%d][%s]", k ? " + " : "", e->in[0], row, k, e->in[1], k, col);
+            }
+            fprintf(e->out, ";\n");
+            break;
+    }
+}
+
+//POST: node's statements for every element of its nRows x nCols activation, in loops over
+//      dimensions longer than JIT_UNROLL and unrolled over the rest
+static void emitOver(emitter_t *e, int nRows, int nCols) {
+    char row[12] = "i", col[12] = "j";
+    bool loopRows = nRows > JIT_UNROLL, loopCols = nCols > JIT_UNROLL;
+    if (loopRows) line(e, "for (int i = 0; i < %d; i++) {", nRows);
+    e->depth += loopRows;
+    for (int r = 0; r < (loopRows ? 1 : nRows); r++) {
+        if (!loopRows) snprintf(row, sizeof(row), "%d", r);
+        if (loopCols) line(e, "for (int j = 0; j < %d; j++) {", nCols);
+        e->depth += loopCols;
+        for (int c = 0; c < (loopCols ? 1 : nCols); c++) {
+            if (!loopCols) snprintf(col, sizeof(col), "%d", c);
+            emitElement(e, row, col);
+        }
+        e->depth -= loopCols;
+        if (loopCols) line(e, "}");
+    }
+    e->depth -= loopRows;
+    if (loopRows) line(e, "}");
+}
+
+//POST: A product with a long inner dimension, as rows of the output accumulating rows of the right
+//      hand side, so the innermost loop is contiguous and can be vectorised
+static void emitDot(emitter_t *e, int nRows, int nCols, int inner) {
+    line(e, "for (int i = 0; i < %d; i++) {", nRows);
+    line(e, "    real_t *restrict out = b[%d][i];", e->self);
+    line(e, "    for (int j = 0; j < %d; j++) out[j] = 0;", nCols);
+    line(e, "    for (int k = 0; k < %d; k++) {", inner);
+    line(e, "        const real_t a = b[%d][i][k], *restrict w = b[%d][k];", e->in[0], e->in[1]);
+    line(e, "        for (int j = 0; j < %d; j++) out[j] += a * w[j];", nCols);
+    line(e, "    }");
+    line(e, "}");
+}
+
+//PRE: FORWARD has run on nodes, so every operation's activation has its shape
+//POST: Whether node k could be compiled, in which case its code has been written to out
+static bool emitNode(FILE *out, node_t **nodes, int length, int k) {
+    node_t *node = nodes[k];
+    operation_t *op = &node->content.operation;
+    matrix2d_t *shape = shapeOf(node);
+    if (!shape) return false;
+
+    int in[node->n + 1];
+    for (int j = 0; j < node->n; j++) {
+        in[j] = node->inputs[j] ? bufferOf(nodes, length, node->inputs[j]) : -1;
+        if (in[j] < 0 || !shapeOf(node->inputs[j])) return false;
+    }
+    emitter_t e = {.out = out, .node = node, .self = k, .in = in, .depth = 1};
+
+    matrix2d_t *a = node->n ? shapeOf(node->inputs[0]) : NULL, *b = node->n > 1 ? shapeOf(node->inputs[1]) : NULL;
+    switch (op->funcName) {
+        case ADD:
+        case SUBTRACT:
+        case MULTIPLY:
+            if (2 != node->n || !sameShape(a, shape) || !sameShape(b, shape)) return false;
+            break;
+        case ACTIVATION:
+            if (1 != node->n || !activationOf(op->activationName) || !sameShape(a, shape)) return false;
+            break;
+        case TRANSPOSE:
+            if (1 != node->n || a->nRows != shape->nCols || a->nCols != shape->nRows) return false;
+            break;
+        case FUSED:
+            for (int j = 0; j < node->n; j++) {
+                if (!sameShape(shapeOf(node->inputs[j]), shape)) return false;
+            }
+            break;
+        case DOT:
+            if (2 != node->n || a->nRows != shape->nRows || a->nCols != b->nRows || b->nCols != shape->nCols) return false;
+            line(&e, "//%d: %s", k, encodeOperation(op->funcName));
+            if (a->nCols > JIT_UNROLL) {
+                emitDot(&e, shape->nRows, shape->nCols, a->nCols);
+                return true;
+            }
+            emitOver(&e, shape->nRows, shape->nCols);
+            return true;
+        default:
+            return false;
+    }
+    line(&e, "//%d: %s", k, encodeOperation(op->funcName));
+    emitOver(&e, shape->nRows, shape->nCols);
+    return true;
+}
+
+//POST: The 64 bit FNV-1a hash of source
+static unsigned long hashSource(const char *source) {
+    unsigned long hash = 14695981039346656037UL;
+    for (; *source; source++) {
+        hash ^= (unsigned char) *source;
+        hash *= 1099511628211UL;
+    }
+    return hash;
+}
+
+//POST: Whether the compiler built building from sourcePath
+//      It's run directly rather than through a shell, so nothing in the paths is interpreted
+static bool runCompiler(const char *building, const char *sourcePath) {
+    char flags[] = JIT_COMPILER;
+    char *argv[32];
+    int argc = 0;
+    for (char *word = strtok(flags, " "); word && argc < 27; word = strtok(NULL, " ")) argv[argc++] = word;
+    argv[argc++] = "-o";
+    argv[argc++] = (char*) building;
+    argv[argc++] = (char*) sourcePath;
+    argv[argc++] = "-lm";
+    argv[argc] = NULL;
+    pid_t pid = fork();
+    if (pid < 0) return false;
+    if (!pid) {
+        execvp(argv[0], argv);
+        _exit(127);
+    }
+    int status;
+    while (waitpid(pid, &status, 0) < 0) {
+        if (EINTR != errno) return false;
+    }
+    return WIFEXITED(status) && !WEXITSTATUS(status);
+}
+
+//POST: The shared object built from source, from the cache if it's been built before, NULL if it can't be
+//      Only a cache directory and objects owned by this user, which no one else can write, are used
+static void *loadShared(const char *source, unsigned long hash, bool *cached) {
+    char directory[256], path[512], sourcePath[512], building[512];
+    if (!cacheDirectory(directory, sizeof(directory), JIT_CACHE_NAME)) return NULL;
+    snprintf(path, sizeof(path), "%s/%016lx.so", directory, hash);
+    *cached = isPrivate(path, false);
+    if (!*cached) {
+        snprintf(sourcePath, sizeof(sourcePath), "%s/%016lx.XXXXXX.c", directory, hash);
+        FILE *file = createPrivate(sourcePath, 2);
+        if (!file) {
+            perror("Couldn't write JIT source");
+            return NULL;
+        }
+        fputs(source, file);
+        fclose(file);
+        //Built under a name of its own first, so no other process can load it half written
+        snprintf(building, sizeof(building), "%s/%016lx.XXXXXX.so", directory, hash);
+        int fd = mkstemps(building, 3);
+        bool built = fd >= 0;
+        if (built) {
+            close(fd);
+            built = runCompiler(building, sourcePath) && !rename(building, path);
+            if (!built) unlink(building);
+        }
+        unlink(sourcePath);
+        if (!built) {
+            printf("Couldn't compile JIT kernel %016lx\n", hash);
+            return NULL;
+        }
+    }
+    if (!isPrivate(path, false)) {
+        printf("%s isn't private to this user, so it isn't loaded\n", path);
+        return NULL;
+    }
+    void *handle = dlopen(path, RTLD_NOW);
+    if (!handle) printf("%s\n", dlerror());
+    return handle;
+}
+
+//PRE: nodes is a forward schedule as made by schedule, and FORWARD has run on it with the shapes to compile for
+//POST: A kernel running FORWARD over nodes with every shape and activation built in, or NULL if nodes has
+//      an operation which can't be compiled or the compiler fails
+//      Weights are read from their nodes on every run, so training can carry on between runs
+jitKernel_t *jitCompile(node_t **nodes, int length) {
+    char *source;
+    size_t size;
+    FILE *out = open_memstream(&source, &size);
+    //The flags are part of the hash, so changing them rebuilds everything
+    fprintf(out, "//%s\n#include <math.h>\n\n#define ALPHA %.17g\ntypedef %s real_t;\n\n%s", JIT_COMPILER, ALPHA,
+            sizeof(real_t) == sizeof(float) ? "float" : "double", prelude);
+    fprintf(out, "void cflowForward(real_t **const *b) {\n");
+    bool compilable = true;
+    for (int k = length - 1; k >= 0 && compilable; k--) {
+        compilable = nodes[k]->isData ? NULL != shapeOf(nodes[k]) : emitNode(out, nodes, length, k);
+    }
+    fprintf(out, "}\n");
+    fclose(out);
+
+    jitKernel_t *kernel = NULL;
+    unsigned long hash = hashSource(source);
+    bool cached;
+    void *handle = compilable ? loadShared(source, hash, &cached) : NULL;
+    free(source);
+    if (!handle) return NULL;
+
+    kernel = malloc(sizeof(jitKernel_t));
+    kernel->nodes = nodes;
+    kernel->length = length;
+    kernel->outputs = malloc(sizeof(matrix2d_t*) * length);
+    kernel->nRows = malloc(sizeof(int) * length);
+    kernel->nCols = malloc(sizeof(int) * length);
+    kernel->buffers = malloc(sizeof(real_t**) * length);
+    kernel->handle = handle;
+    kernel->hash = hash;
+    kernel->cached = cached;
+    //dlsym returns an object pointer, which ISO C can't cast to a function pointer
+    *(void**) (&kernel->forward) = dlsym(handle, "cflowForward");
+    for (int k = 0; k < length; k++) {
+        kernel->nRows[k] = shapeOf(nodes[k])->nRows;
+        kernel->nCols[k] = shapeOf(nodes[k])->nCols;
+        kernel->outputs[k] = nodes[k]->isData ? NULL : matrixCreate(kernel->nRows[k], kernel->nCols[k]);
+    }
+    return kernel;
+}
+
+//PRE: Every data node holds a matrix of the shape kernel was compiled for
+//POST: As execute in FORWARD, except each operation's activation is the kernel's, until jitFree
+//      Data nodes are read in place, and their activations are left alone so nothing else owns their data
+void jitExecute(jitKernel_t *kernel) {
+    node_t *node;
+    matrix2d_t *matrix;
+    for (int k = 0; k < kernel->length; k++) {
+        node = kernel->nodes[k];
+        matrix = node->isData ? node->content.data->data->matrix2d : kernel->outputs[k];
+        if (!matrix || matrix->nRows != kernel->nRows[k] || matrix->nCols != kernel->nCols[k]) {
+            printf("JIT kernel was compiled for a %d x %d %s\n", kernel->nRows[k], kernel->nCols[k], node->name);
+            exit(EXIT_FAILURE);
+        }
+        if (!node->isData) node->matrix->matrix2d = matrix;
+        kernel->buffers[k] = matrix->data;
+    }
+    kernel->forward(kernel->buffers);
+}
+
+//POST: kernel's buffers and shared object are released; a NULL kernel, as jitCompile may return, is left alone
+void jitFree(jitKernel_t *kernel) {
+    if (!kernel) return;
+    for (int k = 0; k < kernel->length; k++) {
+        if (!kernel->outputs[k]) continue;
+        if (kernel->nodes[k]->matrix->matrix2d == kernel->outputs[k]) kernel->nodes[k]->matrix->matrix2d = NULL;
+        matrixFree(kernel->outputs[k]);
+    }
+    dlclose(kernel->handle);
+    free(kernel->outputs);
+    free(kernel->nRows);
+    free(kernel->nCols);
+    free(kernel->buffers);
+    free(kernel);
+}
@@ -0,0 +1,235 @@
+#include "../kernels.h"
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "../matrix.h"
+#include "../nodes.h"
+#include "../passes.h"
+#include "../predict.h"
+
+//Each specialised kernel adds up in the same order as the generic one, so both give the same bits
+
+static kernelSpec_t *registry = NULL;
+static int nRegistered = 0;
+static bool builtinsRegistered = false;
+
+static matrix2d_t *inputOf(node_t *node, int idx) {
+    return node->inputs[idx]->matrix->matrix2d;
+}
+
+//PRE: Stride 1, no padding or dilation
+static matrix2d_t *convolution3x3(node_t *node) {
+    matrix2d_t *matrix = inputOf(node, 0), *kernel = inputOf(node, 1), *config = inputOf(node, 2);
+    if (3 != kernel->nRows || 3 != kernel->nCols || matrix->nRows < 3 || matrix->nCols < 3
+        || 1 != matrixGet(config, 0, 0) || 0 != matrixGet(config, 0, 1) || 1 != convolutionDilation(config)) return NULL;
+
+    matrix2d_t *result = matrixCreate(matrix->nRows - 2, matrix->nCols - 2);
+    real_t **k = kernel->data, *top, *middle, *bottom, *out, sum;
+    real_t k00 = k[0][0], k01 = k[0][1], k02 = k[0][2];
+    real_t k10 = k[1][0], k11 = k[1][1], k12 = k[1][2];
+    real_t k20 = k[2][0], k21 = k[2][1], k22 = k[2][2];
+    for (int i = 0; i < result->nRows; i++) {
+        top = matrix->data[i];
+        middle = matrix->data[i + 1];
+        bottom = matrix->data[i + 2];
+        out = result->data[i];
+        for (int j = 0; j < result->nCols; j++) {
+            sum = top[j] * k00;
+            sum += top[j + 1] * k01;
+            sum += top[j + 2] * k02;
+            sum += middle[j] * k10;
+            sum += middle[j + 1] * k11;
+            sum += middle[j + 2] * k12;
+            sum += bottom[j] * k20;
+            sum += bottom[j + 1] * k21;
+            sum += bottom[j + 2] * k22;
+            out[j] = sum;
+        }
+    }
+    return result;
+}
+
+static bool isPooling2x2(node_t *node) {
+    matrix2d_t *config = inputOf(node, 1);
+    return 2 == matrixGet(config, 0, 0) && 2 == matrixGet(config, 0, 1);
+}
+
+//PRE: Stride 2, so the windows don't overlap and are never clipped
+static matrix2d_t *maxPooling2x2(node_t *node) {
+    if (!isPooling2x2(node)) return NULL;
+    matrix2d_t *matrix = inputOf(node, 0);
+    int outRows = matrix->nRows / 2, outCols = matrix->nCols / 2, nCols = matrix->nCols, col;
+    node->poolingArgmax = realloc(node->poolingArgmax, sizeof(int32_t) * (outRows * outCols + 1));
+    matrix2d_t *result = matrixCreate(outRows, outCols);
+    real_t *top, *bottom, *out, best;
+    int32_t *indices;
+    for (int i = 0; i < outRows; i++) {
+        top = matrix->data[2 * i];
+        bottom = matrix->data[2 * i + 1];
+        out = result->data[i];
+        indices = node->poolingArgmax + i * outCols;
+        for (int j = 0; j < outCols; j++) {
+            col = 2 * j;
+            //The first maximum in row-major order, as matrixMaxPooling picks
+            best = top[col];
+            indices[j] = 2 * i * nCols + col;
+            if (top[col + 1] > best) {
+                best = top[col + 1];
+                indices[j] = 2 * i * nCols + col + 1;
+            }
+            if (bottom[col] > best) {
+                best = bottom[col];
+                indices[j] = (2 * i + 1) * nCols + col;
+            }
+            if (bottom[col + 1] > best) {
+                best = bottom[col + 1];
+                indices[j] = (2 * i + 1) * nCols + col + 1;
+            }
+            out[j] = best;
+        }
+    }
+    return result;
+}
+
+static matrix2d_t *averagePooling2x2(node_t *node) {
+    if (!isPooling2x2(node)) return NULL;
+    matrix2d_t *matrix = inputOf(node, 0);
+    matrix2d_t *result = matrixCreate(matrix->nRows / 2, matrix->nCols / 2);
+    real_t *top, *bottom, *out;
+    for (int i = 0; i < result->nRows; i++) {
+        top = matrix->data[2 * i];
+        bottom = matrix->data[2 * i + 1];
+        out = result->data[i];
+        for (int j = 0; j < result->nCols; j++) {
+            out[j] = (top[2 * j] + top[2 * j + 1] + bottom[2 * j] + bottom[2 * j + 1]) * 0.25;
+        }
+    }
+    return result;
+}
+
+//POST: The product of a dense layer's input and its width wide weights, with the width fixed
+static matrix2d_t *denseProduct(node_t *node, int width) {
+    matrix2d_t *a = inputOf(node, 0), *b = inputOf(node, 1);
+    if (width != b->nCols || a->nCols != b->nRows) return NULL;
+    matrix2d_t *result = matrixCreate(a->nRows, width);
+    real_t *out, *weights, value;
+    for (int i = 0; i < a->nRows; i++) {
+        out = result->data[i];
+        for (int k = 0; k < a->nCols; k++) {
+            if (!(value = a->data[i][k])) continue;
+            weights = b->data[k];
+            for (int j = 0; j < width; j++) out[j] += value * weights[j];
+        }
+    }
+    return result;
+}
+
+static matrix2d_t *dense64(node_t *node) {
+    return denseProduct(node, 64);
+}
+
+static matrix2d_t *dense128(node_t *node) {
+    return denseProduct(node, 128);
+}
+
+static void registerBuiltins(void) {
+    registerKernel((kernelSpec_t) {"convolution 3x3", CONVOLUTION, ANY, ANY, 3, 3, {1, 0, 1}, convolution3x3});
+    registerKernel((kernelSpec_t) {"max pooling 2x2", MAX_POOLING, ANY, ANY, ANY, ANY, {2, 2, ANY}, maxPooling2x2});
+    registerKernel((kernelSpec_t) {"average pooling 2x2", AVERAGE_POOLING, ANY, ANY, ANY, ANY, {2, 2, ANY},
+                                   averagePooling2x2});
+    registerKernel((kernelSpec_t) {"dense 64", DOT, ANY, ANY, ANY, 64, {ANY, ANY, ANY}, dense64});
+    registerKernel((kernelSpec_t) {"dense 128", DOT, ANY, ANY, ANY, 128, {ANY, ANY, ANY}, dense128});
+}
+
+//POST: spec can be chosen by prepareKernels; of equally specific kernels, the first registered wins
+void registerKernel(kernelSpec_t spec) {
+    if (!builtinsRegistered) {
+        builtinsRegistered = true;
+        registerBuiltins();
+    }
+    registry = realloc(registry, sizeof(kernelSpec_t) * (nRegistered + 1));
+    registry[nRegistered++] = spec;
+}
+
+//POST: node's attributes from its config, ANY past the ones it has
+static void attributesOf(node_t *node, int *attributes) {
+    for (int a = 0; a < MAX_ATTRIBUTES; a++) attributes[a] = ANY;
+    node_t *configNode;
+    switch (node->content.operation.funcName) {
+        case CONVOLUTION:
+        case DECONVOLUTION:
+            configNode = node->inputs[2];
+            break;
+        case MAX_POOLING:
+        case AVERAGE_POOLING:
+            configNode = node->inputs[1];
+            break;
+        default:
+            return;
+    }
+    matrix2d_t *config = configNode && configNode->isData ? configNode->content.data->data->matrix2d : NULL;
+    if (!config) return;
+    for (int a = 0; a < config->nCols && a < MAX_ATTRIBUTES; a++) attributes[a] = matrixGet(config, 0, a);
+    //Dilation is optional
+    if (CONVOLUTION == node->content.operation.funcName) attributes[2] = convolutionDilation(config);
+}
+
+//POST: Whether value is what spec asks for, adding to how specific spec is if it asks for anything
+static bool matches(int wanted, int value, int *specificity) {
+    if (ANY == wanted) return true;
+    (*specificity)++;
+    return wanted == value;
+}
+
+//PRE: node's inputs are nRows x nCols and kRows x kCols, or ANY if there's no second input
+//POST: The registered kernel matching node that gives the most sizes and attributes, NULL if none match
+kernelSpec_t *chooseKernel(node_t *node, int nRows, int nCols, int kRows, int kCols) {
+    if (!builtinsRegistered) {
+        builtinsRegistered = true;
+        registerBuiltins();
+    }
+    int attributes[MAX_ATTRIBUTES], specificity, best = -1;
+    attributesOf(node, attributes);
+    kernelSpec_t *chosen = NULL, *spec;
+    bool matched;
+    for (int s = 0; s < nRegistered; s++) {
+        spec = &registry[s];
+        if (spec->funcName != node->content.operation.funcName) continue;
+        specificity = 0;
+        matched = matches(spec->nRows, nRows, &specificity) & matches(spec->nCols, nCols, &specificity)
+                  & matches(spec->kRows, kRows, &specificity) & matches(spec->kCols, kCols, &specificity);
+        for (int a = 0; a < MAX_ATTRIBUTES; a++) matched &= matches(spec->attributes[a], attributes[a], &specificity);
+        if (matched && specificity > best) {
+            chosen = spec;
+            best = specificity;
+        }
+    }
+    return chosen;
+}
+
+//PRE: nodes is a forward schedule as made by schedule
+//POST: Every operation runs the most specific registered kernel for the shapes it's scheduled with,
+//      if there is one, and the number which do is returned
+int prepareKernels(node_t **nodes, int length) {
+    shape_t *shapes = scheduleShapes(nodes, length);
+    nodeIndex_t *sorted = indexNodes(nodes, length);
+
+    int nSpecialised = 0, first, second;
+    kernelSpec_t *spec;
+    for (int i = 0; i < length; i++) {
+        if (nodes[i]->isData || !nodes[i]->n) continue;
+        first = indexOf(sorted, length, nodes[i]->inputs[0]);
+        second = nodes[i]->n > 1 ? indexOf(sorted, length, nodes[i]->inputs[1]) : -1;
+        spec = first < 0 ? NULL : chooseKernel(nodes[i], shapes[first].nRows, shapes[first].nCols,
+                                               second < 0 ? ANY : shapes[second].nRows,
+                                               second < 0 ? ANY : shapes[second].nCols);
+        nodes[i]->specialised = spec ? spec->run : NULL;
+        nSpecialised += NULL != spec;
+    }
+    free(shapes);
+    free(sorted);
+    return nSpecialised;
+}
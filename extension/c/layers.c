@@ -6,6 +6,7 @@
 #include "../util.h"
 #include "../activation.h"
 #include "../layers.h"
+#include "../lstm.h"
 
 matrix2d_t *generateRandMatrix(int nRows, int nCols) {
     matrix2d_t *randMT = matrixCreate(nRows, nCols);   
@@ -17,6 +18,7 @@ int nDense = 0;
 int nConvLayers = 0;
 int nLSTM = 0;
 int nGates = 0;
+int nGateParams = 0;
 
 //PRE: Number of neurons, input node number of features and a activation function to apply
 //POST: Links the input node to a dense layer and returns the output of the dense layer
@@ -110,6 +112,7 @@ node_t *convolutionalLayer(node_t *x, int nChannels, int kernelSize,
     activFunc->content.operation = (operation_t) {.funcName = ACTIVATION, .activationName = activationFunction};
 
     node_t *data = nodeInit("config", 0, 1, true);
+    data->content.data->constant = true;
     data->content.data->data->matrix2d = matrixCreate(1, 2);
     matrixSet(data->content.data->data->matrix2d, 0, 0, stride);
     matrixSet(data->content.data->data->matrix2d, 0, 1, padding);
@@ -123,57 +126,70 @@ node_t *convolutionalLayer(node_t *x, int nChannels, int kernelSize,
 
     push(entryPoints, length, kernel);
     push(entryPoints, length, bias);
+    push(entryPoints, length, data);
 
     activFunc->matrix->matrix2d = matrixCreate(dimension, dimension);
 
     return activFunc;
 }
 
+//The weights and bias of one LSTM gate, shared by every timestep it is unrolled over
+typedef struct gateParams {
+    node_t *weightW, *weightU, *bias;
+} gateParams_t;
+
+//PRE: Accepts the shape of the gate and how many cells will use it
+//POST: The gate's parameters, each with an output for every cell, are added to entryPoints
+static gateParams_t LSTMGateParams(int nFeatures, int nNeurons, int batchSize, int timeSteps,
+                                   node_t ***entryPoints, int *length) {
+
+    char *weightWName = calloc(MAX_NODE_NAME_LENGTH + 1, sizeof(char));
+    char *weightUName = calloc(MAX_NODE_NAME_LENGTH + 1, sizeof(char));
+    char *biasName = calloc(MAX_NODE_NAME_LENGTH + 1, sizeof(char));
+
+    snprintf(weightWName, MAX_NODE_NAME_LENGTH, "WEIGHTW%d", nGateParams);
+    snprintf(weightUName, MAX_NODE_NAME_LENGTH, "WEIGHTU%d", nGateParams);
+    snprintf(biasName, MAX_NODE_NAME_LENGTH, "BIAS%d", nGateParams++);
+
+    gateParams_t params;
+    params.weightW = nodeInit(weightWName, 0, timeSteps, true);
+    params.weightW->content.data->data->matrix2d = generateRandMatrix(nFeatures, nNeurons);
+
+    params.weightU = nodeInit(weightUName, 0, timeSteps, true);
+    params.weightU->content.data->data->matrix2d = generateRandMatrix(nNeurons, nNeurons);
+
+    params.bias = nodeInit(biasName, 0, timeSteps, true);
+    params.bias->content.data->data->matrix2d = matrixCreate(batchSize, nNeurons);
+
+    push(entryPoints, length, params.weightW);
+    push(entryPoints, length, params.weightU);
+    push(entryPoints, length, params.bias);
+
+    return params;
+}
+
 //From: https://medium.com/@aidangomez/let-s-do-this-f9b699de31d9
 
 //PRE: Accepts an input and the previous cell's output - both must have 4 outputs
-//PRE: Accepts the activation func
+//PRE: Accepts the gate's parameters and activation func
 //POST: Links the input and previous output to the gate and returns the gate
-static node_t *LSTMGate(node_t *x, node_t *prevOutput, 
-        enum activationFunction activationFunction,
-        node_t ***entryPoints, int *length) {
+static node_t *LSTMGate(node_t *x, node_t *prevOutput, gateParams_t *params,
+        enum activationFunction activationFunction) {
 
     //activationFunction(dot(x, W) + dot(prev, U) + b)
 
-    int nNeurons  = prevOutput->matrix->matrix2d->nCols;
-    //int batchSize = prevOutput->matrix->nRows;
-
-    matrix2d_t *weightMTW = generateRandMatrix(x->matrix->matrix2d->nCols, nNeurons);
-    matrix2d_t *weightMTU = generateRandMatrix(nNeurons, nNeurons);
-    matrix2d_t *biasMT = matrixCreate(x->matrix->matrix2d->nRows, nNeurons);
-    
-    char *weightWName = calloc(MAX_NODE_NAME_LENGTH + 1, sizeof(char));
-    char *weightUName = calloc(MAX_NODE_NAME_LENGTH + 1, sizeof(char));
-    char *biasName = calloc(MAX_NODE_NAME_LENGTH + 1, sizeof(char));
     char *dotWName = calloc(MAX_NODE_NAME_LENGTH + 1, sizeof(char));
     char *dotUName = calloc(MAX_NODE_NAME_LENGTH + 1, sizeof(char));
     char *addName = calloc(MAX_NODE_NAME_LENGTH + 1, sizeof(char));
     char *addBName = calloc(MAX_NODE_NAME_LENGTH + 1, sizeof(char));
     char *gateName = calloc(MAX_NODE_NAME_LENGTH + 1, sizeof(char));
 
-    snprintf(weightWName, MAX_NODE_NAME_LENGTH, "WEIGHTW%d", nGates);
-    snprintf(weightUName, MAX_NODE_NAME_LENGTH, "WEIGHTU%d", nGates);
-    snprintf(biasName, MAX_NODE_NAME_LENGTH, "BIAS%d", nGates);
     snprintf(dotWName, MAX_NODE_NAME_LENGTH, "DOTW%d", nGates);
     snprintf(dotUName, MAX_NODE_NAME_LENGTH, "DOTU%d", nGates);
     snprintf(addName, MAX_NODE_NAME_LENGTH, "ADD%d", nGates);
     snprintf(addBName, MAX_NODE_NAME_LENGTH, "ADDB%d", nGates);
     snprintf(gateName, MAX_NODE_NAME_LENGTH, "FUNC%d", nGates++);
 
-    node_t *weightW = nodeInit(weightWName, 0, 1, true);
-    weightW->content.data->data->matrix2d = weightMTW;
-
-    node_t *weightU = nodeInit(weightUName, 0, 1, true);
-    weightU->content.data->data->matrix2d = weightMTU;
-
-    node_t *bias = nodeInit(biasName, 0, 1, true);
-    bias->content.data->data->matrix2d = biasMT;
-
     node_t *dotProductW = nodeInit(dotWName, 2, 1, false);
     dotProductW->content.operation = (operation_t) {.funcName = DOT};
 
@@ -190,23 +206,19 @@ static node_t *LSTMGate(node_t *x, node_t *prevOutput,
     gate->content.operation = (operation_t) {.funcName = ACTIVATION, .activationName = activationFunction};
 
     linkNodes(x, dotProductW);
-    linkNodes(weightW, dotProductW);
+    linkNodes(params->weightW, dotProductW);
 
     linkNodes(prevOutput, dotProductU);
-    linkNodes(weightU, dotProductU);
+    linkNodes(params->weightU, dotProductU);
 
     linkNodes(dotProductW, add);
     linkNodes(dotProductU, add);
 
-    linkNodes(bias, addB);
+    linkNodes(params->bias, addB);
     linkNodes(add, addB);
 
     linkNodes(addB, gate);
 
-    push(entryPoints, length, weightW);
-    push(entryPoints, length, weightU);
-    push(entryPoints, length, bias);
-
     return gate;
 }
 
@@ -215,8 +227,14 @@ node_t *genDouble(node_t *x, node_t *prevOutput,
         enum activationFunction activationFunction,
         node_t ***entryPoints, int *length) {
 
-    node_t *activationGate = LSTMGate(x, prevOutput, TANH, entryPoints, length);
-    node_t *inputGate = LSTMGate(x, prevOutput, activationFunction, entryPoints, length);
+    int nFeatures = x->matrix->matrix2d->nCols;
+    int nNeurons = prevOutput->matrix->matrix2d->nCols;
+    int batchSize = x->matrix->matrix2d->nRows;
+    gateParams_t activationParams = LSTMGateParams(nFeatures, nNeurons, batchSize, 1, entryPoints, length);
+    gateParams_t inputParams = LSTMGateParams(nFeatures, nNeurons, batchSize, 1, entryPoints, length);
+
+    node_t *activationGate = LSTMGate(x, prevOutput, &activationParams, TANH);
+    node_t *inputGate = LSTMGate(x, prevOutput, &inputParams, activationFunction);
 
     char *mult1Name = calloc(MAX_NODE_NAME_LENGTH + 1, sizeof(char));
 
@@ -232,20 +250,18 @@ node_t *genDouble(node_t *x, node_t *prevOutput,
 }
 
 //PRE: Accepts an input, the previous cell's output (both must have 4 outputs)
-//PRE: And the previous cell's state and a null pointer for the next cell
+//PRE: And the previous cell's state, a null pointer for the next cell
+//PRE: And the parameters of the activation, input, forget and output gates in that order
 //POST: Returns (in this order) the output and state of this cell
 static node_t *LSTMCell(node_t *x, node_t *prevOutput, node_t *prevState,
                  enum activationFunction func, node_t **nextState,
-                 node_t ***entryPoints, int *length) {
-    
-    push(entryPoints, length, prevOutput);
-    push(entryPoints, length, prevState);               
+                 gateParams_t *params) {
 
-    node_t *activationGate = LSTMGate(x, prevOutput, TANH, entryPoints, length);
-    node_t *inputGate = LSTMGate(x, prevOutput, func, entryPoints, length);
-    node_t *forgetGate = LSTMGate(x, prevOutput, func, entryPoints, length);
+    node_t *activationGate = LSTMGate(x, prevOutput, &params[0], TANH);
+    node_t *inputGate = LSTMGate(x, prevOutput, &params[1], func);
+    node_t *forgetGate = LSTMGate(x, prevOutput, &params[2], func);
     //Not the same as the cell's output
-    node_t *outputGate = LSTMGate(x, prevOutput, func, entryPoints, length);
+    node_t *outputGate = LSTMGate(x, prevOutput, &params[3], func);
 
     char *mult1Name = calloc(MAX_NODE_NAME_LENGTH + 1, sizeof(char));
     char *mult2Name = calloc(MAX_NODE_NAME_LENGTH + 1, sizeof(char));
@@ -269,7 +285,7 @@ static node_t *LSTMCell(node_t *x, node_t *prevOutput, node_t *prevState,
     node_t *state = nodeInit(stateName, 2, 2, false);
     state->content.operation = (operation_t) {.funcName = ADD};
 
-    node_t *tanh = nodeInit(tanhName, 2, 1, false);
+    node_t *tanh = nodeInit(tanhName, 1, 1, false);
     tanh->content.operation = (operation_t) {.funcName = ACTIVATION, .activationName = TANH};
 
     node_t *output = nodeInit(outputName, 2, 4, false);
@@ -307,6 +323,7 @@ static node_t *clone(node_t *node) {
 }
 
 //PRE: inputs has timeSteps nodes, timeSteps > 0; all inputs have the same shape
+//POST: Every cell shares one set of gate parameters, so their gradients accumulate across timesteps
 graph_t *LSTM(node_t **inputs, int timeSteps, enum activationFunction func, int nNeurons) {
     node_t **entryPoints = NULL; //contains weights and biases
     int length = 0;
@@ -321,30 +338,25 @@ graph_t *LSTM(node_t **inputs, int timeSteps, enum activationFunction func, int
     prevState->matrix->matrix2d = matrixCreate(inputs[0]->matrix->matrix2d->nRows, nNeurons);
     prevState->content.data->data->matrix2d = prevState->matrix->matrix2d;
     
-    node_t *nextState;
+    prevOutput = clone(prevOutput);
+    prevState = clone(prevState);
+    push(&entryPoints, &length, prevOutput);
+    push(&entryPoints, &length, prevState);
+
+    int nFeatures = inputs[0]->matrix->matrix2d->nCols;
+    int batchSize = inputs[0]->matrix->matrix2d->nRows;
+    gateParams_t params[4];
+    for (int i = 0; i < 4; i++) {
+        params[i] = LSTMGateParams(nFeatures, nNeurons, batchSize, timeSteps, &entryPoints, &length);
+    }
 
-    node_t *output = LSTMCell(inputs[0], clone(prevOutput), clone(prevState), func, 
-                              &nextState, &entryPoints, &length);
-    
-    push(&entryPoints, &length, inputs[0]);
-    
-    node_t **linkPoints;
-    int nLink;
-    for (int t = 1; t < timeSteps; t++) {
+    node_t *nextState;
+    node_t *output;
+    for (int t = 0; t < timeSteps; t++) {
         push(&entryPoints, &length, inputs[t]);
-        linkPoints = NULL;
-        nLink = 0;
+        output = LSTMCell(inputs[t], prevOutput, prevState, func, &nextState, params);
         prevOutput = output;
         prevState = nextState;
-        output = LSTMCell(inputs[t], prevOutput, prevState, func,
-                          &nextState, &linkPoints, &nLink);
-        
-        //Link all points which aren't state or output
-        entryPoints = realloc(entryPoints, sizeof(node_t*) * (length + nLink - 2));
-        for (int i = 2; i < nLink; i++) {
-            entryPoints[length + i - 2] = linkPoints[i];
-        }
-        length += nLink - 2;
     }
 
     node_t *y = nodeInit("y", 1, 0, true);
@@ -358,4 +370,176 @@ graph_t *LSTM(node_t **inputs, int timeSteps, enum activationFunction func, int
     exitPoints[0] = output;
 
     return graphInit("LSTM", length, entryPoints, 1, exitPoints);
-}
\ No newline at end of file
+}
+//POST: Exits unless input has one output, which nothing reads yet, for a fused LSTM's cells to read it
+static void checkSequenceInput(node_t *input) {
+    if (1 != input->m || input->outputIdx) {
+        printf("A fused LSTM's inputs must have one output that nothing else reads\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+static node_t *packedParam(char *name, matrix2d_t *matrix, int nOutputs) {
+    node_t *param = nodeInit(name, 0, nOutputs, true);
+    param->content.data->data->matrix2d = matrix;
+    return param;
+}
+
+//PRE: inputs has timeSteps nodes with one output each, timeSteps > 0; all inputs have the same shape
+//POST: As LSTM, but the gates' weights are packed as in lstm.h. The input projections don't
+//      depend on the recurrence, so one LSTM_PROJECTION node computes x_t . W + bias for every
+//      step as a single GEMM, and each LSTM_STEP node only adds h . U and applies the gates
+//      The graph's exit point holds the last cell's output
+graph_t *fusedLSTM(node_t **inputs, int timeSteps, enum activationFunction func, int nNeurons) {
+    lstmParams_t *params = lstmParamsCreate(inputs[0]->matrix->matrix2d->nCols, nNeurons, func);
+    graph_t *graph = packedLSTM(inputs, timeSteps, params, NULL);
+    free(params);
+    return graph;
+}
+
+//PRE: inputs has timeSteps nodes with one output each, timeSteps > 0
+//POST: fusedLSTM over existing weights, so several graphs can share them
+//      The graph's first entry point is the initial state and configs, unless NULL, is set to
+//      the steps' 1 x 2 configs, which can be changed to run packed batches as in LSTM_STEP
+graph_t *packedLSTM(node_t **inputs, int timeSteps, lstmParams_t *params, node_t **configs) {
+    node_t **entryPoints = NULL; //contains weights and biases
+    int length = 0;
+
+    int batchSize = inputs[0]->matrix->matrix2d->nRows;
+    int nNeurons = params->nNeurons;
+    enum activationFunction func = params->func;
+
+    node_t *state = nodeInit("STATE", 0, 1, true);
+    state->content.data->data->matrix2d = matrixCreate(batchSize, 2 * nNeurons);
+    state->matrix->matrix2d = state->content.data->data->matrix2d;
+
+    node_t *weightW = packedParam("WEIGHTW", params->weightW, 1);
+    node_t *weightU = packedParam("WEIGHTU", params->weightU, timeSteps);
+    node_t *bias = packedParam("BIAS", params->bias, 1);
+
+    push(&entryPoints, &length, state);
+    push(&entryPoints, &length, weightW);
+    push(&entryPoints, &length, weightU);
+    push(&entryPoints, &length, bias);
+
+    char *name = calloc(MAX_NODE_NAME_LENGTH + 1, sizeof(char));
+    snprintf(name, MAX_NODE_NAME_LENGTH, "LSTMPROJ%d", nLSTM++);
+    node_t *projection = nodeInit(name, timeSteps + 2, timeSteps, false);
+    projection->content.operation = (operation_t) {.funcName = LSTM_PROJECTION};
+    for (int t = 0; t < timeSteps; t++) {
+        checkSequenceInput(inputs[t]);
+        push(&entryPoints, &length, inputs[t]);
+        linkNodes(inputs[t], projection);
+    }
+    linkNodes(weightW, projection);
+    linkNodes(bias, projection);
+
+    node_t *step, *config;
+    for (int t = 0; t < timeSteps; t++) {
+        config = nodeInit("config", 0, 1, true);
+        config->content.data->data->matrix2d = matrixCreate(1, 2);
+        matrixSet(config->content.data->data->matrix2d, 0, 0, t * batchSize);
+        matrixSet(config->content.data->data->matrix2d, 0, 1, batchSize);
+        config->matrix->matrix2d = config->content.data->data->matrix2d;
+        push(&entryPoints, &length, config);
+        if (configs) configs[t] = config;
+
+        name = calloc(MAX_NODE_NAME_LENGTH + 1, sizeof(char));
+        snprintf(name, MAX_NODE_NAME_LENGTH, "LSTMSTEP%d", nLSTM++);
+        step = nodeInit(name, 4, 1, false);
+        step->content.operation = (operation_t) {.funcName = LSTM_STEP, .activationName = func};
+
+        linkNodes(projection, step);
+        linkNodes(state, step);
+        linkNodes(weightU, step);
+        linkNodes(config, step);
+        state = step;
+    }
+
+    node_t *output = nodeInit("OUTPUT", 1, 1, false);
+    output->content.operation = (operation_t) {.funcName = LSTM_HIDDEN};
+    linkNodes(state, output);
+
+    node_t *y = nodeInit("y", 1, 0, true);
+    y->content.data->internalNode = false;
+    linkNodes(output, y);
+
+    node_t **exitPoints = malloc(sizeof(node_t*));
+    exitPoints[0] = y;
+
+    return graphInit("fusedLSTM", length, entryPoints, 1, exitPoints);
+}
+
+//PRE: inputs has timeSteps nodes with one output each, timeSteps > 0, nLayers > 0; all inputs have the same shape
+//POST: nLayers fused LSTMs, layer l taking layer l - 1's hidden output at every step
+//      Cell (l, t) only waits for cells (l - 1, t) and (l, t - 1), so scheduleWavefront can run
+//      a whole anti-diagonal of cells at once; the input projections aren't hoisted because a layer's
+//      inputs only appear one step at a time. The graph's exit point holds the top layer's last output
+graph_t *stackedLSTM(node_t **inputs, int timeSteps, int nLayers, enum activationFunction func, int nNeurons) {
+    node_t **entryPoints = NULL; //contains weights and biases
+    int length = 0;
+
+    int batchSize = inputs[0]->matrix->matrix2d->nRows;
+    node_t **layerInputs = malloc(sizeof(node_t*) * timeSteps);
+    for (int t = 0; t < timeSteps; t++) {
+        checkSequenceInput(inputs[t]);
+        push(&entryPoints, &length, inputs[t]);
+        layerInputs[t] = inputs[t];
+    }
+
+    lstmParams_t *params;
+    node_t *state, *weightW, *weightU, *bias, *cell, *hidden;
+    char *name;
+    bool top;
+    for (int l = 0; l < nLayers; l++) {
+        top = l == nLayers - 1;
+        params = lstmParamsCreate(l ? nNeurons : inputs[0]->matrix->matrix2d->nCols, nNeurons, func);
+        state = nodeInit("STATE", 0, 1, true);
+        state->content.data->data->matrix2d = matrixCreate(batchSize, 2 * nNeurons);
+        state->matrix->matrix2d = state->content.data->data->matrix2d;
+        weightW = packedParam("WEIGHTW", params->weightW, timeSteps);
+        weightU = packedParam("WEIGHTU", params->weightU, timeSteps);
+        bias = packedParam("BIAS", params->bias, timeSteps);
+        free(params);
+        push(&entryPoints, &length, state);
+        push(&entryPoints, &length, weightW);
+        push(&entryPoints, &length, weightU);
+        push(&entryPoints, &length, bias);
+
+        for (int t = 0; t < timeSteps; t++) {
+            name = calloc(MAX_NODE_NAME_LENGTH + 1, sizeof(char));
+            snprintf(name, MAX_NODE_NAME_LENGTH, "LSTMCELL%d", nLSTM++);
+            //Feeds the next step, and the layer above unless this is the top layer's last step
+            cell = nodeInit(name, 5, (t < timeSteps - 1) + (!top || t == timeSteps - 1), false);
+            cell->content.operation = (operation_t) {.funcName = LSTM_CELL, .activationName = func};
+            linkNodes(layerInputs[t], cell);
+            linkNodes(state, cell);
+            linkNodes(weightW, cell);
+            linkNodes(weightU, cell);
+            linkNodes(bias, cell);
+            state = cell;
+
+            if (top) continue;
+            name = calloc(MAX_NODE_NAME_LENGTH + 1, sizeof(char));
+            snprintf(name, MAX_NODE_NAME_LENGTH, "LSTMHIDDEN%d", nLSTM++);
+            hidden = nodeInit(name, 1, 1, false);
+            hidden->content.operation = (operation_t) {.funcName = LSTM_HIDDEN};
+            linkNodes(cell, hidden);
+            layerInputs[t] = hidden;
+        }
+    }
+    free(layerInputs);
+
+    node_t *output = nodeInit("OUTPUT", 1, 1, false);
+    output->content.operation = (operation_t) {.funcName = LSTM_HIDDEN};
+    linkNodes(state, output);
+
+    node_t *y = nodeInit("y", 1, 0, true);
+    y->content.data->internalNode = false;
+    linkNodes(output, y);
+
+    node_t **exitPoints = malloc(sizeof(node_t*));
+    exitPoints[0] = y;
+
+    return graphInit("stackedLSTM", length, entryPoints, 1, exitPoints);
+}
@@ -0,0 +1,261 @@
+#include "../lowrank.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "../matrix.h"
+#include "../nodes.h"
+#include "../passes.h"
+#include "../util.h"
+
+//One sided Jacobi rotates pairs of columns until they're orthogonal, which converges in a handful of sweeps
+#define MAX_SWEEPS 60
+#define JACOBI_TOLERANCE 1e-15
+#define TIMED_REPEATS 10
+
+static int nFactorised = 0;
+
+typedef struct singularValue {
+    double s;
+    int idx;
+} singularValue_t;
+
+static int compareDescending(const void *a, const void *b) {
+    double first = ((singularValue_t*) a)->s, second = ((singularValue_t*) b)->s;
+    return (first < second) - (first > second);
+}
+
+//PRE: matrix has at least as many rows as columns
+//POST: The SVD of matrix, computed in doubles whatever real_t is
+static svd_t *tallSVD(matrix2d_t *matrix) {
+    int m = matrix->nRows, n = matrix->nCols;
+    //Columns are rotated, so they're held contiguously
+    double **a = malloc(sizeof(double*) * n), **v = malloc(sizeof(double*) * n);
+    for (int j = 0; j < n; j++) {
+        a[j] = malloc(sizeof(double) * m);
+        v[j] = calloc(n, sizeof(double));
+        for (int i = 0; i < m; i++) a[j][i] = matrix->data[i][j];
+        v[j][j] = 1;
+    }
+
+    double alpha, beta, gamma, zeta, t, c, s, ap, aq;
+    bool rotated = true;
+    for (int sweep = 0; sweep < MAX_SWEEPS && rotated; sweep++) {
+        rotated = false;
+        for (int p = 0; p < n - 1; p++) {
+            for (int q = p + 1; q < n; q++) {
+                alpha = beta = gamma = 0;
+                for (int i = 0; i < m; i++) {
+                    alpha += a[p][i] * a[p][i];
+                    beta += a[q][i] * a[q][i];
+                    gamma += a[p][i] * a[q][i];
+                }
+                if (fabs(gamma) <= JACOBI_TOLERANCE * sqrt(alpha * beta)) continue;
+                rotated = true;
+                zeta = (beta - alpha) / (2 * gamma);
+                t = (zeta >= 0 ? 1 : -1) / (fabs(zeta) + sqrt(1 + zeta * zeta));
+                c = 1 / sqrt(1 + t * t);
+                s = c * t;
+                for (int i = 0; i < m; i++) {
+                    ap = a[p][i], aq = a[q][i];
+                    a[p][i] = c * ap - s * aq;
+                    a[q][i] = s * ap + c * aq;
+                }
+                for (int i = 0; i < n; i++) {
+                    ap = v[p][i], aq = v[q][i];
+                    v[p][i] = c * ap - s * aq;
+                    v[q][i] = s * ap + c * aq;
+                }
+            }
+        }
+    }
+
+    //Each column's norm is its singular value, and the column over it is a left singular vector
+    singularValue_t *order = malloc(sizeof(singularValue_t) * n);
+    for (int j = 0; j < n; j++) {
+        order[j] = (singularValue_t) {0, j};
+        for (int i = 0; i < m; i++) order[j].s += a[j][i] * a[j][i];
+        order[j].s = sqrt(order[j].s);
+    }
+    qsort(order, n, sizeof(singularValue_t), compareDescending);
+
+    svd_t *svd = malloc(sizeof(svd_t));
+    svd->rank = n;
+    svd->s = malloc(sizeof(double) * n);
+    svd->u = matrixCreate(m, n);
+    svd->v = matrixCreate(n, n);
+    int col;
+    for (int k = 0; k < n; k++) {
+        col = order[k].idx;
+        svd->s[k] = order[k].s;
+        for (int i = 0; i < m; i++) svd->u->data[i][k] = order[k].s > 0 ? a[col][i] / order[k].s : 0;
+        for (int i = 0; i < n; i++) svd->v->data[i][k] = v[col][i];
+    }
+    for (int j = 0; j < n; j++) {
+        free(a[j]);
+        free(v[j]);
+    }
+    free(a);
+    free(v);
+    free(order);
+    return svd;
+}
+
+//POST: matrix = u . diag(s) . v^T, the factors of a wide matrix being those of its transpose swapped
+svd_t *matrixSVD(matrix2d_t *matrix) {
+    if (matrix->nRows >= matrix->nCols) return tallSVD(matrix);
+    matrix2d_t *transpose = matrixTranspose(matrix), *swap;
+    svd_t *svd = tallSVD(transpose);
+    swap = svd->u;
+    svd->u = svd->v;
+    svd->v = swap;
+    matrixFree(transpose);
+    return svd;
+}
+
+void svdFree(svd_t *svd) {
+    matrixFree(svd->u);
+    matrixFree(svd->v);
+    free(svd->s);
+    free(svd);
+}
+
+//POST: The fewest singular values whose squares add up to at least energy of all of theirs
+int rankForEnergy(svd_t *svd, double energy) {
+    double total = 0, kept = 0;
+    for (int k = 0; k < svd->rank; k++) total += svd->s[k] * svd->s[k];
+    for (int k = 0; k < svd->rank; k++) {
+        kept += svd->s[k] * svd->s[k];
+        if (kept >= energy * total) return k + 1;
+    }
+    return svd->rank;
+}
+
+//POST: The Frobenius norm of a - b relative to a's
+static double relativeError(matrix2d_t *a, matrix2d_t *b) {
+    double difference = 0, norm = 0;
+    for (int i = 0; i < a->nRows; i++) {
+        for (int j = 0; j < a->nCols; j++) {
+            difference += (a->data[i][j] - b->data[i][j]) * (a->data[i][j] - b->data[i][j]);
+            norm += a->data[i][j] * a->data[i][j];
+        }
+    }
+    return norm > 0 ? sqrt(difference / norm) : 0;
+}
+
+static double secondsSince(struct timespec *start) {
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return (end.tv_sec - start->tv_sec) + (end.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+//POST: Seconds for x . weights, and x . first . second in outputError with how far it is from x . weights
+static double timeFactors(matrix2d_t *x, matrix2d_t *weights, matrix2d_t *first, matrix2d_t *second,
+                          double *factoredSeconds, double *outputError) {
+    struct timespec start;
+    matrix2d_t *exact, *inner, *approximate;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int r = 0; r < TIMED_REPEATS; r++) {
+        exact = matrixDotProduct(x, weights);
+        if (r < TIMED_REPEATS - 1) matrixFree(exact);
+    }
+    double seconds = secondsSince(&start) / TIMED_REPEATS;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int r = 0; r < TIMED_REPEATS; r++) {
+        inner = matrixDotProduct(x, first);
+        approximate = matrixDotProduct(inner, second);
+        matrixFree(inner);
+        if (r < TIMED_REPEATS - 1) matrixFree(approximate);
+    }
+    *factoredSeconds = secondsSince(&start) / TIMED_REPEATS;
+    *outputError = relativeError(exact, approximate);
+    matrixFree(exact);
+    matrixFree(approximate);
+    return seconds;
+}
+
+//POST: dot reads x . first, a new product of its input with first, where it read its input before
+static void splitProduct(graph_t *graph, node_t *dot, matrix2d_t *first) {
+    char *name = calloc(MAX_NODE_NAME_LENGTH + 1, sizeof(char));
+    char *factorName = calloc(MAX_NODE_NAME_LENGTH + 1, sizeof(char));
+    snprintf(name, MAX_NODE_NAME_LENGTH, "LOWRANK%d", nFactorised);
+    snprintf(factorName, MAX_NODE_NAME_LENGTH, "FACTOR%d", nFactorised++);
+    node_t *input = dot->inputs[0], *product = nodeInit(name, 2, 1, false), *factor = nodeInit(factorName, 0, 1, true);
+    product->content.operation = (operation_t) {.funcName = DOT};
+    factor->content.data->data->matrix2d = first;
+    for (int i = 0; i < input->m; i++) {
+        if (input->outputs[i] == dot) {
+            input->outputs[i] = product;
+            break;
+        }
+    }
+    product->inputs[product->inputIdx++] = input;
+    linkNodes(factor, product);
+    product->outputs[product->outputIdx++] = dot;
+    dot->inputs[0] = product;
+    push(&graph->entryPoints, &graph->n, factor);
+}
+
+//PRE: nodes is a forward schedule of graph as made by schedule
+//POST: Every product of an activation with weights read by nothing else, where a truncated SVD of the rank
+//      selection picks needs fewer FLOPs, is split into x . (u_k . diag(s_k)) . v_k^T, and the number split
+//      is returned. The new factors are entry points of graph, so nodes must be scheduled again
+//      verbose prints each layer's rank, speedup and error, timed on its input if FORWARD has run
+int factoriseDense(graph_t *graph, node_t **nodes, int length, enum rankSelection selection, double target, bool verbose) {
+    nodeIndex_t *sorted = indexNodes(nodes, length);
+    shape_t *shapes = scheduleShapes(nodes, length);
+    node_t *node, *weights;
+    matrix2d_t *matrix, *first, *second, *x;
+    svd_t *svd;
+    int input, rank, m, n, nSplit = 0;
+    double kept, total, seconds, factoredSeconds, outputError;
+    for (int i = 0; i < length; i++) {
+        node = nodes[i];
+        if (!(weights = ownedProductWeights(node, shapes, sorted, length))) continue;
+        input = indexOf(sorted, length, node->inputs[0]);
+        matrix = weights->content.data->data->matrix2d;
+        m = matrix->nRows, n = matrix->nCols;
+        svd = matrixSVD(matrix);
+        rank = ENERGY == selection ? rankForEnergy(svd, target) : target * m * n / (m + n);
+        if (rank < 1) rank = 1;
+        //Only worth it if the two products need fewer FLOPs
+        if ((long) rank * (m + n) >= (long) m * n) {
+            svdFree(svd);
+            continue;
+        }
+
+        first = matrixCreate(m, rank);
+        second = matrixCreate(rank, n);
+        for (int k = 0; k < rank; k++) {
+            for (int r = 0; r < m; r++) first->data[r][k] = svd->u->data[r][k] * svd->s[k];
+            for (int c = 0; c < n; c++) second->data[k][c] = svd->v->data[c][k];
+        }
+        if (verbose) {
+            kept = total = 0;
+            for (int k = 0; k < svd->rank; k++) {
+                total += svd->s[k] * svd->s[k];
+                if (k < rank) kept += svd->s[k] * svd->s[k];
+            }
+            printf("%s: %d x %d at rank %d, %.2lfx fewer FLOPs, %.3e weight error", node->name, m, n, rank,
+                   (double) m * n / ((double) rank * (m + n)), total > 0 ? sqrt(fmax(0, 1 - kept / total)) : 0);
+            if ((x = nodes[input]->matrix->matrix2d)) {
+                seconds = timeFactors(x, matrix, first, second, &factoredSeconds, &outputError);
+                printf(", %.2lfx faster, %.3e output error", seconds / factoredSeconds, outputError);
+            }
+            printf("\n");
+        }
+        svdFree(svd);
+
+        matrixFree(matrix);
+        weights->content.data->data->matrix2d = second;
+        if (weights->matrix->matrix2d) matrixFree(weights->matrix->matrix2d);
+        weights->matrix->matrix2d = NULL;
+        splitProduct(graph, node, first);
+        nSplit++;
+    }
+    free(sorted);
+    free(shapes);
+    return nSplit;
+}
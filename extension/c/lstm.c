@@ -0,0 +1,379 @@
+#include "../lstm.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../matrix.h"
+#include "../activation.h"
+#include "../gemm.h"
+#include "../util.h"
+
+//A cell's state is packed as [h | c], both batchSize x nNeurons
+
+static double gate(enum activationFunction func, double x) {
+    switch (func) {
+        case SIGMOID: return sigmoid(x);
+        case TANH:    return tanh(x);
+        case RELU:    return relu(x);
+        case LINEAR:  return x;
+        default:
+            printf("LSTM gates don't support that activation function\n");
+            exit(EXIT_FAILURE);
+    }
+}
+
+//PRE: y is the gate's output, i.e. already activated
+static double gatePrime(enum activationFunction func, double y) {
+    switch (func) {
+        case SIGMOID: return y * (1 - y);
+        case TANH:    return 1 - y * y;
+        case RELU:    return y > 0;
+        default:      return 1;
+    }
+}
+
+//POST: out += a^T . b, where a is nShared x nRows and b is nShared x nCols
+static void gemmTransA(real_t **a, real_t **b, real_t **out, int nRows, int nShared, int nCols) {
+    real_t aki, *bk;
+    for (int k = 0; k < nShared; k++) {
+        bk = b[k];
+        for (int i = 0; i < nRows; i++) {
+            aki = a[k][i];
+            if (0 == aki) continue;
+            for (int j = 0; j < nCols; j++) out[i][j] += aki * bk[j];
+        }
+    }
+}
+
+//POST: out += a . b^T, where a is nRows x nShared and b is nCols x nShared
+static void gemmTransB(real_t **a, real_t **b, real_t **out, int nRows, int nShared, int nCols) {
+    real_t sum;
+    for (int i = 0; i < nRows; i++) {
+        for (int j = 0; j < nCols; j++) {
+            sum = 0;
+            for (int k = 0; k < nShared; k++) sum += a[i][k] * b[j][k];
+            out[i][j] += sum;
+        }
+    }
+}
+
+lstmParams_t *lstmParamsCreate(int nFeatures, int nNeurons, enum activationFunction func) {
+    lstmParams_t *params = malloc(sizeof(lstmParams_t));
+    params->weightW = matrixCreate(nFeatures, N_GATES * nNeurons);
+    params->weightU = matrixCreate(nNeurons, N_GATES * nNeurons);
+    params->bias = matrixCreate(1, N_GATES * nNeurons);
+    matrixRandomise(params->weightW);
+    matrixRandomise(params->weightU);
+    params->nNeurons = nNeurons;
+    params->func = func;
+    return params;
+}
+
+//POST: Zeroed parameters of the same shape, i.e. to accumulate gradients in
+lstmParams_t *lstmParamsZeroLike(lstmParams_t *params) {
+    lstmParams_t *zeroed = malloc(sizeof(lstmParams_t));
+    zeroed->weightW = matrixCreate(params->weightW->nRows, params->weightW->nCols);
+    zeroed->weightU = matrixCreate(params->weightU->nRows, params->weightU->nCols);
+    zeroed->bias = matrixCreate(1, params->bias->nCols);
+    zeroed->nNeurons = params->nNeurons;
+    zeroed->func = params->func;
+    return zeroed;
+}
+
+void lstmParamsFree(lstmParams_t *params) {
+    matrixFree(params->weightW);
+    matrixFree(params->weightU);
+    matrixFree(params->bias);
+    free(params);
+}
+
+//PRE: gates holds this step's x . W + bias, state is batchSize x 2 * nNeurons
+//POST: h . U is added to gates, then one pass applies the gates and writes the next state
+//      next may be state itself, as each element of the state is read before it's overwritten
+static void updateState(lstmParams_t *params, matrix2d_t *gates, matrix2d_t *state,
+                        matrix2d_t *next, matrix2d_t *tanhState) {
+    int batchSize = gates->nRows;
+    int h = params->nNeurons;
+
+    //Only the h half of the state takes part in the recurrence
+    gemm(state->data, params->weightU->data, gates->data, batchSize, h, N_GATES * h);
+
+    real_t *g, a, in, f, o, c, tc;
+    for (int i = 0; i < batchSize; i++) {
+        g = gates->data[i];
+        for (int j = 0; j < h; j++) {
+            a = g[ACTIVATION_GATE * h + j] = tanh(g[ACTIVATION_GATE * h + j]);
+            in = g[INPUT_GATE * h + j] = gate(params->func, g[INPUT_GATE * h + j]);
+            f = g[FORGET_GATE * h + j] = gate(params->func, g[FORGET_GATE * h + j]);
+            o = g[OUTPUT_GATE * h + j] = gate(params->func, g[OUTPUT_GATE * h + j]);
+
+            c = a * in + f * state->data[i][h + j];
+            tc = tanh(c);
+            next->data[i][j] = o * tc;
+            next->data[i][h + j] = c;
+            if (tanhState) tanhState->data[i][j] = tc;
+        }
+    }
+}
+
+static matrix2d_t *cellFromGates(lstmParams_t *params, matrix2d_t *gates, matrix2d_t *state, lstmCache_t *cache) {
+    matrix2d_t *next = matrixCreate(gates->nRows, 2 * params->nNeurons);
+    matrix2d_t *tanhState = cache ? matrixCreate(gates->nRows, params->nNeurons) : NULL;
+    updateState(params, gates, state, next, tanhState);
+    if (cache) {
+        cache->gates = gates;
+        cache->tanhState = tanhState;
+    } else {
+        matrixFree(gates);
+    }
+    return next;
+}
+
+//POST: out = x . W + bias for nRows rows of x
+static void projectRows(lstmParams_t *params, real_t **x, int nRows, int nFeatures, real_t **out) {
+    int width = N_GATES * params->nNeurons;
+    for (int i = 0; i < nRows; i++) memcpy(out[i], params->bias->data[0], sizeof(real_t) * width);
+    gemm(x, params->weightW->data, out, nRows, nFeatures, width);
+}
+
+//PRE: x is batchSize x nFeatures, state is batchSize x 2 * nNeurons
+//POST: The next state; pre-activations come from one GEMM per operand into a single
+//      batchSize x 4 * nNeurons buffer, then one pass applies the gates and updates the state
+//      If cache isn't NULL it's filled for lstmCellBackward
+matrix2d_t *lstmCellForward(lstmParams_t *params, matrix2d_t *x, matrix2d_t *state, lstmCache_t *cache) {
+    matrix2d_t *gates = lstmProjectInputs(params, &x, 1);
+    return cellFromGates(params, gates, state, cache);
+}
+
+//POST: The rows of every input one after another, as pointers so nothing is copied
+static real_t **stackInputs(matrix2d_t **inputs, int timeSteps, int *nRows) {
+    *nRows = 0;
+    for (int t = 0; t < timeSteps; t++) *nRows += inputs[t]->nRows;
+    real_t **stacked = malloc(sizeof(real_t*) * (*nRows ? *nRows : 1));
+    for (int t = 0, row = 0; t < timeSteps; t++) {
+        for (int i = 0; i < inputs[t]->nRows; i++) stacked[row++] = inputs[t]->data[i];
+    }
+    return stacked;
+}
+
+//PRE: Each of the timeSteps inputs has nFeatures columns; with a batch of packed sequences,
+//     input t holds only the rows of the sequences still running at step t
+//POST: The pre-activations x_t . W + bias of every step stacked in order, e.g. step t in rows
+//      [t * batchSize, (t + 1) * batchSize) when every input has batchSize rows,
+//      as one GEMM over the stacked inputs
+//      None of it depends on the recurrence, so it's computed once before the first step
+matrix2d_t *lstmProjectInputs(lstmParams_t *params, matrix2d_t **inputs, int timeSteps) {
+    int nRows;
+    real_t **stacked = stackInputs(inputs, timeSteps, &nRows);
+    matrix2d_t *projection = matrixCreate(nRows, N_GATES * params->nNeurons);
+    projectRows(params, stacked, nRows, inputs[0]->nCols, projection->data);
+    free(stacked);
+    return projection;
+}
+
+//PRE: projection came from lstmProjectInputs, its rows from firstRow on are this step's
+//POST: The next state of state->nRows rows, the same as lstmCellForward on x_t
+matrix2d_t *lstmStepForward(lstmParams_t *params, matrix2d_t *projection, int firstRow,
+                            matrix2d_t *state, lstmCache_t *cache) {
+    int batchSize = state->nRows;
+    matrix2d_t *gates = matrixCreate(batchSize, projection->nCols);
+    for (int i = 0; i < batchSize; i++) {
+        memcpy(gates->data[i], projection->data[firstRow + i], sizeof(real_t) * projection->nCols);
+    }
+    return cellFromGates(params, gates, state, cache);
+}
+
+//PRE: dGates has batchSize rows of 4 * nNeurons
+//POST: Fills dGates with dL/d(pre-activations), adds dL/dU and dL/dbias to gradients
+//      and returns dL/dstate; dL/dW and dL/dx are left to whoever multiplied by W
+static matrix2d_t *gatesBackward(lstmParams_t *params, matrix2d_t *state, lstmCache_t *cache,
+                                 matrix2d_t *dNextState, lstmParams_t *gradients, real_t **dGates) {
+    int batchSize = state->nRows;
+    int h = params->nNeurons;
+
+    matrix2d_t *dState = matrixCreate(batchSize, 2 * h);
+    real_t *g, *dg, a, in, f, o, tc, dh, dc;
+    for (int i = 0; i < batchSize; i++) {
+        g = cache->gates->data[i];
+        dg = dGates[i];
+        for (int j = 0; j < h; j++) {
+            a = g[ACTIVATION_GATE * h + j];
+            in = g[INPUT_GATE * h + j];
+            f = g[FORGET_GATE * h + j];
+            o = g[OUTPUT_GATE * h + j];
+            tc = cache->tanhState->data[i][j];
+
+            dh = dNextState->data[i][j];
+            dc = dNextState->data[i][h + j] + dh * o * (1 - tc * tc);
+
+            dg[ACTIVATION_GATE * h + j] = dc * in * (1 - a * a);
+            dg[INPUT_GATE * h + j] = dc * a * gatePrime(params->func, in);
+            dg[FORGET_GATE * h + j] = dc * state->data[i][h + j] * gatePrime(params->func, f);
+            dg[OUTPUT_GATE * h + j] = dh * tc * gatePrime(params->func, o);
+            dState->data[i][h + j] = dc * f;
+        }
+    }
+
+    gemmTransA(state->data, dGates, gradients->weightU->data, h, batchSize, N_GATES * h);
+    for (int i = 0; i < batchSize; i++) {
+        for (int j = 0; j < N_GATES * h; j++) gradients->bias->data[0][j] += dGates[i][j];
+    }
+
+    //The h half of dState, the c half was set above
+    gemmTransB(dGates, params->weightU->data, dState->data, batchSize, N_GATES * h, h);
+    return dState;
+}
+
+//PRE: cache was filled by lstmCellForward on x and state, dNextState is dL/d(next state)
+//POST: Returns dL/dstate, adds dL/dparameters to gradients and sets dx to dL/dx unless it is NULL
+matrix2d_t *lstmCellBackward(lstmParams_t *params, matrix2d_t *x, matrix2d_t *state, lstmCache_t *cache,
+                             matrix2d_t *dNextState, lstmParams_t *gradients, matrix2d_t **dx) {
+    matrix2d_t *dGates = matrixCreate(x->nRows, N_GATES * params->nNeurons);
+    matrix2d_t *dState = gatesBackward(params, state, cache, dNextState, gradients, dGates->data);
+    lstmProjectInputsBackward(params, &x, 1, dGates, gradients, dx);
+    matrixFree(dGates);
+    return dState;
+}
+
+//PRE: cache was filled by lstmStepForward from firstRow, dProjection is shaped like the projection
+//POST: Returns dL/dstate, adds dL/dU and dL/dbias to gradients and writes
+//      dL/d(pre-activations) of the step into its rows of dProjection
+matrix2d_t *lstmStepBackward(lstmParams_t *params, int firstRow, matrix2d_t *state, lstmCache_t *cache,
+                             matrix2d_t *dNextState, lstmParams_t *gradients, matrix2d_t *dProjection) {
+    return gatesBackward(params, state, cache, dNextState, gradients, dProjection->data + firstRow);
+}
+
+//PRE: dProjection holds every step's rows from lstmStepBackward
+//POST: Adds dL/dW to gradients as one GEMM over the stacked inputs and, unless dxs is NULL,
+//      sets dxs[t] to dL/dx_t
+void lstmProjectInputsBackward(lstmParams_t *params, matrix2d_t **inputs, int timeSteps,
+                               matrix2d_t *dProjection, lstmParams_t *gradients, matrix2d_t **dxs) {
+    int nRows, nFeatures = inputs[0]->nCols;
+    real_t **stacked = stackInputs(inputs, timeSteps, &nRows);
+    gemmTransA(stacked, dProjection->data, gradients->weightW->data, nFeatures, nRows, dProjection->nCols);
+    free(stacked);
+
+    if (!dxs) return;
+    for (int t = 0, firstRow = 0; t < timeSteps; firstRow += inputs[t++]->nRows) {
+        dxs[t] = matrixCreate(inputs[t]->nRows, nFeatures);
+        gemmTransB(dProjection->data + firstRow, params->weightW->data, dxs[t]->data,
+                   inputs[t]->nRows, dProjection->nCols, nFeatures);
+    }
+}
+
+//POST: The h half of a packed state
+matrix2d_t *lstmHidden(matrix2d_t *state) {
+    int h = state->nCols / 2;
+    matrix2d_t *hidden = matrixCreate(state->nRows, h);
+    for (int i = 0; i < state->nRows; i++) {
+        for (int j = 0; j < h; j++) hidden->data[i][j] = state->data[i][j];
+    }
+    return hidden;
+}
+
+void lstmCacheFree(lstmCache_t *cache) {
+    matrixFree(cache->gates);
+    matrixFree(cache->tanhState);
+}
+
+//POST: nRows row pointers into one contiguous, zeroed block
+static real_t **contiguousRows(int nRows, int nCols) {
+    real_t **rows = malloc(sizeof(real_t*) * nRows);
+    real_t *block = calloc((size_t) nRows * nCols, sizeof(real_t));
+    for (int i = 0; i < nRows; i++) rows[i] = block + (size_t) i * nCols;
+    return rows;
+}
+
+static void freeContiguousRows(real_t **rows) {
+    free(rows[0]);
+    free(rows);
+}
+
+//PRE: capacity > 0, params outlives the session
+//POST: A session for up to capacity concurrent streams, none of them open yet
+lstmSession_t *lstmSessionCreate(lstmParams_t *params, int nFeatures, int capacity) {
+    lstmSession_t *session = malloc(sizeof(lstmSession_t));
+    session->params = params;
+    session->nFeatures = nFeatures;
+    session->capacity = capacity;
+    session->states = contiguousRows(capacity, 2 * params->nNeurons);
+    session->staged = contiguousRows(capacity, nFeatures);
+    session->gates = contiguousRows(capacity, N_GATES * params->nNeurons);
+    session->tickStates = malloc(sizeof(real_t*) * capacity);
+    session->pending = malloc(sizeof(int) * capacity);
+    session->nPending = 0;
+    session->isPending = calloc(capacity, sizeof(bool));
+    session->isOpen = calloc(capacity, sizeof(bool));
+    session->closed = malloc(sizeof(int) * capacity);
+    //Lowest rows first, so a lightly loaded table stays compact
+    for (int i = 0; i < capacity; i++) session->closed[i] = capacity - 1 - i;
+    session->nClosed = capacity;
+    return session;
+}
+
+//POST: The id of a new stream with a zero state, or -1 if every row is in use
+int lstmSessionOpen(lstmSession_t *session) {
+    if (!session->nClosed) return -1;
+    int stream = session->closed[--session->nClosed];
+    memset(session->states[stream], 0, sizeof(real_t) * 2 * session->params->nNeurons);
+    session->isOpen[stream] = true;
+    return stream;
+}
+
+//PRE: stream is open and has no step pending
+void lstmSessionClose(lstmSession_t *session, int stream) {
+    session->isOpen[stream] = false;
+    session->closed[session->nClosed++] = stream;
+}
+
+//PRE: stream is open, x has nFeatures elements
+//POST: Queues x as the stream's next timestep, run by the next tick
+//      Returns false, queueing nothing, if the stream already has a step waiting for this tick
+bool lstmSessionPush(lstmSession_t *session, int stream, real_t *x) {
+    if (!session->isOpen[stream]) {
+        printf("LSTM stream %d isn't open\n", stream);
+        exit(EXIT_FAILURE);
+    }
+    if (session->isPending[stream]) return false;
+    memcpy(session->staged[session->nPending], x, sizeof(real_t) * session->nFeatures);
+    session->isPending[stream] = true;
+    session->pending[session->nPending++] = stream;
+    return true;
+}
+
+//POST: Advances every stream with a pending step by one cell, all in one batch
+//      Returns how many streams were stepped
+int lstmSessionTick(lstmSession_t *session) {
+    int n = session->nPending;
+    if (!n) return 0;
+    for (int i = 0; i < n; i++) session->tickStates[i] = session->states[session->pending[i]];
+
+    matrix2d_t gates = {.data = session->gates, .nRows = n, .nCols = N_GATES * session->params->nNeurons};
+    matrix2d_t states = {.data = session->tickStates, .nRows = n, .nCols = 2 * session->params->nNeurons};
+    projectRows(session->params, session->staged, n, session->nFeatures, gates.data);
+    //The rows are views into the table, so the next states are written straight back
+    updateState(session->params, &gates, &states, &states, NULL);
+
+    for (int i = 0; i < n; i++) session->isPending[session->pending[i]] = false;
+    session->nPending = 0;
+    return n;
+}
+
+//POST: The stream's latest hidden output, nNeurons long, valid until its next tick
+real_t *lstmSessionHidden(lstmSession_t *session, int stream) {
+    return session->states[stream];
+}
+
+void lstmSessionFree(lstmSession_t *session) {
+    freeContiguousRows(session->states);
+    freeContiguousRows(session->staged);
+    freeContiguousRows(session->gates);
+    free(session->tickStates);
+    free(session->pending);
+    free(session->isPending);
+    free(session->isOpen);
+    free(session->closed);
+    free(session);
+}
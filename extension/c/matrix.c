@@ -9,6 +9,7 @@
 #include <stdio.h>
 
 #include "../activation.h"
+#include "../gemm.h"
 
 matrix2d_t *matrixCreate(int nRows, int nCols) {
     matrix2d_t *matrix = malloc(sizeof(matrix2d_t));
@@ -16,9 +17,9 @@ matrix2d_t *matrixCreate(int nRows, int nCols) {
     matrix->nRows = nRows;
     matrix->nCols = nCols;
 
-    double **data = calloc(nRows, sizeof(double*));
+    real_t **data = calloc(nRows, sizeof(real_t*));
     for (int i = 0; i < nRows; i++) {
-        data[i] = calloc(nCols, sizeof(double));
+        data[i] = calloc(nCols, sizeof(real_t));
     }
     matrix->data = data;
 
@@ -32,23 +33,23 @@ matrix3d_t *matrix3DCreate(int nRows, int nCols, int nDepth) {
     matrix->nCols = nCols;
     matrix->nDepth = nDepth;
 
-    double ***data = calloc(nRows, sizeof(double*));
+    real_t ***data = calloc(nRows, sizeof(real_t**));
     for (int i = 0; i < nRows; i++) {
-        data[i] = calloc(nCols, sizeof(double*));
+        data[i] = calloc(nCols, sizeof(real_t*));
         for (int j = 0; j < nCols; j++) {
-            data[i][j] = calloc(nDepth, sizeof(double));
+            data[i][j] = calloc(nDepth, sizeof(real_t));
         }
     }
     matrix->data = data;
     return matrix;
 }
 
-double matrixGet(matrix2d_t *matrix, int row, int col) {
+real_t matrixGet(matrix2d_t *matrix, int row, int col) {
     assert(matrix);
     return matrix->data[row][col];
 }
 
-void matrixSet(matrix2d_t *matrix, int row, int col, double value) {
+void matrixSet(matrix2d_t *matrix, int row, int col, real_t value) {
     assert(matrix);
     matrix->data[row][col] = value;
 }
@@ -135,16 +136,8 @@ matrix2d_t *matrixDotProduct(matrix2d_t *matrix1, matrix2d_t *matrix2) {
     int nShared = matrix1->nCols;
 
     matrix2d_t *output = matrixCreate(nRows, nCols);
-    for (int i = 0; i < nRows; i++) {
-        for (int k = 0; k < nShared; k++) {
-            double matrix1Value = matrixGet(matrix1, i, k);
-            if (matrix1Value != 0) {
-                for (int j = 0; j < nCols; j++) {
-                    matrixSet(output, i, j, matrixGet(output, i, j) + matrix1Value * matrixGet(matrix2, k, j));
-                }
-            }
-        }
-    }
+    //Blocked and split as tuned for the shape on this machine
+    gemm(matrix1->data, matrix2->data, output->data, nRows, nShared, nCols);
     return output;
 }
 
@@ -264,40 +257,112 @@ matrix2d_t *matrixSquareRoot(matrix2d_t *matrix) {
     return matrixElementWise(matrix, sqrt);
 }
 
-// PRE: Pointer to initialised input matrix, kernel matrix, stride and padding
-// POST: Convolution applied to matrix by multiply input matrix with kernel and summing resulting values
-matrix2d_t *matrixConvolution(matrix2d_t *matrix, matrix2d_t *kernel, int stride, int padding) {
-    int dimension = ((matrix->nCols - kernel->nCols + 2 * padding) / stride) + 1;
-    matrix2d_t *resultMatrix = matrixCreate(dimension, dimension);
-    int result = 0;
-    int valueInMatrix = 0;
-    for (int i = 0; i < dimension; i++) {
-        for (int j = 0; j < dimension; j++) {
-            result = 0;
-            for (int k = 0; k < kernel->nRows; k++) {
-                for (int l = 0; l < kernel->nCols; l++) {
-                    if (i + k < padding || j + l < padding || i + k >= matrix->nCols + padding || j + l >= matrix->nCols + padding) {
-                        //checks if current square is in padding
-                        valueInMatrix = 0;
-                    } else {
-                        valueInMatrix = matrixGet(matrix, stride * (i + k) - padding, stride * (j + l) - padding);
+//POST: [lo, hi) are the kernel taps k for which origin + k * dilation lands inside [0, size)
+static void validTaps(int origin, int dilation, int kernelSize, int size, int *lo, int *hi) {
+    *lo = origin < 0 ? (-origin + dilation - 1) / dilation : 0;
+    *hi = origin >= size ? 0 : (size - 1 - origin) / dilation + 1;
+    if (*hi > kernelSize) *hi = kernelSize;
+}
+
+//POST: Size of one axis of the output of a convolution over an axis of length size
+static int convolutionSize(int size, int kernelSize, int stride, int padding, int dilation) {
+    return (size + 2 * padding - dilation * (kernelSize - 1) - 1) / stride + 1;
+}
+
+//The kernels below all walk the same taps: output (i, j) reads input (i * stride + k * dilation - padding,
+//j * stride + l * dilation - padding) through kernel (k, l), or (kRows - 1 - k, kCols - 1 - l) if flipped.
+//Taps landing in the padding are skipped rather than read as zeros
+
+//PRE: result has the output's shape
+//POST: The convolution of matrix by kernel is added to result
+void matrixConvolutionInto(matrix2d_t *matrix, matrix2d_t *kernel, int stride, int padding, int dilation,
+                           bool flipped, matrix2d_t *result) {
+    int kLo, kHi, lLo, lHi, row, col, step = flipped ? -1 : 1;
+    real_t sum, *taps, *inputs;
+    for (int i = 0; i < result->nRows; i++) {
+        row = i * stride - padding;
+        validTaps(row, dilation, kernel->nRows, matrix->nRows, &kLo, &kHi);
+        for (int j = 0; j < result->nCols; j++) {
+            col = j * stride - padding;
+            validTaps(col, dilation, kernel->nCols, matrix->nCols, &lLo, &lHi);
+            sum = 0;
+            for (int k = kLo; k < kHi; k++) {
+                taps = kernel->data[flipped ? kernel->nRows - 1 - k : k] + (flipped ? kernel->nCols - 1 - lLo : lLo);
+                inputs = matrix->data[row + k * dilation] + col + lLo * dilation;
+                for (int l = lLo; l < lHi; l++, taps += step, inputs += dilation) sum += *inputs * *taps;
+            }
+            result->data[i][j] += sum;
+        }
+    }
+}
+
+//PRE: gradient is dL/d(output) of matrixConvolutionInto, inputGradient and kernelGradient have
+//     the input's and kernel's shapes or are NULL if they aren't wanted, in which case neither is matrix or kernel
+//POST: dL/d(input) and dL/d(kernel) are added to them in one pass over the taps,
+//      scattering each output's gradient back over the inputs it read
+void matrixConvolutionBackward(matrix2d_t *matrix, matrix2d_t *kernel, matrix2d_t *gradient,
+                               int stride, int padding, int dilation, bool flipped,
+                               matrix2d_t *inputGradient, matrix2d_t *kernelGradient) {
+    int kRows = kernel ? kernel->nRows : kernelGradient->nRows, kCols = kernel ? kernel->nCols : kernelGradient->nCols;
+    int nRows = matrix ? matrix->nRows : inputGradient->nRows, nCols = matrix ? matrix->nCols : inputGradient->nCols;
+    int kLo, kHi, lLo, lHi, row, col, tap, step = flipped ? -1 : 1;
+    real_t value, *taps, *dTaps, *inputs, *dInputs;
+    for (int i = 0; i < gradient->nRows; i++) {
+        row = i * stride - padding;
+        validTaps(row, dilation, kRows, nRows, &kLo, &kHi);
+        for (int j = 0; j < gradient->nCols; j++) {
+            if (!(value = gradient->data[i][j])) continue;
+            col = j * stride - padding;
+            validTaps(col, dilation, kCols, nCols, &lLo, &lHi);
+            for (int k = kLo; k < kHi; k++) {
+                tap = flipped ? kRows - 1 - k : k;
+                if (inputGradient && kernelGradient) {
+                    taps = kernel->data[tap] + (flipped ? kCols - 1 - lLo : lLo);
+                    dTaps = kernelGradient->data[tap] + (flipped ? kCols - 1 - lLo : lLo);
+                    inputs = matrix->data[row + k * dilation] + col + lLo * dilation;
+                    dInputs = inputGradient->data[row + k * dilation] + col + lLo * dilation;
+                    for (int l = lLo; l < lHi; l++, taps += step, dTaps += step, inputs += dilation, dInputs += dilation) {
+                        *dInputs += value * *taps;
+                        *dTaps += value * *inputs;
                     }
-                    result += valueInMatrix * matrixGet(kernel, k, l);
+                } else if (inputGradient) {
+                    taps = kernel->data[tap] + (flipped ? kCols - 1 - lLo : lLo);
+                    dInputs = inputGradient->data[row + k * dilation] + col + lLo * dilation;
+                    for (int l = lLo; l < lHi; l++, taps += step, dInputs += dilation) *dInputs += value * *taps;
+                } else if (kernelGradient) {
+                    dTaps = kernelGradient->data[tap] + (flipped ? kCols - 1 - lLo : lLo);
+                    inputs = matrix->data[row + k * dilation] + col + lLo * dilation;
+                    for (int l = lLo; l < lHi; l++, dTaps += step, inputs += dilation) *dTaps += value * *inputs;
                 }
             }
-            matrixSet(resultMatrix, i, j, result);
         }
     }
-    return resultMatrix;
+}
+
+// PRE: Pointer to initialised input matrix, kernel matrix, stride, padding and dilation,
+//      i.e. the spacing between the kernel's taps which is 1 for a dense kernel
+// POST: Convolution applied to matrix by multiply input matrix with kernel and summing resulting values
+matrix2d_t *matrixDilatedConvolution(matrix2d_t *matrix, matrix2d_t *kernel, int stride, int padding, int dilation) {
+    matrix2d_t *result = matrixCreate(convolutionSize(matrix->nRows, kernel->nRows, stride, padding, dilation),
+                                      convolutionSize(matrix->nCols, kernel->nCols, stride, padding, dilation));
+    matrixConvolutionInto(matrix, kernel, stride, padding, dilation, false, result);
+    return result;
+}
+
+// PRE: Pointer to initialised input matrix, kernel matrix, stride and padding
+// POST: Convolution applied to matrix by multiply input matrix with kernel and summing resulting values
+matrix2d_t *matrixConvolution(matrix2d_t *matrix, matrix2d_t *kernel, int stride, int padding) {
+    return matrixDilatedConvolution(matrix, kernel, stride, padding, 1);
 }
 
 //PRE: Pointer to initialised input matric, kernel matrix, stride and padding
-//POST: Returns deconvoluted matrix
+//POST: Returns deconvoluted matrix, i.e. the input whose convolution by the rotated kernel has matrix's shape
+//      Convolving the matrix dilated by stride - 1 zeros is the same as scattering it by the flipped kernel
 matrix2d_t *matrixDeconvolution(matrix2d_t *matrix, matrix2d_t *kernel, int stride, int padding) {
-    int numOfZeros = stride - 1;                                                 //number of zeros to insert between adjacent terms in matrix
-    int zeroPadd = kernel->nCols - padding - 1;                                  // amount of padding to matrix
-
-    return matrixConvolution(matrixDilate(matrix, numOfZeros), kernel, 1, zeroPadd);
+    matrix2d_t *result = matrixCreate((matrix->nRows - 1) * stride + kernel->nRows - 2 * padding,
+                                      (matrix->nCols - 1) * stride + kernel->nCols - 2 * padding);
+    matrixConvolutionBackward(NULL, kernel, matrix, stride, padding, 1, true, result, NULL);
+    return result;
 }
 
 // PRE: Initialised input matrices and kernels.
@@ -309,7 +374,7 @@ matrix3d_t *matrix3DConvolution(matrix3d_t *inputs, matrix3d_t *kernels, int str
     int dimension = ((inputs->nCols - kernels->nCols + 2 * padding) / stride) + 1;
 
     matrix3d_t *results = malloc(sizeof(matrix3d_t));
-    results->data = malloc(sizeof(double) * dimension * dimension * kernels->nDepth);
+    results->data = malloc(sizeof(real_t) * dimension * dimension * kernels->nDepth);
     matrix2d_t *input, *kernel;
     for (int i = 0; i < inputs->nDepth; i++) {
         input = matrixCreate(inputs->nRows, inputs->nCols);
@@ -330,114 +395,6 @@ matrix3d_t *matrix3DConvolution(matrix3d_t *inputs, matrix3d_t *kernels, int str
     return results;
 }
 
-/*
- * Return the maximum value of a part of the give matrix,
- * from rowFrom and colFrom (inclusive) to rowTo and colTo (exclusive).
- */
-static double matrixGetLocalMax(matrix2d_t *matrix, matrix2d_t *gradient, int rowFrom, int colFrom, int rowTo, int colTo) {
-    assert(matrix);
-    int nRows = matrix->nRows;
-    int nCols = matrix->nCols;
-    assert(nRows > 0);
-    assert(nCols > 0);
-    assert(rowFrom >= 0);
-    assert(colFrom >= 0);
-    if (rowTo > nRows) {
-        rowTo = nRows;
-    }
-    if (colTo > nCols) {
-        colTo = nCols;
-    }
-
-    int iMax = rowFrom;
-    int jMax = colFrom;
-    double max = matrixGet(matrix, rowFrom, colFrom);
-    for (int i = rowFrom; i < rowTo; i++) {
-        for (int j = colFrom; j < colTo; j++) {
-            double value = matrixGet(matrix, i, j);
-            if (value > max) {
-                max = value;
-                iMax = i;
-                jMax = j;
-            }
-        }
-    }
-
-    matrixSet(gradient, iMax, jMax, 1.0);
-    return max;
-}
-
-/*
- * Return the average value of a part of the give matrix,
- * from rowFrom and colFrom (inclusive) to rowTo and colTo (exclusive).
- */
-static double matrixGetLocalAvg(matrix2d_t *matrix, matrix2d_t *gradient, int rowFrom, int colFrom, int rowTo, int colTo) {
-    assert(matrix);
-    int nRows = matrix->nRows;
-    int nCols = matrix->nCols;
-    assert(nRows > 0);
-    assert(nCols > 0);
-    assert(rowFrom >= 0);
-    assert(colFrom >= 0);
-    int elemNum = (rowTo - rowFrom) * (colTo - colFrom);
-
-    if (rowTo > nRows) {
-        rowTo = nRows;
-    }
-    if (colTo > nCols) {
-        colTo = nCols;
-    }
-
-    double sum = 0;
-    for (int i = rowFrom; i < rowTo; i++) {
-        for (int j = colFrom; j < colTo; j++) {
-            double value = matrixGet(matrix, i, j);
-            sum += value;
-        }
-    }
-
-    double avg = sum / (double) elemNum;
-
-    for (int i = rowFrom; i < rowTo; i++) {
-        for (int j = colFrom; j < colTo; j++) {
-            matrixSet(gradient, i, j, avg);
-        }
-    }
-
-    return avg;
-}
-
-static matrix2d_t *matrixPooling(matrix2d_t *matrix, matrix2d_t *gradient, int stride, int filterSize, double (*poolingFunc)(matrix2d_t *, matrix2d_t *, int, int, int, int)) {
-    assert(matrix);
-    assert(stride);
-
-    int nRows = matrix->nRows;
-    int nCols = matrix->nCols;
-    int newNRows = nRows / stride;
-    int newNCols = nCols / stride;
-
-    matrix2d_t *output = matrixCreate(nRows / stride, nCols / stride);
-    gradient = matrixCreate(nRows, nCols);
-
-    for (int i = 0; i < newNRows; i++) {
-        for (int j = 0; j < newNCols; j++) {
-            int oldI = i * stride;
-            int oldJ = j * stride;
-            matrixSet(output, i, j, poolingFunc(matrix, gradient, oldI, oldJ, oldI + filterSize, oldJ + filterSize));
-        }
-    }
-
-    return output;
-}
-
-matrix2d_t *matrixMaxPooling(matrix2d_t *matrix, matrix2d_t *gradient, int stride, int filterSize) {
-    return matrixPooling(matrix, gradient, stride, filterSize, matrixGetLocalMax);
-}
-
-matrix2d_t *matrixAveragePooling(matrix2d_t *matrix, matrix2d_t *gradient, int stride, int filterSize) {
-    return matrixPooling(matrix, gradient, stride, filterSize, matrixGetLocalAvg);
-}
-
 bool areMatrixesEqual(matrix2d_t *matrix1, matrix2d_t *matrix2, double tolerance) {
     if (matrix1->nRows != matrix2->nRows || matrix1->nCols != matrix2->nCols) {
         return false;
@@ -458,13 +415,14 @@ bool areMatrixesEqual(matrix2d_t *matrix1, matrix2d_t *matrix2, double tolerance
     return true;
 }
 
+//POST: A 1 x nRows * nCols * nDepth row of matrix's values, depth varying fastest
 matrix2d_t *matrixFlatten(matrix3d_t *matrix) {
-    matrix2d_t *flatTranspose = matrixCreate(1, matrix->nRows * matrix->nCols * matrix->nDepth);
+    matrix2d_t *flatTranspose = matrixCreate(matrix->nRows * matrix->nCols * matrix->nDepth, 1);
 
     for (int i = 0; i < matrix->nRows; i++) {
         for (int j = 0; j < matrix->nCols; j++) {
             for (int k = 0; k < matrix->nDepth; k++) {
-                matrixSet(flatTranspose, (i * matrix->nCols) + (j * matrix->nDepth) + k, 0, matrix->data[i][j][k]);
+                matrixSet(flatTranspose, (i * matrix->nCols + j) * matrix->nDepth + k, 0, matrix->data[i][j][k]);
             }
         }
     }
@@ -473,21 +431,23 @@ matrix2d_t *matrixFlatten(matrix3d_t *matrix) {
     return flattened;
 }
 
+//PRE: matrix is a nRows * nCols * nDepth x 1 column, i.e. the transpose of what matrixFlatten gives
+//POST: The 3D matrix matrixFlatten flattens into matrix's transpose
 matrix3d_t *matrixUnflatten(matrix2d_t *matrix, int nRows, int nCols, int nDepth) {
     matrix3d_t *unflattened = matrix3DCreate(nRows, nCols, nDepth);
 
     for (int i = 0; i < nRows; i++) {
         for (int j = 0; j < nCols; j++) {
             for (int k = 0; k < nDepth; k++) {
-                unflattened->data[i][j][k] = matrixGet(matrix, (i * nCols) + (j * nDepth) + k, 0);
+                unflattened->data[i][j][k] = matrixGet(matrix, (i * nCols + j) * nDepth + k, 0);
             }
         }
     }
     return unflattened;
 }
 
-double* flatten2d(matrix2d_t *matrix) {
-    double *flattened = calloc(matrix->nRows * matrix->nCols, sizeof(double));
+real_t* flatten2d(matrix2d_t *matrix) {
+    real_t *flattened = calloc(matrix->nRows * matrix->nCols, sizeof(real_t));
     for (int i = 0; i < matrix->nRows; i++) {
         for (int j = 0; j < matrix->nCols; j++) {
             flattened[(i * matrix->nCols) + j] = matrixGet(matrix, i, j);
@@ -513,3 +473,12 @@ void matrixFree(matrix2d_t *matrix) {
     free(matrix->data);
     free(matrix);
 }
+
+void matrix3DFree(matrix3d_t *matrix) {
+    for (int i = 0; i < matrix->nRows; i++) {
+        for (int j = 0; j < matrix->nCols; j++) free(matrix->data[i][j]);
+        free(matrix->data[i]);
+    }
+    free(matrix->data);
+    free(matrix);
+}
@@ -2,6 +2,8 @@
 
 #include <stdlib.h>
 
+#include "../util.h"
+
 node_t *nodeInit(char *name, int numInputs, int numOutputs, bool isData) {
     node_t *newNode = malloc(sizeof(node_t));
     newNode->name = name;
@@ -12,13 +14,23 @@ node_t *nodeInit(char *name, int numInputs, int numOutputs, bool isData) {
     newNode->outputIdx = 0;
     newNode->n = numInputs;
     newNode->m = numOutputs;
-    newNode->matrix = malloc(sizeof(matrix_t));
+    //Zeroed so a node holds no activation until execute gives it one
+    newNode->matrix = calloc(1, sizeof(matrix_t));
     newNode->optimiserMatrix = NULL;
+    newNode->poolingArgmax = NULL;
+    newNode->gradient = NULL;
+    newNode->specialised = NULL;
 
     if (isData) {
         newNode->content.data = malloc(sizeof(data_t));
         newNode->content.data->internalNode = true;
-        newNode->content.data->data = malloc(sizeof(matrix_t));
+        newNode->content.data->constant = false;
+        newNode->content.data->data = calloc(1, sizeof(matrix_t));
+        newNode->content.data->quantized = NULL;
+        newNode->content.data->sparse = NULL;
+    } else {
+        //Readers like graphFileRead only set the fields their function uses
+        newNode->content.operation = (operation_t) {0};
     }
     return newNode;
 }
@@ -68,6 +80,87 @@ graph_t *graphInit(char *name, int n, node_t **entryPoints,
     return tmp;
 }
 
+//PRE: node is part of a graph being cloned
+//POST: A copy of node with no links; weights and biases share their data with node
+static node_t *nodeClone(node_t *node) {
+    node_t *copy = nodeInit(node->name, node->n, node->m, node->isData);
+    copy->inputIdx = node->inputIdx;
+    copy->outputIdx = node->outputIdx;
+    if (!node->isData) {
+        copy->content.operation = node->content.operation;
+    } else if (node->content.data->internalNode) {
+        free(copy->content.data->data);
+        free(copy->content.data);
+        copy->content.data = node->content.data;
+    } else {
+        //Inputs and targets are primed per graph so they can't be shared
+        copy->content.data->internalNode = false;
+        copy->content.data->data->matrix2d = node->content.data->data->matrix2d;
+    }
+    //Layers use the output matrix to infer the shape of the next layer
+    copy->matrix->matrix2d = node->matrix->matrix2d;
+    copy->optimiserMatrix = node->optimiserMatrix;
+    //Each clone pools its own input
+    copy->poolingArgmax = NULL;
+    copy->specialised = node->specialised;
+    return copy;
+}
+
+static node_t *findClone(node_t **originals, node_t **clones, int length, node_t *node) {
+    for (int i = 0; i < length; i++) {
+        if (originals[i] == node) return clones[i];
+    }
+    return NULL;
+}
+
+//PRE: All nodes in the graph are reachable from its entry points
+//POST: A graph with the same structure whose nodes can be executed independently of graph's,
+//      weights and biases are shared so updates to one are seen by the other
+graph_t *graphClone(graph_t *graph) {
+    node_t **originals = NULL, **clones = NULL;
+    int nOriginals = 0, nClones = 0;
+
+    node_t **stack = NULL;
+    int stackSize = 0;
+    for (int i = 0; i < graph->n; i++) push(&stack, &stackSize, graph->entryPoints[i]);
+
+    node_t *node;
+    while (stackSize) {
+        node = pop(&stack, &stackSize);
+        if (!contains(originals, nOriginals, node)) {
+            push(&originals, &nOriginals, node);
+            push(&clones, &nClones, nodeClone(node));
+            for (int i = 0; i < node->m; i++) {
+                if (node->outputs[i]) push(&stack, &stackSize, node->outputs[i]);
+            }
+        }
+    }
+
+    for (int i = 0; i < nOriginals; i++) {
+        for (int j = 0; j < originals[i]->n; j++) {
+            clones[i]->inputs[j] = findClone(originals, clones, nOriginals, originals[i]->inputs[j]);
+        }
+        for (int j = 0; j < originals[i]->m; j++) {
+            clones[i]->outputs[j] = findClone(originals, clones, nOriginals, originals[i]->outputs[j]);
+        }
+    }
+
+    node_t **entryPoints = malloc(sizeof(node_t*) * graph->n);
+    for (int i = 0; i < graph->n; i++) {
+        entryPoints[i] = findClone(originals, clones, nOriginals, graph->entryPoints[i]);
+    }
+
+    node_t **exitPoints = malloc(sizeof(node_t*) * graph->m);
+    for (int i = 0; i < graph->m; i++) {
+        exitPoints[i] = findClone(originals, clones, nOriginals, graph->exitPoints[i]);
+    }
+
+    free(stack);
+    free(originals);
+    free(clones);
+    return graphInit(graph->name, graph->n, entryPoints, graph->m, exitPoints);
+}
+
 // Tests
 /*
 int main() {
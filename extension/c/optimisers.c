@@ -15,9 +15,14 @@ void sgd(node_t *weight, int nArgs, ...) {
 
     va_end(args);
 
-    matrix2d_t *newWeights = matrixSubtract(weight->content.data->data->matrix2d, 
-                                            matrixScalarProduct(weight->matrix->matrix2d, lRate));
-    weight->content.data->data->matrix2d = newWeights;
+    //Updated in place so concurrent trainers see the same buffer
+    matrix2d_t *weights = weight->content.data->data->matrix2d;
+    matrix2d_t *gradients = weight->matrix->matrix2d;
+    for (int i = 0; i < weights->nRows; i++) {
+        for (int j = 0; j < weights->nCols; j++) {
+            matrixSet(weights, i, j, matrixGet(weights, i, j) - lRate * matrixGet(gradients, i, j));
+        }
+    }
 }
 
 //PRE: Node containing weight matrix stored in node->content->data, gradients stored in node->matrix,
@@ -33,13 +38,17 @@ void sgdMomentum(node_t *weight, int nArgs, ...) {
     double momentum = va_arg(args, double); 
     va_end(args);
 
-    matrix2d_t *newVelocity = matrixSubtract(matrixScalarProduct(weight->optimiserMatrix->matrix2d, momentum), 
-                                             matrixScalarProduct(weight->matrix->matrix2d, lRate));
-    matrix2d_t *newWeight = matrixAdd(weight->content.data->data->matrix2d, newVelocity);
-
-    weight->content.data->data->matrix2d = newWeight;
-    matrixFree(weight->optimiserMatrix->matrix2d);
-    weight->optimiserMatrix->matrix2d = newVelocity;
+    matrix2d_t *weights = weight->content.data->data->matrix2d;
+    matrix2d_t *gradients = weight->matrix->matrix2d;
+    matrix2d_t *velocity = weight->optimiserMatrix->matrix2d;
+    double newVelocity;
+    for (int i = 0; i < weights->nRows; i++) {
+        for (int j = 0; j < weights->nCols; j++) {
+            newVelocity = momentum * matrixGet(velocity, i, j) - lRate * matrixGet(gradients, i, j);
+            matrixSet(velocity, i, j, newVelocity);
+            matrixSet(weights, i, j, matrixGet(weights, i, j) + newVelocity);
+        }
+    }
 }
 
 static double inverse(double a) {
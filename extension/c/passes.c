@@ -0,0 +1,505 @@
+#include "../passes.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../convolution.h"
+#include "../fusion.h"
+#include "../kernels.h"
+#include "../matrix.h"
+#include "../nodes.h"
+#include "../pooling.h"
+#include "../predict.h"
+#include "../quantize.h"
+#include "../sparse.h"
+#include "../util.h"
+
+static int compareNodeIndex(const void *a, const void *b) {
+    node_t *first = ((nodeIndex_t*) a)->node, *second = ((nodeIndex_t*) b)->node;
+    return (first > second) - (first < second);
+}
+
+//POST: nodes sorted by address, so indexOf can find where each one is in the schedule
+nodeIndex_t *indexNodes(node_t **nodes, int length) {
+    nodeIndex_t *sorted = malloc(sizeof(nodeIndex_t) * length);
+    for (int i = 0; i < length; i++) sorted[i] = (nodeIndex_t) {.node = nodes[i], .idx = i};
+    qsort(sorted, length, sizeof(nodeIndex_t), compareNodeIndex);
+    return sorted;
+}
+
+//POST: node's index in the schedule sorted is made from, -1 if it isn't in it
+int indexOf(nodeIndex_t *sorted, int length, node_t *node) {
+    nodeIndex_t key = {.node = node}, *found;
+    if (!node) return -1;
+    found = bsearch(&key, sorted, length, sizeof(nodeIndex_t), compareNodeIndex);
+    return found ? found->idx : -1;
+}
+
+//POST: Whether node holds dense weights read by nothing else, which a pass can rewrite without changing other nodes
+bool isOwnedWeights(node_t *node) {
+    return node->isData && node->content.data->internalNode && 1 == node->m
+           && !node->content.data->quantized && !node->content.data->sparse && node->content.data->data->matrix2d;
+}
+
+//PRE: shapes and sorted were made from nodes, the schedule of length nodes that node is in
+//POST: node's weights if it's a product of an activation with owned weights, otherwise NULL
+//      Products matrixDotProduct would have to swap are left alone too
+node_t *ownedProductWeights(node_t *node, shape_t *shapes, nodeIndex_t *sorted, int length) {
+    if (node->isData || DOT != node->content.operation.funcName || 2 != node->n) return NULL;
+    int input = indexOf(sorted, length, node->inputs[0]);
+    node_t *weights = node->inputs[1];
+    if (input < 0 || !isOwnedWeights(weights) || shapes[input].nCols != weights->content.data->data->matrix2d->nRows) {
+        return NULL;
+    }
+    return weights;
+}
+
+static bool isConstant(node_t *node) {
+    return node && node->isData && node->content.data->internalNode && node->content.data->constant;
+}
+
+//POST: Whether node is a constant with every element equal to value
+static bool isConstantFill(node_t *node, double value) {
+    if (!isConstant(node)) return false;
+    matrix2d_t *matrix = node->content.data->data->matrix2d;
+    for (int i = 0; i < matrix->nRows; i++) {
+        for (int j = 0; j < matrix->nCols; j++) {
+            if (matrix->data[i][j] != value) return false;
+        }
+    }
+    return true;
+}
+
+//POST: The first of input's outputs which is output is taken out
+static void unlinkOutput(node_t *input, node_t *output) {
+    for (int i = 0; i < input->m; i++) {
+        if (input->outputs[i] != output) continue;
+        for (int j = i + 1; j < input->m; j++) input->outputs[j - 1] = input->outputs[j];
+        input->m--;
+        input->outputIdx = input->m;
+        return;
+    }
+}
+
+static void addOutput(node_t *node, node_t *output) {
+    node->outputs = realloc(node->outputs, sizeof(node_t*) * (node->m + 1));
+    node->outputs[node->m++] = output;
+    node->outputIdx = node->m;
+}
+
+//POST: node is no longer one of its inputs' outputs
+static void detach(node_t *node) {
+    for (int i = 0; i < node->n; i++) {
+        if (node->inputs[i]) unlinkOutput(node->inputs[i], node);
+    }
+}
+
+//POST: Everything which read from now reads to instead, so from has no outputs left
+static void redirect(node_t *from, node_t *to) {
+    node_t *output;
+    for (int i = 0; i < from->m; i++) {
+        output = from->outputs[i];
+        if (!output) continue;
+        for (int j = 0; j < output->n; j++) {
+            if (output->inputs[j] == from) output->inputs[j] = to;
+        }
+        addOutput(to, output);
+    }
+    from->m = from->outputIdx = 0;
+}
+
+//PRE: Every node marked dead has been detached from its inputs
+//POST: The dead nodes are freed and taken out of the schedule and graph's entry points
+static void sweep(graph_t *graph, node_t **nodes, int *length, bool *dead) {
+    int kept = 0, j;
+    for (int i = 0; i < *length; i++) {
+        if (!dead[i]) {
+            nodes[kept++] = nodes[i];
+            continue;
+        }
+        for (j = 0; j < graph->n && graph->entryPoints[j] != nodes[i]; j++);
+        if (j < graph->n) {
+            for (j++; j < graph->n; j++) graph->entryPoints[j - 1] = graph->entryPoints[j];
+            graph->n--;
+        }
+        //Its data and activation may be shared with a clone, so only the node itself goes
+        free(nodes[i]->inputs);
+        free(nodes[i]->outputs);
+        free(nodes[i]->matrix);
+        free(nodes[i]);
+    }
+    *length = kept;
+}
+
+//PRE: nodes is a forward schedule as made by schedule
+//POST: Every operation and constant which no exit point depends on is removed
+//      Weights and inputs are kept even when unread, as the trainers still look for them
+int eliminateDeadNodes(graph_t *graph, node_t **nodes, int *length) {
+    int n = *length, idx, nDead = 0;
+    nodeIndex_t *sorted = indexNodes(nodes, n);
+    bool *live = calloc(n, sizeof(bool)), *dead = malloc(sizeof(bool) * n);
+    //Readers come before the nodes they read, so each node's outputs are already decided
+    for (int i = 0; i < n; i++) {
+        live[i] = (nodes[i]->isData && !isConstant(nodes[i])) || contains(graph->exitPoints, graph->m, nodes[i]);
+        for (int j = 0; j < nodes[i]->m && !live[i]; j++) {
+            idx = indexOf(sorted, n, nodes[i]->outputs[j]);
+            live[i] = idx >= 0 && live[idx];
+        }
+        dead[i] = !live[i];
+        nDead += dead[i];
+    }
+    for (int i = 0; i < n; i++) {
+        if (dead[i]) detach(nodes[i]);
+    }
+    sweep(graph, nodes, length, dead);
+    free(sorted);
+    free(live);
+    free(dead);
+    return nDead;
+}
+
+//POST: node holds its activation as a constant, with no inputs, and is one of graph's entry points
+static void foldNode(graph_t *graph, node_t *node) {
+    detach(node);
+    free(node->inputs);
+    node->inputs = NULL;
+    node->n = node->inputIdx = 0;
+    node->isData = true;
+    node->content.data = malloc(sizeof(data_t));
+    node->content.data->internalNode = true;
+    node->content.data->constant = true;
+    node->content.data->quantized = NULL;
+    node->content.data->sparse = NULL;
+    node->content.data->data = malloc(sizeof(matrix_t));
+    node->content.data->data->matrix2d = node->matrix->matrix2d;
+    push(&graph->entryPoints, &graph->n, node);
+}
+
+//PRE: nodes is a forward schedule as made by schedule
+//POST: Every operation reading only constants, directly or through other such operations, is run once
+//      Those read by anything else become constants holding their result, the rest are removed
+int foldConstants(graph_t *graph, node_t **nodes, int *length) {
+    int n = *length, idx;
+    nodeIndex_t *sorted = indexNodes(nodes, n);
+    bool *constant = malloc(sizeof(bool) * n);
+    //Inputs run before the nodes reading them, i.e. from the end of the schedule
+    for (int i = n - 1; i >= 0; i--) {
+        if (nodes[i]->isData) {
+            constant[i] = isConstant(nodes[i]);
+            continue;
+        }
+        constant[i] = nodes[i]->n > 0;
+        for (int j = 0; j < nodes[i]->n && constant[i]; j++) {
+            idx = indexOf(sorted, n, nodes[i]->inputs[j]);
+            constant[i] = idx >= 0 && constant[idx];
+        }
+    }
+
+    node_t **folded = NULL, **subgraph = NULL;
+    int nFolded = 0, nSubgraph = 0;
+    bool readOutside;
+    for (int i = 0; i < n; i++) {
+        if (!constant[i]) continue;
+        push(&subgraph, &nSubgraph, nodes[i]);
+        if (nodes[i]->isData) continue;
+        readOutside = contains(graph->exitPoints, graph->m, nodes[i]);
+        for (int j = 0; j < nodes[i]->m && !readOutside; j++) {
+            idx = indexOf(sorted, n, nodes[i]->outputs[j]);
+            readOutside = idx < 0 || !constant[idx];
+        }
+        if (readOutside) push(&folded, &nFolded, nodes[i]);
+    }
+
+    if (nFolded) {
+        execute(subgraph, nSubgraph, FORWARD);
+        for (int i = 0; i < nFolded; i++) foldNode(graph, folded[i]);
+        //What the folded nodes read is now unread
+        eliminateDeadNodes(graph, nodes, length);
+    }
+    free(folded);
+    free(subgraph);
+    free(sorted);
+    free(constant);
+    return nFolded;
+}
+
+//POST: Whether a and b are the same input, or constants with the same values
+static bool sameInput(node_t *a, node_t *b) {
+    if (a == b) return true;
+    if (!isConstant(a) || !isConstant(b)) return false;
+    return areMatrixesEqual(a->content.data->data->matrix2d, b->content.data->data->matrix2d, 0);
+}
+
+//POST: Whether operations a and b always compute the same activation
+static bool isEquivalent(node_t *a, node_t *b) {
+    operation_t *first = &a->content.operation, *second = &b->content.operation;
+    if (b->isData || first->funcName != second->funcName || first->activationName != second->activationName
+        || (FUSED == first->funcName && first->kernel != second->kernel) || a->n != b->n) return false;
+
+    bool same = true;
+    for (int i = 0; i < a->n && same; i++) same = sameInput(a->inputs[i], b->inputs[i]);
+    if (same) return true;
+    //ADD and MULTIPLY don't care which way round their inputs are
+    return (ADD == first->funcName || MULTIPLY == first->funcName)
+           && sameInput(a->inputs[0], b->inputs[1]) && sameInput(a->inputs[1], b->inputs[0]);
+}
+
+//PRE: nodes is a forward schedule as made by schedule
+//POST: Of any operations with the same function, attributes and inputs, only the first one run is kept,
+//      and the others' readers read it instead
+int eliminateCommonSubexpressions(graph_t *graph, node_t **nodes, int *length) {
+    int n = *length, idx, nMerged = 0;
+    nodeIndex_t *sorted = indexNodes(nodes, n);
+    node_t *node, *sibling;
+    for (int i = n - 1; i >= 0; i--) {
+        node = nodes[i];
+        if (node->isData || !node->n || !node->inputs[0] || contains(graph->exitPoints, graph->m, node)) continue;
+        //Anything equivalent reads the same first input, so it's one of that input's outputs
+        for (int j = 0; j < node->inputs[0]->m; j++) {
+            sibling = node->inputs[0]->outputs[j];
+            idx = indexOf(sorted, n, sibling);
+            //Only nodes run before this one can stand in for it
+            if (idx <= i || !sibling->m || !isEquivalent(node, sibling)) continue;
+            redirect(node, sibling);
+            nMerged++;
+            break;
+        }
+    }
+    //Merged nodes have no readers left
+    if (nMerged) eliminateDeadNodes(graph, nodes, length);
+    free(sorted);
+    return nMerged;
+}
+
+//POST: The input node always passes straight through, NULL if it isn't an identity
+static node_t *identityOf(node_t *node) {
+    switch (node->content.operation.funcName) {
+        case ACTIVATION:
+            return LINEAR == node->content.operation.activationName ? node->inputs[0] : NULL;
+        case ADD:
+            if (isConstantFill(node->inputs[0], 0)) return node->inputs[1];
+            //Fall through, as x + 0 is x - 0
+        case SUBTRACT:
+            return isConstantFill(node->inputs[1], 0) ? node->inputs[0] : NULL;
+        case MULTIPLY:
+            if (isConstantFill(node->inputs[0], 1)) return node->inputs[1];
+            return isConstantFill(node->inputs[1], 1) ? node->inputs[0] : NULL;
+        default:
+            return NULL;
+    }
+}
+
+//PRE: nodes is a forward schedule as made by schedule
+//POST: Linear activations, adding or subtracting constant zeros and multiplying by constant ones
+//      are removed, and their readers read the input passed through instead
+int eliminateIdentities(graph_t *graph, node_t **nodes, int *length) {
+    int nRemoved = 0;
+    node_t *input;
+    for (int i = *length - 1; i >= 0; i--) {
+        if (nodes[i]->isData || contains(graph->exitPoints, graph->m, nodes[i])) continue;
+        input = identityOf(nodes[i]);
+        if (!input) continue;
+        redirect(nodes[i], input);
+        nRemoved++;
+    }
+    if (nRemoved) eliminateDeadNodes(graph, nodes, length);
+    return nRemoved;
+}
+
+static shape_t shapeOfMatrix(matrix2d_t *matrix) {
+    return matrix ? (shape_t) {matrix->nRows, matrix->nCols} : (shape_t) {0, 0};
+}
+
+//POST: Entry col of a 1 x n config, 0 if it isn't known before running
+static int configAt(node_t *config, int col) {
+    matrix2d_t *matrix = config && config->isData ? config->content.data->data->matrix2d : NULL;
+    return matrix && col < matrix->nCols ? (int) matrixGet(matrix, 0, col) : 0;
+}
+
+//PRE: in holds the shapes of node's inputs
+//POST: The shape of node's activation, from its inputs' shapes where it can be worked out
+//      before running and otherwise from its current activation
+static shape_t outputShape(node_t *node, shape_t *in) {
+    if (node->isData) {
+        sparse_t *sparse = node->content.data->sparse;
+        if (sparse) return (shape_t) {sparse->nRows, sparse->nCols};
+        quantized_t *quantized = node->content.data->quantized;
+        if (quantized) return (shape_t) {quantized->nRows, quantized->nCols};
+        matrix2d_t *matrix = node->content.data->data->matrix2d;
+        return shapeOfMatrix(matrix ? matrix : node->matrix->matrix2d);
+    }
+    int stride, padding, dilation, nRows = 0;
+    switch (node->content.operation.funcName) {
+        case ADD:
+        case SUBTRACT:
+        case MULTIPLY:
+        case ACTIVATION:
+        case FUSED:
+            return in[0];
+        case DOT:
+        case QUANTIZED_DOT:
+        case SPARSE_DOT:
+            return (shape_t) {in[0].nRows, in[1].nCols};
+        case TRANSPOSE:
+            return (shape_t) {in[0].nCols, in[0].nRows};
+        case CONVOLUTION:
+            if (!(stride = configAt(node->inputs[2], 0))) break;
+            padding = configAt(node->inputs[2], 1);
+            dilation = configAt(node->inputs[2], 2) ? configAt(node->inputs[2], 2) : 1;
+            return (shape_t) {(in[0].nRows + 2 * padding - dilation * (in[1].nRows - 1) - 1) / stride + 1,
+                              (in[0].nCols + 2 * padding - dilation * (in[1].nCols - 1) - 1) / stride + 1};
+        case DECONVOLUTION:
+            if (!(stride = configAt(node->inputs[2], 0))) break;
+            padding = configAt(node->inputs[2], 1);
+            return (shape_t) {(in[0].nRows - 1) * stride + in[1].nRows - 2 * padding,
+                              (in[0].nCols - 1) * stride + in[1].nCols - 2 * padding};
+        case MAX_POOLING:
+        case AVERAGE_POOLING:
+            if (!(stride = configAt(node->inputs[1], 0))) break;
+            return (shape_t) {poolingSize(in[0].nRows, stride), poolingSize(in[0].nCols, stride)};
+        case LSTM_CELL:
+            return (shape_t) {in[0].nRows, 2 * in[3].nRows};
+        case LSTM_HIDDEN:
+            return (shape_t) {in[0].nRows, in[0].nCols / 2};
+        case LSTM_PROJECTION:
+            for (int t = 0; t < node->n - 2; t++) nRows += in[t].nRows;
+            return (shape_t) {nRows, in[node->n - 2].nCols};
+        case LSTM_STEP:
+            return in[1];
+        default:
+            break;
+    }
+    return shapeOfMatrix(node->matrix->matrix2d);
+}
+
+//POST: Floating point operations for node to make an activation of shape out; a multiply-add is two
+//      and moving data around is free
+static long nodeFlops(node_t *node, shape_t out, shape_t *in) {
+    if (node->isData) return 0;
+    long elements = (long) out.nRows * out.nCols;
+    int filterSize;
+    sparse_t *sparse;
+    switch (node->content.operation.funcName) {
+        case ADD:
+        case SUBTRACT:
+        case MULTIPLY:
+        case ACTIVATION:
+            return elements;
+        case FUSED:
+            return elements * node->content.operation.kernel->nOps;
+        case DOT:
+        case QUANTIZED_DOT:
+            return 2 * elements * in[0].nCols;
+        case SPARSE_DOT:
+            sparse = node->inputs[1]->content.data->sparse;
+            if (!sparse) return 2 * elements * in[0].nCols;
+            return 2L * out.nRows * sparse->nBlocks * sparse->blockSize * sparse->blockSize;
+        case CONVOLUTION:
+            return 2 * elements * in[1].nRows * in[1].nCols;
+        case DECONVOLUTION:
+            //Each input element is scattered through the kernel
+            return 2L * in[0].nRows * in[0].nCols * in[1].nRows * in[1].nCols;
+        case MAX_POOLING:
+        case AVERAGE_POOLING:
+            filterSize = configAt(node->inputs[1], 1);
+            return elements * filterSize * filterSize;
+        case LSTM_CELL:
+            return 2L * in[0].nRows * ((long) in[2].nRows * in[2].nCols + (long) in[3].nRows * in[3].nCols);
+        case LSTM_PROJECTION:
+            return 2 * (long) out.nRows * in[node->n - 2].nRows * in[node->n - 2].nCols;
+        case LSTM_STEP:
+            //Only the running rows are multiplied by U
+            return 2L * configAt(node->inputs[3], 1) * in[2].nRows * in[2].nCols;
+        default:
+            return 0;
+    }
+}
+
+//PRE: nodes is a forward schedule as made by schedule
+//POST: The shape of each node's activation, 0 x 0 where it isn't known before running
+shape_t *scheduleShapes(node_t **nodes, int length) {
+    nodeIndex_t *sorted = indexNodes(nodes, length);
+    shape_t *shapes = malloc(sizeof(shape_t) * length), *in;
+    int idx;
+    for (int i = length - 1; i >= 0; i--) {
+        in = malloc(sizeof(shape_t) * (nodes[i]->n + 1));
+        for (int j = 0; j < nodes[i]->n; j++) {
+            idx = indexOf(sorted, length, nodes[i]->inputs[j]);
+            in[j] = idx < 0 ? (shape_t) {0, 0} : shapes[idx];
+        }
+        shapes[i] = outputShape(nodes[i], in);
+        free(in);
+    }
+    free(sorted);
+    return shapes;
+}
+
+//PRE: nodes is a forward schedule as made by schedule
+//POST: Roughly how many floating point operations one FORWARD over nodes does
+long scheduleFlops(node_t **nodes, int length) {
+    nodeIndex_t *sorted = indexNodes(nodes, length);
+    shape_t *shapes = scheduleShapes(nodes, length), *in;
+    long flops = 0;
+    int idx;
+    for (int i = 0; i < length; i++) {
+        in = malloc(sizeof(shape_t) * (nodes[i]->n + 1));
+        for (int j = 0; j < nodes[i]->n; j++) {
+            idx = indexOf(sorted, length, nodes[i]->inputs[j]);
+            in[j] = idx < 0 ? (shape_t) {0, 0} : shapes[idx];
+        }
+        flops += nodeFlops(nodes[i], shapes[i], in);
+        free(in);
+    }
+    free(sorted);
+    free(shapes);
+    return flops;
+}
+
+//PRE: nodes is a forward schedule of graph, as made by schedule
+//POST: Each pass has been run on nodes in order, and if verbose the nodes and FLOPs before and
+//      after each one are printed
+void runPasses(pass_t *passes, int nPasses, graph_t *graph, node_t **nodes, int *length, bool verbose) {
+    int before, changed;
+    long flopsBefore;
+    for (int p = 0; p < nPasses; p++) {
+        before = *length;
+        flopsBefore = verbose ? scheduleFlops(nodes, *length) : 0;
+        changed = passes[p].run(graph, nodes, length);
+        if (verbose) {
+            printf("%-12s %3d changed, %5d -> %5d nodes, %ld -> %ld FLOPs\n", passes[p].name, changed,
+                   before, *length, flopsBefore, scheduleFlops(nodes, *length));
+        }
+    }
+}
+
+static int fuseElementwisePass(graph_t *graph, node_t **nodes, int *length) {
+    return fuseElementwise(nodes, length).nKernels;
+}
+
+static int prepareKernelsPass(graph_t *graph, node_t **nodes, int *length) {
+    return prepareKernels(nodes, *length);
+}
+
+static int selectConvolutionsPass(graph_t *graph, node_t **nodes, int *length) {
+    return selectConvolutions(nodes, *length);
+}
+
+//Identities and duplicates can stop chains from fusing, so fusion goes last but for choosing
+//kernels and convolution algorithms, which is done once here rather than on every step
+static pass_t defaultPasses[] = {
+    {"dead nodes", eliminateDeadNodes},
+    {"constants", foldConstants},
+    {"CSE", eliminateCommonSubexpressions},
+    {"identities", eliminateIdentities},
+    {"fusion", fuseElementwisePass},
+    {"kernels", prepareKernelsPass},
+    {"convolutions", selectConvolutionsPass}
+};
+
+//PRE: nodes is a forward schedule of graph, before any tape or plan is made from it
+//POST: The default passes have been run on nodes, ending with elementwise fusion and choosing kernels
+//      and convolution algorithms
+void optimiseSchedule(graph_t *graph, node_t **nodes, int *length, bool verbose) {
+    runPasses(defaultPasses, sizeof(defaultPasses) / sizeof(pass_t), graph, nodes, length, verbose);
+}
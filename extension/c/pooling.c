@@ -0,0 +1,274 @@
+#include "../pooling.h"
+
+#include <assert.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "../matrix.h"
+
+//Windows are filterSize x filterSize and start every stride rows and columns, giving size / stride
+//outputs along each axis. Windows running off the bottom or right edge are clipped, and averages
+//still divide by the full window as if the edge were padded with zeros.
+//The kernels work a plane at a time, on an array of its rows, with the innermost loops running
+//along a row so they can be vectorised
+
+//Average pooling windows of at most this many elements are summed directly,
+//which reads no more than the four corners of a summed-area table
+#define DIRECT_AVERAGE_MAX 4
+
+tensor4d_t *tensor4DCreate(int nBatch, int nChannels, int nRows, int nCols) {
+    tensor4d_t *tensor = malloc(sizeof(tensor4d_t));
+    tensor->nBatch = nBatch;
+    tensor->nChannels = nChannels;
+    tensor->nRows = nRows;
+    tensor->nCols = nCols;
+    tensor->data = calloc((size_t) nBatch * nChannels * nRows * nCols, sizeof(real_t));
+    return tensor;
+}
+
+void tensor4DFree(tensor4d_t *tensor) {
+    free(tensor->data);
+    free(tensor);
+}
+
+//POST: Number of windows along an axis of length size
+int poolingSize(int size, int stride) {
+    assert(stride > 0);
+    return size / stride;
+}
+
+//POST: rows[i] points to row i of the nRows x nCols plane
+static void planeRows(real_t *plane, int nRows, int nCols, real_t **rows) {
+    for (int i = 0; i < nRows; i++) rows[i] = plane + (size_t) i * nCols;
+}
+
+//PRE: argmax has an entry for every output
+//POST: Each output is its window's first maximum in row-major order, whose index in the
+//      flattened input plane is saved in argmax
+static void maxPoolPlane(real_t **input, int nRows, int nCols, int stride, int filterSize,
+                         real_t **output, int32_t *argmax) {
+    int outRows = poolingSize(nRows, stride), outCols = poolingSize(nCols, stride);
+    int row, nCovered;
+    real_t *in, *out, value;
+    int32_t *indices;
+    for (int i = 0; i < outRows; i++) {
+        out = output[i];
+        indices = argmax + (size_t) i * outCols;
+        for (int j = 0; j < outCols; j++) out[j] = -INFINITY;
+        for (int k = 0; k < filterSize && (row = i * stride + k) < nRows; k++) {
+            in = input[row];
+            for (int l = 0; l < filterSize && l < nCols; l++) {
+                //Windows whose column l is off the right edge
+                nCovered = (nCols - l + stride - 1) / stride;
+                if (nCovered > outCols) nCovered = outCols;
+                for (int j = 0; j < nCovered; j++) {
+                    value = in[j * stride + l];
+                    if (value > out[j]) {
+                        out[j] = value;
+                        indices[j] = row * nCols + j * stride + l;
+                    }
+                }
+            }
+        }
+    }
+}
+
+//POST: Each output's gradient is added to the input its maximum came from
+static void maxPoolPlaneBackward(real_t **gradient, int outRows, int outCols, int32_t *argmax,
+                                 int nCols, real_t **inputGradient) {
+    int32_t index;
+    for (int i = 0; i < outRows; i++) {
+        for (int j = 0; j < outCols; j++) {
+            index = argmax[(size_t) i * outCols + j];
+            inputGradient[index / nCols][index % nCols] += gradient[i][j];
+        }
+    }
+}
+
+//PRE: table has (nRows + 1) x (nCols + 1) entries
+//POST: table[r][c] is the sum of plane[0..r)[0..c)
+static void summedAreaTable(real_t **plane, int nRows, int nCols, real_t *table) {
+    int width = nCols + 1;
+    real_t running, *above, *below;
+    for (int c = 0; c < width; c++) table[c] = 0;
+    for (int r = 0; r < nRows; r++) {
+        above = table + (size_t) r * width;
+        below = above + width;
+        below[0] = running = 0;
+        for (int c = 0; c < nCols; c++) {
+            running += plane[r][c];
+            below[c + 1] = above[c + 1] + running;
+        }
+    }
+}
+
+//POST: Sum over [rowFrom, rowTo) x [colFrom, colTo) from four corners of the summed-area table
+static real_t boxSum(real_t *table, int nCols, int rowFrom, int colFrom, int rowTo, int colTo) {
+    int width = nCols + 1;
+    return table[(size_t) rowTo * width + colTo] - table[(size_t) rowFrom * width + colTo]
+         - table[(size_t) rowTo * width + colFrom] + table[(size_t) rowFrom * width + colFrom];
+}
+
+//PRE: table has (nRows + 1) x (nCols + 1) entries, it's only scratch
+static void averagePoolPlane(real_t **input, int nRows, int nCols, int stride, int filterSize,
+                             real_t **output, real_t *table) {
+    int outRows = poolingSize(nRows, stride), outCols = poolingSize(nCols, stride);
+    int rowFrom, rowTo, colFrom, colTo;
+    real_t scale = 1.0 / (filterSize * filterSize), sum;
+    bool direct = filterSize * filterSize <= DIRECT_AVERAGE_MAX;
+    if (!direct) summedAreaTable(input, nRows, nCols, table);
+    for (int i = 0; i < outRows; i++) {
+        rowFrom = i * stride;
+        rowTo = rowFrom + filterSize < nRows ? rowFrom + filterSize : nRows;
+        for (int j = 0; j < outCols; j++) {
+            colFrom = j * stride;
+            colTo = colFrom + filterSize < nCols ? colFrom + filterSize : nCols;
+            if (direct) {
+                sum = 0;
+                for (int r = rowFrom; r < rowTo; r++) {
+                    for (int c = colFrom; c < colTo; c++) sum += input[r][c];
+                }
+            } else {
+                sum = boxSum(table, nCols, rowFrom, colFrom, rowTo, colTo);
+            }
+            output[i][j] = sum * scale;
+        }
+    }
+}
+
+//POST: [from[x], to[x]) are the windows along an axis of outSize which cover position x
+static void coveringWindows(int size, int outSize, int stride, int filterSize, int *from, int *to) {
+    int first;
+    for (int x = 0; x < size; x++) {
+        first = x - filterSize + 1;
+        from[x] = first <= 0 ? 0 : (first + stride - 1) / stride;
+        to[x] = x / stride + 1 < outSize ? x / stride + 1 : outSize;
+    }
+}
+
+//PRE: table has (outRows + 1) x (outCols + 1) entries and from and to have nRows + nCols, they're only scratch
+//POST: Each input gets the gradients of the windows covering it, a box of outputs summed from a
+//      summed-area table of the gradient, divided by the window's size
+static void averagePoolPlaneBackward(real_t **gradient, int nRows, int nCols, int stride, int filterSize,
+                                     real_t **inputGradient, real_t *table, int *from, int *to) {
+    int outRows = poolingSize(nRows, stride), outCols = poolingSize(nCols, stride);
+    real_t scale = 1.0 / (filterSize * filterSize);
+    int *colFrom = from + nRows, *colTo = to + nRows;
+    summedAreaTable(gradient, outRows, outCols, table);
+    coveringWindows(nRows, outRows, stride, filterSize, from, to);
+    coveringWindows(nCols, outCols, stride, filterSize, colFrom, colTo);
+    for (int r = 0; r < nRows; r++) {
+        if (from[r] >= to[r]) continue;
+        for (int c = 0; c < nCols; c++) {
+            if (colFrom[c] >= colTo[c]) continue;
+            inputGradient[r][c] += boxSum(table, outCols, from[r], colFrom[c], to[r], colTo[c]) * scale;
+        }
+    }
+}
+
+//PRE: argmax has an entry for every output, i.e. of nBatch x nChannels x size / stride planes
+//POST: Max pooling of every plane of input; argmax saves where each output came from for the backward pass
+tensor4d_t *tensorMaxPooling(tensor4d_t *input, int32_t *argmax, int stride, int filterSize) {
+    int outRows = poolingSize(input->nRows, stride), outCols = poolingSize(input->nCols, stride);
+    tensor4d_t *output = tensor4DCreate(input->nBatch, input->nChannels, outRows, outCols);
+    real_t **inRows = malloc(sizeof(real_t*) * input->nRows), **outRowPtrs = malloc(sizeof(real_t*) * (outRows + 1));
+    size_t inPlane = (size_t) input->nRows * input->nCols, outPlane = (size_t) outRows * outCols;
+    for (int p = 0; p < input->nBatch * input->nChannels; p++) {
+        planeRows(input->data + p * inPlane, input->nRows, input->nCols, inRows);
+        planeRows(output->data + p * outPlane, outRows, outCols, outRowPtrs);
+        maxPoolPlane(inRows, input->nRows, input->nCols, stride, filterSize, outRowPtrs, argmax + p * outPlane);
+    }
+    free(inRows);
+    free(outRowPtrs);
+    return output;
+}
+
+//PRE: argmax is from the tensorMaxPooling whose output gradient is the gradient of
+//POST: The gradient is added to inputGradient, which has the input's shape
+void tensorMaxPoolingBackward(tensor4d_t *gradient, int32_t *argmax, tensor4d_t *inputGradient) {
+    real_t **outRows = malloc(sizeof(real_t*) * (gradient->nRows + 1));
+    real_t **inRows = malloc(sizeof(real_t*) * inputGradient->nRows);
+    size_t inPlane = (size_t) inputGradient->nRows * inputGradient->nCols;
+    size_t outPlane = (size_t) gradient->nRows * gradient->nCols;
+    for (int p = 0; p < gradient->nBatch * gradient->nChannels; p++) {
+        planeRows(gradient->data + p * outPlane, gradient->nRows, gradient->nCols, outRows);
+        planeRows(inputGradient->data + p * inPlane, inputGradient->nRows, inputGradient->nCols, inRows);
+        maxPoolPlaneBackward(outRows, gradient->nRows, gradient->nCols, argmax + p * outPlane,
+                             inputGradient->nCols, inRows);
+    }
+    free(outRows);
+    free(inRows);
+}
+
+//POST: Average pooling of every plane of input
+tensor4d_t *tensorAveragePooling(tensor4d_t *input, int stride, int filterSize) {
+    int outRows = poolingSize(input->nRows, stride), outCols = poolingSize(input->nCols, stride);
+    tensor4d_t *output = tensor4DCreate(input->nBatch, input->nChannels, outRows, outCols);
+    real_t **inRows = malloc(sizeof(real_t*) * input->nRows), **outRowPtrs = malloc(sizeof(real_t*) * (outRows + 1));
+    real_t *table = malloc(sizeof(real_t) * (input->nRows + 1) * (input->nCols + 1));
+    size_t inPlane = (size_t) input->nRows * input->nCols, outPlane = (size_t) outRows * outCols;
+    for (int p = 0; p < input->nBatch * input->nChannels; p++) {
+        planeRows(input->data + p * inPlane, input->nRows, input->nCols, inRows);
+        planeRows(output->data + p * outPlane, outRows, outCols, outRowPtrs);
+        averagePoolPlane(inRows, input->nRows, input->nCols, stride, filterSize, outRowPtrs, table);
+    }
+    free(inRows);
+    free(outRowPtrs);
+    free(table);
+    return output;
+}
+
+//POST: The gradient of tensorAveragePooling's output is added to inputGradient, which has the input's shape
+void tensorAveragePoolingBackward(tensor4d_t *gradient, int stride, int filterSize, tensor4d_t *inputGradient) {
+    int nRows = inputGradient->nRows, nCols = inputGradient->nCols;
+    real_t **outRows = malloc(sizeof(real_t*) * (gradient->nRows + 1)), **inRows = malloc(sizeof(real_t*) * nRows);
+    real_t *table = malloc(sizeof(real_t) * (gradient->nRows + 1) * (gradient->nCols + 1));
+    int *from = malloc(sizeof(int) * (nRows + nCols)), *to = malloc(sizeof(int) * (nRows + nCols));
+    size_t inPlane = (size_t) nRows * nCols, outPlane = (size_t) gradient->nRows * gradient->nCols;
+    for (int p = 0; p < gradient->nBatch * gradient->nChannels; p++) {
+        planeRows(gradient->data + p * outPlane, gradient->nRows, gradient->nCols, outRows);
+        planeRows(inputGradient->data + p * inPlane, nRows, nCols, inRows);
+        averagePoolPlaneBackward(outRows, nRows, nCols, stride, filterSize, inRows, table, from, to);
+    }
+    free(outRows);
+    free(inRows);
+    free(table);
+    free(from);
+    free(to);
+}
+
+//PRE: argmax has an entry for every output, or is NULL if the backward pass won't need it
+//POST: Max pooling of one plane
+matrix2d_t *matrixMaxPooling(matrix2d_t *matrix, int32_t *argmax, int stride, int filterSize) {
+    matrix2d_t *output = matrixCreate(poolingSize(matrix->nRows, stride), poolingSize(matrix->nCols, stride));
+    int32_t *indices = argmax ? argmax : malloc(sizeof(int32_t) * (output->nRows * output->nCols + 1));
+    maxPoolPlane(matrix->data, matrix->nRows, matrix->nCols, stride, filterSize, output->data, indices);
+    if (!argmax) free(indices);
+    return output;
+}
+
+void matrixMaxPoolingBackward(matrix2d_t *gradient, int32_t *argmax, matrix2d_t *inputGradient) {
+    maxPoolPlaneBackward(gradient->data, gradient->nRows, gradient->nCols, argmax, inputGradient->nCols,
+                         inputGradient->data);
+}
+
+//POST: Average pooling of one plane
+matrix2d_t *matrixAveragePooling(matrix2d_t *matrix, int stride, int filterSize) {
+    matrix2d_t *output = matrixCreate(poolingSize(matrix->nRows, stride), poolingSize(matrix->nCols, stride));
+    real_t *table = malloc(sizeof(real_t) * (matrix->nRows + 1) * (matrix->nCols + 1));
+    averagePoolPlane(matrix->data, matrix->nRows, matrix->nCols, stride, filterSize, output->data, table);
+    free(table);
+    return output;
+}
+
+void matrixAveragePoolingBackward(matrix2d_t *gradient, int stride, int filterSize, matrix2d_t *inputGradient) {
+    int nRows = inputGradient->nRows, nCols = inputGradient->nCols;
+    real_t *table = malloc(sizeof(real_t) * (gradient->nRows + 1) * (gradient->nCols + 1));
+    int *from = malloc(sizeof(int) * (nRows + nCols)), *to = malloc(sizeof(int) * (nRows + nCols));
+    averagePoolPlaneBackward(gradient->data, nRows, nCols, stride, filterSize, inputGradient->data, table, from, to);
+    free(table);
+    free(from);
+    free(to);
+}
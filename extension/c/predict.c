@@ -1,131 +1,388 @@
+#include <pthread.h>
 #include <stdlib.h>
-#include <stdarg.h>
+#include <string.h>
 
 #include "../predict.h"
+#include "../autograd.h"
+#include "../scheduler.h"
 #include "../data.h"
+#include "../fusion.h"
+#include "../half.h"
+#include "../lstm.h"
 #include "../matrix.h"
 #include "../nodes.h"
+#include "../pooling.h"
+#include "../quantize.h"
+#include "../sparse.h"
 #include "../util.h"
 #include "../testUtils.h"
 
+//PRE: config is a convolution's 1 X 2 or 1 X 3 config of stride, padding and dilation
+//POST: The dilation, 1 i.e. a dense kernel if the config doesn't give one
+int convolutionDilation(matrix2d_t *config) {
+    return config->nCols > 2 ? (int) matrixGet(config, 0, 2) : 1;
+}
+
+// POST: In FORWARD node's matrix value is set depending on the operation,
+//       in BACKWARD its gradient is passed on to its inputs' gradients as in autograd.h
+static void executeNode(node_t *node, enum executionMode mode) {
+    if (BACKWARD == mode) {
+        if (!node->isData) vjp(node);
+        return;
+    }
+    if (node->isData) {
+        //Sparse and quantized weights are only read by SPARSE_DOT and QUANTIZED_DOT, straight from the node's data
+        node->matrix->matrix2d = node->content.data->sparse || node->content.data->quantized
+                                 ? NULL : matrixClone(node->content.data->data->matrix2d);
+    } else if (!node->specialised || !(node->matrix->matrix2d = node->specialised(node))) {
+        //if (node->matrix->matrix2d) free(node->matrix->matrix2d);
+        switch (node->content.operation.funcName) {
+            case CONVOLUTION:
+                //stride, padding and optionally dilation are stored in a 1 X 2 or 1 X 3 matrix
+                node->matrix->matrix2d = matrixDilatedConvolution(node->inputs[0]->matrix->matrix2d, node->inputs[1]->matrix->matrix2d,
+                matrixGet(node->inputs[2]->matrix->matrix2d, 0, 0), matrixGet(node->inputs[2]->matrix->matrix2d, 0, 1),
+                convolutionDilation(node->inputs[2]->matrix->matrix2d));
+                break;
+            case DECONVOLUTION:
+                //stride and padding are stored in a 1 X 2 matrix
+                node->matrix->matrix2d = matrixDeconvolution(node->inputs[0]->matrix->matrix2d, node->inputs[1]->matrix->matrix2d,
+                matrixGet(node->inputs[2]->matrix->matrix2d, 0, 0), matrixGet(node->inputs[2]->matrix->matrix2d, 0, 1));
+                break;
+            case ADD:
+                node->matrix->matrix2d = matrixAdd(node->inputs[0]->matrix->matrix2d, node->inputs[1]->matrix->matrix2d);
+                break;
+            case SUBTRACT:
+                node->matrix->matrix2d = matrixSubtract(node->inputs[0]->matrix->matrix2d, node->inputs[1]->matrix->matrix2d);
+                break;
+            case MULTIPLY:
+                node->matrix->matrix2d = matrixMultiplyElementWise(node->inputs[0]->matrix->matrix2d, node->inputs[1]->matrix->matrix2d);
+                break;
+            case DOT:
+                node->matrix->matrix2d = matrixDotProduct(node->inputs[0]->matrix->matrix2d, node->inputs[1]->matrix->matrix2d);
+                break;
+            case QUANTIZED_DOT:
+                node->matrix->matrix2d = quantizedDotProduct(node->inputs[0]->matrix->matrix2d,
+                                                             node->inputs[1]->content.data->quantized->values,
+                                                             node->inputs[2]->matrix->matrix2d);
+                break;
+            case SPARSE_DOT:
+                node->matrix->matrix2d = denseSparseProduct(node->inputs[0]->matrix->matrix2d,
+                                                            sparseWeights(node->inputs[1]->content.data));
+                break;
+            case MAX_POOLING:
+                //stride and filter size are stored in a 1 X 2 matrix
+                {matrix2d_t *input = node->inputs[0]->matrix->matrix2d;
+                int stride = matrixGet(node->inputs[1]->matrix->matrix2d, 0, 0);
+                node->poolingArgmax = realloc(node->poolingArgmax, sizeof(int32_t)
+                                              * (poolingSize(input->nRows, stride) * poolingSize(input->nCols, stride) + 1));
+                node->matrix->matrix2d = matrixMaxPooling(input, node->poolingArgmax, stride,
+                                                          matrixGet(node->inputs[1]->matrix->matrix2d, 0, 1));}
+                break;
+            case AVERAGE_POOLING:
+                //stride and filter size are stored in a 1 X 2 matrix
+                node->matrix->matrix2d = matrixAveragePooling(node->inputs[0]->matrix->matrix2d,
+                matrixGet(node->inputs[1]->matrix->matrix2d, 0, 0), matrixGet(node->inputs[1]->matrix->matrix2d, 0, 1));
+                break;
+            case FUSED:
+                {matrix2d_t **inputs = malloc(sizeof(matrix2d_t*) * node->n);
+                for (int i = 0; i < node->n; i++) inputs[i] = node->inputs[i]->matrix->matrix2d;
+                node->matrix->matrix2d = fusedForward(node->content.operation.kernel, inputs);
+                free(inputs);}
+                break;
+            case ACTIVATION:
+                node->matrix->matrix2d = matrixActiveFunc(node->inputs[0]->matrix->matrix2d, node->content.operation.activationName);
+                break;
+            case TRANSPOSE:
+                node->matrix->matrix2d = matrixTranspose(node->inputs[0]->matrix->matrix2d);
+                break;
+            case LSTM_CELL:
+                {lstmParams_t params = {.weightW = node->inputs[2]->matrix->matrix2d,
+                                        .weightU = node->inputs[3]->matrix->matrix2d,
+                                        .bias = node->inputs[4]->matrix->matrix2d,
+                                        .nNeurons = node->inputs[3]->matrix->matrix2d->nRows,
+                                        .func = node->content.operation.activationName};
+                node->matrix->matrix2d = lstmCellForward(&params, node->inputs[0]->matrix->matrix2d,
+                                                         node->inputs[1]->matrix->matrix2d, NULL);}
+                break;
+            case LSTM_PROJECTION:
+                {int timeSteps = node->n - 2;
+                matrix2d_t **inputs = malloc(sizeof(matrix2d_t*) * timeSteps);
+                for (int t = 0; t < timeSteps; t++) inputs[t] = node->inputs[t]->matrix->matrix2d;
+                lstmParams_t params = {.weightW = node->inputs[timeSteps]->matrix->matrix2d,
+                                       .bias = node->inputs[timeSteps + 1]->matrix->matrix2d,
+                                       .nNeurons = node->inputs[timeSteps]->matrix->matrix2d->nCols / N_GATES};
+                node->matrix->matrix2d = lstmProjectInputs(&params, inputs, timeSteps);
+                free(inputs);}
+                break;
+            case LSTM_STEP:
+                //The config holds the step's first projection row and how many rows are running
+                //Those are the first rows of the state; the rest have finished and keep their state
+                {lstmParams_t params = {.weightU = node->inputs[2]->matrix->matrix2d,
+                                        .nNeurons = node->inputs[2]->matrix->matrix2d->nRows,
+                                        .func = node->content.operation.activationName};
+                matrix2d_t *state = node->inputs[1]->matrix->matrix2d;
+                int nActive = matrixGet(node->inputs[3]->matrix->matrix2d, 0, 1);
+                if (nActive == state->nRows) {
+                    node->matrix->matrix2d = lstmStepForward(&params, node->inputs[0]->matrix->matrix2d,
+                                                             matrixGet(node->inputs[3]->matrix->matrix2d, 0, 0),
+                                                             state, NULL);
+                    break;
+                }
+                matrix2d_t active = {.data = state->data, .nRows = nActive, .nCols = state->nCols};
+                matrix2d_t *next = nActive ? lstmStepForward(&params, node->inputs[0]->matrix->matrix2d,
+                                                             matrixGet(node->inputs[3]->matrix->matrix2d, 0, 0),
+                                                             &active, NULL) : NULL;
+                node->matrix->matrix2d = matrixCreate(state->nRows, state->nCols);
+                for (int i = 0; i < state->nRows; i++) {
+                    memcpy(node->matrix->matrix2d->data[i], i < nActive ? next->data[i] : state->data[i],
+                           sizeof(real_t) * state->nCols);
+                }
+                if (next) matrixFree(next);}
+                break;
+            case LSTM_HIDDEN:
+                node->matrix->matrix2d = lstmHidden(node->inputs[0]->matrix->matrix2d);
+                break;
+            case FLATTEN:
+                node->matrix->matrix2d = matrixFlatten(node->inputs[0]->matrix->matrix3d);
+                break;
+            default:
+                printf("I haven't programmed that path in yet\n");
+                exit(EXIT_FAILURE); 
+        }
+    }
+    /*if (FORWARD == mode) {
+        printf("%s\n", node->name);
+        if (node->matrix->matrix2d) if(node->matrix->matrix2d->data) printMatrix(node->matrix->matrix2d);
+        printf("\n\n");
+    }*/
+}
+
 // PRE: A topological sort of the graph (reversed order) and it's length
-// POST: Each node's matrix value is set depending on the operation
-void execute(node_t **nodes, int length, enum executionMode mode,
-             void (*optimiser)(node_t *, int nArgs, ...), int nArgs, ...) {
+// POST: Each node's matrix value is set depending on the operation in FORWARD,
+//       BACKWARD runs the nodes the other way round so each gradient is complete before it's passed on
+void execute(node_t **nodes, int length, enum executionMode mode) {
+    if (BACKWARD == mode) {
+        for (int i = 0; i < length; i++) executeNode(nodes[i], mode);
+        return;
+    }
+    for (int i = length - 1; i >= 0; i--) {
+        executeNode(nodes[i], mode);
+    }
+}
 
-    va_list args;
+static void drop(checkpoints_t *plan, node_t *node) {
+    matrixFree(node->matrix->matrix2d);
+    node->matrix->matrix2d = NULL;
+    plan->nLive--;
+}
+
+//POST: node's activation, and any dropped activations it depends on, are recomputed
+static void rematerialise(checkpoints_t *plan, node_t *node) {
+    for (int i = 0; i < node->n; i++) {
+        if (node->inputs[i] && !node->inputs[i]->isData && !node->inputs[i]->matrix->matrix2d) {
+            rematerialise(plan, node->inputs[i]);
+        }
+    }
+    executeNode(node, FORWARD);
+    push(&plan->recomputed, &plan->nRecomputed, node);
+    if (++plan->nLive > plan->peakLive) plan->peakLive = plan->nLive;
+}
 
+//POST: Whether BACKWARD on node reads an activation FORWARD has dropped
+static bool isMissing(node_t *node) {
+    node_t *input;
+    bool missing = !node->matrix->matrix2d;
+    for (int j = 0; j < node->n; j++) {
+        input = node->inputs[j];
+        missing |= input && !input->isData && !input->matrix->matrix2d;
+    }
+    return missing;
+}
+
+// PRE: plan was made by scheduleCheckpoints for the forward schedule, which nodes is
+// POST: As execute, except FORWARD frees every activation which isn't a checkpoint once it has been used,
+//       and BACKWARD recomputes them a segment at a time from the checkpoint before when they're read
+void executeCheckpointed(checkpoints_t *plan, node_t **nodes, int length, enum executionMode mode) {
     node_t *node;
-    for (int i = length - 1; i >= 0; i--) {
+    //FORWARD replaces every activation from the previous pass
+    if (FORWARD == mode) {
+        plan->nLive = 0;
+        for (int i = length - 1; i >= 0; i--) {
+            node = nodes[i];
+            executeNode(node, mode);
+            if (!node->isData && ++plan->nLive > plan->peakLive) plan->peakLive = plan->nLive;
+            for (int j = 0; j < plan->nDrops[i]; j++) drop(plan, plan->drops[i][j]);
+        }
+        return;
+    }
+
+    for (int i = 0; i < length; i++) {
         node = nodes[i];
-        if (node->isData) {
-            switch (mode) {
-            case FORWARD:
-                node->matrix->matrix2d = matrixClone(node->content.data->data->matrix2d);
-                break;
-            case BACKWARD:
-                if (node->content.data->internalNode) {
-                    if (node->matrix->matrix2d) free(node->matrix->matrix2d);
-                    node->matrix->matrix2d = matrixClone(node->content.data->data->matrix2d);
-                    for (int j = 0; j < node->n; j++) {
-                        node->matrix->matrix2d = matrixAdd(node->matrix->matrix2d, 
-                                                 node->inputs[j]->matrix->matrix2d);
-                        optimiser(node, nArgs, args);
-                    }
-                } else {
-                   node->matrix->matrix2d = matrixClone(node->content.data->data->matrix2d); 
-                }
-                break;
-            case UPDATE:
-                if (node->content.data->internalNode && 'd' == *(node->name)) {
-                    free(node->content.data->data->matrix2d);
-                    node->content.data->data->matrix2d = matrixClone(node->matrix->matrix2d);
-                    free(node->matrix->matrix2d);
+        //Nodes without a gradient don't read anything in BACKWARD
+        if (!node->isData && node->gradient && node->gradient->matrix2d && isMissing(node)) {
+            //Activations recomputed for a later segment are no longer needed
+            if (plan->nRecomputed >= plan->segmentLength) {
+                for (int j = 0; j < plan->nRecomputed; j++) {
+                    if (plan->recomputed[j]->matrix->matrix2d) drop(plan, plan->recomputed[j]);
                 }
+                plan->nRecomputed = 0;
             }
-        } else {
-            if (UPDATE == mode) continue;
-            //if (node->matrix->matrix2d) free(node->matrix->matrix2d);
-            switch (node->content.operation.funcName) {
-                case CONVOLUTION:
-                    //stride and padding are stored in a 2 X 1 matrix
-                    node->matrix->matrix3d = matrix3DConvolution(node->inputs[0]->matrix->matrix3d, node->inputs[1]->matrix->matrix3d,
-                    matrixGet(node->inputs[2]->matrix->matrix2d, 0, 0), matrixGet(node->inputs[2]->matrix->matrix2d, 0, 1));
-                    break;
-                case DECONVOLUTION:
-                    //stride and padding are stored in a 2 X 1 matrix
-                    node->matrix->matrix2d = matrixDeconvolution(node->inputs[0]->matrix->matrix2d, node->inputs[1]->matrix->matrix2d,
-                    matrixGet(node->inputs[2]->matrix->matrix2d, 0, 0), matrixGet(node->inputs[2]->matrix->matrix2d, 0, 1));
-                    break;
-                case ADD:
-                    node->matrix->matrix2d = matrixAdd(node->inputs[0]->matrix->matrix2d, node->inputs[1]->matrix->matrix2d);
-                    break;
-                case SUBTRACT:
-                    node->matrix->matrix2d = matrixSubtract(node->inputs[0]->matrix->matrix2d, node->inputs[1]->matrix->matrix2d);
-                    break;
-                case MULTIPLY:
-                    node->matrix->matrix2d = matrixMultiplyElementWise(node->inputs[0]->matrix->matrix2d, node->inputs[1]->matrix->matrix2d);
-                    break;
-                case DOT:
-                    node->matrix->matrix2d = matrixDotProduct(node->inputs[0]->matrix->matrix2d, node->inputs[1]->matrix->matrix2d);
-                    break;
-                case MAX_POOLING:
-                    if (mode == BACKWARD) {
-                        matrix2d_t* errorMatrix = matrixCreate(node->inputs[0]->poolingMatrixGrad->matrix2d->nRows, 
-                                                             node->inputs[0]->poolingMatrixGrad->matrix2d->nCols);
-                        for (int i = 0; i < errorMatrix->nRows; i++) {
-                            for (int j = 0; j < errorMatrix->nCols; i++) {
-                                if (matrixGet(node->inputs[0]->poolingMatrixGrad->matrix2d, i, j) == 1.0) {
-                                    matrixSet(errorMatrix, i, j, matrixGet(node->inputs[0]->matrix->matrix2d, i, j));
-                                }
-                            }
-                        }
-                        node->matrix->matrix2d = errorMatrix;
-                    } else {
-                        //stride and filter size are stored in a 2 X 1 matrix
-                        node->matrix->matrix2d = matrixMaxPooling(node->inputs[0]->matrix->matrix2d, node->poolingMatrixGrad->matrix2d,
-                        matrixGet(node->inputs[1]->matrix->matrix2d, 0, 0), matrixGet(node->inputs[1]->matrix->matrix2d, 0, 1));
+            if (!node->matrix->matrix2d) {
+                rematerialise(plan, node);
+            } else {
+                for (int j = 0; j < node->n; j++) {
+                    if (node->inputs[j] && !node->inputs[j]->isData && !node->inputs[j]->matrix->matrix2d) {
+                        rematerialise(plan, node->inputs[j]);
                     }
-                    break;
-                case AVERAGE_POOLING:
-                    if (mode == BACKWARD) {
-                        matrix2d_t* errorMatrix = matrixCreate(node->inputs[0]->poolingMatrixGrad->matrix2d->nRows, 
-                                                             node->inputs[0]->poolingMatrixGrad->matrix2d->nCols);
-                        int filterSize = matrixGet(node->inputs[1]->matrix->matrix2d, 0, 1);
-                        for (int i = 0; i < errorMatrix->nRows; i++) {
-                            for (int j = 0; j < errorMatrix->nCols; i++) {
-                                    matrixSet(errorMatrix, i, j, matrixGet(node->inputs[0]->matrix->matrix2d, i, j) / (double) (filterSize * filterSize));
-                            }
-                        }
-                        node->matrix->matrix2d = errorMatrix;
-                    } else {
-                        //stride and filter size are stored in a 2 X 1 matrix
-                        node->matrix->matrix2d = matrixAveragePooling(node->inputs[0]->matrix->matrix2d, node->poolingMatrixGrad->matrix2d,
-                        matrixGet(node->inputs[1]->matrix->matrix2d, 0, 0), matrixGet(node->inputs[1]->matrix->matrix2d, 0, 1));
-                    }
-                    break;
-                case ACTIVATION:
-                    node->matrix->matrix2d = matrixActiveFunc(node->inputs[0]->matrix->matrix2d, node->content.operation.activationName);
-                    break;
-                case TRANSPOSE:
-                    node->matrix->matrix2d = matrixTranspose(node->inputs[0]->matrix->matrix2d);
-                    break;
-                case FLATTEN:
-                    if (mode == FORWARD) {
-                        node->matrix->matrix2d = matrixFlatten(node->inputs[0]->matrix->matrix3d);
-                    } else {
-                        double *config = node->inputs[1]->matrix->matrix2d->data[0];
-                        node->matrix->matrix3d = matrixUnflatten(node->inputs[0]->matrix->matrix2d, config[0], config[1], config[2]);
-                    }
-                default:
-                    printf("I haven't programmed that path in yet\n");
-                    exit(EXIT_FAILURE); 
+                }
+            }
+        }
+        executeNode(node, mode);
+    }
+
+    for (int j = 0; j < plan->nRecomputed; j++) {
+        if (plan->recomputed[j]->matrix->matrix2d) drop(plan, plan->recomputed[j]);
+    }
+    plan->nRecomputed = 0;
+}
+
+static void holdBytes(mixedPrecision_t *plan, long bytes) {
+    plan->bytesHeld += bytes;
+    if (plan->bytesHeld > plan->peakBytes) plan->peakBytes = plan->bytesHeld;
+}
+
+static long activationBytes(matrix2d_t *matrix) {
+    return (long) matrix->nRows * matrix->nCols * sizeof(real_t);
+}
+
+//POST: nodes[i]'s activation is held in 16 bits only
+static void stash(mixedPrecision_t *plan, int i) {
+    matrix2d_t *matrix = plan->nodes[i]->matrix->matrix2d;
+    if (!matrix) return;
+    plan->shapes[i] = (shape_t) {matrix->nRows, matrix->nCols};
+    plan->stashed[i] = malloc(sizeof(half_t) * ((size_t) matrix->nRows * matrix->nCols + 1));
+    for (int r = 0; r < matrix->nRows; r++) {
+        halfFromReals(plan->format, matrix->data[r], plan->stashed[i] + (size_t) r * matrix->nCols, matrix->nCols);
+    }
+    holdBytes(plan, (long) matrix->nRows * matrix->nCols * sizeof(half_t) - activationBytes(matrix));
+    matrixFree(matrix);
+    plan->nodes[i]->matrix->matrix2d = NULL;
+}
+
+//POST: nodes[i]'s stashed activation is back at full precision, and still stashed until it's released
+static void unstash(mixedPrecision_t *plan, int i) {
+    shape_t shape = plan->shapes[i];
+    matrix2d_t *matrix = matrixCreate(shape.nRows, shape.nCols);
+    for (int r = 0; r < shape.nRows; r++) {
+        halfToReals(plan->format, plan->stashed[i] + (size_t) r * shape.nCols, matrix->data[r], shape.nCols);
+    }
+    plan->nodes[i]->matrix->matrix2d = matrix;
+    holdBytes(plan, activationBytes(matrix));
+}
+
+//POST: nodes[i]'s stashed activation is freed, at both precisions
+static void release(mixedPrecision_t *plan, int i) {
+    matrix2d_t *matrix = plan->nodes[i]->matrix->matrix2d;
+    if (matrix) {
+        holdBytes(plan, -activationBytes(matrix));
+        matrixFree(matrix);
+        plan->nodes[i]->matrix->matrix2d = NULL;
+    }
+    holdBytes(plan, -(long) plan->shapes[i].nRows * plan->shapes[i].nCols * sizeof(half_t));
+    free(plan->stashed[i]);
+    plan->stashed[i] = NULL;
+}
+
+//POST: Each of node's inputs and node itself is at full precision if it was stashed
+static void unstashInputs(mixedPrecision_t *plan, node_t *node, int i) {
+    int input;
+    if (plan->stashed[i] && !node->matrix->matrix2d) unstash(plan, i);
+    for (int j = 0; j < node->n; j++) {
+        input = indexOf(plan->sorted, plan->length, node->inputs[j]);
+        if (input >= 0 && plan->stashed[input] && !plan->nodes[input]->matrix->matrix2d) unstash(plan, input);
+    }
+}
+
+// PRE: plan was made by scheduleMixedPrecision for the forward schedule, which nodes is
+// POST: As execute, except every activation and every gradient passed on is rounded to plan's format,
+//       and activations are held in 16 bits from their last reader in FORWARD to their first in BACKWARD.
+//       plan->nOverflows is how many values the pass rounded to infinity or NaN
+void executeMixed(mixedPrecision_t *plan, node_t **nodes, int length, enum executionMode mode) {
+    node_t *node;
+    matrix2d_t *matrix;
+    plan->nOverflows = 0;
+    if (FORWARD == mode) {
+        //Left over if BACKWARD didn't run after the last FORWARD
+        for (int i = 0; i < length; i++) {
+            if (plan->stashed[i]) release(plan, i);
+        }
+        plan->bytesHeld = plan->peakBytes = 0;
+        for (int i = length - 1; i >= 0; i--) {
+            node = nodes[i];
+            executeNode(node, mode);
+            if (!node->isData && (matrix = node->matrix->matrix2d)) {
+                plan->nOverflows += matrixRoundToHalf(plan->format, matrix);
+                holdBytes(plan, activationBytes(matrix));
             }
+            for (int j = 0; j < plan->nDrops[i]; j++) stash(plan, plan->drops[i][j]);
         }
-        /*if (FORWARD == mode) {
-            printf("%s\n", node->name);
-            if (node->matrix->matrix2d) if(node->matrix->matrix2d->data) printMatrix(node->matrix->matrix2d);
-            printf("\n\n");
-        }*/
+        return;
     }
+
+    for (int i = 0; i < length; i++) {
+        node = nodes[i];
+        //Nodes without a gradient don't read anything in BACKWARD
+        if (!node->isData && node->gradient && (matrix = node->gradient->matrix2d)) {
+            //Complete now, so it's held as the format would hold it
+            plan->nOverflows += matrixRoundToHalf(plan->format, matrix);
+            unstashInputs(plan, node, i);
+        }
+        executeNode(node, mode);
+        //Every node reading it has already passed its gradient on
+        if (plan->stashed[i]) release(plan, i);
+    }
+}
+
+typedef struct waveWorker {
+    wavefront_t *plan;
+    int id, nThreads;
+    pthread_barrier_t *barrier;
+} waveWorker_t;
+
+//POST: Runs every nThreads'th node of each level, waiting for the other threads between levels
+static void *waveWorker(void *arg) {
+    waveWorker_t *worker = arg;
+    wavefront_t *plan = worker->plan;
+    for (int l = 0; l < plan->nLevels; l++) {
+        for (int i = worker->id; i < plan->levelLengths[l]; i += worker->nThreads) {
+            executeNode(plan->levels[l][i], FORWARD);
+        }
+        pthread_barrier_wait(worker->barrier);
+    }
+    return NULL;
+}
+
+// PRE: plan was made by scheduleWavefront, nThreads > 0
+// POST: As execute in FORWARD mode, with the nodes of each level shared between nThreads threads
+void executeWavefront(wavefront_t *plan, int nThreads) {
+    pthread_barrier_t barrier;
+    pthread_barrier_init(&barrier, NULL, nThreads);
+    waveWorker_t *workers = malloc(sizeof(waveWorker_t) * nThreads);
+    pthread_t *threads = malloc(sizeof(pthread_t) * nThreads);
+    for (int i = 0; i < nThreads; i++) {
+        workers[i] = (waveWorker_t) {.plan = plan, .id = i, .nThreads = nThreads, .barrier = &barrier};
+    }
+    //The calling thread takes the first share itself
+    for (int i = 1; i < nThreads; i++) {
+        if (pthread_create(&threads[i], NULL, waveWorker, &workers[i])) {
+            perror("Couldn't start wavefront thread");
+            exit(EXIT_FAILURE);
+        }
+    }
+    waveWorker(&workers[0]);
+    for (int i = 1; i < nThreads; i++) pthread_join(threads[i], NULL);
+
+    pthread_barrier_destroy(&barrier);
+    free(threads);
+    free(workers);
 }
@@ -0,0 +1,151 @@
+#include "../prune.h"
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include "../matrix.h"
+#include "../nodes.h"
+#include "../passes.h"
+
+//A dense layer as denseLayer builds it, x . weights + bias through an activation, read only by the products
+//of later layers. Its neurons are the columns of weights and bias and the rows of each later layer's weights
+typedef struct denseLayer {
+    node_t *dot, *add, *activation;
+    node_t *weights, *bias;
+    int nNext; //Products reading the activation
+    int nNeurons;
+} denseLayer_t;
+
+//PRE: shapes and sorted were made from the schedule of length nodes that dot is in
+//POST: Whether dot is the product of a dense layer whose neurons can be removed, which is then filled in
+static bool matchDenseLayer(node_t *dot, shape_t *shapes, nodeIndex_t *sorted, int length, denseLayer_t *layer) {
+    layer->dot = dot;
+    if (!(layer->weights = ownedProductWeights(dot, shapes, sorted, length)) || 1 != dot->m) return false;
+    layer->nNeurons = layer->weights->content.data->data->matrix2d->nCols;
+
+    layer->add = dot->outputs[0];
+    if (layer->add->isData || ADD != layer->add->content.operation.funcName || 2 != layer->add->n || 1 != layer->add->m) {
+        return false;
+    }
+    layer->bias = layer->add->inputs[0] == dot ? layer->add->inputs[1] : layer->add->inputs[0];
+    if (!isOwnedWeights(layer->bias) || layer->nNeurons != layer->bias->content.data->data->matrix2d->nCols) return false;
+
+    layer->activation = layer->add->outputs[0];
+    if (layer->activation->isData || ACTIVATION != layer->activation->content.operation.funcName || !layer->activation->m) {
+        return false;
+    }
+    //Exit points need every neuron, as do operations other than the next layer's product
+    node_t *next;
+    layer->nNext = layer->activation->m;
+    for (int i = 0; i < layer->nNext; i++) {
+        next = layer->activation->outputs[i];
+        if (next->isData || DOT != next->content.operation.funcName || 2 != next->n || next->inputs[0] != layer->activation
+            || !isOwnedWeights(next->inputs[1]) || layer->nNeurons != next->inputs[1]->content.data->data->matrix2d->nRows) {
+            return false;
+        }
+    }
+    return true;
+}
+
+//POST: How much each of layer's neurons contributes to the layers after it, as ranking measures it
+static double *rankNeurons(denseLayer_t *layer, enum neuronRanking ranking) {
+    double *scores = calloc(layer->nNeurons, sizeof(double));
+    matrix2d_t *weights;
+    for (int i = 0; i < layer->nNext; i++) {
+        weights = layer->activation->outputs[i]->inputs[1]->content.data->data->matrix2d;
+        for (int j = 0; j < layer->nNeurons; j++) {
+            for (int k = 0; k < weights->nCols; k++) scores[j] += fabs(weights->data[j][k]);
+        }
+    }
+    matrix2d_t *activations = layer->activation->matrix->matrix2d;
+    if (ACTIVATIONS != ranking || !activations) return scores;
+    double mean;
+    for (int j = 0; j < layer->nNeurons; j++) {
+        mean = 0;
+        for (int i = 0; i < activations->nRows; i++) mean += fabs(activations->data[i][j]);
+        scores[j] *= mean / activations->nRows;
+    }
+    return scores;
+}
+
+//POST: matrix with only the columns, or rows, that keep marks, and the original freed
+static matrix2d_t *keepOnly(matrix2d_t *matrix, bool *keep, int nKept, bool columns) {
+    matrix2d_t *kept = columns ? matrixCreate(matrix->nRows, nKept) : matrixCreate(nKept, matrix->nCols);
+    int row = 0, col;
+    for (int i = 0; i < matrix->nRows; i++) {
+        if (!columns && !keep[i]) continue;
+        col = 0;
+        for (int j = 0; j < matrix->nCols; j++) {
+            if (columns && !keep[j]) continue;
+            kept->data[row][col++] = matrix->data[i][j];
+        }
+        row++;
+    }
+    matrixFree(matrix);
+    return kept;
+}
+
+//POST: The activation node held, which is of the old shape, is freed
+static void dropActivation(node_t *node) {
+    if (node->matrix->matrix2d) matrixFree(node->matrix->matrix2d);
+    node->matrix->matrix2d = NULL;
+}
+
+//POST: node's weights hold only the columns, or rows, that keep marks
+static void cutWeights(node_t *node, bool *keep, int nKept, bool columns) {
+    matrix_t *data = node->content.data->data;
+    data->matrix2d = keepOnly(data->matrix2d, keep, nKept, columns);
+    dropActivation(node);
+}
+
+//PRE: nodes is a forward schedule as made by schedule; ACTIVATIONS needs FORWARD to have run
+//POST: The fraction of each dense layer's neurons that rank lowest, but never all of them, are removed
+//      from its weights and bias and the next layer's weights, leaving a smaller dense graph
+//      The number of neurons removed is returned
+int pruneNeurons(node_t **nodes, int length, double fraction, enum neuronRanking ranking) {
+    shape_t *shapes = scheduleShapes(nodes, length);
+    nodeIndex_t *sorted = indexNodes(nodes, length);
+    denseLayer_t layer;
+    int nPruned, nRemoved = 0;
+    for (int i = 0; i < length; i++) {
+        if (!matchDenseLayer(nodes[i], shapes, sorted, length, &layer)) continue;
+        nPruned = fraction * layer.nNeurons;
+        if (nPruned >= layer.nNeurons) nPruned = layer.nNeurons - 1;
+        if (nPruned <= 0) continue;
+
+        double *scores = rankNeurons(&layer, ranking), lowestScore = 0;
+        bool *keep = malloc(sizeof(bool) * layer.nNeurons);
+        int nKept = layer.nNeurons;
+        for (int j = 0; j < layer.nNeurons; j++) keep[j] = true;
+        //The lowest score still kept is removed until enough are, the first of any ties going first
+        while (nKept > layer.nNeurons - nPruned) {
+            int lowest = -1;
+            for (int j = 0; j < layer.nNeurons; j++) {
+                if (keep[j] && (lowest < 0 || scores[j] < lowestScore)) {
+                    lowest = j;
+                    lowestScore = scores[j];
+                }
+            }
+            keep[lowest] = false;
+            nKept--;
+        }
+
+        cutWeights(layer.weights, keep, nKept, true);
+        cutWeights(layer.bias, keep, nKept, true);
+        for (int k = 0; k < layer.nNext; k++) cutWeights(layer.activation->outputs[k]->inputs[1], keep, nKept, false);
+        dropActivation(layer.dot);
+        dropActivation(layer.add);
+        dropActivation(layer.activation);
+        //So the next layer, if it comes later in the schedule, still matches its input
+        shapes[indexOf(sorted, length, layer.dot)].nCols = nKept;
+        shapes[indexOf(sorted, length, layer.add)].nCols = nKept;
+        shapes[indexOf(sorted, length, layer.activation)].nCols = nKept;
+        nRemoved += layer.nNeurons - nKept;
+        free(scores);
+        free(keep);
+    }
+    free(shapes);
+    free(sorted);
+    return nRemoved;
+}
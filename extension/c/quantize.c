@@ -0,0 +1,198 @@
+#include "../quantize.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../gemm.h"
+#include "../matrix.h"
+#include "../nodes.h"
+#include "../passes.h"
+#include "../predict.h"
+#include "../util.h"
+
+//Every quantized value x stands for x * scale, and scales are chosen so the largest magnitude seen
+//becomes QUANTIZED_MAX. Activations share one scale per tensor, weights have one per output column
+
+static int nQuantized = 0;
+
+//POST: The scale mapping absMax onto QUANTIZED_MAX, 1 for a tensor that's all zeros
+static real_t scaleFor(real_t absMax) {
+    return absMax > 0 ? absMax / QUANTIZED_MAX : 1;
+}
+
+static inline int8_t quantizeValue(real_t value) {
+    value = value > QUANTIZED_MAX ? QUANTIZED_MAX : value < -QUANTIZED_MAX ? -QUANTIZED_MAX : value;
+    return (int8_t) (value >= 0 ? value + 0.5 : value - 0.5);
+}
+
+static real_t absMaxOf(matrix2d_t *matrix) {
+    real_t absMax = 0;
+    for (int i = 0; i < matrix->nRows; i++) {
+        for (int j = 0; j < matrix->nCols; j++) {
+            if (fabs(matrix->data[i][j]) > absMax) absMax = fabs(matrix->data[i][j]);
+        }
+    }
+    return absMax;
+}
+
+//PRE: nodes is a forward schedule of graph as made by schedule, and inputs[k] holds a row for each sample
+//     of graph's k-th input; batchSize matches the rows the graph was built for
+//POST: The largest magnitude each node's activation reached over every whole batch in inputs
+//      Entry points hold their own data again afterwards
+real_t *calibrate(graph_t *graph, node_t **nodes, int length, matrix2d_t **inputs, int batchSize) {
+    real_t *ranges = calloc(length, sizeof(real_t)), absMax;
+    matrix2d_t **held = malloc(sizeof(matrix2d_t*) * graph->n);
+    for (int j = 0; j < graph->n; j++) held[j] = graph->entryPoints[j]->content.data->data->matrix2d;
+
+    int nBatches = inputs[0]->nRows / batchSize, inputIdx;
+    for (int b = 0; b < nBatches; b++) {
+        inputIdx = 0;
+        for (int j = 0; j < graph->n; j++) {
+            if (graph->entryPoints[j]->content.data->internalNode) continue;
+            matrix2d_t *batch = matrixCreate(batchSize, inputs[inputIdx]->nCols);
+            for (int k = 0; k < batchSize; k++) {
+                memcpy(batch->data[k], inputs[inputIdx]->data[b * batchSize + k], sizeof(real_t) * batch->nCols);
+            }
+            graph->entryPoints[j]->content.data->data->matrix2d = batch;
+            inputIdx++;
+        }
+
+        execute(nodes, length, FORWARD);
+        for (int i = 0; i < length; i++) {
+            if ((absMax = absMaxOf(nodes[i]->matrix->matrix2d)) > ranges[i]) ranges[i] = absMax;
+            matrixFree(nodes[i]->matrix->matrix2d);
+            nodes[i]->matrix->matrix2d = NULL;
+        }
+
+        for (int j = 0; j < graph->n; j++) {
+            if (graph->entryPoints[j]->content.data->internalNode) continue;
+            matrixFree(graph->entryPoints[j]->content.data->data->matrix2d);
+            graph->entryPoints[j]->content.data->data->matrix2d = held[j];
+        }
+    }
+    free(held);
+    return ranges;
+}
+
+//POST: A constant 1 x (nCols + 1) config of the input's scale then each column's, linked into node as its third input
+static node_t *scalesNode(graph_t *graph, node_t *node, real_t inputScale, real_t *columnScales, int nCols) {
+    char *name = calloc(MAX_NODE_NAME_LENGTH + 1, sizeof(char));
+    snprintf(name, MAX_NODE_NAME_LENGTH, "QSCALES%d", nQuantized++);
+    node_t *scales = nodeInit(name, 0, 1, true);
+    scales->content.data->constant = true;
+    matrix2d_t *config = matrixCreate(1, nCols + 1);
+    matrixSet(config, 0, 0, inputScale);
+    for (int j = 0; j < nCols; j++) matrixSet(config, 0, j + 1, columnScales[j]);
+    scales->content.data->data->matrix2d = config;
+
+    node->inputs = realloc(node->inputs, sizeof(node_t*) * 3);
+    node->n = 3;
+    node->inputIdx = 2;
+    linkNodes(scales, node);
+    push(&graph->entryPoints, &graph->n, scales);
+    return scales;
+}
+
+//POST: weights are whole numbers in [-QUANTIZED_MAX, QUANTIZED_MAX] packed into their data's quantized bytes,
+//      their dense matrix is freed, and the scale of each column is in columnScales
+static void quantizeWeights(data_t *weights, real_t *columnScales) {
+    matrix2d_t *matrix = weights->data->matrix2d;
+    real_t absMax;
+    for (int j = 0; j < matrix->nCols; j++) {
+        absMax = 0;
+        for (int i = 0; i < matrix->nRows; i++) {
+            if (fabs(matrix->data[i][j]) > absMax) absMax = fabs(matrix->data[i][j]);
+        }
+        columnScales[j] = scaleFor(absMax);
+    }
+    quantized_t *quantized = malloc(sizeof(quantized_t));
+    quantized->nRows = matrix->nRows;
+    quantized->nCols = matrix->nCols;
+    quantized->values = malloc(sizeof(int8_t) * matrix->nRows * matrix->nCols + 1);
+    for (int i = 0; i < matrix->nRows; i++) {
+        for (int j = 0; j < matrix->nCols; j++) {
+            quantized->values[i * matrix->nCols + j] = quantizeValue(matrix->data[i][j] / columnScales[j]);
+        }
+    }
+    matrixFree(matrix);
+    weights->data->matrix2d = NULL;
+    weights->quantized = quantized;
+    weights->constant = true;
+}
+
+//PRE: nodes is the forward schedule calibrate gave ranges for
+//POST: Every product of an activation with weights read by nothing else is a QUANTIZED_DOT, and the number
+//      rewritten is returned. Their configs are new entry points of graph, so nodes must be scheduled again
+int quantizeGraph(graph_t *graph, node_t **nodes, int length, real_t *ranges) {
+    nodeIndex_t *sorted = indexNodes(nodes, length);
+    shape_t *shapes = scheduleShapes(nodes, length);
+    node_t *node, *weights;
+    int input, nRewritten = 0;
+    for (int i = 0; i < length; i++) {
+        node = nodes[i];
+        if (!(weights = ownedProductWeights(node, shapes, sorted, length))) continue;
+        input = indexOf(sorted, length, node->inputs[0]);
+        int nCols = weights->content.data->data->matrix2d->nCols;
+        real_t *columnScales = malloc(sizeof(real_t) * nCols);
+        quantizeWeights(weights->content.data, columnScales);
+        if (weights->matrix->matrix2d) matrixFree(weights->matrix->matrix2d);
+        weights->matrix->matrix2d = NULL;
+        scalesNode(graph, node, scaleFor(ranges[input]), columnScales, nCols);
+        node->content.operation.funcName = QUANTIZED_DOT;
+        free(columnScales);
+        nRewritten++;
+    }
+    free(sorted);
+    free(shapes);
+    return nRewritten;
+}
+
+//PRE: input is nRows x nShared, weights are quantizeWeights' nShared x nCols bytes and scales is their config
+//POST: input . weights, with input quantized at the config's scale, multiplied in int8 and added up in int32
+//      Each sum is scaled back as it's written out, so the int32 products are never stored
+matrix2d_t *quantizedDotProduct(matrix2d_t *input, const int8_t *weights, matrix2d_t *scales) {
+    int nRows = input->nRows, nShared = input->nCols, nCols = scales->nCols - 1;
+    real_t inverse = 1 / matrixGet(scales, 0, 0);
+    int8_t *a = malloc(sizeof(int8_t) * nRows * nShared + 1);
+    for (int i = 0; i < nRows; i++) {
+        for (int k = 0; k < nShared; k++) a[i * nShared + k] = quantizeValue(input->data[i][k] * inverse);
+    }
+    real_t *outScales = malloc(sizeof(real_t) * nCols);
+    for (int j = 0; j < nCols; j++) outScales[j] = matrixGet(scales, 0, 0) * matrixGet(scales, 0, j + 1);
+
+    matrix2d_t *output = matrixCreate(nRows, nCols);
+    int32_t *sums = malloc(sizeof(int32_t) * GEMM_ROWS * nCols + 1), *s0, *s1, *s2, *s3;
+    int32_t a0, a1, a2, a3, bkj;
+    const int8_t *bk;
+    int i, rows;
+    //As gemm, blocks of GEMM_ROWS rows share each load of weights
+    for (i = 0; i < nRows; i += GEMM_ROWS) {
+        rows = i + GEMM_ROWS <= nRows ? GEMM_ROWS : nRows - i;
+        memset(sums, 0, sizeof(int32_t) * GEMM_ROWS * nCols);
+        s0 = sums, s1 = sums + nCols, s2 = sums + 2 * nCols, s3 = sums + 3 * nCols;
+        for (int k = 0; k < nShared; k++) {
+            a0 = a[i * nShared + k];
+            a1 = rows > 1 ? a[(i + 1) * nShared + k] : 0;
+            a2 = rows > 2 ? a[(i + 2) * nShared + k] : 0;
+            a3 = rows > 3 ? a[(i + 3) * nShared + k] : 0;
+            if (!(a0 || a1 || a2 || a3)) continue;
+            bk = weights + k * nCols;
+            for (int j = 0; j < nCols; j++) {
+                bkj = bk[j];
+                s0[j] += a0 * bkj;
+                s1[j] += a1 * bkj;
+                s2[j] += a2 * bkj;
+                s3[j] += a3 * bkj;
+            }
+        }
+        for (int r = 0; r < rows; r++) {
+            for (int j = 0; j < nCols; j++) output->data[i + r][j] = sums[r * nCols + j] * outScales[j];
+        }
+    }
+    free(a);
+    free(outScales);
+    free(sums);
+    return output;
+}
@@ -28,7 +28,7 @@ csvDataPack_t readCSV(char* filename, int nFields) {
         exit(EXIT_FAILURE);
     }
     matrix2d_t** matrixRecord = calloc(nFields, sizeof(matrix2d_t*));
-    double* labelRecord = calloc(nFields, sizeof(double));
+    real_t* labelRecord = calloc(nFields, sizeof(real_t));
 
 
     char buffer[MAX_LINE_SIZE];
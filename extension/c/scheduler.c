@@ -46,4 +46,165 @@ node_t **schedule(graph_t *graph, int *nNodes) {
     free(newNodes);
 
     return nodes;
-}
\ No newline at end of file
+}
+
+typedef struct nodeIndex {
+    node_t *node;
+    int idx;
+} nodeIndex_t;
+
+static int compareNodeIndex(const void *a, const void *b) {
+    node_t *first = ((nodeIndex_t*) a)->node, *second = ((nodeIndex_t*) b)->node;
+    return (first > second) - (first < second);
+}
+
+//POST: Whether FORWARD can free node's activation and recompute it later
+//      Only 2D operations without side effects qualify
+static bool isRecomputable(node_t *node) {
+    if (node->isData) return false;
+    switch (node->content.operation.funcName) {
+        case ADD:
+        case SUBTRACT:
+        case MULTIPLY:
+        case DOT:
+        case QUANTIZED_DOT:
+        case ACTIVATION:
+        case TRANSPOSE:
+        case FUSED:
+        case LSTM_CELL:
+        case LSTM_HIDDEN:
+        case LSTM_PROJECTION:
+        case LSTM_STEP:
+            break;
+        default:
+            return false;
+    }
+    //Exit points are read by train after FORWARD
+    if (!node->m) return false;
+    for (int i = 0; i < node->m; i++) {
+        if (node->outputs[i] && node->outputs[i]->isData) return false;
+    }
+    return true;
+}
+
+//POST: The segment length k minimising the activations held at once, i.e. every
+//      checkpoint plus one segment being recomputed: ceil(n / k) + k
+//      maxActivations of 0 gives k = sqrt(n), otherwise the smallest k within the budget
+static int segmentLength(int nRecomputable, int maxActivations) {
+    int best = 1, bestCost = nRecomputable + 1, cost;
+    for (int k = 1; k <= nRecomputable; k++) {
+        cost = (nRecomputable + k - 1) / k + k;
+        if (maxActivations && cost <= maxActivations) return k;
+        if (cost < bestCost) {
+            best = k;
+            bestCost = cost;
+        }
+    }
+    //Nothing fits the budget, so settle for the fewest activations possible
+    return best;
+}
+
+//PRE: nodes is a schedule of length nodes as returned by schedule
+//PRE: maxActivations is 0 for sqrt(n) checkpoints, otherwise how many activations may be held at once
+//POST: Every segmentLength'th recomputable operation (in execution order) is a checkpoint
+checkpoints_t *scheduleCheckpoints(node_t **nodes, int length, int maxActivations) {
+    checkpoints_t *plan = calloc(1, sizeof(checkpoints_t));
+    plan->nodes = nodes;
+    plan->length = length;
+    plan->keep = malloc(sizeof(bool) * length);
+    plan->drops = calloc(length, sizeof(node_t**));
+    plan->nDrops = calloc(length, sizeof(int));
+
+    int nRecomputable = 0;
+    for (int i = 0; i < length; i++) {
+        nRecomputable += isRecomputable(nodes[i]);
+        plan->nActivations += !nodes[i]->isData;
+    }
+    plan->segmentLength = segmentLength(nRecomputable, maxActivations);
+
+    int seen = 0;
+    for (int i = length - 1; i >= 0; i--) {
+        plan->keep[i] = !isRecomputable(nodes[i]) || 0 == ++seen % plan->segmentLength;
+    }
+
+    //Nodes run from the end of the schedule so an activation's last reader has the smallest index
+    nodeIndex_t *sorted = malloc(sizeof(nodeIndex_t) * length);
+    int *lastUse = malloc(sizeof(int) * length);
+    for (int i = 0; i < length; i++) {
+        sorted[i] = (nodeIndex_t) {.node = nodes[i], .idx = i};
+        lastUse[i] = -1;
+    }
+    qsort(sorted, length, sizeof(nodeIndex_t), compareNodeIndex);
+
+    nodeIndex_t key, *found;
+    for (int i = length - 1; i >= 0; i--) {
+        for (int j = 0; j < nodes[i]->n; j++) {
+            key.node = nodes[i]->inputs[j];
+            if (!key.node) continue;
+            found = bsearch(&key, sorted, length, sizeof(nodeIndex_t), compareNodeIndex);
+            if (found) lastUse[found->idx] = i;
+        }
+    }
+    for (int i = 0; i < length; i++) {
+        if (!plan->keep[i] && lastUse[i] >= 0) {
+            push(&plan->drops[lastUse[i]], &plan->nDrops[lastUse[i]], nodes[i]);
+        }
+    }
+
+    free(sorted);
+    free(lastUse);
+    return plan;
+}
+
+void checkpointsFree(checkpoints_t *plan) {
+    for (int i = 0; i < plan->length; i++) free(plan->drops[i]);
+    free(plan->drops);
+    free(plan->nDrops);
+    free(plan->keep);
+    free(plan->recomputed);
+    free(plan);
+}
+
+//PRE: nodes is a schedule of length nodes as returned by schedule
+//POST: Each node is one level after the latest of its inputs, so in a stack of recurrent
+//      layers the cell of layer l at step t lands on the anti-diagonal through (l - 1, t) and (l, t - 1)
+wavefront_t *scheduleWavefront(node_t **nodes, int length) {
+    wavefront_t *plan = calloc(1, sizeof(wavefront_t));
+
+    nodeIndex_t *sorted = malloc(sizeof(nodeIndex_t) * length);
+    for (int i = 0; i < length; i++) sorted[i] = (nodeIndex_t) {.node = nodes[i], .idx = i};
+    qsort(sorted, length, sizeof(nodeIndex_t), compareNodeIndex);
+
+    //Nodes run from the end of the schedule, so inputs always have their level first
+    int *level = calloc(length, sizeof(int));
+    nodeIndex_t key, *found;
+    for (int i = length - 1; i >= 0; i--) {
+        for (int j = 0; j < nodes[i]->n; j++) {
+            key.node = nodes[i]->inputs[j];
+            if (!key.node) continue;
+            found = bsearch(&key, sorted, length, sizeof(nodeIndex_t), compareNodeIndex);
+            if (found && level[found->idx] + 1 > level[i]) level[i] = level[found->idx] + 1;
+        }
+        if (level[i] + 1 > plan->nLevels) plan->nLevels = level[i] + 1;
+    }
+
+    plan->levels = calloc(plan->nLevels, sizeof(node_t**));
+    plan->levelLengths = calloc(plan->nLevels, sizeof(int));
+    int *nOperations = calloc(plan->nLevels, sizeof(int));
+    for (int i = length - 1; i >= 0; i--) {
+        push(&plan->levels[level[i]], &plan->levelLengths[level[i]], nodes[i]);
+        if (!nodes[i]->isData && ++nOperations[level[i]] > plan->widest) plan->widest = nOperations[level[i]];
+    }
+
+    free(nOperations);
+    free(level);
+    free(sorted);
+    return plan;
+}
+
+void wavefrontFree(wavefront_t *plan) {
+    for (int i = 0; i < plan->nLevels; i++) free(plan->levels[i]);
+    free(plan->levels);
+    free(plan->levelLengths);
+    free(plan);
+}
@@ -0,0 +1,212 @@
+#include "../sparse.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../gemm.h"
+#include "../matrix.h"
+#include "../nodes.h"
+#include "../passes.h"
+
+//Products add each output's terms in order of k as gemm does, so a sparse product of a pruned matrix
+//gives the same bits as the dense one
+
+//POST: Whether the blockSize x blockSize block at block row r and block column c holds a non zero
+static bool isBlockZero(matrix2d_t *matrix, int blockSize, int r, int c) {
+    for (int i = r * blockSize; i < (r + 1) * blockSize; i++) {
+        for (int j = c * blockSize; j < (c + 1) * blockSize; j++) {
+            if (matrix->data[i][j]) return false;
+        }
+    }
+    return true;
+}
+
+//PRE: blockSize divides both of matrix's dimensions
+//POST: The blocks of matrix holding a non zero, in block sparse rows
+sparse_t *sparseFromMatrix(matrix2d_t *matrix, int blockSize) {
+    int nBlockRows = matrix->nRows / blockSize, nBlockCols = matrix->nCols / blockSize, area = blockSize * blockSize;
+    sparse_t *sparse = malloc(sizeof(sparse_t));
+    sparse->nRows = matrix->nRows;
+    sparse->nCols = matrix->nCols;
+    sparse->blockSize = blockSize;
+    sparse->nBlocks = 0;
+    sparse->rowStarts = malloc(sizeof(int) * (nBlockRows + 1));
+    for (int r = 0; r < nBlockRows; r++) {
+        sparse->rowStarts[r] = sparse->nBlocks;
+        for (int c = 0; c < nBlockCols; c++) sparse->nBlocks += !isBlockZero(matrix, blockSize, r, c);
+    }
+    sparse->rowStarts[nBlockRows] = sparse->nBlocks;
+    sparse->blockCols = malloc(sizeof(int) * sparse->nBlocks + 1);
+    sparse->values = malloc(sizeof(real_t) * sparse->nBlocks * area + 1);
+
+    int p = 0;
+    for (int r = 0; r < nBlockRows; r++) {
+        for (int c = 0; c < nBlockCols; c++) {
+            if (isBlockZero(matrix, blockSize, r, c)) continue;
+            sparse->blockCols[p] = c;
+            for (int i = 0; i < blockSize; i++) {
+                memcpy(sparse->values + p * area + i * blockSize, matrix->data[r * blockSize + i] + c * blockSize,
+                       sizeof(real_t) * blockSize);
+            }
+            p++;
+        }
+    }
+    return sparse;
+}
+
+matrix2d_t *sparseToMatrix(sparse_t *sparse) {
+    int blockSize = sparse->blockSize, area = blockSize * blockSize;
+    matrix2d_t *matrix = matrixCreate(sparse->nRows, sparse->nCols);
+    for (int r = 0; r < sparse->nRows / blockSize; r++) {
+        for (int p = sparse->rowStarts[r]; p < sparse->rowStarts[r + 1]; p++) {
+            for (int i = 0; i < blockSize; i++) {
+                memcpy(matrix->data[r * blockSize + i] + sparse->blockCols[p] * blockSize,
+                       sparse->values + p * area + i * blockSize, sizeof(real_t) * blockSize);
+            }
+        }
+    }
+    return matrix;
+}
+
+void sparseFree(sparse_t *sparse) {
+    if (!sparse) return;
+    free(sparse->rowStarts);
+    free(sparse->blockCols);
+    free(sparse->values);
+    free(sparse);
+}
+
+//PRE: sparse is nRows x nShared and dense is nShared x nCols
+//POST: sparse . dense, with each stored value scaling a row of dense into a row of the output
+matrix2d_t *sparseDenseProduct(sparse_t *sparse, matrix2d_t *dense) {
+    int blockSize = sparse->blockSize, area = blockSize * blockSize, nCols = dense->nCols;
+    matrix2d_t *output = matrixCreate(sparse->nRows, nCols);
+    real_t value, *block, *out, *in;
+    for (int r = 0; r < sparse->nRows / blockSize; r++) {
+        for (int p = sparse->rowStarts[r]; p < sparse->rowStarts[r + 1]; p++) {
+            block = sparse->values + p * area;
+            for (int i = 0; i < blockSize; i++) {
+                out = output->data[r * blockSize + i];
+                for (int k = 0; k < blockSize; k++) {
+                    if (!(value = block[i * blockSize + k])) continue;
+                    in = dense->data[sparse->blockCols[p] * blockSize + k];
+                    for (int j = 0; j < nCols; j++) out[j] += value * in[j];
+                }
+            }
+        }
+    }
+    return output;
+}
+
+//POST: out's nOut rows += in's nOut rows . sparse, so up to GEMM_ROWS rows share each load of an index
+static void denseSparseRows(real_t **in, real_t **out, int nOut, sparse_t *sparse) {
+    int blockSize = sparse->blockSize, area = blockSize * blockSize, k, col;
+    real_t a[GEMM_ROWS], value, *block;
+    bool any;
+    for (int r = 0; r < sparse->nRows / blockSize; r++) {
+        for (int i = 0; i < blockSize; i++) {
+            k = r * blockSize + i;
+            any = false;
+            for (int t = 0; t < nOut; t++) any |= (a[t] = in[t][k]) != 0;
+            //Sparse inputs, i.e. images, are mostly zeros
+            if (!any) continue;
+            for (int p = sparse->rowStarts[r]; p < sparse->rowStarts[r + 1]; p++) {
+                block = sparse->values + p * area + i * blockSize;
+                col = sparse->blockCols[p] * blockSize;
+                for (int j = 0; j < blockSize; j++) {
+                    value = block[j];
+                    for (int t = 0; t < nOut; t++) out[t][col + j] += a[t] * value;
+                }
+            }
+        }
+    }
+}
+
+//PRE: dense is nRows x nShared and sparse is nShared x nCols
+//POST: dense . sparse, i.e. a layer's input times its pruned weights
+matrix2d_t *denseSparseProduct(matrix2d_t *dense, sparse_t *sparse) {
+    matrix2d_t *output = matrixCreate(dense->nRows, sparse->nCols);
+    int i;
+    for (i = 0; i + GEMM_ROWS <= dense->nRows; i += GEMM_ROWS) {
+        denseSparseRows(dense->data + i, output->data + i, GEMM_ROWS, sparse);
+    }
+    if (i < dense->nRows) denseSparseRows(dense->data + i, output->data + i, dense->nRows - i, sparse);
+    return output;
+}
+
+typedef struct blockNorm {
+    real_t norm;
+    int idx;
+} blockNorm_t;
+
+static int compareBlockNorm(const void *a, const void *b) {
+    real_t first = ((blockNorm_t*) a)->norm, second = ((blockNorm_t*) b)->norm;
+    return (first > second) - (first < second);
+}
+
+//PRE: blockSize divides both of matrix's dimensions
+//POST: The sparsity fraction of matrix's blocks with the smallest L1 norms are zeroed
+void pruneMatrix(matrix2d_t *matrix, double sparsity, int blockSize) {
+    int nBlockCols = matrix->nCols / blockSize, nBlocks = matrix->nRows / blockSize * nBlockCols;
+    int nPruned = sparsity * nBlocks, r, c;
+    blockNorm_t *norms = malloc(sizeof(blockNorm_t) * nBlocks + 1);
+    for (int b = 0; b < nBlocks; b++) {
+        norms[b] = (blockNorm_t) {0, b};
+        r = b / nBlockCols, c = b % nBlockCols;
+        for (int i = r * blockSize; i < (r + 1) * blockSize; i++) {
+            for (int j = c * blockSize; j < (c + 1) * blockSize; j++) norms[b].norm += fabs(matrix->data[i][j]);
+        }
+    }
+    qsort(norms, nBlocks, sizeof(blockNorm_t), compareBlockNorm);
+    for (int b = 0; b < nPruned; b++) {
+        r = norms[b].idx / nBlockCols, c = norms[b].idx % nBlockCols;
+        for (int i = r * blockSize; i < (r + 1) * blockSize; i++) {
+            memset(matrix->data[i] + c * blockSize, 0, sizeof(real_t) * blockSize);
+        }
+    }
+    free(norms);
+}
+
+//POST: weights as block sparse rows, made from their dense matrix, which is freed, if they aren't already
+//      Graphs read back from a file hold their pruned weights dense
+//      Sparse weights are constant, as there's no dense matrix left for a gradient to be the shape of
+sparse_t *sparseWeights(data_t *weights) {
+    if (weights->sparse) return weights->sparse;
+    weights->constant = true;
+    weights->sparse = sparseFromMatrix(weights->data->matrix2d, 1);
+    matrixFree(weights->data->matrix2d);
+    weights->data->matrix2d = NULL;
+    return weights->sparse;
+}
+
+//PRE: nodes is a forward schedule as made by schedule
+//POST: Every product of an activation with weights read by nothing else is a SPARSE_DOT, with the sparsity
+//      fraction of its weights' blocks pruned by magnitude and the rest held as block sparse rows
+//      Weights blockSize doesn't divide are pruned element by element. The number rewritten is returned
+//      Pruned weights are constant from then on, so they are no longer trained
+int pruneWeights(node_t **nodes, int length, double sparsity, int blockSize) {
+    nodeIndex_t *sorted = indexNodes(nodes, length);
+    shape_t *shapes = scheduleShapes(nodes, length);
+    node_t *node, *weights;
+    matrix2d_t *matrix;
+    int size, nRewritten = 0;
+    for (int i = 0; i < length; i++) {
+        node = nodes[i];
+        if (!(weights = ownedProductWeights(node, shapes, sorted, length))) continue;
+        matrix = weights->content.data->data->matrix2d;
+        size = matrix->nRows % blockSize || matrix->nCols % blockSize ? 1 : blockSize;
+        pruneMatrix(matrix, sparsity, size);
+        weights->content.data->sparse = sparseFromMatrix(matrix, size);
+        weights->content.data->constant = true;
+        matrixFree(matrix);
+        weights->content.data->data->matrix2d = NULL;
+        if (weights->matrix->matrix2d) matrixFree(weights->matrix->matrix2d);
+        weights->matrix->matrix2d = NULL;
+        node->content.operation.funcName = SPARSE_DOT;
+        nRewritten++;
+    }
+    free(sorted);
+    free(shapes);
+    return nRewritten;
+}
@@ -6,15 +6,35 @@
 #include <string.h>
 
 #include "../activation.h"
+#include "../allreduce.h"
+#include "../autograd.h"
+#include "../bucket.h"
+#include "../convolution.h"
 #include "../data.h"
 #include "../error.h"
 #include "../file.h"
+#include "../fusion.h"
+#include "../gemm.h"
+#include "../half.h"
+#include "../jit.h"
+#include "../kernels.h"
+#include "../passes.h"
+#include "../layers.h"
+#include "../lowrank.h"
+#include "../lstm.h"
 #include "../matrix.h"
 #include "../nodes.h"
 #include "../optimisers.h"
+#include "../pooling.h"
+#include "../predict.h"
+#include "../prune.h"
+#include "../quantize.h"
 #include "../readCSV.h"
 #include "../scheduler.h"
+#include "../sparse.h"
 #include "../testUtils.h"
+#include "../train.h"
+#include "../util.h"
 
 #define SCALAR_TEST 213584.042312
 #define DOUBLE_COMPARISON 0.000000000000001
@@ -143,7 +163,7 @@ void testMatrix() {
         for (int j = 0; j < m1->nCols; j++) {
             assertEqual(matrixGet(m3, i, j), ((matrixGet(m1, i, j)) + matrixGet(m2, i, j)));
             assertEqual(matrixGet(m4, i, j), ((matrixGet(m1, i, j)) * matrixGet(m2, i, j)));
-            assertEqual(matrixGet(m5, i, j), (matrixGet(m1, i, j) * SCALAR_TEST));
+            assertEqual(matrixGet(m5, i, j), (real_t) (matrixGet(m1, i, j) * SCALAR_TEST));
             assertEqual(matrixGet(m6, i, j), ((matrixGet(m1, i, j)) - matrixGet(m2, i, j)));
         }
     }
@@ -168,7 +188,8 @@ void testMatrixDotProduct() {
     assertEqual(m3->nRows, m1->nRows);
     assertEqual(m3->nCols, m2->nCols);
     matrix2d_t *m4 = matrixDotProduct(m5, m6);
-    double result1, result2;
+    //Summed in the same type and order as gemm, so the results are identical
+    real_t result1, result2;
     for (int i = 0; i < m1->nRows; i++) {
         for (int j = 0; j < m2->nCols; j++) {
             result1 = result2 = 0;
@@ -203,16 +224,16 @@ void testMatrixActiveFuncs() {
 
     for (int i = 0; i < m1->nRows; i++) {
         for (int j = 0; j < m1->nCols; j++) {
-            assertEqual(matrixGet(m2, i, j), relu(matrixGet(m1, i, j)));
-            assertEqual(matrixGet(m3, i, j), reluPrime(matrixGet(m1, i, j)));
-            assertEqual(matrixGet(m4, i, j), lRelu(matrixGet(m1, i, j)));
-            assertEqual(matrixGet(m5, i, j), lReluPrime());
-            assertEqual(matrixGet(m6, i, j), linear(matrixGet(m1, i, j)));
-            assertEqual(matrixGet(m7, i, j), linearPrime(matrixGet(m1, i, j)));
-            assertEqual(matrixGet(m8, i, j), sigmoid(matrixGet(m1, i, j)));
-            assertEqual(matrixGet(m9, i, j), sigmoidPrime(matrixGet(m1, i, j)));
-            assertEqual(matrixGet(m10, i, j), tanhActive(matrixGet(m1, i, j)));
-            assertEqual(matrixGet(m11, i, j), tanhPrime(matrixGet(m1, i, j)));
+            assertEqual(matrixGet(m2, i, j), (real_t) relu(matrixGet(m1, i, j)));
+            assertEqual(matrixGet(m3, i, j), (real_t) reluPrime(matrixGet(m1, i, j)));
+            assertEqual(matrixGet(m4, i, j), (real_t) lRelu(matrixGet(m1, i, j)));
+            assertEqual(matrixGet(m5, i, j), (real_t) lReluPrime());
+            assertEqual(matrixGet(m6, i, j), (real_t) linear(matrixGet(m1, i, j)));
+            assertEqual(matrixGet(m7, i, j), (real_t) linearPrime(matrixGet(m1, i, j)));
+            assertEqual(matrixGet(m8, i, j), (real_t) sigmoid(matrixGet(m1, i, j)));
+            assertEqual(matrixGet(m9, i, j), (real_t) sigmoidPrime(matrixGet(m1, i, j)));
+            assertEqual(matrixGet(m10, i, j), (real_t) tanhActive(matrixGet(m1, i, j)));
+            assertEqual(matrixGet(m11, i, j), (real_t) tanhPrime(matrixGet(m1, i, j)));
         }
     }
     printf("Finished testing matrix apply activations functions\n");
@@ -272,7 +293,7 @@ void testSingleMatrixFuncs() {
 
     matrix2d_t *m4 = matrixCreate(231, 234);
     matrixRandomise(m4);
-    double* flattenM4 = flatten2d(m4);
+    real_t* flattenM4 = flatten2d(m4);
     for (int i = 0; i < m4->nRows; i++) {
         for (int j = 0; j < m4->nCols; j++) {
             assertEqual(flattenM4[(i * m4->nCols) + j], matrixGet(m4, i, j));
@@ -291,6 +312,56 @@ void testGraph(void) {
     printf("Finished testing graph read/write functions\n");
 }
 
+void testGraphClone(void) {
+    printf("Testing graph cloning\n");
+
+    graph_t *graph = genGraph();
+    graph->entryPoints[2]->content.data->internalNode = false;
+    graph_t *copy = graphClone(graph);
+    assertOther(graphsAreEqual(graph, copy));
+
+    for (int i = 0; i < graph->n; i++) {
+        assertOther(graph->entryPoints[i] != copy->entryPoints[i]);
+        assertOther(graph->entryPoints[i]->matrix != copy->entryPoints[i]->matrix);
+    }
+    //Weights are shared, inputs aren't
+    assertEqualPtr(copy->entryPoints[0]->content.data, graph->entryPoints[0]->content.data);
+    assertOther(copy->entryPoints[2]->content.data != graph->entryPoints[2]->content.data);
+    assertEqualPtr(copy->exitPoints[0]->inputs[0], copy->entryPoints[0]->outputs[0]);
+
+    printf("Finished testing graph cloning\n");
+}
+
+#define ALLREDUCE_TEST_LENGTH (3 * ALLREDUCE_CHUNK + 7)
+
+//Each rank records in shared memory whether it received the correct sum
+static void allReduceRank(void *arg) {
+    communicator_t *comm = arg;
+    real_t *data = malloc(sizeof(real_t) * ALLREDUCE_TEST_LENGTH);
+    for (int i = 0; i < ALLREDUCE_TEST_LENGTH; i++) data[i] = (comm->rank + 1) * i;
+    allReduce(comm, data, ALLREDUCE_TEST_LENGTH);
+
+    int sum = comm->nRanks * (comm->nRanks + 1) / 2;
+    bool correct = true;
+    for (int i = 0; i < ALLREDUCE_TEST_LENGTH; i++) correct &= data[i] == (double) sum * i;
+    comm->shared[comm->rank] = correct;
+    free(data);
+}
+
+void testAllReduce(void) {
+    printf("Testing all-reduce\n");
+
+    const int nRanks = 3;
+    communicator_t *comm = communicatorInit(nRanks, nRanks);
+    assertOther(communicatorRun(comm, allReduceRank, comm));
+    for (int i = 0; i < nRanks; i++) {
+        assertEqual(comm->shared[i], 1.0);
+    }
+    communicatorFree(comm);
+
+    printf("Finished testing all-reduce\n");
+}
+
 //Uses this graph
 //https://miro.medium.com/max/4000/1*Fi1AZPZLrGf-6wM_wTSPQw.png
 void testScheduler() {
@@ -384,6 +455,1879 @@ void testDataFile() {
     printf("Finished testing data files\n");
 }
 
+void testDataPrecision(void) {
+    printf("Testing data files of either precision\n");
+    const double values[] = {0.5, -1.25, 3.0, 0.375, 42.0, -0.0078125};
+    FILE *file = fopen("dataTest", "w");
+    //As written before the element size was recorded, so doubles
+    fprintf(file, "old\t2\t3\t");
+    fwrite(values, sizeof(double), 6, file);
+    //As a float32 build writes them
+    fprintf(file, "floats\t3\t2:%zu\t", sizeof(float));
+    for (int i = 0; i < 6; i++) {
+        float value = values[i];
+        fwrite(&value, sizeof(float), 1, file);
+    }
+    fclose(file);
+    //And as this build writes them
+    node_t *node = nodeInit("native", 0, 1, true);
+    node->content.data->data->matrix2d = matrixCreate(1, 6);
+    for (int i = 0; i < 6; i++) matrixSet(node->content.data->data->matrix2d, 0, i, values[i]);
+    file = fopen("dataTest", "a");
+    writeBlock(file, *node);
+    fclose(file);
+
+    data_t **read = readData("dataTest");
+    matrix2d_t *old = read[0]->data->matrix2d, *floats = read[1]->data->matrix2d, *native = read[2]->data->matrix2d;
+    assertEqual(old->nRows, 2);
+    assertEqual(old->nCols, 3);
+    assertEqual(floats->nRows, 3);
+    assertEqual(floats->nCols, 2);
+    //Every value is exact in a float, so nothing is lost either way
+    bool exact = true;
+    for (int i = 0; i < 6; i++) {
+        exact &= values[i] == matrixGet(old, i / 3, i % 3);
+        exact &= values[i] == matrixGet(floats, i / 2, i % 2);
+        exact &= values[i] == matrixGet(native, 0, i);
+    }
+    assertOther(exact);
+    remove("dataTest");
+    printf("Finished testing data files of either precision\n");
+}
+
+//POST: timeSteps inputs of batchSize x nFeatures random values, which aren't trained
+static node_t **randomInputs(int timeSteps, int batchSize, int nFeatures) {
+    node_t **inputs = malloc(sizeof(node_t*) * timeSteps);
+    for (int t = 0; t < timeSteps; t++) {
+        inputs[t] = nodeInit("x", 0, 1, true);
+        inputs[t]->content.data->internalNode = false;
+        inputs[t]->content.data->data->matrix2d = matrixCreate(batchSize, nFeatures);
+        matrixRandomise(inputs[t]->content.data->data->matrix2d);
+        inputs[t]->matrix->matrix2d = inputs[t]->content.data->data->matrix2d;
+    }
+    return inputs;
+}
+
+void testCheckpoints(void) {
+    printf("Testing checkpointing\n");
+
+    //x -> sigmoid -> ... -> sigmoid -> y
+    const int depth = 16;
+    node_t *x = nodeInit("x", 0, 1, true);
+    x->content.data->data->matrix2d = matrixCreate(2, 2);
+    for (int i = 0; i < 4; i++) matrixSet(x->content.data->data->matrix2d, i / 2, i % 2, i);
+
+    node_t **chain = malloc(sizeof(node_t*) * depth);
+    node_t *prev = x;
+    for (int i = 0; i < depth; i++) {
+        chain[i] = nodeInit("sigmoid", 1, 1, false);
+        chain[i]->content.operation = (operation_t) {.funcName = ACTIVATION, .activationName = SIGMOID};
+        linkNodes(prev, chain[i]);
+        prev = chain[i];
+    }
+    node_t *y = nodeInit("y", 1, 0, true);
+    y->content.data->data->matrix2d = matrixCreate(2, 2);
+    linkNodes(prev, y);
+
+    node_t **entryPoints = malloc(sizeof(node_t*));
+    entryPoints[0] = x;
+    node_t **exitPoints = malloc(sizeof(node_t*));
+    exitPoints[0] = y;
+    graph_t *graph = graphInit("chain", 1, entryPoints, 1, exitPoints);
+
+    int length;
+    node_t **nodes = schedule(graph, &length);
+    tape_t *tape = tapeRecord(nodes, length);
+    matrix2d_t *seed = matrixCreate(2, 2);
+    for (int i = 0; i < 4; i++) matrixSet(seed, i / 2, i % 2, 1);
+    execute(nodes, length, FORWARD);
+    tapeZero(tape);
+    tapeSeed(chain[depth - 1], seed);
+    tapeBackward(tape, NULL);
+    matrix2d_t *expected = matrixClone(x->gradient->matrix2d);
+
+    checkpoints_t *plan = scheduleCheckpoints(nodes, length, 0);
+    executeCheckpointed(plan, nodes, length, FORWARD);
+    assertOther(plan->peakLive < depth);
+    //The exit point's input is always kept
+    assertOther(NULL != chain[depth - 1]->matrix->matrix2d);
+    bool *dropped = calloc(depth, sizeof(bool));
+    int nDropped = 0;
+    for (int i = 0; i < depth; i++) nDropped += dropped[i] = !chain[i]->matrix->matrix2d;
+    assertOther(nDropped > 0);
+
+    //BACKWARD recomputes every dropped activation it reads, a segment at a time
+    tapeZero(tape);
+    tapeSeed(chain[depth - 1], seed);
+    tapeBackward(tape, plan);
+    for (int j = 0; j < 4; j++) {
+        assertEqual(matrixGet(x->gradient->matrix2d, j / 2, j % 2), matrixGet(expected, j / 2, j % 2));
+    }
+    //Recomputed activations are freed again once BACKWARD is done
+    for (int i = 0; i < depth; i++) {
+        if (dropped[i]) assertOther(NULL == chain[i]->matrix->matrix2d);
+    }
+    assertOther(plan->peakLive < depth);
+
+    checkpointsFree(plan);
+    tapeFree(tape);
+    matrixFree(seed);
+    matrixFree(expected);
+    free(dropped);
+    free(nodes);
+
+    //Long fused and stacked LSTMs, the sequences checkpointing is for
+    const int timeSteps = 12, batchSize = 2, nFeatures = 3, nNeurons = 4;
+    matrix2d_t **gradients;
+    for (int g = 0; g < 2; g++) {
+        graph = g ? stackedLSTM(randomInputs(timeSteps, batchSize, nFeatures), timeSteps, 2, SIGMOID, nNeurons)
+                  : fusedLSTM(randomInputs(timeSteps, batchSize, nFeatures), timeSteps, SIGMOID, nNeurons);
+        graph->exitPoints[0]->content.data->data->matrix2d = matrixCreate(batchSize, nNeurons);
+        nodes = schedule(graph, &length);
+        tape = tapeRecord(nodes, length);
+        seed = matrixCreate(batchSize, nNeurons);
+        matrixRandomise(seed);
+        execute(nodes, length, FORWARD);
+        tapeZero(tape);
+        tapeSeed(graph->exitPoints[0]->inputs[0], seed);
+        tapeBackward(tape, NULL);
+        gradients = malloc(sizeof(matrix2d_t*) * tape->nParams);
+        for (int i = 0; i < tape->nParams; i++) gradients[i] = matrixClone(tape->params[i]->gradient->matrix2d);
+
+        plan = scheduleCheckpoints(nodes, length, 0);
+        executeCheckpointed(plan, nodes, length, FORWARD);
+        assertOther(plan->peakLive < plan->nActivations);
+        tapeZero(tape);
+        tapeSeed(graph->exitPoints[0]->inputs[0], seed);
+        tapeBackward(tape, plan);
+        assertOther(plan->peakLive < plan->nActivations);
+        for (int i = 0; i < tape->nParams; i++) {
+            assertOther(areMatrixesEqual(gradients[i], tape->params[i]->gradient->matrix2d, 0));
+            matrixFree(gradients[i]);
+        }
+
+        free(gradients);
+        checkpointsFree(plan);
+        tapeFree(tape);
+        matrixFree(seed);
+        free(nodes);
+    }
+    printf("Finished testing checkpointing\n");
+}
+
+static graph_t *genLSTM(int timeSteps) {
+    node_t **inputs = malloc(sizeof(node_t*) * timeSteps);
+    for (int t = 0; t < timeSteps; t++) {
+        inputs[t] = nodeInit("x", 0, 4, true);
+        inputs[t]->content.data->internalNode = false;
+        inputs[t]->content.data->data->matrix2d = matrixCreate(2, 3);
+        matrixRandomise(inputs[t]->content.data->data->matrix2d);
+        inputs[t]->matrix->matrix2d = inputs[t]->content.data->data->matrix2d;
+    }
+    return LSTM(inputs, timeSteps, SIGMOID, 4);
+}
+
+static int countParams(graph_t *graph) {
+    int nParams = 0;
+    for (int i = 0; i < graph->n; i++) nParams += graph->entryPoints[i]->content.data->internalNode;
+    return nParams;
+}
+
+void testLSTMSharedWeights(void) {
+    printf("Testing LSTM weight sharing\n");
+
+    const int timeSteps = 8;
+    graph_t *single = genLSTM(1);
+    graph_t *unrolled = genLSTM(timeSteps);
+    //Initial output and state, then W, U and a bias for each of the 4 gates
+    assertEqual(countParams(single), 14);
+    assertEqual(countParams(unrolled), 14);
+
+    //Every cell uses the same weights
+    node_t *weightW = unrolled->entryPoints[2];
+    assertEqual(weightW->m, timeSteps);
+    assertEqual(weightW->outputIdx, timeSteps);
+    for (int t = 1; t < timeSteps; t++) {
+        assertOther(weightW->outputs[t] != weightW->outputs[0]);
+    }
+
+    printf("Finished testing LSTM weight sharing\n");
+}
+
+//Central differences are most accurate with a step near the cube root of real_t's rounding error,
+//where their error is near its square
+#define GRADIENT_CHECK_STEP cbrt(REAL_EPSILON)
+#define GRADIENT_CHECK_TOLERANCE (1000 * pow(REAL_EPSILON, 2.0 / 3))
+
+//POST: sum(lstmCellForward(params, x, state) * weights), i.e. a loss whose dL/dNextState is weights
+static double lstmLoss(lstmParams_t *params, matrix2d_t *x, matrix2d_t *state, matrix2d_t *weights) {
+    matrix2d_t *next = lstmCellForward(params, x, state, NULL);
+    double loss = 0;
+    for (int i = 0; i < next->nRows; i++) {
+        for (int j = 0; j < next->nCols; j++) loss += next->data[i][j] * weights->data[i][j];
+    }
+    matrixFree(next);
+    return loss;
+}
+
+//POST: Whether gradient matches the central difference of lstmLoss for every element of matrix
+static bool gradientMatches(lstmParams_t *params, matrix2d_t *x, matrix2d_t *state, matrix2d_t *weights,
+                            matrix2d_t *matrix, matrix2d_t *gradient) {
+    double original, up, down;
+    bool matches = true;
+    for (int i = 0; i < matrix->nRows; i++) {
+        for (int j = 0; j < matrix->nCols; j++) {
+            original = matrix->data[i][j];
+            matrix->data[i][j] = original + GRADIENT_CHECK_STEP;
+            up = lstmLoss(params, x, state, weights);
+            matrix->data[i][j] = original - GRADIENT_CHECK_STEP;
+            down = lstmLoss(params, x, state, weights);
+            matrix->data[i][j] = original;
+            matches &= fabs((up - down) / (2 * GRADIENT_CHECK_STEP) - gradient->data[i][j]) < GRADIENT_CHECK_TOLERANCE;
+        }
+    }
+    return matches;
+}
+
+void testLSTMCell(void) {
+    printf("Testing fused LSTM cell\n");
+
+    const int batchSize = 2, nFeatures = 3, nNeurons = 2;
+    lstmParams_t *params = lstmParamsCreate(nFeatures, nNeurons, SIGMOID);
+    matrix2d_t *x = matrixCreate(batchSize, nFeatures);
+    matrix2d_t *state = matrixCreate(batchSize, 2 * nNeurons);
+    matrix2d_t *weights = matrixCreate(batchSize, 2 * nNeurons);
+    matrixRandomise(params->bias);
+    matrixRandomise(x);
+    matrixRandomise(state);
+    matrixRandomise(weights);
+
+    lstmCache_t cache;
+    matrix2d_t *next = lstmCellForward(params, x, state, &cache);
+    lstmParams_t *gradients = lstmParamsZeroLike(params);
+    matrix2d_t *dx;
+    matrix2d_t *dState = lstmCellBackward(params, x, state, &cache, weights, gradients, &dx);
+
+    assertOther(gradientMatches(params, x, state, weights, params->weightW, gradients->weightW));
+    assertOther(gradientMatches(params, x, state, weights, params->weightU, gradients->weightU));
+    assertOther(gradientMatches(params, x, state, weights, params->bias, gradients->bias));
+    assertOther(gradientMatches(params, x, state, weights, x, dx));
+    assertOther(gradientMatches(params, x, state, weights, state, dState));
+
+    //With no weights every gate is 0.5 except the activation gate which is 0
+    lstmParams_t *zeroed = lstmParamsZeroLike(params);
+    matrixFree(next);
+    next = lstmCellForward(zeroed, x, state, NULL);
+    for (int i = 0; i < batchSize; i++) {
+        for (int j = 0; j < nNeurons; j++) {
+            assertEqual(next->data[i][nNeurons + j], (real_t) (0.5 * state->data[i][nNeurons + j]));
+            assertEqual(next->data[i][j], (real_t) (0.5 * tanh(0.5 * state->data[i][nNeurons + j])));
+        }
+    }
+
+    //A graph of fused cells runs end to end
+    const int timeSteps = 3;
+    node_t **inputs = malloc(sizeof(node_t*) * timeSteps);
+    for (int t = 0; t < timeSteps; t++) {
+        inputs[t] = nodeInit("x", 0, 1, true);
+        inputs[t]->content.data->internalNode = false;
+        inputs[t]->content.data->data->matrix2d = x;
+        inputs[t]->matrix->matrix2d = x;
+    }
+    graph_t *graph = fusedLSTM(inputs, timeSteps, SIGMOID, nNeurons);
+    graph->exitPoints[0]->content.data->data->matrix2d = matrixCreate(batchSize, nNeurons);
+    int length;
+    node_t **nodes = schedule(graph, &length);
+    execute(nodes, length, FORWARD);
+    matrix2d_t *output = graph->exitPoints[0]->inputs[0]->matrix->matrix2d;
+    assertEqual(output->nRows, batchSize);
+    assertEqual(output->nCols, nNeurons);
+
+    lstmCacheFree(&cache);
+    lstmParamsFree(params);
+    lstmParamsFree(gradients);
+    lstmParamsFree(zeroed);
+    printf("Finished testing fused LSTM cell\n");
+}
+
+static bool matricesClose(matrix2d_t *a, matrix2d_t *b) {
+    if (a->nRows != b->nRows || a->nCols != b->nCols) return false;
+    for (int i = 0; i < a->nRows; i++) {
+        for (int j = 0; j < a->nCols; j++) {
+            if (fabs(a->data[i][j] - b->data[i][j]) > GRADIENT_CHECK_TOLERANCE) return false;
+        }
+    }
+    return true;
+}
+
+void testLSTMProjection(void) {
+    printf("Testing hoisted LSTM input projections\n");
+
+    const int timeSteps = 3, batchSize = 2, nFeatures = 3, nNeurons = 2;
+    lstmParams_t *params = lstmParamsCreate(nFeatures, nNeurons, SIGMOID);
+    matrixRandomise(params->bias);
+    matrix2d_t *xs[timeSteps], *cellStates[timeSteps + 1], *stepStates[timeSteps + 1];
+    lstmCache_t cellCaches[timeSteps], stepCaches[timeSteps];
+    cellStates[0] = stepStates[0] = matrixCreate(batchSize, 2 * nNeurons);
+    matrixRandomise(cellStates[0]);
+
+    //Stepping through one projection gives the same states as cell by cell
+    for (int t = 0; t < timeSteps; t++) {
+        xs[t] = matrixCreate(batchSize, nFeatures);
+        matrixRandomise(xs[t]);
+    }
+    matrix2d_t *projection = lstmProjectInputs(params, xs, timeSteps);
+    assertEqual(projection->nRows, timeSteps * batchSize);
+    for (int t = 0; t < timeSteps; t++) {
+        cellStates[t + 1] = lstmCellForward(params, xs[t], cellStates[t], &cellCaches[t]);
+        stepStates[t + 1] = lstmStepForward(params, projection, t * batchSize, stepStates[t], &stepCaches[t]);
+        assertOther(matricesClose(cellStates[t + 1], stepStates[t + 1]));
+    }
+
+    //And the same gradients, with dW from one GEMM over the whole sequence
+    lstmParams_t *cellGradients = lstmParamsZeroLike(params);
+    lstmParams_t *stepGradients = lstmParamsZeroLike(params);
+    matrix2d_t *dProjection = matrixCreate(projection->nRows, projection->nCols);
+    matrix2d_t *cellDx[timeSteps], *stepDx[timeSteps];
+    matrix2d_t *dCell = matrixCreate(batchSize, 2 * nNeurons), *dStep = dCell;
+    matrixRandomise(dCell);
+    for (int t = timeSteps - 1; t >= 0; t--) {
+        dCell = lstmCellBackward(params, xs[t], cellStates[t], &cellCaches[t], dCell, cellGradients, &cellDx[t]);
+        dStep = lstmStepBackward(params, t * batchSize, stepStates[t], &stepCaches[t], dStep, stepGradients, dProjection);
+    }
+    lstmProjectInputsBackward(params, xs, timeSteps, dProjection, stepGradients, stepDx);
+    assertOther(matricesClose(dCell, dStep));
+    assertOther(matricesClose(cellGradients->weightW, stepGradients->weightW));
+    assertOther(matricesClose(cellGradients->weightU, stepGradients->weightU));
+    assertOther(matricesClose(cellGradients->bias, stepGradients->bias));
+    for (int t = 0; t < timeSteps; t++) assertOther(matricesClose(cellDx[t], stepDx[t]));
+
+    printf("Finished testing hoisted LSTM input projections\n");
+}
+
+//POST: sum(output * weights) once nodes have run forward, a loss whose dL/doutput is weights
+static double graphLoss(node_t **nodes, int length, node_t *output, matrix2d_t *weights) {
+    execute(nodes, length, FORWARD);
+    matrix2d_t *y = output->matrix->matrix2d;
+    double loss = 0;
+    for (int i = 0; i < y->nRows; i++) {
+        for (int j = 0; j < y->nCols; j++) loss += y->data[i][j] * weights->data[i][j];
+    }
+    return loss;
+}
+
+//POST: Whether the tape's gradient of every weight and bias matches the central difference of graphLoss
+static bool tapeMatches(tape_t *tape, node_t *output, matrix2d_t *weights) {
+    execute(tape->nodes, tape->length, FORWARD);
+    tapeZero(tape);
+    tapeSeed(output, weights);
+    tapeBackward(tape, NULL);
+
+    matrix2d_t *matrix, *gradient;
+    double original, up, down;
+    bool matches = tape->nParams > 0;
+    for (int k = 0; k < tape->nParams; k++) {
+        matrix = tape->params[k]->content.data->data->matrix2d;
+        gradient = tape->params[k]->gradient->matrix2d;
+        for (int i = 0; i < matrix->nRows; i++) {
+            for (int j = 0; j < matrix->nCols; j++) {
+                original = matrix->data[i][j];
+                matrix->data[i][j] = original + GRADIENT_CHECK_STEP;
+                up = graphLoss(tape->nodes, tape->length, output, weights);
+                matrix->data[i][j] = original - GRADIENT_CHECK_STEP;
+                down = graphLoss(tape->nodes, tape->length, output, weights);
+                matrix->data[i][j] = original;
+                matches &= fabs((up - down) / (2 * GRADIENT_CHECK_STEP) - gradient->data[i][j]) < GRADIENT_CHECK_TOLERANCE;
+            }
+        }
+    }
+    return matches;
+}
+
+//POST: Whether the tape's gradients of graph match central differences, for a random dL/doutput
+static bool graphGradientsMatch(graph_t *graph, int nRows, int nCols) {
+    //LSTM's exit point is its output rather than the y it feeds
+    node_t *y = graph->exitPoints[0]->isData ? graph->exitPoints[0] : graph->exitPoints[0]->outputs[0];
+    y->content.data->data->matrix2d = matrixCreate(nRows, nCols);
+    int length;
+    node_t **nodes = schedule(graph, &length);
+    tape_t *tape = tapeRecord(nodes, length);
+    matrix2d_t *weights = matrixCreate(nRows, nCols);
+    matrixRandomise(weights);
+    bool matches = tapeMatches(tape, y->inputs[0], weights);
+    tapeFree(tape);
+    matrixFree(weights);
+    free(nodes);
+    return matches;
+}
+
+//POST: A convolution or deconvolution of x by a random kernelSize x kernelSize kernel, which is added to entryPoints
+static node_t *convolutionNode(node_t *x, enum matrixFunction funcName, int kernelSize, int stride, int padding,
+                               int dilation, node_t ***entryPoints, int *length) {
+    node_t *kernel = nodeInit("kernel", 0, 1, true);
+    kernel->content.data->data->matrix2d = matrixCreate(kernelSize, kernelSize);
+    matrixRandomise(kernel->content.data->data->matrix2d);
+    node_t *config = nodeInit("config", 0, 1, true);
+    config->content.data->constant = true;
+    config->content.data->data->matrix2d = matrixCreate(1, 3);
+    matrixSet(config->content.data->data->matrix2d, 0, 0, stride);
+    matrixSet(config->content.data->data->matrix2d, 0, 1, padding);
+    matrixSet(config->content.data->data->matrix2d, 0, 2, dilation);
+    node_t *conv = nodeInit("conv", 3, 1, false);
+    conv->content.operation = (operation_t) {.funcName = funcName};
+    linkNodes(x, conv);
+    linkNodes(kernel, conv);
+    linkNodes(config, conv);
+    push(entryPoints, length, kernel);
+    push(entryPoints, length, config);
+    return conv;
+}
+
+//POST: A pooling of x by filterSize x filterSize windows every stride rows and columns
+static node_t *poolingNode(node_t *x, enum matrixFunction funcName, int stride, int filterSize,
+                           node_t ***entryPoints, int *length) {
+    node_t *config = nodeInit("config", 0, 1, true);
+    config->content.data->constant = true;
+    config->content.data->data->matrix2d = matrixCreate(1, 2);
+    matrixSet(config->content.data->data->matrix2d, 0, 0, stride);
+    matrixSet(config->content.data->data->matrix2d, 0, 1, filterSize);
+    node_t *pool = nodeInit("pool", 2, 1, false);
+    pool->content.operation = (operation_t) {.funcName = funcName};
+    linkNodes(x, pool);
+    linkNodes(config, pool);
+    push(entryPoints, length, config);
+    return pool;
+}
+
+//POST: transpose(tanh(x . w) * tanh(x . w) - tanh(x . w)) for a random 3 x 2 x, so tanh's
+//      gradient comes from three uses
+static graph_t *elementwiseGraph(void) {
+    node_t *x = randomInputs(1, 3, 2)[0];
+    node_t *w = nodeInit("w", 0, 1, true);
+    w->content.data->data->matrix2d = matrixCreate(2, 2);
+    matrixRandomise(w->content.data->data->matrix2d);
+    node_t *dot = nodeInit("dot", 2, 1, false);
+    dot->content.operation = (operation_t) {.funcName = DOT};
+    node_t *active = nodeInit("tanh", 1, 3, false);
+    active->content.operation = (operation_t) {.funcName = ACTIVATION, .activationName = TANH};
+    node_t *square = nodeInit("square", 2, 1, false);
+    square->content.operation = (operation_t) {.funcName = MULTIPLY};
+    node_t *difference = nodeInit("difference", 2, 1, false);
+    difference->content.operation = (operation_t) {.funcName = SUBTRACT};
+    node_t *transpose = nodeInit("transpose", 1, 1, false);
+    transpose->content.operation = (operation_t) {.funcName = TRANSPOSE};
+    node_t *y = nodeInit("y", 1, 0, true);
+    y->content.data->internalNode = false;
+    linkNodes(x, dot);
+    linkNodes(w, dot);
+    linkNodes(dot, active);
+    linkNodes(active, square);
+    linkNodes(active, square);
+    linkNodes(square, difference);
+    linkNodes(active, difference);
+    linkNodes(difference, transpose);
+    linkNodes(transpose, y);
+    node_t **entryPoints = malloc(sizeof(node_t*) * 2);
+    entryPoints[0] = x;
+    entryPoints[1] = w;
+    node_t **exitPoints = malloc(sizeof(node_t*));
+    exitPoints[0] = y;
+    return graphInit("elementwise", 2, entryPoints, 1, exitPoints);
+}
+
+//POST: A sigmoid then a tanh dense layer, of nHidden and nOutputs neurons, over a random batchSize x nFeatures x
+static graph_t *mlpGraph(int batchSize, int nFeatures, int nHidden, int nOutputs) {
+    node_t **entryPoints = NULL;
+    int n = 0;
+    node_t *x = randomInputs(1, batchSize, nFeatures)[0];
+    push(&entryPoints, &n, x);
+    node_t *layer = denseLayer(x, nHidden, SIGMOID, &entryPoints, &n);
+    layer = denseLayer(layer, nOutputs, TANH, &entryPoints, &n);
+    node_t *y = nodeInit("y", 1, 0, true);
+    y->content.data->internalNode = false;
+    linkNodes(layer, y);
+    node_t **exitPoints = malloc(sizeof(node_t*));
+    exitPoints[0] = y;
+    return graphInit("dense", n, entryPoints, 1, exitPoints);
+}
+
+static graph_t *denseGraph(void) {
+    return mlpGraph(4, 3, 3, 2);
+}
+
+//Trainers that take the same steps in a different order only differ by rounding
+#define TRAINING_TOLERANCE (1000 * REAL_EPSILON)
+
+//POST: nCopies of the same random 4 x 3 batch of inputs for denseGraph, one after another, and of its
+//      4 x 2 targets, returned through inputs
+static matrix2d_t **denseBatches(matrix2d_t ***inputs, int nCopies) {
+    matrix2d_t *x = matrixCreate(4, 3), *y = matrixCreate(4, 2);
+    matrixRandomise(x);
+    matrixRandomise(y);
+    *inputs = malloc(sizeof(matrix2d_t*));
+    (*inputs)[0] = matrixCreate(4 * nCopies, 3);
+    matrix2d_t **targets = malloc(sizeof(matrix2d_t*));
+    targets[0] = matrixCreate(4 * nCopies, 2);
+    for (int i = 0; i < 4 * nCopies; i++) {
+        memcpy((*inputs)[0]->data[i], x->data[i % 4], sizeof(real_t) * 3);
+        memcpy(targets[0]->data[i], y->data[i % 4], sizeof(real_t) * 2);
+    }
+    matrixFree(x);
+    matrixFree(y);
+    return targets;
+}
+
+//PRE: a and b are graphs of the same shape
+//POST: Whether every weight and bias of a is within tolerance of b's
+static bool sameWeights(graph_t *a, graph_t *b, double tolerance) {
+    bool same = true;
+    for (int i = 0; i < a->n; i++) {
+        if (!a->entryPoints[i]->content.data->internalNode) continue;
+        same &= areMatrixesEqual(a->entryPoints[i]->content.data->data->matrix2d,
+                                 b->entryPoints[i]->content.data->data->matrix2d, tolerance);
+    }
+    return same;
+}
+
+void testTrainDistributed(void) {
+    printf("Testing distributed training\n");
+
+    const int seed = 7, epochs = 10;
+    const double lRate = 0.05;
+    matrix2d_t **inputs;
+    srand(seed);
+    matrix2d_t **targets = denseBatches(&inputs, 1);
+
+    srand(seed);
+    graph_t *expected = denseGraph();
+    int before, after;
+    free(schedule(expected, &before));
+    train(expected, inputs, targets, lRate, epochs, MSE, 4, SGD);
+    //train optimises a clone, which leaves the graph it was given whole
+    free(schedule(expected, &after));
+    assertEqual(after, before);
+
+    //Every worker gets its own copy of the full batch, so their averaged gradient is the one train took
+    graph_t *graph;
+    for (int nWorkers = 1; nWorkers <= 2; nWorkers++) {
+        srand(seed);
+        targets = denseBatches(&inputs, nWorkers);
+        srand(seed);
+        graph = denseGraph();
+        assertOther(trainDistributed(graph, inputs, targets, lRate, epochs, MSE, 4, SGD, nWorkers));
+        assertOther(sameWeights(graph, expected, TRAINING_TOLERANCE));
+    }
+
+    printf("Finished testing distributed training\n");
+}
+
+void testTrainAsync(void) {
+    printf("Testing asynchronous training\n");
+
+    const int seed = 11, epochs = 10;
+    const double lRate = 0.05;
+    matrix2d_t **inputs;
+    matrix2d_t **targets = denseBatches(&inputs, 1);
+
+    srand(seed);
+    graph_t *expected = denseGraph();
+    train(expected, inputs, targets, lRate, epochs, MSE, 4, SGD);
+
+    //A single thread on full batches takes the same steps as train
+    srand(seed);
+    graph_t *graph = denseGraph();
+    trainAsync(graph, inputs, targets, lRate, epochs, MSE, 4, SGD, 1);
+    assertOther(sameWeights(graph, expected, TRAINING_TOLERANCE));
+
+    //Threads racing on the shared weights still bring the loss down
+    srand(seed);
+    double before = evaluate(denseGraph(), inputs, targets, MSE, 4);
+    srand(seed);
+    graph = denseGraph();
+    trainAsync(graph, inputs, targets, lRate, 20 * epochs, MSE, 4, SGD, 4);
+    assertOther(evaluate(graph, inputs, targets, MSE, 4) < before);
+
+    printf("Finished testing asynchronous training\n");
+}
+
+void testAutograd(void) {
+    printf("Testing tape autograd\n");
+
+    //transpose(tanh(x . w) * tanh(x . w) - tanh(x . w)), so tanh's gradient comes from three uses
+    assertOther(graphGradientsMatch(elementwiseGraph(), 2, 3));
+
+    //Dense layers
+    assertOther(graphGradientsMatch(denseGraph(), 4, 2));
+
+    //Through every step of an LSTM, which compile couldn't differentiate past the first
+    //genLSTM's cells share one set of weights, whose gradients are summed over every step
+    assertOther(graphGradientsMatch(genLSTM(3), 2, 4));
+    const int timeSteps = 3, batchSize = 2, nFeatures = 3, nNeurons = 2;
+    assertOther(graphGradientsMatch(fusedLSTM(randomInputs(timeSteps, batchSize, nFeatures), timeSteps, SIGMOID, nNeurons),
+                                    batchSize, nNeurons));
+    assertOther(graphGradientsMatch(stackedLSTM(randomInputs(timeSteps, batchSize, nFeatures), timeSteps, 2, SIGMOID, nNeurons),
+                                    batchSize, nNeurons));
+
+    //Convolutions, each passing its data gradient back to the kernels before it
+    node_t **entryPoints = NULL, **exitPoints;
+    int n = 0;
+    node_t *x = randomInputs(1, 7, 7)[0];
+    push(&entryPoints, &n, x);
+    node_t *layer = convolutionalLayer(x, 1, 3, 1, TANH, 1, 1, &entryPoints, &n);
+    layer = convolutionalLayer(layer, 1, 3, 1, TANH, 2, 1, &entryPoints, &n);
+    layer = convolutionNode(layer, CONVOLUTION, 2, 1, 1, 2, &entryPoints, &n);
+    layer = convolutionNode(layer, DECONVOLUTION, 3, 2, 1, 1, &entryPoints, &n);
+    node_t *y = nodeInit("y", 1, 0, true);
+    y->content.data->internalNode = false;
+    linkNodes(layer, y);
+    exitPoints = malloc(sizeof(node_t*));
+    exitPoints[0] = y;
+    assertOther(graphGradientsMatch(graphInit("convolution", n, entryPoints, 1, exitPoints), 7, 7));
+
+    //Pooling, with max pooling's gradient routed by the saved argmax
+    entryPoints = NULL;
+    n = 0;
+    x = randomInputs(1, 8, 8)[0];
+    push(&entryPoints, &n, x);
+    layer = convolutionalLayer(x, 1, 3, 1, TANH, 1, 1, &entryPoints, &n);
+    layer = poolingNode(layer, MAX_POOLING, 2, 3, &entryPoints, &n);
+    layer = poolingNode(layer, AVERAGE_POOLING, 1, 3, &entryPoints, &n);
+    y = nodeInit("y", 1, 0, true);
+    y->content.data->internalNode = false;
+    linkNodes(layer, y);
+    exitPoints = malloc(sizeof(node_t*));
+    exitPoints[0] = y;
+    assertOther(graphGradientsMatch(graphInit("pooling", n, entryPoints, 1, exitPoints), 4, 4));
+
+    //Flatten passes each value's gradient back to where it came from in the 3D input
+    node_t *volume = nodeInit("x", 0, 1, true), *flatten = nodeInit("flatten", 1, 1, false);
+    flatten->content.operation = (operation_t) {.funcName = FLATTEN};
+    linkNodes(volume, flatten);
+    volume->matrix->matrix3d = matrix3DCreate(2, 3, 4);
+    for (int i = 0; i < 24; i++) volume->matrix->matrix3d->data[i / 12][i / 4 % 3][i % 4] = i;
+    flatten->matrix->matrix2d = matrixFlatten(volume->matrix->matrix3d);
+    volume->gradient = calloc(1, sizeof(matrix_t));
+    flatten->gradient = calloc(1, sizeof(matrix_t));
+    flatten->gradient->matrix2d = matrixCreate(1, 24);
+    matrixRandomise(flatten->gradient->matrix2d);
+    vjp(flatten);
+    vjp(flatten);
+    bool routed = 1 == flatten->matrix->matrix2d->nRows && 24 == flatten->matrix->matrix2d->nCols;
+    for (int i = 0; i < 24; i++) {
+        routed &= i == flatten->matrix->matrix2d->data[0][i];
+        routed &= 2 * flatten->gradient->matrix2d->data[0][i] == volume->gradient->matrix3d->data[i / 12][i / 4 % 3][i % 4];
+    }
+    assertOther(routed);
+
+    printf("Finished testing tape autograd\n");
+}
+
+//POST: The output of the graph's last operation after a FORWARD over nodes
+static matrix2d_t *lastOutput(node_t **nodes, int length) {
+    execute(nodes, length, FORWARD);
+    for (int i = 0; i < length; i++) {
+        if (!nodes[i]->isData && 1 == nodes[i]->m && nodes[i]->outputs[0]->isData) return nodes[i]->matrix->matrix2d;
+    }
+    return NULL;
+}
+
+//POST: Whether fusing a clone of graph folds nRemoved nodes into nKernels kernels, and the clone then
+//      computes exactly what graph does, with gradients matching central differences
+static bool fusionMatches(graph_t *graph, int nRows, int nCols, int nKernels, int nRemoved, long trafficSaved) {
+    graph->exitPoints[0]->content.data->data->matrix2d = matrixCreate(nRows, nCols);
+    graph_t *fused = graphClone(graph);
+    int length, fusedLength;
+    node_t **nodes = schedule(graph, &length), **fusedNodes = schedule(fused, &fusedLength);
+    fusionStats_t stats = fuseElementwise(fusedNodes, &fusedLength);
+    bool matches = stats.nKernels == nKernels && stats.nRemoved == nRemoved && fusedLength == length - nRemoved;
+
+    execute(nodes, length, FORWARD);
+    execute(fusedNodes, fusedLength, FORWARD);
+    matches &= areMatrixesEqual(graph->exitPoints[0]->inputs[0]->matrix->matrix2d,
+                                fused->exitPoints[0]->inputs[0]->matrix->matrix2d, 0);
+    matches &= fusedTrafficSaved(fusedNodes, fusedLength) == trafficSaved;
+
+    tape_t *tape = tapeRecord(fusedNodes, fusedLength);
+    matrix2d_t *weights = matrixCreate(nRows, nCols);
+    matrixRandomise(weights);
+    matches &= tapeMatches(tape, fused->exitPoints[0]->inputs[0], weights);
+    tapeFree(tape);
+    matrixFree(weights);
+    free(nodes);
+    free(fusedNodes);
+    return matches;
+}
+
+void testFusion(void) {
+    printf("Testing elementwise fusion\n");
+
+    //tanh and the square fold into the difference: tanh's output is written and read 3 times,
+    //the square's once each, over 3 x 2 elements
+    assertOther(fusionMatches(elementwiseGraph(), 2, 3, 1, 2, (4 + 2) * 6 * sizeof(real_t)));
+    //Each layer's bias add folds into its activation
+    assertOther(fusionMatches(denseGraph(), 4, 2, 2, 2, 2 * (4 * 3 + 4 * 2) * sizeof(real_t)));
+
+    //An LSTM is already fused, so there's nothing left to do
+    const int timeSteps = 3, batchSize = 2, nFeatures = 3, nNeurons = 2;
+    assertOther(fusionMatches(fusedLSTM(randomInputs(timeSteps, batchSize, nFeatures), timeSteps, SIGMOID, nNeurons),
+                              batchSize, nNeurons, 0, 0, 0));
+
+    //Fused kernels are saved with the graph and read back the same
+    graph_t *graph = denseGraph();
+    graph->name = "fused";
+    graph->exitPoints[0]->content.data->data->matrix2d = matrixCreate(4, 2);
+    int length;
+    node_t **nodes = schedule(graph, &length);
+    fuseElementwise(nodes, &length);
+    execute(nodes, length, FORWARD);
+    remove("fused_data");
+    graphFileWrite("fused.graph", graph);
+    graph_t *read = graphFileRead("fused.graph");
+    free(nodes);
+    nodes = schedule(read, &length);
+    int nFused = 0;
+    for (int i = 0; i < length; i++) nFused += !nodes[i]->isData && FUSED == nodes[i]->content.operation.funcName;
+    assertEqual(nFused, 2);
+    assertOther(areMatrixesEqual(lastOutput(nodes, length), graph->exitPoints[0]->inputs[0]->matrix->matrix2d, 0));
+    remove("fused.graph");
+    remove("fused_data");
+    free(nodes);
+
+    printf("Finished testing elementwise fusion\n");
+}
+
+//POST: A 2 x 3 constant of value, or random values if random
+static node_t *constantNode(double value, bool random, node_t ***entryPoints, int *length) {
+    node_t *constant = nodeInit("constant", 0, 1, true);
+    constant->content.data->constant = true;
+    constant->content.data->data->matrix2d = matrixCreate(2, 3);
+    for (int i = 0; i < 2; i++) {
+        for (int j = 0; j < 3; j++) matrixSet(constant->content.data->data->matrix2d, i, j, random ? randFloat() : value);
+    }
+    push(entryPoints, length, constant);
+    return constant;
+}
+
+static node_t *operationNode(enum matrixFunction funcName, enum activationFunction activationName,
+                             node_t *a, node_t *b, int nOutputs) {
+    node_t *node = nodeInit("op", b ? 2 : 1, nOutputs, false);
+    node->content.operation = (operation_t) {.funcName = funcName, .activationName = activationName};
+    linkNodes(a, node);
+    if (b) linkNodes(b, node);
+    return node;
+}
+
+//POST: y = tanh(x * (c1 + c2) + 0) * w + tanh(x * (c1 + c2) + 0), through a linear activation,
+//      with the tanh computed twice and an unread x - w
+static graph_t *redundantGraph(void) {
+    node_t **entryPoints = NULL;
+    int n = 0;
+    node_t *x = nodeInit("x", 0, 2, true);
+    x->content.data->internalNode = false;
+    x->content.data->data->matrix2d = matrixCreate(2, 3);
+    matrixRandomise(x->content.data->data->matrix2d);
+    x->matrix->matrix2d = x->content.data->data->matrix2d;
+    node_t *w = nodeInit("w", 0, 2, true);
+    w->content.data->data->matrix2d = matrixCreate(2, 3);
+    matrixRandomise(w->content.data->data->matrix2d);
+    push(&entryPoints, &n, x);
+    push(&entryPoints, &n, w);
+
+    node_t *sum = operationNode(ADD, 0, constantNode(0, true, &entryPoints, &n),
+                                constantNode(0, true, &entryPoints, &n), 1);
+    node_t *product = operationNode(MULTIPLY, 0, x, sum, 1);
+    node_t *linear = operationNode(ACTIVATION, LINEAR, product, NULL, 1);
+    node_t *shifted = operationNode(ADD, 0, linear, constantNode(0, false, &entryPoints, &n), 2);
+    node_t *first = operationNode(ACTIVATION, TANH, shifted, NULL, 1);
+    node_t *second = operationNode(ACTIVATION, TANH, shifted, NULL, 1);
+    node_t *scaled = operationNode(MULTIPLY, 0, first, w, 1);
+    node_t *total = operationNode(ADD, 0, scaled, second, 1);
+    operationNode(SUBTRACT, 0, x, w, 0);
+
+    node_t *y = nodeInit("y", 1, 0, true);
+    y->content.data->internalNode = false;
+    y->content.data->data->matrix2d = matrixCreate(2, 3);
+    linkNodes(total, y);
+    node_t **exitPoints = malloc(sizeof(node_t*));
+    exitPoints[0] = y;
+    return graphInit("redundant", n, entryPoints, 1, exitPoints);
+}
+
+void testPasses(void) {
+    printf("Testing graph optimisation passes\n");
+
+    graph_t *graph = redundantGraph(), *optimised = graphClone(graph);
+    int length, optimisedLength, rescheduled;
+    node_t **nodes = schedule(graph, &length), **optimisedNodes = schedule(optimised, &optimisedLength);
+    //9 elementwise operations over 2 x 3
+    assertEqual(scheduleFlops(optimisedNodes, optimisedLength), 9 * 6);
+
+    //x - w, then c1 + c2 and the constants it reads, then a tanh, then the linear activation, the + 0 and the 0
+    bool removed = 1 == eliminateDeadNodes(optimised, optimisedNodes, &optimisedLength) && 14 == optimisedLength;
+    removed &= 1 == foldConstants(optimised, optimisedNodes, &optimisedLength) && 12 == optimisedLength;
+    removed &= 1 == eliminateCommonSubexpressions(optimised, optimisedNodes, &optimisedLength) && 11 == optimisedLength;
+    removed &= 2 == eliminateIdentities(optimised, optimisedNodes, &optimisedLength) && 8 == optimisedLength;
+    assertOther(removed);
+    //What's left is one chain, so it fuses into one kernel
+    optimiseSchedule(optimised, optimisedNodes, &optimisedLength, false);
+    assertEqual(optimisedLength, 5);
+    assertEqual(scheduleFlops(optimisedNodes, optimisedLength), 4 * 6);
+    //The graph was kept in step with the schedule
+    free(schedule(optimised, &rescheduled));
+    assertEqual(rescheduled, optimisedLength);
+
+    execute(nodes, length, FORWARD);
+    execute(optimisedNodes, optimisedLength, FORWARD);
+    assertOther(areMatrixesEqual(graph->exitPoints[0]->inputs[0]->matrix->matrix2d,
+                                 optimised->exitPoints[0]->inputs[0]->matrix->matrix2d, 100 * REAL_EPSILON));
+
+    //Only w is trained; the folded constant isn't
+    tape_t *tape = tapeRecord(optimisedNodes, optimisedLength);
+    matrix2d_t *weights = matrixCreate(2, 3);
+    matrixRandomise(weights);
+    assertOther(1 == tape->nParams && tapeMatches(tape, optimised->exitPoints[0]->inputs[0], weights));
+    tapeFree(tape);
+    matrixFree(weights);
+    free(nodes);
+    free(optimisedNodes);
+
+    printf("Finished testing graph optimisation passes\n");
+}
+
+//POST: Whether the kernel jitCompile makes for graph's schedule computes what execute does, both before
+//      and after graph's first entry point is given new values
+static bool jitMatches(graph_t *graph, int nRows, int nCols, bool fuse) {
+    graph->exitPoints[0]->content.data->data->matrix2d = matrixCreate(nRows, nCols);
+    int length;
+    node_t **nodes = schedule(graph, &length);
+    if (fuse) fuseElementwise(nodes, &length);
+    execute(nodes, length, FORWARD);
+    jitKernel_t *kernel = jitCompile(nodes, length);
+    if (!kernel) return false;
+
+    node_t *output = graph->exitPoints[0]->inputs[0];
+    matrix2d_t *expected;
+    bool matches = true;
+    for (int run = 0; run < 2; run++) {
+        execute(nodes, length, FORWARD);
+        expected = output->matrix->matrix2d;
+        jitExecute(kernel);
+        matches &= areMatrixesEqual(expected, output->matrix->matrix2d, 100 * REAL_EPSILON);
+        matrixRandomise(graph->entryPoints[0]->content.data->data->matrix2d);
+    }
+    jitFree(kernel);
+    free(nodes);
+    return matches;
+}
+
+void testJIT(void) {
+    printf("Testing JIT compiled schedules\n");
+
+    //Small enough to be fully unrolled
+    assertOther(jitMatches(elementwiseGraph(), 2, 3, false));
+    assertOther(jitMatches(denseGraph(), 4, 2, true));
+    //Loops, and a product long enough to be blocked
+    assertOther(jitMatches(mlpGraph(9, 13, 7, 5), 9, 5, false));
+    assertOther(jitMatches(mlpGraph(9, 13, 7, 5), 9, 5, true));
+
+    //The same shapes hash to the same source, which is only built once
+    graph_t *graph = mlpGraph(6, 5, 4, 3);
+    int length;
+    node_t **nodes = schedule(graph, &length);
+    graph->exitPoints[0]->content.data->data->matrix2d = matrixCreate(6, 3);
+    execute(nodes, length, FORWARD);
+    jitKernel_t *first = jitCompile(nodes, length), *second = jitCompile(nodes, length);
+    assertOther(first && second && second->cached && first->hash == second->hash);
+    jitFree(first);
+    jitFree(second);
+
+    //Weights are only read by the kernel, so passes that free their matrices don't free them twice
+    jitKernel_t *kernel = jitCompile(nodes, length);
+    jitExecute(kernel);
+    jitFree(kernel);
+    assertEqual(pruneWeights(nodes, length, 0.5, 1), 2);
+    execute(nodes, length, FORWARD);
+    free(nodes);
+
+    printf("Finished testing JIT compiled schedules\n");
+}
+
+//POST: Whether gemmWith gives exactly the textbook product of random nRows x nShared and nShared x nCols
+//      matrices, for blocks smaller and larger than the shape and for several threads
+static bool gemmMatches(int nRows, int nShared, int nCols) {
+    gemmConfig_t configs[] = {{16, 0, 1}, {64, 64, 2}, {512, 256, 4}, {32, 8, 3}};
+    matrix2d_t *a = matrixCreate(nRows, nShared), *b = matrixCreate(nShared, nCols), *expected = matrixCreate(nRows, nCols);
+    matrixRandomise(a);
+    matrixRandomise(b);
+    for (int i = 0; i < nRows; i++) {
+        for (int k = 0; k < nShared; k++) {
+            for (int j = 0; j < nCols; j++) expected->data[i][j] += a->data[i][k] * b->data[k][j];
+        }
+    }
+    matrix2d_t *out;
+    bool matches = true;
+    for (int c = 0; c < sizeof(configs) / sizeof(gemmConfig_t); c++) {
+        out = matrixCreate(nRows, nCols);
+        gemmWith(configs[c], a->data, b->data, out->data, nRows, nShared, nCols);
+        matches &= areMatrixesEqual(expected, out, 0);
+        matrixFree(out);
+    }
+    matrixFree(a);
+    matrixFree(b);
+    matrixFree(expected);
+    return matches;
+}
+
+void testGemm(void) {
+    printf("Testing tuned GEMM\n");
+
+    assertOther(gemmMatches(1, 1, 1));
+    assertOther(gemmMatches(7, 5, 9));
+    //Ragged row blocks, shared blocks and column strips
+    assertOther(gemmMatches(13, 70, 130));
+
+    //The winner is kept, and survives being written out and read back
+    gemmConfig_t tuned = tuneGemmShape(13, 70, 130), found = gemmTuning(13, 70, 130);
+    assertOther(tuned.colBlock == found.colBlock && tuned.sharedBlock == found.sharedBlock
+                && tuned.nThreads == found.nThreads);
+    saveGemmTuning("/tmp/cflow-gemm-test.tuning");
+    loadGemmTuning("/tmp/cflow-gemm-test.tuning");
+    found = gemmTuning(13, 70, 130);
+    assertOther(tuned.colBlock == found.colBlock && tuned.sharedBlock == found.sharedBlock
+                && tuned.nThreads == found.nThreads);
+    remove("/tmp/cflow-gemm-test.tuning");
+    //Starting from no tunings, whatever the user's cache holds
+    loadGemmTuning("/tmp/cflow-gemm-test.tuning");
+
+    //A graph's shapes are only timed the first time
+    graph_t *graph = mlpGraph(5, 7, 11, 3);
+    graph->exitPoints[0]->content.data->data->matrix2d = matrixCreate(5, 3);
+    int length;
+    node_t **nodes = schedule(graph, &length);
+    tuneGemm(nodes, length);
+    assertEqual(tuneGemm(nodes, length), 0);
+    free(nodes);
+
+    //A fused LSTM projects every step's x . W at once, then each step multiplies h by U
+    graph = fusedLSTM(randomInputs(3, 3, 7), 3, SIGMOID, 6);
+    graph->exitPoints[0]->content.data->data->matrix2d = matrixCreate(3, 6);
+    nodes = schedule(graph, &length);
+    assertEqual(tuneGemm(nodes, length), 2);
+    free(nodes);
+
+    //An im2col convolution is one product, a direct one none
+    node_t **entryPoints = NULL;
+    int n = 0;
+    node_t *x = randomInputs(1, 10, 11)[0];
+    push(&entryPoints, &n, x);
+    node_t *conv = convolutionNode(x, CONVOLUTION, 3, 1, 0, 1, &entryPoints, &n);
+    node_t *y = nodeInit("y", 1, 0, true);
+    y->content.data->internalNode = false;
+    linkNodes(conv, y);
+    node_t **exitPoints = malloc(sizeof(node_t*));
+    exitPoints[0] = y;
+    graph = graphInit("conv", n, entryPoints, 1, exitPoints);
+    nodes = schedule(graph, &length);
+    conv->content.operation.algorithm = DIRECT_CONVOLUTION;
+    assertEqual(tuneGemm(nodes, length), 0);
+    conv->content.operation.algorithm = IM2COL_CONVOLUTION;
+    assertEqual(tuneGemm(nodes, length), 1);
+    free(nodes);
+    loadGemmTuning(NULL);
+
+    printf("Finished testing tuned GEMM\n");
+}
+
+//POST: x . w for a random 10 x 10 x convolved by a 3 x 3 kernel every stride, then pooled by 2 x 2 windows,
+//      and a random w with nOutputs columns
+static graph_t *imageGraph(enum matrixFunction pooling, int stride, int nOutputs) {
+    node_t **entryPoints = NULL;
+    int n = 0;
+    node_t *x = randomInputs(1, 10, 10)[0];
+    push(&entryPoints, &n, x);
+    node_t *conv = convolutionNode(x, CONVOLUTION, 3, stride, 0, 1, &entryPoints, &n);
+    node_t *pool = poolingNode(conv, pooling, 2, 2, &entryPoints, &n);
+    int nPooled = ((10 - 3) / stride + 1) / 2;
+    node_t *w = nodeInit("w", 0, 1, true);
+    w->content.data->data->matrix2d = matrixCreate(nPooled, nOutputs);
+    matrixRandomise(w->content.data->data->matrix2d);
+    push(&entryPoints, &n, w);
+    node_t *dot = nodeInit("dot", 2, 1, false);
+    dot->content.operation = (operation_t) {.funcName = DOT};
+    linkNodes(pool, dot);
+    linkNodes(w, dot);
+    node_t *y = nodeInit("y", 1, 0, true);
+    y->content.data->internalNode = false;
+    y->content.data->data->matrix2d = matrixCreate(nPooled, nOutputs);
+    linkNodes(dot, y);
+    node_t **exitPoints = malloc(sizeof(node_t*));
+    exitPoints[0] = y;
+    return graphInit("image", n, entryPoints, 1, exitPoints);
+}
+
+//POST: Whether nSpecialised of graph's operations get specialised kernels, and running them gives
+//      exactly what the generic kernels do, including where max pooling took each maximum from
+static bool kernelsMatch(graph_t *graph, int nSpecialised) {
+    int length;
+    node_t **nodes = schedule(graph, &length);
+    node_t *output = graph->exitPoints[0]->inputs[0], *pool = output->inputs[0];
+    execute(nodes, length, FORWARD);
+    matrix2d_t *expected = matrixClone(output->matrix->matrix2d);
+    int nPooled = pool->matrix->matrix2d->nRows * pool->matrix->matrix2d->nCols;
+    int32_t *expectedArgmax = malloc(sizeof(int32_t) * nPooled);
+    if (pool->poolingArgmax) memcpy(expectedArgmax, pool->poolingArgmax, sizeof(int32_t) * nPooled);
+
+    bool matches = nSpecialised == prepareKernels(nodes, length);
+    execute(nodes, length, FORWARD);
+    matches &= areMatrixesEqual(expected, output->matrix->matrix2d, 0);
+    if (pool->poolingArgmax) matches &= !memcmp(expectedArgmax, pool->poolingArgmax, sizeof(int32_t) * nPooled);
+    matrixFree(expected);
+    free(expectedArgmax);
+    free(nodes);
+    return matches;
+}
+
+static int nFallbacks = 0;
+
+static matrix2d_t *fallBack(node_t *node) {
+    nFallbacks++;
+    return NULL;
+}
+
+void testKernels(void) {
+    printf("Testing specialised kernels\n");
+
+    //A 3 x 3 convolution, 2 x 2 pooling and a 64 or 128 wide product
+    assertOther(kernelsMatch(imageGraph(MAX_POOLING, 1, 64), 3));
+    assertOther(kernelsMatch(imageGraph(AVERAGE_POOLING, 1, 128), 3));
+    //Strided convolutions and other widths are left to the generic kernels
+    assertOther(kernelsMatch(imageGraph(MAX_POOLING, 2, 64), 2));
+    assertOther(kernelsMatch(imageGraph(AVERAGE_POOLING, 1, 10), 2));
+
+    //A kernel for the exact shape is more specific than the one for any 3 x 3 convolution
+    graph_t *graph = imageGraph(MAX_POOLING, 1, 10);
+    node_t *conv = graph->exitPoints[0]->inputs[0]->inputs[0]->inputs[0];
+    registerKernel((kernelSpec_t) {"fall back", CONVOLUTION, 10, 10, 3, 3, {1, 0, 1}, fallBack});
+    kernelSpec_t *exact = chooseKernel(conv, 10, 10, 3, 3), *general = chooseKernel(conv, 12, 12, 3, 3);
+    assertOther(exact && !strcmp(exact->name, "fall back") && general && !strcmp(general->name, "convolution 3x3"));
+    //It's chosen once, and when it declines the generic kernel runs
+    assertOther(kernelsMatch(graph, 2));
+    assertEqual(nFallbacks, 1);
+
+    printf("Finished testing specialised kernels\n");
+}
+
+//POST: Whether every algorithm that can run the convolution, or deconvolution if dilation is 0,
+//      agrees with direct convolution on random nRows x nCols input and kernelSize x kernelSize kernel
+static bool algorithmsAgree(int nRows, int nCols, int kernelSize, int stride, int padding, int dilation) {
+    matrix2d_t *matrix = matrixCreate(nRows, nCols), *kernel = matrixCreate(kernelSize, kernelSize), *expected, *result;
+    matrixRandomise(matrix);
+    matrixRandomise(kernel);
+    expected = dilation ? matrixDilatedConvolution(matrix, kernel, stride, padding, dilation)
+                        : matrixDeconvolution(matrix, kernel, stride, padding);
+    bool agree = true;
+    for (enum convolutionAlgorithm algorithm = IM2COL_CONVOLUTION; algorithm < N_CONVOLUTION_ALGORITHMS; algorithm++) {
+        result = dilation ? convolveWith(algorithm, matrix, kernel, stride, padding, dilation)
+                          : deconvolveWith(algorithm, matrix, kernel, stride, padding);
+        //Only Winograd turns convolutions down, and only those it has no transform for
+        if (!result) {
+            agree &= WINOGRAD_CONVOLUTION == algorithm && (3 != kernelSize || 1 != stride || dilation > 1);
+            continue;
+        }
+        agree &= areMatrixesEqual(expected, result, 1000 * REAL_EPSILON);
+        matrixFree(result);
+    }
+    matrixFree(matrix);
+    matrixFree(kernel);
+    matrixFree(expected);
+    return agree;
+}
+
+void testConvolutionAlgorithms(void) {
+    printf("Testing convolution algorithms\n");
+
+    //Winograd's tiles, ragged and whole
+    assertOther(algorithmsAgree(9, 11, 3, 1, 1, 1));
+    assertOther(algorithmsAgree(8, 8, 3, 1, 0, 1));
+    assertOther(algorithmsAgree(12, 13, 5, 2, 2, 1));
+    assertOther(algorithmsAgree(10, 10, 3, 1, 0, 2));
+    assertOther(algorithmsAgree(5, 6, 3, 2, 1, 0));
+    assertOther(algorithmsAgree(4, 4, 2, 3, 0, 0));
+
+    //Choices are kept, and survive being written out and read back
+    enum convolutionAlgorithm chosen = selectConvolution(CONVOLUTION, 17, 19, 3, 3, 1, 1, 1);
+    assertEqual(selectConvolution(CONVOLUTION, 17, 19, 3, 3, 1, 1, 1), chosen);
+    saveConvolutionCache("/tmp/cflow-convolution-test.cache");
+    loadConvolutionCache("/tmp/cflow-convolution-test.cache");
+    assertEqual(selectConvolution(CONVOLUTION, 17, 19, 3, 3, 1, 1, 1), chosen);
+    remove("/tmp/cflow-convolution-test.cache");
+    loadConvolutionCache(NULL);
+
+    //A schedule gets the same answers whichever algorithms it's given
+    graph_t *graph = imageGraph(MAX_POOLING, 1, 10);
+    int length;
+    node_t **nodes = schedule(graph, &length);
+    node_t *output = graph->exitPoints[0]->inputs[0];
+    execute(nodes, length, FORWARD);
+    matrix2d_t *expected = matrixClone(output->matrix->matrix2d);
+    selectConvolutions(nodes, length);
+    execute(nodes, length, FORWARD);
+    assertOther(areMatrixesEqual(expected, output->matrix->matrix2d, 1000 * REAL_EPSILON));
+    matrixFree(expected);
+    free(nodes);
+
+    printf("Finished testing convolution algorithms\n");
+}
+
+//POST: Whether each weight's gradient from a mixed precision pass in format is within tolerance of the full
+//      precision one, relative to the largest, and how much activation memory the mixed pass held at most
+static bool mixedGradientsMatch(enum halfFormat format, double tolerance, long *peakBytes) {
+    graph_t *graph = mlpGraph(16, 12, 24, 6);
+    graph->exitPoints[0]->content.data->data->matrix2d = matrixCreate(16, 6);
+    //Scaled down so the activations don't saturate, where rounding would zero their gradients
+    matrix2d_t *entry;
+    for (int e = 0; e < graph->n; e++) {
+        entry = graph->entryPoints[e]->content.data->data->matrix2d;
+        for (int i = 0; i < entry->nRows; i++) {
+            for (int j = 0; j < entry->nCols; j++) entry->data[i][j] /= 4 * entry->nRows;
+        }
+    }
+    node_t *output = graph->exitPoints[0]->inputs[0];
+    int length;
+    node_t **nodes = schedule(graph, &length);
+    tape_t *tape = tapeRecord(nodes, length);
+    matrix2d_t *seed = matrixCreate(16, 6);
+    matrixRandomise(seed);
+
+    execute(nodes, length, FORWARD);
+    tapeZero(tape);
+    tapeSeed(output, seed);
+    tapeBackward(tape, NULL);
+    matrix2d_t **expected = malloc(sizeof(matrix2d_t*) * tape->nParams);
+    for (int p = 0; p < tape->nParams; p++) expected[p] = matrixClone(tape->params[p]->gradient->matrix2d);
+
+    mixedPrecision_t *plan = scheduleMixedPrecision(nodes, length, format);
+    executeMixed(plan, nodes, length, FORWARD);
+    //The hidden layer's activations are only held in 16 bits between the passes
+    bool matches = 0 == plan->nOverflows && plan->peakBytes > 0;
+    int nStashed = 0;
+    for (int i = 0; i < length; i++) nStashed += NULL != plan->stashed[i];
+    matches &= nStashed > 0;
+    tapeZero(tape);
+    tapeSeed(output, seed);
+    executeMixed(plan, nodes, length, BACKWARD);
+    matches &= 0 == plan->nOverflows;
+    for (int i = 0; i < length; i++) matches &= NULL == plan->stashed[i];
+
+    double largest, error;
+    matrix2d_t *gradient;
+    for (int p = 0; p < tape->nParams; p++) {
+        gradient = tape->params[p]->gradient->matrix2d;
+        largest = error = 0;
+        for (int i = 0; i < gradient->nRows; i++) {
+            for (int j = 0; j < gradient->nCols; j++) {
+                largest = fmax(largest, fabs(expected[p]->data[i][j]));
+                error = fmax(error, fabs(gradient->data[i][j] - expected[p]->data[i][j]));
+            }
+        }
+        matches &= error <= tolerance * largest;
+        matrixFree(expected[p]);
+    }
+    *peakBytes = plan->peakBytes;
+
+    mixedPrecisionFree(plan);
+    free(expected);
+    matrixFree(seed);
+    tapeFree(tape);
+    free(nodes);
+    return matches;
+}
+
+void testMixedPrecision(void) {
+    printf("Testing mixed precision\n");
+
+    //Conversions round to nearest, ties to even, and count what overflows
+    const real_t values[] = {1, -2, 65504, 1e5, 1.0 / (1 << 24), 1 + 1.0 / (1 << 11), 1 + 3.0 / (1 << 11), 0};
+    const half_t fp16[] = {0x3c00, 0xc000, 0x7bff, 0x7c00, 0x0001, 0x3c00, 0x3c02, 0x0000};
+    const half_t bf16[] = {0x3f80, 0xc000, 0x4780, 0x47c3, 0x3380, 0x3f80, 0x3f80, 0x0000};
+    half_t converted[8];
+    assertEqual(halfFromReals(FP16, values, converted, 8), 1);
+    for (int i = 0; i < 8; i++) assertEqual(converted[i], fp16[i]);
+    assertEqual(halfFromReals(BF16, values, converted, 8), 0);
+    for (int i = 0; i < 8; i++) assertEqual(converted[i], bf16[i]);
+
+    //Every value either format holds survives the round trip exactly
+    half_t *all = malloc(sizeof(half_t) * 65536), *back = malloc(sizeof(half_t) * 65536);
+    real_t *reals = malloc(sizeof(real_t) * 65536);
+    for (int i = 0; i < 65536; i++) all[i] = i;
+    bool exact = true;
+    halfToReals(FP16, all, reals, 65536);
+    halfFromReals(FP16, reals, back, 65536);
+    for (int i = 0; i < 65536; i++) exact &= back[i] == all[i] || isnan(reals[i]);
+    halfToReals(BF16, all, reals, 65536);
+    halfFromReals(BF16, reals, back, 65536);
+    for (int i = 0; i < 65536; i++) exact &= back[i] == all[i] || isnan(reals[i]);
+    assertOther(exact);
+    free(all);
+    free(back);
+    free(reals);
+
+    //Gradients from activations and gradients held in 16 bits stay close to full precision ones,
+    //while holding less memory
+    long bf16Bytes, fp16Bytes;
+    assertOther(mixedGradientsMatch(BF16, 0.05, &bf16Bytes));
+    assertOther(mixedGradientsMatch(FP16, 0.01, &fp16Bytes));
+    assertEqual(bf16Bytes, fp16Bytes);
+    //The input, both layers' activations and the output at full precision
+    assertOther(bf16Bytes < (long) 16 * (12 + 24 * 4 + 6 * 4) * sizeof(real_t));
+
+    //Gradients too big for fp16 are caught
+    graph_t *graph = mlpGraph(4, 3, 3, 2);
+    graph->exitPoints[0]->content.data->data->matrix2d = matrixCreate(4, 2);
+    int length;
+    node_t **nodes = schedule(graph, &length);
+    tape_t *tape = tapeRecord(nodes, length);
+    mixedPrecision_t *plan = scheduleMixedPrecision(nodes, length, FP16);
+    matrix2d_t *seed = matrixCreate(4, 2);
+    for (int i = 0; i < 8; i++) matrixSet(seed, i / 2, i % 2, 1e6);
+    executeMixed(plan, nodes, length, FORWARD);
+    tapeZero(tape);
+    tapeSeed(graph->exitPoints[0]->inputs[0], seed);
+    executeMixed(plan, nodes, length, BACKWARD);
+    assertOther(plan->nOverflows > 0);
+    mixedPrecisionFree(plan);
+    matrixFree(seed);
+    tapeFree(tape);
+    free(nodes);
+
+    printf("Finished testing mixed precision\n");
+}
+
+void testQuantization(void) {
+    printf("Testing int8 quantization\n");
+
+    //Values already on the grid come through exactly, scaled by the input's scale and each column's
+    matrix2d_t *input = matrixCreate(5, 3), *scales = matrixCreate(1, 3);
+    const int8_t weights[] = {1, -2, 3, 4, -127, 127};
+    for (int i = 0; i < 15; i++) matrixSet(input, i / 3, i % 3, (i % 7) - 3);
+    matrixSet(scales, 0, 0, 1);
+    matrixSet(scales, 0, 1, 0.5);
+    matrixSet(scales, 0, 2, 2);
+    matrix2d_t *product = quantizedDotProduct(input, weights, scales);
+    assertEqual(product->nRows, 5);
+    assertEqual(product->nCols, 2);
+    bool exact = true;
+    for (int i = 0; i < 5; i++) {
+        for (int j = 0; j < 2; j++) {
+            real_t sum = 0;
+            for (int k = 0; k < 3; k++) sum += matrixGet(input, i, k) * weights[k * 2 + j];
+            exact &= matrixGet(product, i, j) == sum * matrixGet(scales, 0, j + 1);
+        }
+    }
+    assertOther(exact);
+    matrixFree(input);
+    matrixFree(scales);
+    matrixFree(product);
+
+    //Calibrated on batches including the one it's run on, a quantized MLP stays close to full precision
+    graph_t *graph = mlpGraph(8, 16, 24, 6);
+    graph->exitPoints[0]->content.data->data->matrix2d = matrixCreate(8, 6);
+    //Scaled down so the outputs don't saturate, where they'd hide any error
+    matrix2d_t *entry;
+    for (int e = 1; e < graph->n; e++) {
+        entry = graph->entryPoints[e]->content.data->data->matrix2d;
+        for (int i = 0; i < entry->nRows; i++) {
+            for (int j = 0; j < entry->nCols; j++) entry->data[i][j] /= entry->nRows;
+        }
+    }
+    matrix2d_t *calibration = matrixCreate(32, 16);
+    matrixRandomise(calibration);
+    for (int i = 0; i < 8; i++) {
+        for (int j = 0; j < 16; j++) matrixSet(calibration, i, j, matrixGet(graph->entryPoints[0]->content.data->data->matrix2d, i, j));
+    }
+    int length;
+    node_t **nodes = schedule(graph, &length);
+    matrix2d_t *expected = matrixClone(lastOutput(nodes, length));
+    real_t *ranges = calibrate(graph, nodes, length, &calibration, 8);
+    assertEqual(quantizeGraph(graph, nodes, length, ranges), 2);
+    //Only the int8 bytes of quantized weights are kept
+    bool dropped = true;
+    for (int i = 0; i < length; i++) {
+        if (nodes[i]->isData && nodes[i]->content.data->quantized) dropped &= !nodes[i]->content.data->data->matrix2d;
+    }
+    assertOther(dropped);
+    free(nodes);
+    free(ranges);
+    nodes = schedule(graph, &length);
+    matrix2d_t *actual = matrixClone(lastOutput(nodes, length));
+    real_t maxError = 0;
+    for (int i = 0; i < 8; i++) {
+        for (int j = 0; j < 6; j++) maxError = fmax(maxError, fabs(matrixGet(actual, i, j) - matrixGet(expected, i, j)));
+    }
+    assertOther(maxError > 0 && maxError < 0.01);
+
+    //Saved with int8 weights, the graph reads back and gives the same outputs
+    graph->name = "quantized";
+    remove("quantized_data");
+    graphFileWrite("quantized.graph", graph);
+    graph_t *read = graphFileRead("quantized.graph");
+    free(nodes);
+    nodes = schedule(read, &length);
+    int nQuantized = 0, nConstant = 0;
+    for (int i = 0; i < length; i++) {
+        nQuantized += nodes[i]->isData && nodes[i]->content.data->quantized;
+        nConstant += nodes[i]->isData && nodes[i]->content.data->constant;
+    }
+    assertEqual(nQuantized, 2);
+    //The weights and their scales are still constant, so no pass or trainer treats them as weights
+    assertEqual(nConstant, 4);
+    matrix2d_t *reread = lastOutput(nodes, length);
+    exact = true;
+    for (int i = 0; i < 8; i++) {
+        for (int j = 0; j < 6; j++) exact &= matrixGet(reread, i, j) == matrixGet(actual, i, j);
+    }
+    assertOther(exact);
+    remove("quantized.graph");
+    remove("quantized_data");
+    matrixFree(calibration);
+    matrixFree(expected);
+    matrixFree(actual);
+    free(nodes);
+
+    printf("Finished testing int8 quantization\n");
+}
+
+//POST: Whether dense . sparse and, when sparse fits in front of it, sparse . dense match dense products exactly
+static bool sparseProductsMatch(sparse_t *sparse, matrix2d_t *dense) {
+    matrix2d_t *weights = sparseToMatrix(sparse), *expected = matrixDotProduct(dense, weights);
+    matrix2d_t *actual = denseSparseProduct(dense, sparse);
+    bool match = areMatrixesEqual(expected, actual, 0);
+    matrixFree(expected);
+    matrixFree(actual);
+    matrix2d_t *right = matrixCreate(sparse->nCols, 3);
+    matrixRandomise(right);
+    expected = matrixDotProduct(weights, right);
+    actual = sparseDenseProduct(sparse, right);
+    match &= areMatrixesEqual(expected, actual, 0);
+    matrixFree(expected);
+    matrixFree(actual);
+    matrixFree(right);
+    matrixFree(weights);
+    return match;
+}
+
+void testSparse(void) {
+    printf("Testing sparse weights\n");
+
+    //Magnitude pruning keeps the largest elements, or blocks, and sparse rows hold exactly those
+    matrix2d_t *matrix = matrixCreate(12, 8), *copy, *dense = matrixCreate(5, 12);
+    matrixRandomise(matrix);
+    matrixRandomise(dense);
+    matrixSet(dense, 4, 3, 0);
+    copy = matrixClone(matrix);
+    pruneMatrix(copy, 0.75, 1);
+    int nZeros = 0;
+    for (int i = 0; i < 12; i++) {
+        for (int j = 0; j < 8; j++) nZeros += 0 == matrixGet(copy, i, j);
+    }
+    assertEqual(nZeros, 72);
+    sparse_t *sparse = sparseFromMatrix(copy, 1);
+    assertEqual(sparse->nBlocks, 24);
+    matrix2d_t *back = sparseToMatrix(sparse);
+    assertOther(areMatrixesEqual(back, copy, 0));
+    assertOther(sparseProductsMatch(sparse, dense));
+    matrixFree(back);
+    matrixFree(copy);
+    sparseFree(sparse);
+
+    copy = matrixClone(matrix);
+    pruneMatrix(copy, 0.75, 4);
+    sparse = sparseFromMatrix(copy, 4);
+    assertEqual(sparse->nBlocks, 2);
+    back = sparseToMatrix(sparse);
+    assertOther(areMatrixesEqual(back, copy, 0));
+    assertOther(sparseProductsMatch(sparse, dense));
+    matrixFree(back);
+    matrixFree(copy);
+    matrixFree(matrix);
+    matrixFree(dense);
+    sparseFree(sparse);
+
+    //Pruned dense layers run sparse products, hold no dense weights and are saved like any other graph
+    graph_t *graph = mlpGraph(8, 16, 24, 6);
+    graph->exitPoints[0]->content.data->data->matrix2d = matrixCreate(8, 6);
+    int length;
+    node_t **nodes = schedule(graph, &length);
+    assertEqual(pruneWeights(nodes, length, 0.9, 4), 2);
+    int nBlocks = 0;
+    bool match = true;
+    matrix2d_t *output = matrixClone(lastOutput(nodes, length));
+    for (int i = 0; i < length; i++) {
+        if (nodes[i]->isData || SPARSE_DOT != nodes[i]->content.operation.funcName) continue;
+        sparse = nodes[i]->inputs[1]->content.data->sparse;
+        nBlocks += sparse->nBlocks;
+        match &= !nodes[i]->inputs[1]->content.data->data->matrix2d;
+        back = sparseToMatrix(sparse);
+        matrix2d_t *expected = matrixDotProduct(nodes[i]->inputs[0]->matrix->matrix2d, back);
+        match &= areMatrixesEqual(expected, nodes[i]->matrix->matrix2d, 0);
+        matrixFree(expected);
+        matrixFree(back);
+    }
+    //3 of the first layer's 24 4 x 4 blocks, and 15 of the second's 144 elements as 4 doesn't divide 6
+    assertEqual(nBlocks, 18);
+    assertOther(match);
+    //Sparse weights are constant, so only the biases are trained
+    tape_t *tape = tapeRecord(nodes, length);
+    tapeZero(tape);
+    assertEqual(tape->nParams, 2);
+    tapeFree(tape);
+
+    graph->name = "sparse";
+    remove("sparse_data");
+    graphFileWrite("sparse.graph", graph);
+    graph_t *read = graphFileRead("sparse.graph");
+    free(nodes);
+    nodes = schedule(read, &length);
+    assertOther(areMatrixesEqual(lastOutput(nodes, length), output, 0));
+    //Made sparse again by that run, and constant again with it
+    tape = tapeRecord(nodes, length);
+    tapeZero(tape);
+    match = true;
+    for (int k = 0; k < tape->nParams; k++) match &= !tape->params[k]->content.data->sparse;
+    assertOther(match);
+    tapeFree(tape);
+    remove("sparse.graph");
+    remove("sparse_data");
+    matrixFree(output);
+    free(nodes);
+
+    printf("Finished testing sparse weights\n");
+}
+
+//POST: x through dense layers of 24, 20 and 6 neurons into y, with the same weights for the same seed
+static graph_t *deepMlpGraph(unsigned seed) {
+    srand(seed);
+    node_t **entryPoints = NULL;
+    int n = 0;
+    node_t *x = randomInputs(1, 8, 16)[0];
+    push(&entryPoints, &n, x);
+    node_t *layer = denseLayer(x, 24, SIGMOID, &entryPoints, &n);
+    layer = denseLayer(layer, 20, TANH, &entryPoints, &n);
+    layer = denseLayer(layer, 6, TANH, &entryPoints, &n);
+    node_t *y = nodeInit("y", 1, 0, true);
+    y->content.data->internalNode = false;
+    linkNodes(layer, y);
+    node_t **exitPoints = malloc(sizeof(node_t*));
+    exitPoints[0] = y;
+    graph_t *graph = graphInit("deep", n, entryPoints, 1, exitPoints);
+    y->content.data->data->matrix2d = matrixCreate(8, 6);
+    return graph;
+}
+
+//POST: Whether each of pruned's rows is the row of full it came from, full's other rows are zeroed
+//      and at least removed of them were, i.e. the pruned neurons' outgoing weights
+static bool zeroRemovedRows(matrix2d_t *full, matrix2d_t *pruned, int removed) {
+    int row = 0;
+    for (int i = 0; i < full->nRows; i++) {
+        bool kept = row < pruned->nRows;
+        for (int j = 0; j < full->nCols && kept; j++) kept = matrixGet(full, i, j) == matrixGet(pruned, row, j);
+        if (kept) {
+            row++;
+            continue;
+        }
+        for (int j = 0; j < full->nCols; j++) matrixSet(full, i, j, 0);
+        removed--;
+    }
+    return row == pruned->nRows && 0 == removed;
+}
+
+void testStructuredPruning(void) {
+    printf("Testing structured pruning\n");
+
+    graph_t *graph = deepMlpGraph(7), *full = deepMlpGraph(7);
+    matrix2d_t *lastWeights = matrixClone(full->entryPoints[5]->content.data->data->matrix2d);
+    int length, fullLength;
+    node_t **nodes = schedule(graph, &length), **fullNodes = schedule(full, &fullLength);
+    long flops = scheduleFlops(nodes, length);
+    assertEqual(pruneNeurons(nodes, length, 0.5, OUTGOING_WEIGHTS), 22);
+    assertEqual(graph->entryPoints[1]->content.data->data->matrix2d->nCols, 12);
+    assertEqual(graph->entryPoints[2]->content.data->data->matrix2d->nCols, 12);
+    assertEqual(graph->entryPoints[3]->content.data->data->matrix2d->nRows, 12);
+    assertEqual(graph->entryPoints[3]->content.data->data->matrix2d->nCols, 10);
+    assertEqual(graph->entryPoints[5]->content.data->data->matrix2d->nRows, 10);
+    assertOther(scheduleFlops(nodes, length) < flops / 2);
+
+    //The last hidden layer kept the neurons with the largest outgoing weights
+    double minKept = -1, maxRemoved = 0, norm;
+    matrix2d_t *kept = graph->entryPoints[5]->content.data->data->matrix2d;
+    for (int i = 0; i < lastWeights->nRows; i++) {
+        norm = 0;
+        for (int j = 0; j < 6; j++) norm += fabs(matrixGet(lastWeights, i, j));
+        bool isKept = false;
+        for (int k = 0; k < kept->nRows; k++) isKept |= matrixGet(kept, k, 0) == matrixGet(lastWeights, i, 0);
+        if (isKept && (minKept < 0 || norm < minKept)) minKept = norm;
+        if (!isKept && norm > maxRemoved) maxRemoved = norm;
+    }
+    assertOther(maxRemoved <= minKept);
+    matrixFree(lastWeights);
+
+    //Removing neurons gives exactly what zeroing their outgoing weights does
+    assertOther(zeroRemovedRows(full->entryPoints[5]->content.data->data->matrix2d, kept, 10));
+    //The middle layer's weights lost columns too, so its rows are matched on the first layer's columns
+    matrix2d_t *fullFirst = matrixTranspose(full->entryPoints[1]->content.data->data->matrix2d);
+    matrix2d_t *first = matrixTranspose(graph->entryPoints[1]->content.data->data->matrix2d);
+    assertOther(zeroRemovedRows(fullFirst, first, 12));
+    matrix2d_t *middle = full->entryPoints[3]->content.data->data->matrix2d;
+    for (int i = 0; i < middle->nRows; i++) {
+        if (matrixGet(fullFirst, i, 0) || matrixGet(fullFirst, i, 1)) continue;
+        for (int j = 0; j < middle->nCols; j++) matrixSet(middle, i, j, 0);
+    }
+    matrixFree(fullFirst);
+    matrixFree(first);
+    matrix2d_t *output = matrixClone(lastOutput(nodes, length));
+    assertOther(areMatrixesEqual(output, lastOutput(fullNodes, fullLength), 0));
+
+    //The smaller graph is saved like any other
+    graph->name = "pruned";
+    remove("pruned_data");
+    graphFileWrite("pruned.graph", graph);
+    graph_t *read = graphFileRead("pruned.graph");
+    free(nodes);
+    nodes = schedule(read, &length);
+    assertOther(areMatrixesEqual(lastOutput(nodes, length), output, 0));
+    remove("pruned.graph");
+    remove("pruned_data");
+    matrixFree(output);
+
+    //Ranked on the last FORWARD's activations
+    assertEqual(pruneNeurons(fullNodes, fullLength, 0.25, ACTIVATIONS), 11);
+    assertEqual(full->entryPoints[5]->content.data->data->matrix2d->nRows, 15);
+    free(nodes);
+    free(fullNodes);
+
+    printf("Finished testing structured pruning\n");
+}
+
+//POST: Whether svd's factors are orthonormal, its singular values descend and they multiply back to matrix
+static bool svdMatches(matrix2d_t *matrix, svd_t *svd) {
+    bool match = true;
+    double sum;
+    for (int k = 0; k < svd->rank; k++) {
+        match &= svd->s[k] >= 0 && (!k || svd->s[k] <= svd->s[k - 1]);
+        for (int l = 0; l < svd->rank; l++) {
+            sum = 0;
+            for (int i = 0; i < svd->u->nRows; i++) sum += matrixGet(svd->u, i, k) * matrixGet(svd->u, i, l);
+            match &= fabs(sum - (k == l)) < 1e-5;
+            sum = 0;
+            for (int i = 0; i < svd->v->nRows; i++) sum += matrixGet(svd->v, i, k) * matrixGet(svd->v, i, l);
+            match &= fabs(sum - (k == l)) < 1e-5;
+        }
+    }
+    for (int i = 0; i < matrix->nRows; i++) {
+        for (int j = 0; j < matrix->nCols; j++) {
+            sum = 0;
+            for (int k = 0; k < svd->rank; k++) sum += matrixGet(svd->u, i, k) * svd->s[k] * matrixGet(svd->v, j, k);
+            match &= fabs(sum - matrixGet(matrix, i, j)) < 1e-5;
+        }
+    }
+    return match;
+}
+
+void testLowRank(void) {
+    printf("Testing low rank factorisation\n");
+
+    //Tall and wide matrices both factorise
+    matrix2d_t *tall = matrixCreate(7, 5), *wide = matrixCreate(5, 7);
+    matrixRandomise(tall);
+    matrixRandomise(wide);
+    svd_t *svd = matrixSVD(tall);
+    assertEqual(svd->rank, 5);
+    assertOther(svdMatches(tall, svd));
+    svdFree(svd);
+    svd = matrixSVD(wide);
+    assertOther(svdMatches(wide, svd));
+    svdFree(svd);
+    matrixFree(tall);
+    matrixFree(wide);
+
+    //Weights of rank 3 split into factors of rank 3 which give the same outputs
+    graph_t *graph = mlpGraph(8, 16, 12, 6);
+    graph->exitPoints[0]->content.data->data->matrix2d = matrixCreate(8, 6);
+    matrix2d_t *left = matrixCreate(16, 3), *right = matrixCreate(3, 12);
+    matrixRandomise(left);
+    matrixRandomise(right);
+    matrix2d_t *weights = graph->entryPoints[1]->content.data->data->matrix2d;
+    graph->entryPoints[1]->content.data->data->matrix2d = matrixDotProduct(left, right);
+    matrixFree(weights);
+    svd = matrixSVD(graph->entryPoints[1]->content.data->data->matrix2d);
+    assertEqual(rankForEnergy(svd, 1 - 1e-9), 3);
+    svdFree(svd);
+    int length;
+    node_t **nodes = schedule(graph, &length);
+    matrix2d_t *expected = matrixClone(lastOutput(nodes, length));
+    int nEntryPoints = graph->n;
+    assertEqual(factoriseDense(graph, nodes, length, ENERGY, 1 - 1e-9, false), 1);
+    assertEqual(graph->n, nEntryPoints + 1);
+    assertEqual(graph->entryPoints[nEntryPoints]->content.data->data->matrix2d->nRows, 16);
+    assertEqual(graph->entryPoints[nEntryPoints]->content.data->data->matrix2d->nCols, 3);
+    assertEqual(graph->entryPoints[1]->content.data->data->matrix2d->nRows, 3);
+    free(nodes);
+    nodes = schedule(graph, &length);
+    assertOther(areMatrixesEqual(expected, lastOutput(nodes, length), 1e-5));
+    matrixFree(expected);
+    matrixFree(left);
+    matrixFree(right);
+    free(nodes);
+
+    //A FLOP budget of half keeps the rank where two products cost at most half of one
+    graph = mlpGraph(8, 16, 24, 6);
+    nodes = schedule(graph, &length);
+    assertEqual(factoriseDense(graph, nodes, length, FLOP_BUDGET, 0.5, false), 2);
+    assertEqual(graph->entryPoints[1]->content.data->data->matrix2d->nRows, 16 * 24 / 2 / (16 + 24));
+    assertEqual(graph->entryPoints[3]->content.data->data->matrix2d->nRows, 24 * 6 / 2 / (24 + 6));
+    free(nodes);
+
+    printf("Finished testing low rank factorisation\n");
+}
+
+void testWavefront(void) {
+    printf("Testing wavefront execution of stacked LSTMs\n");
+
+    const int timeSteps = 4, nLayers = 3, batchSize = 2, nFeatures = 3, nNeurons = 2;
+    node_t **inputs = malloc(sizeof(node_t*) * timeSteps);
+    for (int t = 0; t < timeSteps; t++) {
+        inputs[t] = nodeInit("x", 0, 1, true);
+        inputs[t]->content.data->internalNode = false;
+        inputs[t]->content.data->data->matrix2d = matrixCreate(batchSize, nFeatures);
+        matrixRandomise(inputs[t]->content.data->data->matrix2d);
+        inputs[t]->matrix->matrix2d = inputs[t]->content.data->data->matrix2d;
+    }
+    graph_t *graph = stackedLSTM(inputs, timeSteps, nLayers, SIGMOID, nNeurons);
+    graph->exitPoints[0]->content.data->data->matrix2d = matrixCreate(batchSize, nNeurons);
+    int length;
+    node_t **nodes = schedule(graph, &length);
+    wavefront_t *plan = scheduleWavefront(nodes, length);
+
+    //Every input is in an earlier level
+    int nScheduled = 0;
+    bool ordered = true;
+    for (int l = 0; l < plan->nLevels; l++) {
+        for (int i = 0; i < plan->levelLengths[l]; i++) {
+            nScheduled++;
+            for (int j = 0; j < plan->levels[l][i]->n; j++) {
+                for (int k = l; k < plan->nLevels; k++) {
+                    for (int m = 0; m < plan->levelLengths[k]; m++) {
+                        if (plan->levels[k][m] == plan->levels[l][i]->inputs[j]) ordered = false;
+                    }
+                }
+            }
+        }
+    }
+    assertEqual(nScheduled, length);
+    assertOther(ordered);
+    //Cells on an anti-diagonal share a level, so some level holds one per layer
+    assertOther(plan->widest >= nLayers);
+
+    execute(nodes, length, FORWARD);
+    matrix2d_t *serial = matrixClone(graph->exitPoints[0]->inputs[0]->matrix->matrix2d);
+    executeWavefront(plan, 3);
+    matrix2d_t *parallel = graph->exitPoints[0]->inputs[0]->matrix->matrix2d;
+    for (int i = 0; i < batchSize; i++) {
+        for (int j = 0; j < nNeurons; j++) assertEqual(parallel->data[i][j], serial->data[i][j]);
+    }
+
+    wavefrontFree(plan);
+    matrixFree(serial);
+    printf("Finished testing wavefront execution of stacked LSTMs\n");
+}
+
+void testLSTMSession(void) {
+    printf("Testing streaming LSTM sessions\n");
+
+    const int nStreams = 3, timeSteps = 4, nFeatures = 3, nNeurons = 2;
+    lstmParams_t *params = lstmParamsCreate(nFeatures, nNeurons, SIGMOID);
+    matrixRandomise(params->bias);
+    lstmSession_t *session = lstmSessionCreate(params, nFeatures, nStreams);
+
+    int streams[nStreams];
+    for (int s = 0; s < nStreams; s++) streams[s] = lstmSessionOpen(session);
+    assertEqual(lstmSessionOpen(session), -1);
+
+    //Each stream is stepped alone as a batch of one to compare with
+    matrix2d_t *x = matrixCreate(1, nFeatures), *expected[nStreams], *next;
+    for (int s = 0; s < nStreams; s++) expected[s] = matrixCreate(1, 2 * nNeurons);
+    for (int t = 0; t < timeSteps; t++) {
+        for (int s = 0; s < nStreams; s++) {
+            //The last stream only has an event every other tick
+            if (nStreams - 1 == s && t % 2) continue;
+            matrixRandomise(x);
+            assertOther(lstmSessionPush(session, streams[s], x->data[0]));
+            next = lstmCellForward(params, x, expected[s], NULL);
+            matrixFree(expected[s]);
+            expected[s] = next;
+        }
+        assertOther(!lstmSessionPush(session, streams[0], x->data[0]));
+        assertEqual(lstmSessionTick(session), nStreams - t % 2);
+    }
+
+    bool matches = true;
+    for (int s = 0; s < nStreams; s++) {
+        for (int j = 0; j < nNeurons; j++) {
+            if (fabs(lstmSessionHidden(session, streams[s])[j] - expected[s]->data[0][j]) > GRADIENT_CHECK_TOLERANCE) {
+                matches = false;
+            }
+        }
+    }
+    assertOther(matches);
+
+    //A reopened row starts from a zero state
+    lstmSessionClose(session, streams[1]);
+    int reopened = lstmSessionOpen(session);
+    assertEqual(reopened, streams[1]);
+    assertEqual(lstmSessionHidden(session, reopened)[0], 0);
+
+    for (int s = 0; s < nStreams; s++) matrixFree(expected[s]);
+    matrixFree(x);
+    lstmSessionFree(session);
+    lstmParamsFree(params);
+    printf("Finished testing streaming LSTM sessions\n");
+}
+
+void testTruncatedBPTT(void) {
+    printf("Testing truncated BPTT\n");
+
+    //Predict the next value of a sine wave, each row of the batch at a different phase
+    const int length = 300, batchSize = 4, nNeurons = 8;
+    matrix2d_t **inputs = malloc(sizeof(matrix2d_t*) * length);
+    matrix2d_t **targets = malloc(sizeof(matrix2d_t*) * length);
+    for (int t = 0; t < length; t++) {
+        inputs[t] = matrixCreate(batchSize, 1);
+        targets[t] = matrixCreate(batchSize, 1);
+        for (int r = 0; r < batchSize; r++) {
+            inputs[t]->data[r][0] = sin(0.2 * t + r);
+            targets[t]->data[r][0] = sin(0.2 * (t + 1) + r);
+        }
+    }
+    lstmParams_t *params = lstmParamsCreate(1, nNeurons, SIGMOID);
+    matrix2d_t *readout = matrixCreate(nNeurons, 1);
+    matrixRandomise(readout);
+
+    double before = trainTruncatedBPTT(params, readout, inputs, targets, length, 5, 10, 0.1, BPTT_MAX_GRADIENT_NORM, 1);
+    double after = trainTruncatedBPTT(params, readout, inputs, targets, length, 5, 10, 0.1, BPTT_MAX_GRADIENT_NORM, 20);
+    assertOther(after < before / 2);
+
+    //With one window over the whole sequence and no cap, an update is minus lRate times full BPTT's gradients
+    const int shortLength = 6;
+    lstmParams_t *fresh = lstmParamsCreate(1, nNeurons, SIGMOID), *gradients = lstmParamsZeroLike(fresh);
+    matrixRandomise(readout);
+    matrix2d_t *dReadout = matrixCreate(nNeurons, 1), *states[shortLength + 1], *hidden[shortLength], *dY[shortLength];
+    lstmCache_t caches[shortLength];
+    states[0] = matrixCreate(batchSize, 2 * nNeurons);
+    for (int t = 0; t < shortLength; t++) {
+        states[t + 1] = lstmCellForward(fresh, inputs[t], states[t], &caches[t]);
+        hidden[t] = lstmHidden(states[t + 1]);
+        matrix2d_t *prediction = matrixDotProduct(hidden[t], readout);
+        dY[t] = matrixSubtract(prediction, targets[t]);
+        for (int r = 0; r < batchSize; r++) dY[t]->data[r][0] /= batchSize;
+        matrixFree(prediction);
+    }
+    matrix2d_t *dState = matrixCreate(batchSize, 2 * nNeurons), *dPrevious;
+    for (int t = shortLength - 1; t >= 0; t--) {
+        for (int r = 0; r < batchSize; r++) {
+            for (int j = 0; j < nNeurons; j++) {
+                dState->data[r][j] += dY[t]->data[r][0] * readout->data[j][0];
+                dReadout->data[j][0] += hidden[t]->data[r][j] * dY[t]->data[r][0];
+            }
+        }
+        dPrevious = lstmCellBackward(fresh, inputs[t], states[t], &caches[t], dState, gradients, NULL);
+        matrixFree(dState);
+        dState = dPrevious;
+    }
+
+    matrix2d_t *original[] = {matrixClone(fresh->weightW), matrixClone(fresh->weightU), matrixClone(fresh->bias),
+                              matrixClone(readout)};
+    trainTruncatedBPTT(fresh, readout, inputs, targets, shortLength, shortLength, shortLength, 1, 0, 1);
+    matrix2d_t *updated[] = {fresh->weightW, fresh->weightU, fresh->bias, readout};
+    matrix2d_t *expected[] = {gradients->weightW, gradients->weightU, gradients->bias, dReadout};
+    for (int k = 0; k < 4; k++) {
+        matrix2d_t *step = matrixSubtract(original[k], updated[k]);
+        assertOther(areMatrixesEqual(step, expected[k], 1000 * REAL_EPSILON));
+        matrixFree(step);
+        matrixFree(original[k]);
+    }
+
+    for (int t = 0; t < shortLength; t++) {
+        matrixFree(states[t]);
+        matrixFree(hidden[t]);
+        matrixFree(dY[t]);
+        lstmCacheFree(&caches[t]);
+    }
+    matrixFree(states[shortLength]);
+    matrixFree(dState);
+    matrixFree(dReadout);
+    lstmParamsFree(fresh);
+    lstmParamsFree(gradients);
+
+    for (int t = 0; t < length; t++) {
+        matrixFree(inputs[t]);
+        matrixFree(targets[t]);
+    }
+    free(inputs);
+    free(targets);
+    matrixFree(readout);
+    lstmParamsFree(params);
+    printf("Finished testing truncated BPTT\n");
+}
+
+void testBucketedLSTM(void) {
+    printf("Testing bucketed LSTM batches\n");
+
+    const int nSequences = 5, nFeatures = 2, nNeurons = 3, batchSize = 2;
+    int lengths[] = {3, 7, 1, 5, 7}, bucketLengths[] = {4, 8};
+    lstmParams_t *params = lstmParamsCreate(nFeatures, nNeurons, SIGMOID);
+    matrixRandomise(params->bias);
+    bucketedLSTM_t *model = bucketedLSTMCreate(params, nFeatures, bucketLengths, 2);
+
+    matrix2d_t *sequences[nSequences], *outputs[nSequences];
+    for (int i = 0; i < nSequences; i++) {
+        sequences[i] = matrixCreate(lengths[i], nFeatures);
+        matrixRandomise(sequences[i]);
+    }
+    bucketedLSTMForward(model, sequences, nSequences, batchSize, outputs);
+
+    //Each sequence on its own, cell by cell, for as many steps as it has
+    bool matches = true;
+    matrix2d_t x = {.nRows = 1, .nCols = nFeatures}, *state, *next;
+    for (int i = 0; i < nSequences; i++) {
+        state = matrixCreate(1, 2 * nNeurons);
+        for (int t = 0; t < lengths[i]; t++) {
+            x.data = sequences[i]->data + t;
+            next = lstmCellForward(params, &x, state, NULL);
+            matrixFree(state);
+            state = next;
+        }
+        for (int j = 0; j < nNeurons; j++) {
+            if (fabs(outputs[i]->data[0][j] - state->data[0][j]) > GRADIENT_CHECK_TOLERANCE) matches = false;
+        }
+        matrixFree(state);
+    }
+    assertOther(matches);
+    //Only real steps are computed, where padding would take 5 x 7
+    assertEqual(model->nRowsComputed, 23);
+    assertEqual(model->nRowsPadded, 35);
+    //The batch of the two 7 step sequences needs the long bucket, the rest fit the short one
+    assertOther(NULL != model->buckets[1].graph);
+    assertOther(NULL != model->buckets[0].graph);
+
+    for (int i = 0; i < nSequences; i++) {
+        matrixFree(sequences[i]);
+        matrixFree(outputs[i]);
+    }
+    bucketedLSTMFree(model);
+    lstmParamsFree(params);
+    printf("Finished testing bucketed LSTM batches\n");
+}
+
 void testErrorFunctions() {
     printf("Testing Error Functions\n");
 
@@ -585,8 +2529,8 @@ void testMatrixPooling() {
     matrix2d_t *m1 = matrixCreate(212, 452);
     matrixRandomise(m1);
 
-    matrix2d_t *gradient = matrixCreate(212, 452);
-    matrix2d_t *m1MaxPool = matrixMaxPooling(m1, gradient, 1, 2);
+    int32_t *argmax = malloc(sizeof(int32_t) * 212 * 452);
+    matrix2d_t *m1MaxPool = matrixMaxPooling(m1, argmax, 1, 2);
     assertEqual(m1MaxPool->nCols, 452);
     assertEqual(m1MaxPool->nRows, 212);
 
@@ -604,7 +2548,7 @@ void testMatrixPooling() {
     }
 
     strideSize = 2;
-    matrix2d_t *m2MaxPool = matrixMaxPooling(m1, gradient, 2, 2);
+    matrix2d_t *m2MaxPool = matrixMaxPooling(m1, argmax, 2, 2);
     for (int i = 0; i < m2MaxPool->nRows; i++) {
         for (int j = 0; j < m2MaxPool->nCols; j++) {
             for (int k = 0; k < filterSize; k++) {
@@ -616,7 +2560,7 @@ void testMatrixPooling() {
         }
     }
 
-    matrix2d_t *m4MaxPool = matrixMaxPooling(m1, gradient, 1, 1);
+    matrix2d_t *m4MaxPool = matrixMaxPooling(m1, argmax, 1, 1);
     
     for (int i = 0; i < m1->nRows; i++) {
         for (int j = 0; j < m1->nCols; j++) {
@@ -624,7 +2568,7 @@ void testMatrixPooling() {
         }
     }
 
-    matrix2d_t *m1AvgPool = matrixAveragePooling(m1, gradient, 1, 2);
+    matrix2d_t *m1AvgPool = matrixAveragePooling(m1, 1, 2);
     strideSize = 1;
     for (int i = 0; i < m1AvgPool->nRows; i++) {
         for (int j = 0; j < m1AvgPool->nCols; j++) {
@@ -635,12 +2579,12 @@ void testMatrixPooling() {
                         sum += matrixGet(m1, i*strideSize + k, j*strideSize + l);
                 }
             }
-            assertEqual(matrixGet(m1AvgPool, i, j), sum / (double) (filterSize * filterSize));
+            assertOther(fabs(matrixGet(m1AvgPool, i, j) - sum / (filterSize * filterSize)) < 16 * REAL_EPSILON);
         }
     }
 
 
-    matrix2d_t *m2AvgPool = matrixAveragePooling(m1, gradient, 2, 2);
+    matrix2d_t *m2AvgPool = matrixAveragePooling(m1, 2, 2);
     strideSize = 2;
     // stride size = 2
     for (int i = 0; i < m2AvgPool->nRows; i++) {
@@ -652,12 +2596,12 @@ void testMatrixPooling() {
                         sum += matrixGet(m1, i*strideSize + k, j*strideSize + l);
                 }
             }
-            assertEqual(matrixGet(m2AvgPool, i, j), sum / (double) (filterSize * filterSize));
+            assertOther(fabs(matrixGet(m2AvgPool, i, j) - sum / (filterSize * filterSize)) < 16 * REAL_EPSILON);
         }
     }
 
     
-    matrix2d_t *m4AvgPool = matrixAveragePooling(m1, gradient, 1, 1);
+    matrix2d_t *m4AvgPool = matrixAveragePooling(m1, 1, 1);
     assertEqual(m4AvgPool->nRows, m1->nRows);
     assertEqual(m4AvgPool->nCols, m1->nCols);
 
@@ -667,6 +2611,99 @@ void testMatrixPooling() {
         }
     }
 
+    //Each maximum's index points back at it
+    matrixFree(m2MaxPool);
+    m2MaxPool = matrixMaxPooling(m1, argmax, 2, 2);
+    bool indexed = true;
+    for (int i = 0; i < m2MaxPool->nRows; i++) {
+        for (int j = 0; j < m2MaxPool->nCols; j++) {
+            int32_t index = argmax[i * m2MaxPool->nCols + j];
+            indexed &= matrixGet(m1, index / m1->nCols, index % m1->nCols) == matrixGet(m2MaxPool, i, j);
+        }
+    }
+    assertOther(indexed);
+
+    //Windows of 9 are summed from a summed-area table, so only match to rounding
+    //The table's sums run over the whole matrix, each of which may be off by a rounding error per element
+    filterSize = 3;
+    for (strideSize = 1; strideSize <= 3; strideSize++) {
+        matrix2d_t *m3AvgPool = matrixAveragePooling(m1, strideSize, filterSize);
+        bool averaged = true;
+        for (int i = 0; i < m3AvgPool->nRows; i++) {
+            for (int j = 0; j < m3AvgPool->nCols; j++) {
+                double sum = 0;
+                for (int k = 0; k < filterSize; k++) {
+                    for (int l = 0; l < filterSize; l++) {
+                        if (i*strideSize + k < m1->nRows && j*strideSize + l < m1->nCols)
+                            sum += matrixGet(m1, i*strideSize + k, j*strideSize + l);
+                    }
+                }
+                averaged &= fabs(matrixGet(m3AvgPool, i, j) - sum / (filterSize * filterSize))
+                            < m1->nRows * m1->nCols * REAL_EPSILON;
+            }
+        }
+        assertOther(averaged);
+        matrixFree(m3AvgPool);
+    }
+
+    //A batch of 2 images of 3 channels pools each plane as matrixMaxPooling and matrixAveragePooling do
+    tensor4d_t *batch = tensor4DCreate(2, 3, 9, 7);
+    for (int i = 0; i < 2 * 3 * 9 * 7; i++) batch->data[i] = randFloat();
+    int32_t *batchArgmax = malloc(sizeof(int32_t) * 2 * 3 * 4 * 3);
+    tensor4d_t *batchMax = tensorMaxPooling(batch, batchArgmax, 2, 3);
+    tensor4d_t *batchAvg = tensorAveragePooling(batch, 2, 3);
+    bool planesMatch = batchMax->nRows == 4 && batchMax->nCols == 3;
+    for (int p = 0; p < 6; p++) {
+        matrix2d_t *plane = matrixCreate(9, 7);
+        for (int i = 0; i < 9; i++) {
+            for (int j = 0; j < 7; j++) matrixSet(plane, i, j, batch->data[(p * 9 + i) * 7 + j]);
+        }
+        matrix2d_t *planeMax = matrixMaxPooling(plane, NULL, 2, 3);
+        matrix2d_t *planeAvg = matrixAveragePooling(plane, 2, 3);
+        for (int i = 0; i < 4; i++) {
+            for (int j = 0; j < 3; j++) {
+                planesMatch &= matrixGet(planeMax, i, j) == batchMax->data[(p * 4 + i) * 3 + j];
+                planesMatch &= fabs(matrixGet(planeAvg, i, j) - batchAvg->data[(p * 4 + i) * 3 + j]) < 16 * REAL_EPSILON;
+            }
+        }
+        matrixFree(plane);
+        matrixFree(planeMax);
+        matrixFree(planeAvg);
+    }
+    assertOther(planesMatch);
+
+    //The max gradient only reaches the maxima, and the average's spreads each window's evenly
+    tensor4d_t *batchGradient = tensor4DCreate(2, 3, 4, 3), *maxGradient = tensor4DCreate(2, 3, 9, 7);
+    tensor4d_t *avgGradient = tensor4DCreate(2, 3, 9, 7), *avgExpected = tensor4DCreate(2, 3, 9, 7);
+    for (int i = 0; i < 2 * 3 * 4 * 3; i++) batchGradient->data[i] = randFloat();
+    tensorMaxPoolingBackward(batchGradient, batchArgmax, maxGradient);
+    tensorAveragePoolingBackward(batchGradient, 2, 3, avgGradient);
+    for (int p = 0; p < 6; p++) {
+        for (int i = 0; i < 4; i++) {
+            for (int j = 0; j < 3; j++) {
+                double g = batchGradient->data[(p * 4 + i) * 3 + j];
+                maxGradient->data[p * 9 * 7 + batchArgmax[(p * 4 + i) * 3 + j]] -= g;
+                for (int k = 0; k < 3 && 2 * i + k < 9; k++) {
+                    for (int l = 0; l < 3 && 2 * j + l < 7; l++) avgExpected->data[(p * 9 + 2 * i + k) * 7 + 2 * j + l] += g / 9;
+                }
+            }
+        }
+    }
+    bool routed = true;
+    for (int i = 0; i < 2 * 3 * 9 * 7; i++) {
+        routed &= fabs(maxGradient->data[i]) < 16 * REAL_EPSILON && fabs(avgGradient->data[i] - avgExpected->data[i]) < 16 * REAL_EPSILON;
+    }
+    assertOther(routed);
+    tensor4DFree(avgExpected);
+    tensor4DFree(batch);
+    tensor4DFree(batchMax);
+    tensor4DFree(batchAvg);
+    tensor4DFree(batchGradient);
+    tensor4DFree(maxGradient);
+    tensor4DFree(avgGradient);
+    free(batchArgmax);
+    free(argmax);
+
     printf("Matrix pooling tests pass\n");
 }
 
@@ -722,6 +2759,13 @@ void testMatrixConvolution() {
     }
     assertOther(areMatrixesEqual(m1Conv, m1Expected, 0));
 
+    //A stride of 2 moves the window by 2 rather than spreading the kernel's taps
+    matrix2d_t *m1Strided = matrixConvolution(m1, kernel1, 2, 0);
+    matrix2d_t *stridedExpected = matrixCreate(2, 2);
+    matrixSet(stridedExpected, 0, 1, 30);
+    matrixSet(stridedExpected, 1, 1, 30);
+    assertOther(areMatrixesEqual(m1Strided, stridedExpected, 0));
+
     printf("Matrix convolution tests pass\n");
 }
 
@@ -849,7 +2893,7 @@ void testMatrix3DConvolution() {
 
 void testReadCSV() {
     csvDataPack_t csv = readCSV("data/mnist_train.csv", 60000);
-    double *labels = csv.labels;
+    real_t *labels = csv.labels;
     matrix2d_t **matrices = csv.matrixInputs;
 
     assertEqual(labels[0], 5.0);
@@ -859,6 +2903,8 @@ void testReadCSV() {
 
 int main() {
     printf("Starting tests\n\n");
+    //Tunings and choices found by the tests are kept in memory, leaving the user's cache alone
+    setCacheWrites(false);
     runTest(testActiveFuncs);
     runTest(testMatrix);
     runTest(testMatrixDotProduct);
@@ -870,8 +2916,33 @@ int main() {
     runTest(testSingleMatrixFuncs);
 
     runTest(testDataFile);
+    runTest(testDataPrecision);
     runTest(testGraph);
+    runTest(testGraphClone);
+    runTest(testAllReduce);
     runTest(testScheduler);
+    runTest(testCheckpoints);
+    runTest(testLSTMSharedWeights);
+    runTest(testLSTMCell);
+    runTest(testLSTMProjection);
+    runTest(testAutograd);
+    runTest(testTrainDistributed);
+    runTest(testTrainAsync);
+    runTest(testFusion);
+    runTest(testPasses);
+    runTest(testJIT);
+    runTest(testGemm);
+    runTest(testKernels);
+    runTest(testConvolutionAlgorithms);
+    runTest(testMixedPrecision);
+    runTest(testQuantization);
+    runTest(testSparse);
+    runTest(testStructuredPruning);
+    runTest(testLowRank);
+    runTest(testWavefront);
+    runTest(testLSTMSession);
+    runTest(testTruncatedBPTT);
+    runTest(testBucketedLSTM);
     runTest(testErrorFunctions);
     // runTest(testOptimisers);
     runTest(testReadCSV);
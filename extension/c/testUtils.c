@@ -21,6 +21,9 @@ data_t *initData(bool internalNode, matrix2d_t *matrix) {
     data_t *data = malloc(sizeof(data_t));
 	data->data = malloc(sizeof(matrix_t));
     data->internalNode = internalNode;
+    data->constant = false;
+    data->quantized = NULL;
+    data->sparse = NULL;
     data->data->matrix2d = matrix;
     return data;
 }
@@ -68,6 +71,7 @@ graph_t *genGraph(void) {
     graph->entryPoints[0] = a;
     graph->entryPoints[1] = b;
     graph->entryPoints[2] = c;
+    graph->m = 3;
     graph->exitPoints = calloc(3, sizeof(node_t*));
     graph->exitPoints[0] = e;
     graph->exitPoints[1] = f;
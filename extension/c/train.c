@@ -1,11 +1,20 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <math.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <string.h>
 
 #include "../train.h"
-#include "../compiler.h"
+#include "../allreduce.h"
+#include "../autograd.h"
+#include "../fusion.h"
+#include "../gemm.h"
+#include "../half.h"
+#include "../passes.h"
 #include "../nodes.h"
 #include "../layers.h"
+#include "../lstm.h"
 #include "../predict.h"
 #include "../scheduler.h"
 #include "../graphix.h"
@@ -16,17 +25,26 @@
 // Load batch of data (randomly shuffled)
 // Predict the output
 // Generate the loss
-// Predict on the backprop graph
+// Run the forward schedule backwards on the tape
 // Call optimisers on each node which represents a weight or a bias
 
 #include "../testUtils.h"
 
+#define MOMENTUM_CONSTANT 0.9
+#define NO_CHECKPOINTS -1
+#define FULL_PRECISION -1
+//Mixed precision starts with the loss scaled up by this, halves it whenever gradients overflow
+//and doubles it after LOSS_SCALE_WINDOW steps in a row without an overflow
+#define LOSS_SCALE_INITIAL 65536.0
+#define LOSS_SCALE_WINDOW 1000
+
 //PRE: batchSize <= number of inputs / targets
 //PRE: all inputs/targets have the same shape
 //POST: returns the targets matrix, and sets the input matrix
+//      if seed isn't NULL rows are picked with rand_r so threads don't share rand's state
 matrix2d_t **sample(matrix2d_t **inputs, matrix2d_t **targets, 
                  int batchSize, matrix2d_t ***input, 
-                 int nInputs, int nTargets) {
+                 int nInputs, int nTargets, unsigned int *seed) {
     
     int size = inputs[0]->nRows;
 
@@ -43,7 +61,7 @@ matrix2d_t **sample(matrix2d_t **inputs, matrix2d_t **targets,
 
     int index;
     for (int i = 0; i < batchSize; i++) {
-        index = rand() % size;
+        index = (seed ? rand_r(seed) : rand()) % size;
         for (int j = 0; j < nInputs; j++) {
             for (int k = 0; k < inputs[j]->nCols; k++) {
                 matrixSet((*input)[j], i, k, matrixGet(inputs[j], index, k));
@@ -59,13 +77,91 @@ matrix2d_t **sample(matrix2d_t **inputs, matrix2d_t **targets,
     return target;
 }
 
+static int countInputs(graph_t *graph) {
+    int nInputs = 0;
+    for (int i = 0; i < graph->n; i++) 
+        nInputs += !graph->entryPoints[i]->content.data->internalNode;
+    return nInputs;
+}
+
+//PRE: FORWARD has run on graph and tapeZero was called
+//POST: Seeds the tape with dL/d(output) of exit point j times lossScale and returns dLoss, i.e. expected - actual
+static matrix2d_t *seedLoss(graph_t *graph, int j, matrix2d_t *target,
+                            matrix2d_t *(*dLoss)(matrix2d_t*, matrix2d_t*), double lossScale) {
+    node_t *output = graph->exitPoints[j]->inputs[0];
+    matrix2d_t *delta = dLoss(target, output->matrix->matrix2d);
+    //The loss's gradient is actual - expected
+    matrix2d_t *gradient = matrixScalarProduct(delta, -lossScale);
+    tapeSeed(output, gradient);
+    matrixFree(gradient);
+    return delta;
+}
+
+//PRE: tapeBackward has run, so param's gradient buffer holds dL/dparam
+//POST: opt has updated param's weights; optimisers read the gradient from the node's matrix,
+//      which otherwise holds the weight's activation
+static void applyGradient(node_t *param, void (*opt)(node_t *weight, int nArgs, ...), int nArgs,
+                          double lRate, double momentum) {
+    matrix_t *activation = param->matrix;
+    param->matrix = param->gradient;
+    opt(param, nArgs, lRate, momentum);
+    param->matrix = activation;
+}
+
+//POST: Whether every parameter's gradient is finite, after dividing them all by lossScale if so
+static bool unscaleGradients(tape_t *tape, double lossScale) {
+    matrix2d_t *gradient;
+    bool finite = true;
+    for (int p = 0; p < tape->nParams; p++) {
+        if (!(gradient = tape->params[p]->gradient->matrix2d)) continue;
+        for (int i = 0; i < gradient->nRows; i++) {
+            for (int j = 0; j < gradient->nCols; j++) finite &= isfinite(gradient->data[i][j]);
+        }
+    }
+    for (int p = 0; p < tape->nParams && finite; p++) {
+        if (!(gradient = tape->params[p]->gradient->matrix2d)) continue;
+        for (int i = 0; i < gradient->nRows; i++) {
+            for (int j = 0; j < gradient->nCols; j++) gradient->data[i][j] /= lossScale;
+        }
+    }
+    return finite;
+}
+
+//PRE: forward is clone's schedule, and executed is whether FORWARD has run on it
+//POST: The nodes of clone, made by graphClone, and its schedule are freed, leaving the weights,
+//      biases and velocities it shares with the original graph
+static void freeClone(graph_t *clone, node_t **forward, int nForward, bool executed) {
+    node_t *node;
+    for (int i = 0; i < nForward; i++) {
+        node = forward[i];
+        //Until a FORWARD has run a clone's activation is still the original's
+        if (executed && node->matrix->matrix2d) matrixFree(node->matrix->matrix2d);
+        if (node->gradient && node->gradient->matrix2d) matrixFree(node->gradient->matrix2d);
+        if (node->isData && !node->content.data->internalNode) {
+            free(node->content.data->data);
+            free(node->content.data);
+        }
+        free(node->gradient);
+        free(node->poolingArgmax);
+        free(node->matrix);
+        free(node->inputs);
+        free(node->outputs);
+        free(node);
+    }
+    free(forward);
+    free(clone->entryPoints);
+    free(clone->exitPoints);
+    free(clone);
+}
+
 //PRE: inputs contains matrices for first layer
+//PRE: maxActivations is NO_CHECKPOINTS to keep every activation, otherwise as for scheduleCheckpoints
+//PRE: format is FULL_PRECISION, or an enum halfFormat to hold activations and gradients in,
+//     in which case maxActivations is NO_CHECKPOINTS
 //POST: the network would have been trained for 'epochs' epochs
-void train(graph_t *graph, matrix2d_t **inputs, matrix2d_t **targets,
-           double lRate, int epochs, enum errorFunction func,
-           int batchSize, enum optimiser optimiser) {
-    
-    va_list args;
+static void trainGraph(graph_t *graph, matrix2d_t **inputs, matrix2d_t **targets,
+                       double lRate, int epochs, enum errorFunction func,
+                       int batchSize, enum optimiser optimiser, int maxActivations, int format) {
 
     double (*loss)(matrix2d_t*, matrix2d_t*);
     matrix2d_t *(*dLoss)(matrix2d_t*, matrix2d_t*);
@@ -91,55 +187,57 @@ void train(graph_t *graph, matrix2d_t **inputs, matrix2d_t **targets,
             dLoss = dCrossEntropyLoss;
     }
 
-    int nNodesForward, nNodesBackward;
-    node_t **forward = schedule(graph, &nNodesForward);
-    graph_t *compiled = compile(graph, "backprop");
-    writeGraph(compiled);
-    node_t **backward = schedule(compiled, &nNodesBackward);
+    //The passes rewrite the graph they optimise, so they're run on a clone sharing graph's weights and biases
+    graph_t *clone = graphClone(graph);
+    int nNodes;
+    node_t **forward = schedule(clone, &nNodes);
+    optimiseSchedule(clone, forward, &nNodes, false);
+    //Shapes timed by an earlier run on this machine are read from its tuning file instead
+    int nTuned = tuneGemm(forward, nNodes);
+    if (nTuned) printf("Tuned GEMM blocking for %d new product shapes\n", nTuned);
+    tape_t *tape = tapeRecord(forward, nNodes);
+    checkpoints_t *plan = NO_CHECKPOINTS == maxActivations ? NULL 
+                        : scheduleCheckpoints(forward, nNodes, maxActivations);
+    mixedPrecision_t *mixed = FULL_PRECISION == format ? NULL : scheduleMixedPrecision(forward, nNodes, format);
+    double lossScale = mixed ? LOSS_SCALE_INITIAL : 1;
+    int nGoodSteps = 0;
 
-    int nInputs = 0, nTargets = graph->m;
+    int nInputs = countInputs(clone), nTargets = clone->m;
     matrix2d_t **input, **target;
 
-    for (int i = 0; i < graph->n; i++) 
-        nInputs += !graph->entryPoints[i]->content.data->internalNode;
-
-    //Collect all the losspoints in 1 place
-    node_t **lossPoints = malloc(sizeof(node_t*) * nTargets);
-
-    for (int i = 0; i < nTargets; i++) {
-        for (int j = 0; j < compiled->n; j++) {
-            //Check string pointer equality
-            if (compiled->entryPoints[j]->name == graph->exitPoints[i]->name) {
-                lossPoints[i] = compiled->entryPoints[j];
-                lossPoints[i]->content.data->internalNode = false;
-                break;
-            }
-        }
-    }
-
     int inputIdx = 0;
     double error;
 
     for (int i = 0; i < epochs + 1; i++) {
         //Prime graphs with data
         if (batchSize < nInputs) {
-            target = sample(inputs, targets, batchSize, &input, nInputs, nTargets);
+            target = sample(inputs, targets, batchSize, &input, nInputs, nTargets, NULL);
         } else {
             target = targets;
             input = inputs;
         }
 
-        for (int j = 0; j < graph->n && inputIdx < nInputs; j++) {
-            if (!graph->entryPoints[j]->content.data->internalNode) 
-                graph->entryPoints[j]->content.data->data->matrix2d = input[inputIdx++];
+        for (int j = 0; j < clone->n && inputIdx < nInputs; j++) {
+            if (!clone->entryPoints[j]->content.data->internalNode) 
+                clone->entryPoints[j]->content.data->data->matrix2d = input[inputIdx++];
         }
 
         for (int j = 0; j < nTargets; j++) {
-            lossPoints[j]->content.data->data->matrix2d = target[j];
+            if (clone->exitPoints[j]->isData) clone->exitPoints[j]->content.data->data->matrix2d = target[j];
+        }
+
+        if (mixed) {
+            executeMixed(mixed, forward, nNodes, FORWARD);
+        } else if (plan) {
+            executeCheckpointed(plan, forward, nNodes, FORWARD);
+        } else {
+            execute(forward, nNodes, FORWARD);
+        }
+        //Activations are only sized once FORWARD has run
+        if (!i && fusedTrafficSaved(forward, nNodes)) {
+            printf("Fused kernels save %ld bytes of memory traffic per step\n", fusedTrafficSaved(forward, nNodes));
         }
 
-        execute(forward, nNodesForward, FORWARD, NULL, 0);
-        
 
         if (epochs == i) {
             for (int j = 0; j < batchSize; j++) {
@@ -147,30 +245,652 @@ void train(graph_t *graph, matrix2d_t **inputs, matrix2d_t **targets,
                 printf("Input: [%lf, %lf] -> Prediction: %lf\n",
                                         input[0]->data[j][0],
                                         input[0]->data[j][1],
-                                        graph->exitPoints[0]->inputs[0]->matrix->matrix2d->data[j][0]);
+                                        clone->exitPoints[0]->inputs[0]->matrix->matrix2d->data[j][0]);
             }
             break;
         }
 
         //generate loss
 
-        node_t *graphPoint, *lossPoint;
-        
+        matrix2d_t *delta;
+        tapeZero(tape);
         for (int j = 0; j < nTargets; j++) {
-            graphPoint = graph->exitPoints[j];
-            lossPoint = lossPoints[j];
-            lossPoint->content.data->data->matrix2d = 
-                dLoss(lossPoint->content.data->data->matrix2d, graphPoint->inputs[0]->matrix->matrix2d);
+            delta = seedLoss(clone, j, target[j], dLoss, lossScale);
             error = 0;
             double temp;
             for (int k = 0; k < batchSize; k++) {
-                temp = matrixGet(lossPoint->content.data->data->matrix2d, k, 0);
+                temp = matrixGet(delta, k, 0);
                 error += temp * temp;
             }
             printf("Loss at epoch: %d is %lf\n", i, error / batchSize);
+            matrixFree(delta);
+        }
+
+        if (mixed) {
+            executeMixed(mixed, forward, nNodes, BACKWARD);
+            //An overflow anywhere poisons the parameters' gradients, so the step is skipped
+            if (mixed->nOverflows || !unscaleGradients(tape, lossScale)) {
+                lossScale /= 2;
+                nGoodSteps = 0;
+                printf("Gradients overflowed at epoch %d, loss scale now %g\n", i, lossScale);
+                continue;
+            }
+            if (LOSS_SCALE_WINDOW == ++nGoodSteps) {
+                lossScale *= 2;
+                nGoodSteps = 0;
+            }
+        } else {
+            tapeBackward(tape, plan);
+        }
+        //Once per weight, however many places it's used in
+        for (int j = 0; j < tape->nParams; j++) {
+            applyGradient(tape->params[j], opt, nArgs, lRate, MOMENTUM_CONSTANT);
+        }
+    }
+
+    if (plan) {
+        printf("Peak activations held: %d of %d\n", plan->peakLive, plan->nActivations);
+        checkpointsFree(plan);
+    }
+    if (mixed) {
+        printf("Peak activation memory: %ld bytes\n", mixed->peakBytes);
+        mixedPrecisionFree(mixed);
+    }
+    freeClone(clone, forward, nNodes, true);
+    tapeFree(tape);
+}
+
+//PRE: inputs contains matrices for first layer
+//POST: the network would have been trained for 'epochs' epochs
+void train(graph_t *graph, matrix2d_t **inputs, matrix2d_t **targets,
+           double lRate, int epochs, enum errorFunction func,
+           int batchSize, enum optimiser optimiser) {
+    trainGraph(graph, inputs, targets, lRate, epochs, func, batchSize, optimiser, NO_CHECKPOINTS, FULL_PRECISION);
+}
+
+//Gradient checkpointing: FORWARD only keeps the activations at checkpoints and BACKWARD
+//recomputes the segments between them, trading compute for memory on long unrolled graphs
+//PRE: inputs contains matrices for first layer
+//PRE: maxActivations is 0 for sqrt(n) checkpoints, otherwise how many activations may be held at once
+//POST: the network would have been trained for 'epochs' epochs, exactly as by train
+void trainCheckpointed(graph_t *graph, matrix2d_t **inputs, matrix2d_t **targets,
+                       double lRate, int epochs, enum errorFunction func,
+                       int batchSize, enum optimiser optimiser, int maxActivations) {
+    trainGraph(graph, inputs, targets, lRate, epochs, func, batchSize, optimiser, maxActivations, FULL_PRECISION);
+}
+
+//Mixed precision: activations and gradients are held in 16 bits while the weights, their gradients
+//and the optimisers' state stay at full precision. The loss is scaled up so small gradients don't
+//flush to zero, and steps whose gradients overflow are skipped with the scale halved
+//PRE: inputs contains matrices for first layer
+//POST: the network would have been trained for 'epochs' epochs, less any steps skipped
+void trainMixedPrecision(graph_t *graph, matrix2d_t **inputs, matrix2d_t **targets,
+                         double lRate, int epochs, enum errorFunction func,
+                         int batchSize, enum optimiser optimiser, enum halfFormat format) {
+    trainGraph(graph, inputs, targets, lRate, epochs, func, batchSize, optimiser, NO_CHECKPOINTS, format);
+}
+
+typedef struct trainConfig {
+    matrix2d_t **inputs, **targets;
+    int nInputs, nTargets, batchSize;
+    double lRate, momentum;
+    void (*opt)(node_t *weight, int nArgs, ...);
+    int nArgs;
+    matrix2d_t *(*dLoss)(matrix2d_t*, matrix2d_t*);
+} trainConfig_t;
+
+//A thread (trainAsync) or process (trainDistributed) training its own copy of the graph
+typedef struct worker {
+    trainConfig_t *config;
+    graph_t *graph;
+    node_t **forward;
+    int nForward;
+    tape_t *tape;
+    int steps;
+    unsigned int seed;
+    //Only used by trainDistributed
+    node_t **weights;
+    int nWeights;
+    communicator_t *comm;
+} worker_t;
+
+//PRE: optimiser is SGD or MOMENTUM
+//POST: config is set up for training without the UPDATE pass
+static trainConfig_t trainConfigInit(graph_t *graph, matrix2d_t **inputs, matrix2d_t **targets,
+                                     double lRate, enum errorFunction func, int batchSize,
+                                     enum optimiser optimiser) {
+    trainConfig_t config = {.inputs = inputs, .targets = targets,
+                            .nInputs = countInputs(graph), .nTargets = graph->m,
+                            .batchSize = batchSize, .lRate = lRate,
+                            .momentum = MOMENTUM_CONSTANT};
+
+    switch (optimiser) {
+        case SGD: config.opt = sgd; config.nArgs = 1; break;
+        case MOMENTUM: config.opt = sgdMomentum; config.nArgs = 2; break;
+        default:
+            printf("Parallel training only supports SGD and MOMENTUM\n");
+            exit(EXIT_FAILURE);
+    }
+
+    switch (func) {
+        case MSE: config.dLoss = dMeanSquaredError; break;
+        case CSL: config.dLoss = dCrossEntropyLoss; break;
+    }
+
+    node_t *node;
+    matrix2d_t *weights;
+    if (MOMENTUM == optimiser) {
+        for (int i = 0; i < graph->n; i++) {
+            node = graph->entryPoints[i];
+            if (!node->isData || !node->content.data->internalNode || node->optimiserMatrix) continue;
+            weights = node->content.data->data->matrix2d;
+            node->optimiserMatrix = malloc(sizeof(matrix_t));
+            node->optimiserMatrix->matrix2d = matrixCreate(weights->nRows, weights->nCols);
+        }
+    }
+    return config;
+}
+
+//PRE: The worker's tape has been run backwards
+//POST: Every weight and bias has been updated by the optimiser straight from its gradients
+static void applyGradients(tape_t *tape, trainConfig_t *config) {
+    for (int i = 0; i < tape->nParams; i++) {
+        applyGradient(tape->params[i], config->opt, config->nArgs, config->lRate, config->momentum);
+    }
+}
+
+//POST: The worker's graph is primed with its next minibatch, which is returned through input and target
+static void nextBatch(worker_t *worker, matrix2d_t ***input, matrix2d_t ***target) {
+    trainConfig_t *config = worker->config;
+    graph_t *graph = worker->graph;
+
+    if (config->batchSize != config->inputs[0]->nRows) {
+        *target = sample(config->inputs, config->targets, config->batchSize, input,
+                         config->nInputs, config->nTargets, &worker->seed);
+    } else {
+        *target = config->targets;
+        *input = config->inputs;
+    }
+
+    int inputIdx = 0;
+    for (int j = 0; j < graph->n && inputIdx < config->nInputs; j++) {
+        if (!graph->entryPoints[j]->content.data->internalNode) 
+            graph->entryPoints[j]->content.data->data->matrix2d = (*input)[inputIdx++];
+    }
+
+    for (int j = 0; j < config->nTargets; j++) {
+        if (graph->exitPoints[j]->isData) graph->exitPoints[j]->content.data->data->matrix2d = (*target)[j];
+    }
+}
+
+//PRE: The worker's graph has been executed in FORWARD mode on target's batch
+//POST: The worker's tape is seeded with the derivative of the loss
+static void primeLoss(worker_t *worker, matrix2d_t **target) {
+    tapeZero(worker->tape);
+    for (int j = 0; j < worker->config->nTargets; j++) {
+        matrixFree(seedLoss(worker->graph, j, target[j], worker->config->dLoss, 1));
+    }
+}
+
+static void freeBatch(worker_t *worker, matrix2d_t **input, matrix2d_t **target) {
+    trainConfig_t *config = worker->config;
+    if (input != config->inputs) {
+        for (int j = 0; j < config->nInputs; j++) matrixFree(input[j]);
+        for (int j = 0; j < config->nTargets; j++) matrixFree(target[j]);
+        free(input);
+        free(target);
+    }
+}
+
+static void *asyncWorker(void *arg) {
+    worker_t *worker = arg;
+    matrix2d_t **input, **target;
+
+    for (int step = 0; step < worker->steps; step++) {
+        nextBatch(worker, &input, &target);
+        execute(worker->forward, worker->nForward, FORWARD);
+        primeLoss(worker, target);
+
+        tapeBackward(worker->tape, NULL);
+        applyGradients(worker->tape, worker->config);
+
+        freeBatch(worker, input, target);
+    }
+    return NULL;
+}
+
+//POST: The nodes of worker's cloned graph, its schedule and its tape are freed, leaving the weights,
+//      biases and velocities it shares with the original graph
+static void freeReplica(worker_t *worker) {
+    freeClone(worker->graph, worker->forward, worker->nForward, worker->steps);
+    tapeFree(worker->tape);
+}
+
+//Hogwild: each thread trains its own replica of the graph on its own minibatches
+//and writes updates straight into the shared weights without any locking
+//PRE: inputs contains matrices for first layer, optimiser is SGD or MOMENTUM, nThreads > 0
+//POST: the network would have been trained with 'epochs' minibatch updates split between nThreads
+void trainAsync(graph_t *graph, matrix2d_t **inputs, matrix2d_t **targets,
+                double lRate, int epochs, enum errorFunction func,
+                int batchSize, enum optimiser optimiser, int nThreads) {
+
+    trainConfig_t config = trainConfigInit(graph, inputs, targets, lRate, func, batchSize, optimiser);
+
+    //Each replica has its own gradient buffers, and shares its weights' velocities with graph
+    worker_t *workers = calloc(nThreads, sizeof(worker_t));
+    for (int i = 0; i < nThreads; i++) {
+        workers[i].config = &config;
+        workers[i].graph = graphClone(graph);
+        workers[i].forward = schedule(workers[i].graph, &workers[i].nForward);
+        optimiseSchedule(workers[i].graph, workers[i].forward, &workers[i].nForward, false);
+        workers[i].tape = tapeRecord(workers[i].forward, workers[i].nForward);
+        workers[i].steps = epochs / nThreads + (i < epochs % nThreads);
+        workers[i].seed = rand();
+    }
+
+    pthread_t *threads = malloc(sizeof(pthread_t) * nThreads);
+    for (int i = 0; i < nThreads; i++) {
+        if (pthread_create(&threads[i], NULL, asyncWorker, &workers[i])) {
+            perror("Couldn't start training thread");
+            exit(EXIT_FAILURE);
+        }
+    }
+    for (int i = 0; i < nThreads; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    for (int i = 0; i < nThreads; i++) freeReplica(&workers[i]);
+    free(threads);
+    free(workers);
+}
+
+//Gradients of one weight, all-reduced by a communication thread while backward carries on
+typedef struct bucketQueue {
+    pthread_mutex_t lock;
+    pthread_cond_t posted, reduced;
+    //Both only ever increase, bucket i is buckets[i % nBuckets]
+    int nPosted, nReduced;
+    bool done;
+    real_t **buckets;
+    int *lengths;
+    int nBuckets;
+    communicator_t *comm;
+} bucketQueue_t;
+
+static void *reduceBuckets(void *arg) {
+    bucketQueue_t *queue = arg;
+    int idx;
+    pthread_mutex_lock(&queue->lock);
+    while (true) {
+        while (queue->nReduced == queue->nPosted && !queue->done) {
+            pthread_cond_wait(&queue->posted, &queue->lock);
+        }
+        if (queue->nReduced == queue->nPosted) break;
+        idx = queue->nReduced % queue->nBuckets;
+        pthread_mutex_unlock(&queue->lock);
+
+        allReduce(queue->comm, queue->buckets[idx], queue->lengths[idx]);
+
+        pthread_mutex_lock(&queue->lock);
+        queue->nReduced++;
+        pthread_cond_signal(&queue->reduced);
+    }
+    pthread_mutex_unlock(&queue->lock);
+    return NULL;
+}
+
+//PRE: BACKWARD has completed weight k's gradient
+//POST: The gradient is queued to be all-reduced
+static void postBucket(bucketQueue_t *queue, node_t *weight, int k) {
+    matrix2d_t *gradient = weight->gradient->matrix2d;
+    real_t *bucket = queue->buckets[k];
+    for (int i = 0; i < gradient->nRows; i++) {
+        memcpy(bucket + i * gradient->nCols, gradient->data[i], sizeof(real_t) * gradient->nCols);
+    }
+    pthread_mutex_lock(&queue->lock);
+    queue->nPosted++;
+    pthread_cond_signal(&queue->posted);
+    pthread_mutex_unlock(&queue->lock);
+}
+
+//PRE: The worker's tape is seeded
+//POST: Every weight's gradient buffer holds its gradient averaged over all ranks
+//      Weights are reduced as soon as backward produces them, overlapping with the rest of backward
+static void backwardAllReduce(worker_t *worker, bucketQueue_t *queue) {
+    node_t **nodes = worker->tape->nodes;
+    int length = worker->tape->length;
+    int start = 0;
+    int k = 0;
+    for (int i = 0; i < length && k < worker->nWeights; i++) {
+        if (nodes[i] != worker->weights[k]) continue;
+        //BACKWARD runs nodes from the start of the array so this covers [start, i]
+        execute(nodes + start, i + 1 - start, BACKWARD);
+        start = i + 1;
+        postBucket(queue, worker->weights[k], k);
+        k++;
+    }
+    execute(nodes + start, length - start, BACKWARD);
+
+    pthread_mutex_lock(&queue->lock);
+    while (queue->nReduced < queue->nPosted) pthread_cond_wait(&queue->reduced, &queue->lock);
+    pthread_mutex_unlock(&queue->lock);
+
+    matrix2d_t *gradient;
+    int nRanks = worker->comm->nRanks;
+    for (k = 0; k < worker->nWeights; k++) {
+        gradient = worker->weights[k]->gradient->matrix2d;
+        for (int i = 0; i < gradient->nRows; i++) {
+            for (int j = 0; j < gradient->nCols; j++) {
+                matrixSet(gradient, i, j, queue->buckets[k][i * gradient->nCols + j] / nRanks);
+            }
+        }
+    }
+}
+
+//POST: Views of rows [rank * rows / nRanks, (rank + 1) * rows / nRanks) of each matrix
+static matrix2d_t **shard(matrix2d_t **matrices, int n, int rank, int nRanks) {
+    matrix2d_t **shards = malloc(sizeof(matrix2d_t*) * n);
+    int from, to;
+    for (int i = 0; i < n; i++) {
+        from = matrices[i]->nRows * rank / nRanks;
+        to = matrices[i]->nRows * (rank + 1) / nRanks;
+        shards[i] = malloc(sizeof(matrix2d_t));
+        shards[i]->data = matrices[i]->data + from;
+        shards[i]->nRows = to - from;
+        shards[i]->nCols = matrices[i]->nCols;
+    }
+    return shards;
+}
+
+//PRE: Runs in its own process, forked by communicatorRun after the worker was set up
+//POST: Trains on this rank's shard, rank 0 leaves the final weights in the communicator's shared memory
+static void distributedWorker(void *arg) {
+    worker_t *worker = arg;
+    trainConfig_t *config = worker->config;
+    communicator_t *comm = worker->comm;
+    config->inputs = shard(config->inputs, config->nInputs, comm->rank, comm->nRanks);
+    config->targets = shard(config->targets, config->nTargets, comm->rank, comm->nRanks);
+    worker->seed += comm->rank;
+
+    bucketQueue_t queue = {.nPosted = 0, .nReduced = 0, .done = false,
+                           .nBuckets = worker->nWeights, .comm = comm};
+    pthread_mutex_init(&queue.lock, NULL);
+    pthread_cond_init(&queue.posted, NULL);
+    pthread_cond_init(&queue.reduced, NULL);
+    queue.buckets = malloc(sizeof(real_t*) * worker->nWeights);
+    queue.lengths = malloc(sizeof(int) * worker->nWeights);
+    matrix2d_t *weights;
+    for (int k = 0; k < worker->nWeights; k++) {
+        weights = worker->weights[k]->content.data->data->matrix2d;
+        queue.lengths[k] = weights->nRows * weights->nCols;
+        queue.buckets[k] = malloc(sizeof(real_t) * queue.lengths[k]);
+    }
+
+    pthread_t reducer;
+    if (pthread_create(&reducer, NULL, reduceBuckets, &queue)) {
+        perror("Couldn't start all-reduce thread");
+        exit(EXIT_FAILURE);
+    }
+
+    matrix2d_t **input, **target;
+    for (int step = 0; step < worker->steps; step++) {
+        nextBatch(worker, &input, &target);
+        execute(worker->forward, worker->nForward, FORWARD);
+        primeLoss(worker, target);
+        backwardAllReduce(worker, &queue);
+        //Every rank applies the same averaged gradients so the weights stay identical
+        applyGradients(worker->tape, config);
+        freeBatch(worker, input, target);
+    }
+
+    pthread_mutex_lock(&queue.lock);
+    queue.done = true;
+    pthread_cond_signal(&queue.posted);
+    pthread_mutex_unlock(&queue.lock);
+    pthread_join(reducer, NULL);
+
+    if (0 == comm->rank) {
+        real_t *shared = comm->shared;
+        for (int k = 0; k < worker->nWeights; k++) {
+            weights = worker->weights[k]->content.data->data->matrix2d;
+            for (int i = 0; i < weights->nRows; i++, shared += weights->nCols) {
+                memcpy(shared, weights->data[i], sizeof(real_t) * weights->nCols);
+            }
+        }
+    }
+}
+
+//Data parallel training: nWorkers forked processes each train on their own shard of the data,
+//averaging gradients every step with a ring all-reduce over POSIX shared memory
+//PRE: inputs contains matrices for first layer, optimiser is SGD or MOMENTUM, nWorkers > 0
+//PRE: each shard (rows / nWorkers) has at least batchSize rows
+//POST: Returns whether every worker succeeded, if so graph holds the trained weights
+//      otherwise the remaining workers are stopped and graph is left untouched
+bool trainDistributed(graph_t *graph, matrix2d_t **inputs, matrix2d_t **targets,
+                      double lRate, int epochs, enum errorFunction func,
+                      int batchSize, enum optimiser optimiser, int nWorkers) {
+
+    trainConfig_t config = trainConfigInit(graph, inputs, targets, lRate, func, batchSize, optimiser);
+
+    worker_t worker = {.config = &config, .graph = graph, .steps = epochs, .seed = rand(),
+                       .weights = NULL, .nWeights = 0};
+    worker.forward = schedule(graph, &worker.nForward);
+    optimiseSchedule(graph, worker.forward, &worker.nForward, false);
+    worker.tape = tapeRecord(worker.forward, worker.nForward);
+
+    //Weights are reduced in the order backward produces their gradients
+    worker.weights = worker.tape->params;
+    worker.nWeights = worker.tape->nParams;
+    int nParams = 0;
+    matrix2d_t *weights;
+    for (int k = 0; k < worker.nWeights; k++) {
+        weights = worker.weights[k]->content.data->data->matrix2d;
+        nParams += weights->nRows * weights->nCols;
+    }
+
+    worker.comm = communicatorInit(nWorkers, nParams);
+    bool succeeded = communicatorRun(worker.comm, distributedWorker, &worker);
+
+    if (succeeded) {
+        real_t *shared = worker.comm->shared;
+        for (int k = 0; k < worker.nWeights; k++) {
+            weights = worker.weights[k]->content.data->data->matrix2d;
+            for (int i = 0; i < weights->nRows; i++, shared += weights->nCols) {
+                memcpy(weights->data[i], shared, sizeof(real_t) * weights->nCols);
+            }
+        }
+    }
+
+    communicatorFree(worker.comm);
+    tapeFree(worker.tape);
+    return succeeded;
+}
+
+//What truncated BPTT keeps of one step until it falls out of the backward window
+typedef struct bpttStep {
+    int t;
+    matrix2d_t *x;      //Not owned
+    matrix2d_t *state;  //The state the step started from
+    lstmCache_t cache;
+    matrix2d_t *hidden;
+    matrix2d_t *dY;     //dL/d(readout output) of the step's own loss
+} bpttStep_t;
+
+static void bpttStepFree(bpttStep_t *step) {
+    matrixFree(step->state);
+    lstmCacheFree(&step->cache);
+    matrixFree(step->hidden);
+    matrixFree(step->dY);
+}
+
+//POST: weights -= lRate * gradients
+static void bpttDescend(matrix2d_t *weights, matrix2d_t *gradients, double lRate) {
+    for (int i = 0; i < weights->nRows; i++) {
+        for (int j = 0; j < weights->nCols; j++) weights->data[i][j] -= lRate * gradients->data[i][j];
+    }
+}
+
+//PRE: window holds the last nWindow steps in a ring of k2 starting at first
+//POST: Backpropagates the losses of the steps after lastBackward through every step in the window
+//      and takes one SGD step on params and readout, scaled down if the gradients' norm is over maxNorm
+static void bpttBackward(lstmParams_t *params, matrix2d_t *readout, bpttStep_t *window, int first,
+                         int nWindow, int k2, int lastBackward, double lRate, double maxNorm) {
+    lstmParams_t *gradients = lstmParamsZeroLike(params);
+    matrix2d_t *dReadout = matrixCreate(readout->nRows, readout->nCols);
+    bpttStep_t *step = &window[(first + nWindow - 1) % k2];
+    matrix2d_t *dState = matrixCreate(step->state->nRows, step->state->nCols), *dPrevious;
+    int h = params->nNeurons;
+
+    for (int i = nWindow - 1; i >= 0; i--) {
+        step = &window[(first + i) % k2];
+        if (step->t > lastBackward) {
+            //The loss's share of dL/dh, and of dL/dreadout
+            for (int r = 0; r < step->dY->nRows; r++) {
+                for (int j = 0; j < h; j++) {
+                    for (int o = 0; o < readout->nCols; o++) {
+                        dState->data[r][j] += step->dY->data[r][o] * readout->data[j][o];
+                        dReadout->data[j][o] += step->hidden->data[r][j] * step->dY->data[r][o];
+                    }
+                }
+            }
+        }
+        dPrevious = lstmCellBackward(params, step->x, step->state, &step->cache, dState, gradients, NULL);
+        matrixFree(dState);
+        dState = dPrevious;
+    }
+
+    //Recurrent gradients can explode over a long run of updates, so their norm can be capped
+    matrix2d_t *all[] = {gradients->weightW, gradients->weightU, gradients->bias, dReadout};
+    double norm = 0;
+    for (int k = 0; k < 4; k++) {
+        for (int i = 0; i < all[k]->nRows; i++) {
+            for (int j = 0; j < all[k]->nCols; j++) norm += all[k]->data[i][j] * all[k]->data[i][j];
+        }
+    }
+    norm = sqrt(norm);
+    if (maxNorm > 0 && norm > maxNorm) lRate *= maxNorm / norm;
+
+    bpttDescend(params->weightW, gradients->weightW, lRate);
+    bpttDescend(params->weightU, gradients->weightU, lRate);
+    bpttDescend(params->bias, gradients->bias, lRate);
+    bpttDescend(readout, dReadout, lRate);
+    matrixFree(dState);
+    matrixFree(dReadout);
+    lstmParamsFree(gradients);
+}
+
+//PRE: params came from lstmParamsCreate and readout is nNeurons x nOutputs
+//PRE: inputs and targets are length steps of batchSize x nFeatures and batchSize x nOutputs
+//PRE: 0 < k1 <= k2
+//POST: Trains an LSTM followed by a linear readout on one long sequence with truncated BPTT,
+//      returning the mean squared error per step of the last epoch
+//      Every k1 steps the last k1 losses are backpropagated through the last k2 steps. The state is
+//      carried from window to window, and only k2 steps are held at once however long the sequence is
+//      Each update is scaled down so the norm of all its gradients is at most maxNorm, unless maxNorm is 0
+//      e.g. BPTT_MAX_GRADIENT_NORM. With k1 = k2 = length an update is one step of full BPTT
+double trainTruncatedBPTT(lstmParams_t *params, matrix2d_t *readout, matrix2d_t **inputs, matrix2d_t **targets,
+                          int length, int k1, int k2, double lRate, double maxNorm, int epochs) {
+    int batchSize = inputs[0]->nRows;
+    bpttStep_t *window = malloc(sizeof(bpttStep_t) * k2);
+    double total = 0;
+    matrix2d_t *state, *prediction;
+    bpttStep_t *step;
+
+    for (int e = 0; e < epochs; e++) {
+        total = 0;
+        state = matrixCreate(batchSize, 2 * params->nNeurons);
+        int first = 0, nWindow = 0, lastBackward = -1;
+        for (int t = 0; t < length; t++) {
+            //The oldest step leaves the window once it's full
+            if (nWindow == k2) {
+                bpttStepFree(&window[first]);
+                first = (first + 1) % k2;
+                nWindow--;
+            }
+            step = &window[(first + nWindow++) % k2];
+            step->t = t;
+            step->x = inputs[t];
+            step->state = state;
+            state = lstmCellForward(params, inputs[t], state, &step->cache);
+            step->hidden = lstmHidden(state);
+
+            prediction = matrixDotProduct(step->hidden, readout);
+            step->dY = matrixSubtract(prediction, targets[t]);
+            for (int r = 0; r < batchSize; r++) {
+                for (int o = 0; o < readout->nCols; o++) {
+                    total += step->dY->data[r][o] * step->dY->data[r][o] / batchSize;
+                    step->dY->data[r][o] /= batchSize;
+                }
+            }
+            matrixFree(prediction);
+
+            if (0 == (t + 1) % k1 || length - 1 == t) {
+                bpttBackward(params, readout, window, first, nWindow, k2, lastBackward, lRate, maxNorm);
+                lastBackward = t;
+            }
+        }
+        for (int i = 0; i < nWindow; i++) bpttStepFree(&window[(first + i) % k2]);
+        matrixFree(state);
+    }
+
+    free(window);
+    return total / length;
+}
+
+//PRE: graph takes batches of batchSize rows and inputs/targets have at least batchSize rows
+//POST: The average loss of the graph over every full batch of inputs
+double evaluate(graph_t *graph, matrix2d_t **inputs, matrix2d_t **targets,
+                enum errorFunction func, int batchSize) {
+    double (*loss)(matrix2d_t*, matrix2d_t*);
+    switch (func) {
+        case MSE: loss = meanSquaredError; break;
+        case CSL: loss = crossEntropyLoss; break;
+    }
+
+    int nNodes;
+    node_t **forward = schedule(graph, &nNodes);
+    optimiseSchedule(graph, forward, &nNodes, false);
+    int nInputs = countInputs(graph), nTargets = graph->m;
+    matrix2d_t **input = malloc(sizeof(matrix2d_t*) * nInputs);
+    matrix2d_t **target = malloc(sizeof(matrix2d_t*) * nTargets);
+
+    double total = 0;
+    int nBatches = inputs[0]->nRows / batchSize;
+    int inputIdx;
+    for (int b = 0; b < nBatches; b++) {
+        inputIdx = 0;
+        for (int j = 0; j < graph->n && inputIdx < nInputs; j++) {
+            if (graph->entryPoints[j]->content.data->internalNode) continue;
+            input[inputIdx] = matrixCreate(batchSize, inputs[inputIdx]->nCols);
+            for (int k = 0; k < batchSize; k++) {
+                for (int l = 0; l < inputs[inputIdx]->nCols; l++) {
+                    matrixSet(input[inputIdx], k, l, matrixGet(inputs[inputIdx], b * batchSize + k, l));
+                }
+            }
+            graph->entryPoints[j]->content.data->data->matrix2d = input[inputIdx++];
         }
 
-        execute(backward, nNodesBackward, BACKWARD, opt, nArgs, args);
-        execute(backward, nNodesBackward, UPDATE, NULL, 0);
+        for (int j = 0; j < nTargets; j++) {
+            target[j] = matrixCreate(batchSize, targets[j]->nCols);
+            for (int k = 0; k < batchSize; k++) {
+                for (int l = 0; l < targets[j]->nCols; l++) {
+                    matrixSet(target[j], k, l, matrixGet(targets[j], b * batchSize + k, l));
+                }
+            }
+            graph->exitPoints[j]->content.data->data->matrix2d = target[j];
+        }
+
+        execute(forward, nNodes, FORWARD);
+
+        for (int j = 0; j < nTargets; j++) {
+            total += loss(target[j], graph->exitPoints[j]->inputs[0]->matrix->matrix2d);
+            matrixFree(target[j]);
+        }
+        for (int j = 0; j < nInputs; j++) matrixFree(input[j]);
     }
+
+    free(input);
+    free(target);
+    free(forward);
+    return total / nBatches;
 }
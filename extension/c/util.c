@@ -4,6 +4,9 @@
 #include <assert.h>
 #include <stdio.h>
 #include <math.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <errno.h>
 
 #include "../nodes.h"
 #include "../util.h"
@@ -26,7 +29,7 @@ bool contains(node_t **list, int length, node_t *element) {
 //POST: The list now has the element added to the end
 void append(char ***list, int *length, char *element) {
     if (*length) {
-        *list = realloc(*list, sizeof(char*) * (*length) + 1);
+        *list = realloc(*list, sizeof(char*) * ((*length) + 1));
     } else {
         *list = malloc(sizeof(char*));
     }
@@ -101,6 +104,13 @@ char *encodeOperation(enum matrixFunction func) {
         case CONVOLUTION:     return "CONVOLUTION"; 
         case SUBTRACT:        return "SUBTRACT";
         case TRANSPOSE: 	  return "TRANSPOSE";
+        case LSTM_CELL:       return "LSTM_CELL";
+        case LSTM_HIDDEN:     return "LSTM_HIDDEN";
+        case LSTM_PROJECTION: return "LSTM_PROJECTION";
+        case LSTM_STEP:       return "LSTM_STEP";
+        case FUSED:           return "FUSED";
+        case QUANTIZED_DOT:   return "QUANTIZED_DOT";
+        case SPARSE_DOT:      return "SPARSE_DOT";
     }
     return "INVALID OPERATION FUNCTION";
 }
@@ -123,8 +133,16 @@ enum matrixFunction decodeOperation(char *string) {
             if ('U' == *(++string)) return MULTIPLY;
             return MAX_POOLING;
         case 'T':	return TRANSPOSE;
+        case 'L':
+            if ('C' == string[5]) return LSTM_CELL;
+            if ('P' == string[5]) return LSTM_PROJECTION;
+            if ('S' == string[5]) return LSTM_STEP;
+            return LSTM_HIDDEN;
         case 'S': 
+            if ('P' == string[1]) return SPARSE_DOT;
 			return SUBTRACT;	
+        case 'Q': return QUANTIZED_DOT;
+        case 'F': return FUSED;
     }
     return 0;
 }
@@ -150,4 +168,89 @@ void matrixRandomisePositive(matrix2d_t *matrix) {
             matrixSet(matrix, i, j, fabs(randFloat()));
         }
     }
-}
\ No newline at end of file
+}
+
+static bool writingCaches = true;
+
+//POST: Whether path is a directory, or else a regular file, owned by this user which no one else can write
+//      Symbolic links are refused, so another user can't point a cache at their own files
+bool isPrivate(const char *path, bool isDirectory) {
+    struct stat info;
+    if (lstat(path, &info)) return false;
+    return (isDirectory ? S_ISDIR(info.st_mode) : S_ISREG(info.st_mode)) && geteuid() == info.st_uid
+           && !(info.st_mode & (S_IWGRP | S_IWOTH));
+}
+
+//POST: path holds $XDG_CACHE_HOME/name, or ~/.cache/name, which is made readable only by this user if missing
+//      Returns false if there is no home directory, or the directory could belong to someone else
+bool cacheDirectory(char *path, size_t size, const char *name) {
+    char parent[256];
+    const char *base = getenv("XDG_CACHE_HOME"), *home = getenv("HOME");
+    //The XDG spec says relative paths are to be ignored
+    if (base && '/' == base[0]) {
+        snprintf(parent, sizeof(parent), "%s", base);
+    } else if (home && home[0]) {
+        snprintf(parent, sizeof(parent), "%s/.cache", home);
+    } else {
+        return false;
+    }
+    mkdir(parent, 0700);
+    if ((size_t) snprintf(path, size, "%s/%s", parent, name) >= size) return false;
+    mkdir(path, 0700);
+    if (!isPrivate(path, true)) {
+        printf("%s isn't a directory private to this user, so it isn't used\n", path);
+        return false;
+    }
+    return true;
+}
+
+//POST: path holds name in the CACHE_NAME directory, or false is returned as by cacheDirectory
+bool cacheFile(char *path, size_t size, const char *name) {
+    char directory[256];
+    return cacheDirectory(directory, sizeof(directory), CACHE_NAME)
+           && (size_t) snprintf(path, size, "%s/%s", directory, name) < size;
+}
+
+//PRE: path ends in XXXXXX then suffixLength more characters
+//POST: A new file, readable and writable only by this user, whose name replaces the Xs in path, or NULL
+//      Nothing already at the name is ever opened, so it can't be a link planted by another user
+FILE *createPrivate(char *path, int suffixLength) {
+    int fd = mkstemps(path, suffixLength);
+    if (fd < 0) return NULL;
+    FILE *file = fdopen(fd, "w");
+    if (!file) {
+        close(fd);
+        unlink(path);
+    }
+    return file;
+}
+
+//PRE: replacing has size characters of room
+//POST: A private file to write path's new contents to, under a new name of its own kept in replacing, or NULL
+//      Written there first, so no other process can read it half written or have left a link there for it to follow
+FILE *startReplacing(const char *path, char *replacing, size_t size) {
+    if ((size_t) snprintf(replacing, size, "%s.XXXXXX", path) >= size) {
+        errno = ENAMETOOLONG;
+        return NULL;
+    }
+    return createPrivate(replacing, 0);
+}
+
+//PRE: file came from startReplacing(path, replacing, ...)
+//POST: Closes file and moves it over path, or removes it and returns false if that fails
+bool finishReplacing(FILE *file, const char *replacing, const char *path) {
+    if (fclose(file) || rename(replacing, path)) {
+        unlink(replacing);
+        return false;
+    }
+    return true;
+}
+
+//POST: Whether GEMM tunings and convolution choices are written to the cache once found, i.e. off for tests
+void setCacheWrites(bool enabled) {
+    writingCaches = enabled;
+}
+
+bool cacheWrites(void) {
+    return writingCaches;
+}
@@ -1,8 +0,0 @@
-#ifndef _compiler_h_
-#define _compiler_h_
-
-#include "nodes.h"
-
-graph_t *compile(graph_t *graph, char *name);
-
-#endif
\ No newline at end of file
@@ -0,0 +1,27 @@
+#ifndef _convolution_h_
+#define _convolution_h_
+
+#include "matrix.h"
+#include "nodes.h"
+
+//The algorithm selectConvolution found fastest for each shape, one line per shape and CPU model,
+//kept in the CACHE_NAME directory
+#define CONVOLUTION_CACHE_FILE "convolution.cache"
+//Results may differ from direct convolution by this much, relative to its largest output
+#ifdef FLOAT32
+#define CONVOLUTION_TOLERANCE 1e-4
+#else
+#define CONVOLUTION_TOLERANCE 1e-9
+#endif
+
+matrix2d_t *convolveWith(enum convolutionAlgorithm algorithm, matrix2d_t *matrix, matrix2d_t *kernel,
+                         int stride, int padding, int dilation);
+matrix2d_t *deconvolveWith(enum convolutionAlgorithm algorithm, matrix2d_t *matrix, matrix2d_t *kernel,
+                           int stride, int padding);
+enum convolutionAlgorithm selectConvolution(enum matrixFunction funcName, int nRows, int nCols, int kRows, int kCols,
+                                            int stride, int padding, int dilation);
+int selectConvolutions(node_t **nodes, int length);
+void loadConvolutionCache(char *path);
+void saveConvolutionCache(char *path);
+
+#endif
@@ -0,0 +1,38 @@
+#ifndef _fusion_h_
+#define _fusion_h_
+
+#include "activation.h"
+#include "matrix.h"
+#include "nodes.h"
+
+//One operation of a fused kernel, reading registers a and b (only a for ACTIVATION)
+typedef struct fusedOp {
+    enum matrixFunction funcName; //ADD, SUBTRACT, MULTIPLY or ACTIVATION
+    enum activationFunction activationName;
+    int a, b;
+} fusedOp_t;
+
+//Registers 0 to nInputs - 1 are the FUSED node's inputs, in order, and op i writes
+//register nInputs + i. The last op's register is the node's output
+typedef struct fusedKernel {
+    int nInputs;
+    fusedOp_t *ops;
+    int nOps;
+    //Doubles each element no longer writes to or reads back from memory, i.e. for
+    //every node folded in, its output and each read of it
+    int savedPerElement;
+} fusedKernel_t;
+
+//What fuseElementwise did to a schedule
+typedef struct fusionStats {
+    int nKernels;
+    int nRemoved; //Nodes folded into a kernel and taken out of the schedule
+} fusionStats_t;
+
+fusionStats_t fuseElementwise(node_t **nodes, int *length);
+matrix2d_t *fusedForward(fusedKernel_t *kernel, matrix2d_t **inputs);
+void fusedBackward(fusedKernel_t *kernel, matrix2d_t **inputs, matrix2d_t *gradient, matrix2d_t **inputGradients);
+long fusedTrafficSaved(node_t **nodes, int length);
+void fusedKernelFree(fusedKernel_t *kernel);
+
+#endif
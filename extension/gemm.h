@@ -0,0 +1,27 @@
+#ifndef _gemm_h_
+#define _gemm_h_
+
+#include "nodes.h"
+
+//Winners of tuneGemm on this machine, one line of M K N colBlock sharedBlock nThreads per shape,
+//kept in the CACHE_NAME directory
+#define GEMM_TUNING_FILE "gemm.tuning"
+//Rows of a which share each load of b
+#define GEMM_ROWS 4
+
+//How a product is blocked and split; untuned shapes take 64 columns at a time on one thread
+typedef struct gemmConfig {
+    int colBlock; //Columns of b kept in cache while every row block passes over them
+    int sharedBlock; //Rows of b per pass, 0 for all of them
+    int nThreads; //Each takes an even share of the row blocks
+} gemmConfig_t;
+
+void gemm(real_t **a, real_t **b, real_t **out, int nRows, int nShared, int nCols);
+void gemmWith(gemmConfig_t config, real_t **a, real_t **b, real_t **out, int nRows, int nShared, int nCols);
+gemmConfig_t gemmTuning(int nRows, int nShared, int nCols);
+gemmConfig_t tuneGemmShape(int nRows, int nShared, int nCols);
+int tuneGemm(node_t **nodes, int length);
+void loadGemmTuning(char *path);
+void saveGemmTuning(char *path);
+
+#endif
@@ -0,0 +1,44 @@
+#ifndef _half_h_
+#define _half_h_
+
+#include <stdint.h>
+
+#include "matrix.h"
+#include "nodes.h"
+#include "passes.h"
+
+//16 bit floats, converted in software so they don't need hardware support
+enum halfFormat {
+    BF16, //float's 8 bit exponent with 7 bits of mantissa, so nothing a float holds overflows it
+    FP16  //5 bit exponent with 10 bits of mantissa, at most 65504
+};
+
+typedef uint16_t half_t;
+
+//How FORWARD holds activations for BACKWARD when training in mixed precision. Every activation is
+//rounded to the format as it's computed, and once its last consumer has run it's packed into 16 bits
+//and its full precision copy freed. BACKWARD unpacks each one when it's first read and frees it
+//once the node it belongs to has passed its gradient on
+typedef struct mixedPrecision {
+    enum halfFormat format;
+    node_t **nodes; //The forward schedule
+    int length;
+    nodeIndex_t *sorted;
+    //stashed[i] is nodes[i]'s packed activation, of shapes[i], or NULL if it hasn't been packed
+    half_t **stashed;
+    shape_t *shapes;
+    //drops[i] are the activations to pack once nodes[i] has run
+    int **drops;
+    int *nDrops;
+    int nOverflows; //Values the last pass rounded to infinity or NaN
+    //Bytes of activations held now and at most over a FORWARD and BACKWARD
+    long bytesHeld, peakBytes;
+} mixedPrecision_t;
+
+int halfFromReals(enum halfFormat format, const real_t *in, half_t *out, int n);
+void halfToReals(enum halfFormat format, const half_t *in, real_t *out, int n);
+int matrixRoundToHalf(enum halfFormat format, matrix2d_t *matrix);
+mixedPrecision_t *scheduleMixedPrecision(node_t **nodes, int length, enum halfFormat format);
+void mixedPrecisionFree(mixedPrecision_t *plan);
+
+#endif
@@ -0,0 +1,34 @@
+#ifndef _jit_h_
+#define _jit_h_
+
+#include <stdbool.h>
+
+#include "matrix.h"
+#include "nodes.h"
+
+//The directory, under the user's cache directory, where compiled schedules are kept,
+//one shared object per hash of the generated source
+#define JIT_CACHE_NAME "cflow-jit"
+#define JIT_COMPILER "cc -O3 -march=native -shared -fPIC"
+//Dimensions up to this are unrolled into straight-line code
+#define JIT_UNROLL 4
+
+//A forward schedule compiled to native code for the shapes it was compiled with
+typedef struct jitKernel {
+    node_t **nodes; //The schedule, each node having the buffer of the same index
+    int length;
+    //Activations written by the kernel, NULL for data nodes, whose contents are read in place
+    matrix2d_t **outputs;
+    int *nRows, *nCols; //The shape each buffer was compiled for
+    real_t ***buffers; //Each buffer's rows, gathered on every run
+    void *handle;
+    void (*forward)(real_t **const *buffers);
+    unsigned long hash;
+    bool cached; //Whether the shared object was already built
+} jitKernel_t;
+
+jitKernel_t *jitCompile(node_t **nodes, int length);
+void jitExecute(jitKernel_t *kernel);
+void jitFree(jitKernel_t *kernel);
+
+#endif
@@ -0,0 +1,27 @@
+#ifndef _kernels_h_
+#define _kernels_h_
+
+#include "matrix.h"
+#include "nodes.h"
+
+//Matches any size or attribute in a kernelSpec
+#define ANY -1
+//Convolutions have stride, padding and dilation, pooling has stride and filter size
+#define MAX_ATTRIBUTES 3
+
+//An implementation of an operation for some of its shapes and attributes, each one given or ANY
+//run returns NULL if the node it's handed isn't one it handles, and the generic kernel runs instead
+typedef struct kernelSpec {
+    char *name;
+    enum matrixFunction funcName;
+    int nRows, nCols; //Of the first input
+    int kRows, kCols; //Of the second input, i.e. a convolution's kernel or a product's right hand side
+    int attributes[MAX_ATTRIBUTES];
+    matrix2d_t *(*run)(node_t *node);
+} kernelSpec_t;
+
+void registerKernel(kernelSpec_t spec);
+kernelSpec_t *chooseKernel(node_t *node, int nRows, int nCols, int kRows, int kCols);
+int prepareKernels(node_t **nodes, int length);
+
+#endif
@@ -2,6 +2,7 @@
 #define _layers_h_
 
 #include "nodes.h"
+#include "lstm.h"
 
 node_t *denseLayer(node_t *x, int nNeurons,
         enum activationFunction activationFunction, 
@@ -14,4 +15,13 @@ node_t *convolutionalLayer(node_t *x, int nChannels, int kernelSize,
 
 graph_t *LSTM(node_t **inputs, int timeSteps,
               enum activationFunction func, int nNeurons);
+
+graph_t *fusedLSTM(node_t **inputs, int timeSteps,
+                   enum activationFunction func, int nNeurons);
+
+graph_t *packedLSTM(node_t **inputs, int timeSteps,
+                    lstmParams_t *params, node_t **configs);
+
+graph_t *stackedLSTM(node_t **inputs, int timeSteps, int nLayers,
+                     enum activationFunction func, int nNeurons);
 #endif
\ No newline at end of file
@@ -0,0 +1,28 @@
+#ifndef _lowrank_h_
+#define _lowrank_h_
+
+#include <stdbool.h>
+
+#include "matrix.h"
+#include "nodes.h"
+
+//matrix = u . diag(s) . v^T, with the singular values s in descending order
+typedef struct svd {
+    matrix2d_t *u; //nRows x rank, orthonormal columns
+    double *s;
+    matrix2d_t *v; //nCols x rank, orthonormal columns
+    int rank; //min(nRows, nCols)
+} svd_t;
+
+//How factoriseDense picks each layer's rank
+enum rankSelection {
+    ENERGY,     //The fewest singular values keeping at least target of the sum of their squares
+    FLOP_BUDGET //The most that keep the two products within target of the original product's FLOPs
+};
+
+svd_t *matrixSVD(matrix2d_t *matrix);
+void svdFree(svd_t *svd);
+int rankForEnergy(svd_t *svd, double energy);
+int factoriseDense(graph_t *graph, node_t **nodes, int length, enum rankSelection selection, double target, bool verbose);
+
+#endif
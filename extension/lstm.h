@@ -0,0 +1,74 @@
+#ifndef _lstm_h_
+#define _lstm_h_
+
+#include <stdbool.h>
+
+#include "matrix.h"
+#include "activation.h"
+
+//The gates are packed side by side in this order, each taking nNeurons columns
+enum lstmGate {
+    ACTIVATION_GATE,
+    INPUT_GATE,
+    FORGET_GATE,
+    OUTPUT_GATE,
+    N_GATES
+};
+
+//Parameters of all four gates of a cell
+typedef struct lstmParams {
+    matrix2d_t *weightW; //nFeatures x 4 * nNeurons
+    matrix2d_t *weightU; //nNeurons x 4 * nNeurons
+    matrix2d_t *bias;    //1 x 4 * nNeurons, shared by every row of the batch
+    int nNeurons;
+    //Of the input, forget and output gates, the activation gate always uses TANH
+    enum activationFunction func;
+} lstmParams_t;
+
+//What the backward pass needs from the forward pass of one step
+typedef struct lstmCache {
+    matrix2d_t *gates;     //batchSize x 4 * nNeurons, after their activation functions
+    matrix2d_t *tanhState; //batchSize x nNeurons
+} lstmCache_t;
+
+//Steps many independent sequences one timestep at a time, i.e. to serve them online
+//Each open stream owns a row of the state table, and the steps pushed during a tick
+//are run together with one GEMM per operand
+typedef struct lstmSession {
+    lstmParams_t *params; //Not owned by the session
+    int nFeatures, capacity;
+    real_t **states;      //capacity rows of [h | c], in one contiguous block
+    real_t **staged;      //The pending steps' inputs, in the order they were pushed
+    real_t **gates;       //Scratch for one tick's pre-activations
+    real_t **tickStates;  //The pending streams' rows of states
+    int *pending, nPending;
+    bool *isPending, *isOpen;
+    int *closed, nClosed; //Rows free to open
+} lstmSession_t;
+
+lstmParams_t *lstmParamsCreate(int nFeatures, int nNeurons, enum activationFunction func);
+lstmParams_t *lstmParamsZeroLike(lstmParams_t *params);
+void lstmParamsFree(lstmParams_t *params);
+
+matrix2d_t *lstmCellForward(lstmParams_t *params, matrix2d_t *x, matrix2d_t *state, lstmCache_t *cache);
+matrix2d_t *lstmProjectInputs(lstmParams_t *params, matrix2d_t **inputs, int timeSteps);
+matrix2d_t *lstmStepForward(lstmParams_t *params, matrix2d_t *projection, int firstRow,
+                            matrix2d_t *state, lstmCache_t *cache);
+matrix2d_t *lstmCellBackward(lstmParams_t *params, matrix2d_t *x, matrix2d_t *state, lstmCache_t *cache,
+                             matrix2d_t *dNextState, lstmParams_t *gradients, matrix2d_t **dx);
+matrix2d_t *lstmStepBackward(lstmParams_t *params, int firstRow, matrix2d_t *state, lstmCache_t *cache,
+                             matrix2d_t *dNextState, lstmParams_t *gradients, matrix2d_t *dProjection);
+void lstmProjectInputsBackward(lstmParams_t *params, matrix2d_t **inputs, int timeSteps,
+                               matrix2d_t *dProjection, lstmParams_t *gradients, matrix2d_t **dxs);
+matrix2d_t *lstmHidden(matrix2d_t *state);
+void lstmCacheFree(lstmCache_t *cache);
+
+lstmSession_t *lstmSessionCreate(lstmParams_t *params, int nFeatures, int capacity);
+int lstmSessionOpen(lstmSession_t *session);
+void lstmSessionClose(lstmSession_t *session, int stream);
+bool lstmSessionPush(lstmSession_t *session, int stream, real_t *x);
+int lstmSessionTick(lstmSession_t *session);
+real_t *lstmSessionHidden(lstmSession_t *session, int stream);
+void lstmSessionFree(lstmSession_t *session);
+
+#endif
@@ -1,8 +1,19 @@
 #ifndef _matrix_h_
 #define _matrix_h_
 
+#include <float.h>
 #include <stdbool.h>
 
+//The type every matrix element is held in, double unless built with -DFLOAT32 (make PRECISION=float32)
+//REAL_EPSILON is its rounding error, which tolerances on results should be scaled by
+#ifdef FLOAT32
+typedef float real_t;
+#define REAL_EPSILON FLT_EPSILON
+#else
+typedef double real_t;
+#define REAL_EPSILON DBL_EPSILON
+#endif
+
 enum matrixFunction {
     ADD,
     ACTIVATION,
@@ -16,17 +27,24 @@ enum matrixFunction {
     MAX_POOLING,
     AVERAGE_POOLING,
     TRANSPOSE,  //PRE: Won't ever be in a forward pass
-    FLATTEN
+    FLATTEN,
+    LSTM_CELL,  //Inputs: x, state, W, U, bias as in lstm.h
+    LSTM_HIDDEN,
+    LSTM_PROJECTION, //Inputs: x_0 ... x_T-1, W, bias
+    LSTM_STEP,       //Inputs: projection, state, U, a 1 x 2 config of first row and running rows
+    FUSED,           //A chain of elementwise operations run as one kernel, see fusion.h
+    QUANTIZED_DOT,   //Inputs: x, weights and a config of scales, as made by quantizeGraph in quantize.h
+    SPARSE_DOT       //Inputs: x, weights pruned by pruneWeights in sparse.h
 };
 
 typedef struct matrix2d {
-    double **data;
+    real_t **data;
     int nRows;
     int nCols;
 } matrix2d_t;
 
 typedef struct matrix3d {
-    double ***data;
+    real_t ***data;
     int nRows;
     int nCols;
     int nDepth;
@@ -36,8 +54,8 @@ typedef struct matrix3d {
 #include "activation.h"
 matrix2d_t *matrixCreate(int nRows, int nCols);
 matrix3d_t *matrix3DCreate(int nRows, int nCols, int nDepth);
-double matrixGet(matrix2d_t *matrix, int row, int col);
-void matrixSet(matrix2d_t *matrix, int row, int col, double value);
+real_t matrixGet(matrix2d_t *matrix, int row, int col);
+void matrixSet(matrix2d_t *matrix, int row, int col, real_t value);
 double randFloat();
 void matrixRandomise(matrix2d_t *matrix);
 
@@ -57,20 +75,24 @@ matrix2d_t *matrixTranspose(matrix2d_t *matrix);
 
 matrix2d_t *matrixActiveFunc(matrix2d_t *matrix, enum activationFunction func);
 matrix2d_t *matrixConvolution(matrix2d_t *matrix, matrix2d_t *kernel, int stride, int padding);
+matrix2d_t *matrixDilatedConvolution(matrix2d_t *matrix, matrix2d_t *kernel, int stride, int padding, int dilation);
 matrix2d_t *matrixDeconvolution(matrix2d_t *matrix, matrix2d_t *kernel, int stride, int padding);
 matrix3d_t *matrix3DConvolution(matrix3d_t *inputs, matrix3d_t *kernels, int stride, int padding);
-
-matrix2d_t *matrixMaxPooling(matrix2d_t *matrix, matrix2d_t *gradient, int stride, int filterSize);
-matrix2d_t *matrixAveragePooling(matrix2d_t *matrix, matrix2d_t *gradient, int stride, int filterSize);
+void matrixConvolutionInto(matrix2d_t *matrix, matrix2d_t *kernel, int stride, int padding, int dilation,
+                           bool flipped, matrix2d_t *result);
+void matrixConvolutionBackward(matrix2d_t *matrix, matrix2d_t *kernel, matrix2d_t *gradient,
+                               int stride, int padding, int dilation, bool flipped,
+                               matrix2d_t *inputGradient, matrix2d_t *kernelGradient);
 
 bool areMatrixesEqual(matrix2d_t *matrix1, matrix2d_t *matrix2, double tolerance);
 
 matrix2d_t *matrixFlatten(matrix3d_t *matrix);
-double* flatten2d(matrix2d_t *matrix);
+real_t* flatten2d(matrix2d_t *matrix);
 matrix3d_t *matrixUnflatten(matrix2d_t *matrix, int nRows, int nCols, int nDepth);
 
 void matrixPrint(matrix2d_t *matrix);
 
 void matrixFree(matrix2d_t *matrix);
+void matrix3DFree(matrix3d_t *matrix);
 
 #endif
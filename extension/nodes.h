@@ -2,15 +2,27 @@
 #define _nodes_h_
 
 #include <stdbool.h>
+#include <stdint.h>
 
 #include "matrix.h"
 #include "activation.h"
 
 #define MAX_NODE_NAME_LENGTH 15
 
+//How a CONVOLUTION or DECONVOLUTION is computed, as chosen by selectConvolutions
+enum convolutionAlgorithm {
+    DIRECT_CONVOLUTION,
+    IM2COL_CONVOLUTION,
+    WINOGRAD_CONVOLUTION,
+    FFT_CONVOLUTION,
+    N_CONVOLUTION_ALGORITHMS
+};
+
 typedef struct operation {
     enum matrixFunction funcName;
     enum activationFunction activationName;
+    struct fusedKernel *kernel; //Only used by FUSED, shared with clones
+    enum convolutionAlgorithm algorithm; //Only used by CONVOLUTION and DECONVOLUTION
 } operation_t;
 
 typedef union {
@@ -20,7 +32,10 @@ typedef union {
 
 typedef struct data {
     bool internalNode;
+    bool constant; //Never trained, like a config, so operations reading only constants can be folded
     matrix_t *data;
+    struct quantizedMatrix *quantized; //NULL unless quantizeGraph made data int8 weights, whose dense matrix is then NULL
+    struct sparseMatrix *sparse; //NULL unless pruneWeights made data sparse weights, whose dense matrix is then NULL
 } data_t;
 
 typedef union {
@@ -38,7 +53,10 @@ typedef struct node {
     int inputIdx, outputIdx;
     matrix_t *matrix;
     matrix_t *optimiserMatrix; //Used for storing velocities/gradient accumalations
-    matrix_t *poolingMatrixGrad;
+    int32_t *poolingArgmax; //Where each output of a MAX_POOLING node came from in its input
+    matrix_t *gradient; //dL/d(this node's matrix), NULL unless a tape differentiates the node
+    //The kernel prepareKernels chose for the node's shapes, NULL to run the generic one
+    matrix2d_t *(*specialised)(struct node *node);
 } node_t;
 
 //PRE: All graphs are acyclic
@@ -56,5 +74,6 @@ void freeNode();
 graph_t *graphInit(char* name, int n, node_t **entryPoints, 
                                int m, node_t **exitPoints);
 void freeGraph(graph_t *graph);
+graph_t *graphClone(graph_t *graph);
 
 #endif
\ No newline at end of file
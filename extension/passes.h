@@ -0,0 +1,40 @@
+#ifndef _passes_h_
+#define _passes_h_
+
+#include <stdbool.h>
+
+#include "nodes.h"
+
+//A rewrite of a forward schedule, returning how many nodes it changed
+//Passes keep graph in step with the schedule, so it can still be cloned or scheduled again
+typedef struct pass {
+    char *name;
+    int (*run)(graph_t *graph, node_t **nodes, int *length);
+} pass_t;
+
+//Where a node is in a schedule, for looking nodes up by address
+typedef struct nodeIndex {
+    node_t *node;
+    int idx;
+} nodeIndex_t;
+
+typedef struct shape {
+    int nRows;
+    int nCols;
+} shape_t;
+
+int eliminateDeadNodes(graph_t *graph, node_t **nodes, int *length);
+int foldConstants(graph_t *graph, node_t **nodes, int *length);
+int eliminateCommonSubexpressions(graph_t *graph, node_t **nodes, int *length);
+int eliminateIdentities(graph_t *graph, node_t **nodes, int *length);
+
+nodeIndex_t *indexNodes(node_t **nodes, int length);
+int indexOf(nodeIndex_t *sorted, int length, node_t *node);
+bool isOwnedWeights(node_t *node);
+node_t *ownedProductWeights(node_t *node, shape_t *shapes, nodeIndex_t *sorted, int length);
+shape_t *scheduleShapes(node_t **nodes, int length);
+long scheduleFlops(node_t **nodes, int length);
+void runPasses(pass_t *passes, int nPasses, graph_t *graph, node_t **nodes, int *length, bool verbose);
+void optimiseSchedule(graph_t *graph, node_t **nodes, int *length, bool verbose);
+
+#endif
@@ -0,0 +1,32 @@
+#ifndef _pooling_h_
+#define _pooling_h_
+
+#include <stdint.h>
+
+#include "matrix.h"
+
+//nBatch images of nChannels planes, each nRows x nCols, packed plane after plane in one block
+typedef struct tensor4d {
+    real_t *data;
+    int nBatch;
+    int nChannels;
+    int nRows;
+    int nCols;
+} tensor4d_t;
+
+tensor4d_t *tensor4DCreate(int nBatch, int nChannels, int nRows, int nCols);
+void tensor4DFree(tensor4d_t *tensor);
+
+int poolingSize(int size, int stride);
+
+tensor4d_t *tensorMaxPooling(tensor4d_t *input, int32_t *argmax, int stride, int filterSize);
+void tensorMaxPoolingBackward(tensor4d_t *gradient, int32_t *argmax, tensor4d_t *inputGradient);
+tensor4d_t *tensorAveragePooling(tensor4d_t *input, int stride, int filterSize);
+void tensorAveragePoolingBackward(tensor4d_t *gradient, int stride, int filterSize, tensor4d_t *inputGradient);
+
+matrix2d_t *matrixMaxPooling(matrix2d_t *matrix, int32_t *argmax, int stride, int filterSize);
+void matrixMaxPoolingBackward(matrix2d_t *gradient, int32_t *argmax, matrix2d_t *inputGradient);
+matrix2d_t *matrixAveragePooling(matrix2d_t *matrix, int stride, int filterSize);
+void matrixAveragePoolingBackward(matrix2d_t *gradient, int stride, int filterSize, matrix2d_t *inputGradient);
+
+#endif
@@ -1,17 +1,24 @@
 #ifndef _predict_h_
 #define _predict_h_
 
-#include <stdarg.h>
 
+#include "half.h"
 #include "nodes.h"
+#include "scheduler.h"
 
 enum executionMode {
     FORWARD,
-    BACKWARD,
-    UPDATE
+    BACKWARD
 };
 
-void execute(node_t **nodes, int length, enum executionMode mode, 
-    void (*optimiser)(node_t *weight, int nArgs, ...), int nArgs, ...);
+void execute(node_t **nodes, int length, enum executionMode mode);
+
+void executeCheckpointed(checkpoints_t *plan, node_t **nodes, int length, enum executionMode mode);
+
+void executeMixed(mixedPrecision_t *plan, node_t **nodes, int length, enum executionMode mode);
+
+void executeWavefront(wavefront_t *plan, int nThreads);
+
+int convolutionDilation(matrix2d_t *config);
 
 #endif
@@ -0,0 +1,14 @@
+#ifndef _prune_h_
+#define _prune_h_
+
+#include "nodes.h"
+
+//How pruneNeurons decides which of a dense layer's neurons matter least
+enum neuronRanking {
+    OUTGOING_WEIGHTS, //The L1 norm of the neuron's row of the next layer's weights
+    ACTIVATIONS       //Its mean magnitude over the last FORWARD's rows, times its OUTGOING_WEIGHTS
+};
+
+int pruneNeurons(node_t **nodes, int length, double fraction, enum neuronRanking ranking);
+
+#endif
@@ -0,0 +1,22 @@
+#ifndef _quantize_h_
+#define _quantize_h_
+
+#include <stdint.h>
+
+#include "matrix.h"
+#include "nodes.h"
+
+//Quantized values are symmetric about zero, so -128 is never used and negating one can't overflow
+#define QUANTIZED_MAX 127
+
+//int8 weights, which stand in for their dense matrix
+typedef struct quantizedMatrix {
+    int nRows, nCols;
+    int8_t *values; //Row major
+} quantized_t;
+
+real_t *calibrate(graph_t *graph, node_t **nodes, int length, matrix2d_t **inputs, int batchSize);
+int quantizeGraph(graph_t *graph, node_t **nodes, int length, real_t *ranges);
+matrix2d_t *quantizedDotProduct(matrix2d_t *input, const int8_t *weights, matrix2d_t *scales);
+
+#endif
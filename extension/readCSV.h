@@ -4,7 +4,7 @@
 #include "matrix.h"
 
 typedef struct csvDataPack {
-    double* labels; //array of labels
+    real_t* labels; //array of labels
     matrix2d_t** matrixInputs; // array of matrix pointers
 } csvDataPack_t;
 
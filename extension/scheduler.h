@@ -1,8 +1,41 @@
 #ifndef _scheduler_h_
 #define _scheduler_h_
 
+#include <stdbool.h>
+
 #include "nodes.h"
 
+//Which activations FORWARD keeps when checkpointing, the rest are freed once their last
+//consumer has run and recomputed from the nearest kept ones during BACKWARD
+typedef struct checkpoints {
+    node_t **nodes; //The forward schedule
+    int length;
+    bool *keep;
+    //drops[i] are the activations to free once nodes[i] has run
+    node_t ***drops;
+    int *nDrops;
+    int segmentLength;
+    //Activations rematerialised for the segment BACKWARD is currently in
+    node_t **recomputed;
+    int nRecomputed;
+    //Activations held now and at most, out of nActivations without checkpointing
+    int nLive, peakLive, nActivations;
+} checkpoints_t;
+
+//A schedule split into levels: every node's inputs are in earlier levels,
+//so the nodes within a level are independent and can run at the same time
+typedef struct wavefront {
+    node_t ***levels;
+    int *levelLengths;
+    int nLevels;
+    //Most operations in any one level, i.e. how many threads could be kept busy
+    int widest;
+} wavefront_t;
+
 node_t **schedule(graph_t *graph, int *nNodes);
+checkpoints_t *scheduleCheckpoints(node_t **nodes, int length, int maxActivations);
+void checkpointsFree(checkpoints_t *plan);
+wavefront_t *scheduleWavefront(node_t **nodes, int length);
+void wavefrontFree(wavefront_t *plan);
 
 #endif // _scheduler_h_
@@ -0,0 +1,27 @@
+#ifndef _sparse_h_
+#define _sparse_h_
+
+#include "matrix.h"
+#include "nodes.h"
+
+//Block sparse rows: the matrix is cut into blockSize x blockSize blocks, and only blocks holding a non zero
+//are kept, row of blocks by row of blocks. A blockSize of 1 is plain compressed sparse rows
+typedef struct sparseMatrix {
+    int nRows, nCols;
+    int blockSize;
+    int nBlocks;
+    int *rowStarts; //Block row r's blocks are [rowStarts[r], rowStarts[r + 1])
+    int *blockCols; //The block column of each block
+    real_t *values; //Each block's blockSize x blockSize values, row major
+} sparse_t;
+
+sparse_t *sparseFromMatrix(matrix2d_t *matrix, int blockSize);
+matrix2d_t *sparseToMatrix(sparse_t *sparse);
+void sparseFree(sparse_t *sparse);
+matrix2d_t *sparseDenseProduct(sparse_t *sparse, matrix2d_t *dense);
+matrix2d_t *denseSparseProduct(matrix2d_t *dense, sparse_t *sparse);
+void pruneMatrix(matrix2d_t *matrix, double sparsity, int blockSize);
+int pruneWeights(node_t **nodes, int length, double sparsity, int blockSize);
+sparse_t *sparseWeights(data_t *weights);
+
+#endif
@@ -1,13 +1,42 @@
 #ifndef _train_h_
 #define _train_h_
 
+#include <stdbool.h>
+
 #include "matrix.h"
 #include "optimisers.h"
 #include "error.h"
+#include "half.h"
 #include "nodes.h"
+#include "lstm.h"
+
+//A cap on trainTruncatedBPTT's gradient norm that keeps long runs of updates from exploding
+#define BPTT_MAX_GRADIENT_NORM 1.0
 
 void train(graph_t *graph, matrix2d_t **inputs, matrix2d_t **targets,
            double lRate, int epochs, enum errorFunction func,
            int batchSize, enum optimiser optimiser);
 
+void trainCheckpointed(graph_t *graph, matrix2d_t **inputs, matrix2d_t **targets,
+                       double lRate, int epochs, enum errorFunction func,
+                       int batchSize, enum optimiser optimiser, int maxActivations);
+
+void trainMixedPrecision(graph_t *graph, matrix2d_t **inputs, matrix2d_t **targets,
+                         double lRate, int epochs, enum errorFunction func,
+                         int batchSize, enum optimiser optimiser, enum halfFormat format);
+
+void trainAsync(graph_t *graph, matrix2d_t **inputs, matrix2d_t **targets,
+                double lRate, int epochs, enum errorFunction func,
+                int batchSize, enum optimiser optimiser, int nThreads);
+
+bool trainDistributed(graph_t *graph, matrix2d_t **inputs, matrix2d_t **targets,
+                      double lRate, int epochs, enum errorFunction func,
+                      int batchSize, enum optimiser optimiser, int nWorkers);
+
+double trainTruncatedBPTT(lstmParams_t *params, matrix2d_t *readout, matrix2d_t **inputs, matrix2d_t **targets,
+                          int length, int k1, int k2, double lRate, double maxNorm, int epochs);
+
+double evaluate(graph_t *graph, matrix2d_t **inputs, matrix2d_t **targets,
+                enum errorFunction func, int batchSize);
+
 #endif
\ No newline at end of file
@@ -1,8 +1,13 @@
 #ifndef _util_h_
 #define _util_h_
 
+#include <stdio.h>
+
 #include "nodes.h"
 
+//The directory, under the user's cache directory, which GEMM tunings and convolution choices are kept in
+#define CACHE_NAME "cflow"
+
 bool contains(node_t **list, int length, node_t *element);
 void append(char ***list, int *length, char *element);
 void push(node_t ***stack, int *length, node_t *element);
@@ -14,4 +19,12 @@ enum matrixFunction decodeOperation(char *string);
 double randFloat();
 void matrixRandomise(matrix2d_t *matrix);
 void matrixRandomisePositive(matrix2d_t *matrix);
+bool cacheDirectory(char *path, size_t size, const char *name);
+bool cacheFile(char *path, size_t size, const char *name);
+bool isPrivate(const char *path, bool isDirectory);
+FILE *createPrivate(char *path, int suffixLength);
+FILE *startReplacing(const char *path, char *replacing, size_t size);
+bool finishReplacing(FILE *file, const char *replacing, const char *path);
+void setCacheWrites(bool enabled);
+bool cacheWrites(void);
 #endif
\ No newline at end of file